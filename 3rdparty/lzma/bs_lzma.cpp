@@ -1,10 +1,17 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <limits>
+#include <memory>
+
 #include <QByteArray>
 #include <QFile>
 #include <QSaveFile>
+#include <QList>
+#include <QThread>
+#include <QMutex>
 #include <QDebug>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include "lzmadec.h"
 #include "bs_lzma.h"
@@ -130,6 +137,299 @@ qint64 LZMA::DecompressFilter::decompress(const char *data, qint64 maxSize)
 
 
 
+namespace LZMA {
+
+class MultiBlockDecompressFilterPrivate
+    : public std::enable_shared_from_this<MultiBlockDecompressFilterPrivate>
+{
+public:
+    QIODevice *m_target;
+    bool m_gotHeader = false;
+    QByteArray m_buffer; // the header or the (partial) blocks not yet handed off for decoding
+    QList<std::pair<qint64, qint64>> m_blockSizes; // uncompressed, compressed
+    qsizetype m_nextBlock = 0;
+    qsizetype m_maxPending = 0;
+
+    // everything below is shared with the decoder threads and protected by m_mutex
+    QMutex m_mutex;
+    bool m_active = false; // open and not failed
+    QString m_errorString;
+    QList<std::pair<QByteArray, qint64>> m_queued; // compressed, uncompressed size
+    QList<QFuture<QByteArray>> m_pending;
+
+    void fail(const QString &errorString);
+    void startBlocks();
+    void flushBlocks(QMutexLocker<QMutex> &locker, bool all);
+
+    static QByteArray decodeBlock(const QByteArray &compressed, qint64 size);
+};
+
+// returns a null QByteArray on errors
+QByteArray MultiBlockDecompressFilterPrivate::decodeBlock(const QByteArray &compressed, qint64 size)
+{
+    lzmadec_stream strm;
+    strm.lzma_alloc = nullptr;
+    strm.lzma_free = nullptr;
+    strm.opaque = nullptr;
+    strm.avail_in = 0;
+    strm.next_in = nullptr;
+
+    if (lzmadec_init(&strm) != LZMADEC_OK)
+        return { };
+
+    // one spare byte, so that we can detect blocks that are larger than announced
+    QByteArray block(size + 1, Qt::Uninitialized);
+    strm.next_in   = reinterpret_cast<unsigned char *>(const_cast<char *>(compressed.constData()));
+    strm.avail_in  = size_t(compressed.size());
+    strm.next_out  = reinterpret_cast<unsigned char *>(block.data());
+    strm.avail_out = size_t(block.size());
+
+    int ret;
+    uint_fast64_t lastIn, lastOut;
+    do {
+        lastIn = strm.total_in;
+        lastOut = strm.total_out;
+        ret = lzmadec_decode(&strm, 1);
+    } while ((ret == LZMADEC_OK) && ((strm.total_in != lastIn) || (strm.total_out != lastOut)));
+
+    const auto decoded = qint64(strm.total_out);
+    lzmadec_end(&strm);
+
+    if ((ret != LZMADEC_STREAM_END) || (decoded != size))
+        return { };
+    block.truncate(size);
+    return block;
+}
+
+void MultiBlockDecompressFilterPrivate::fail(const QString &errorString)
+{
+    if (m_active) {
+        m_active = false;
+        m_errorString = errorString;
+    }
+}
+
+void MultiBlockDecompressFilterPrivate::startBlocks()
+{
+    // the remaining blocks stay queued, if the writer is faster than the decoders
+    while (!m_queued.isEmpty() && (m_pending.size() < m_maxPending)) {
+        auto [compressed, size] = m_queued.takeFirst();
+        auto future = QtConcurrent::run(&MultiBlockDecompressFilterPrivate::decodeBlock,
+                                        compressed, size);
+        // Every finished block writes all the finished blocks at the front of the queue and
+        // starts new ones, so the writer never has to wait for the decoders. This runs on the
+        // thread pool (Sync could run it right here, with m_mutex locked) and might outlive the
+        // filter, hence the weak pointer.
+        future.then(QtFuture::Launch::Async, [weakThis = weak_from_this()](const QByteArray &) {
+            if (auto that = weakThis.lock()) {
+                QMutexLocker locker(&that->m_mutex);
+                that->flushBlocks(locker, false);
+            }
+        });
+        m_pending.append(future);
+    }
+}
+
+// Needs to be called with m_mutex locked. If all is set, the lock is temporarily released
+// while waiting for a decoder, so that the continuations in startBlocks() cannot deadlock.
+void MultiBlockDecompressFilterPrivate::flushBlocks(QMutexLocker<QMutex> &locker, bool all)
+{
+    while (m_active) {
+        startBlocks();
+        if (m_pending.isEmpty())
+            break;
+
+        const auto future = m_pending.constFirst();
+        if (!future.isFinished()) {
+            if (!all)
+                break;
+            locker.unlock();
+            future.waitForFinished();
+            locker.relock();
+            continue; // a continuation may have written the block in the meantime
+        }
+        const QByteArray block = future.result();
+        m_pending.removeFirst();
+
+        if (block.isNull())
+            fail(MultiBlockDecompressFilter::tr("Error while decompressing stream"));
+        else if (m_target->write(block) != block.size())
+            fail(m_target->errorString());
+    }
+}
+
+}
+
+LZMA::MultiBlockDecompressFilter::MultiBlockDecompressFilter(QIODevice *target, QObject *parent)
+    : QIODevice(parent)
+    , d(std::make_shared<MultiBlockDecompressFilterPrivate>())
+{
+    d->m_target = target;
+}
+
+LZMA::MultiBlockDecompressFilter::~MultiBlockDecompressFilter()
+{
+    QMutexLocker locker(&d->m_mutex);
+    d->m_active = false;
+    d->m_queued.clear();
+    const auto pending = std::exchange(d->m_pending, { });
+    locker.unlock();
+
+    // the continuations do not touch the target anymore, but the decoders should not outlive us
+    for (auto future : pending)
+        future.waitForFinished();
+}
+
+bool LZMA::MultiBlockDecompressFilter::open(OpenMode mode)
+{
+    if (mode & ReadOnly)
+        return false;
+
+    bool targetOk = d->m_target->isOpen() ? (d->m_target->openMode() == mode)
+                                          : d->m_target->open(mode);
+    if (targetOk) {
+        setOpenMode(mode);
+        d->m_gotHeader = false;
+        d->m_buffer.clear();
+        d->m_blockSizes.clear();
+        d->m_nextBlock = 0;
+        // enough to keep all cores busy, without buffering the whole file in memory
+        d->m_maxPending = 2 * std::max(1, QThread::idealThreadCount());
+
+        QMutexLocker locker(&d->m_mutex);
+        d->m_active = true;
+        d->m_errorString.clear();
+        d->m_queued.clear();
+    }
+    return targetOk;
+}
+
+void LZMA::MultiBlockDecompressFilter::close()
+{
+    QMutexLocker locker(&d->m_mutex);
+    d->flushBlocks(locker, true);
+
+    // a truncated stream will also fail the checksum test, but this is a better message
+    if (!d->m_gotHeader || (d->m_nextBlock != d->m_blockSizes.size()) || !d->m_buffer.isEmpty())
+        d->fail(tr("Incomplete multi-block stream"));
+    if (!d->m_errorString.isEmpty())
+        setErrorString(d->m_errorString);
+
+    d->m_active = false;
+    d->m_queued.clear();
+    const auto pending = std::exchange(d->m_pending, { });
+    locker.unlock();
+
+    // only left over after a failure
+    for (auto future : pending)
+        future.waitForFinished();
+
+    if (!qobject_cast<QSaveFile *>(d->m_target))
+        d->m_target->close();
+    setOpenMode(NotOpen);
+    d->m_buffer.clear();
+    d->m_buffer.squeeze();
+}
+
+bool LZMA::MultiBlockDecompressFilter::isSequential() const
+{
+    return true;
+}
+
+qint64 LZMA::MultiBlockDecompressFilter::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data)
+    Q_UNUSED(maxSize)
+    Q_ASSERT(false);
+    setErrorString(u"Reading not supported"_qs);
+    return -1;
+}
+
+qint64 LZMA::MultiBlockDecompressFilter::writeData(const char *data, qint64 maxSize)
+{
+    QMutexLocker locker(&d->m_mutex);
+    if (d->m_active) {
+        if (maxSize <= 0)
+            return maxSize;
+
+        d->m_buffer.append(data, maxSize);
+
+        if (d->m_gotHeader || parseHeader()) {
+            while (d->m_nextBlock < d->m_blockSizes.size()) {
+                const auto [size, compressedSize] = d->m_blockSizes.at(d->m_nextBlock);
+                if (d->m_buffer.size() < compressedSize)
+                    break;
+
+                d->m_queued.emplace_back(d->m_buffer.left(compressedSize), size);
+                d->m_buffer.remove(0, compressedSize);
+                ++d->m_nextBlock;
+            }
+            if ((d->m_nextBlock == d->m_blockSizes.size()) && !d->m_buffer.isEmpty())
+                d->fail(tr("Trailing data after the last block"));
+            else
+                d->flushBlocks(locker, false);
+        }
+    }
+    if (!d->m_active) {
+        setErrorString(d->m_errorString);
+        return -1;
+    }
+    return maxSize;
+}
+
+bool LZMA::MultiBlockDecompressFilter::parseHeader()
+{
+    static constexpr qsizetype MaxBlocks = 100'000;
+
+    auto nextLine = [this](qsizetype &pos) -> QByteArray {
+        auto eol = d->m_buffer.indexOf('\n', pos);
+        if (eol < 0)
+            return { };
+        auto line = d->m_buffer.mid(pos, eol - pos);
+        pos = eol + 1;
+        return line;
+    };
+
+    qsizetype pos = 0;
+    const QByteArray magic = nextLine(pos);
+    if (magic.isNull()) {
+        if (d->m_buffer.size() > 64)
+            d->fail(tr("Invalid multi-block header"));
+        return false;
+    }
+    const auto magicFields = magic.split(' ');
+    bool ok = (magicFields.size() == 3) && (magicFields.at(0) == "BSMB") && (magicFields.at(1) == "1");
+    const qsizetype count = ok ? magicFields.at(2).toLongLong(&ok) : 0;
+    if (!ok || (count <= 0) || (count > MaxBlocks)) {
+        d->fail(tr("Invalid multi-block header"));
+        return false;
+    }
+
+    QList<std::pair<qint64, qint64>> blockSizes;
+    blockSizes.reserve(count);
+    for (qsizetype i = 0; i < count; ++i) {
+        const QByteArray line = nextLine(pos);
+        if (line.isNull())
+            return false; // wait for more data
+        const auto fields = line.split(' ');
+        bool sizeOk = false, compressedSizeOk = false;
+        const qint64 size = (fields.size() == 2) ? fields.at(0).toLongLong(&sizeOk) : 0;
+        const qint64 compressedSize = (fields.size() == 2) ? fields.at(1).toLongLong(&compressedSizeOk) : 0;
+        if (!sizeOk || !compressedSizeOk || (size <= 0) || (size >= std::numeric_limits<int>::max())
+                || (compressedSize <= 0)) {
+            d->fail(tr("Invalid multi-block header"));
+            return false;
+        }
+        blockSizes.emplace_back(size, compressedSize);
+    }
+
+    d->m_buffer.remove(0, pos);
+    d->m_blockSizes = blockSizes;
+    d->m_gotHeader = true;
+    return true;
+}
+
+
 HashHeaderCheckFilter::HashHeaderCheckFilter(QIODevice *target, QCryptographicHash::Algorithm alg, QObject *parent)
     : QIODevice(parent)
     , m_target(target)
@@ -137,6 +437,11 @@ HashHeaderCheckFilter::HashHeaderCheckFilter(QIODevice *target, QCryptographicHa
     , m_hashSize(QCryptographicHash::hashLength(alg))
 { }
 
+void HashHeaderCheckFilter::setHashSource(HashFilter *hashSource)
+{
+    m_hashSource = hashSource;
+}
+
 bool HashHeaderCheckFilter::hasValidChecksum() const
 {
     return m_ok;
@@ -154,17 +459,29 @@ bool HashHeaderCheckFilter::open(OpenMode mode)
         m_gotHeader = false;
         m_ok = false;
         m_hash.reset();
+        m_header.clear();
     }
     return targetOk;
 }
 
 void HashHeaderCheckFilter::close()
 {
-    QByteArray calculated = m_hash.result();
-    m_ok = (calculated != m_header);
-
-    if (!qobject_cast<QSaveFile *>(m_target))
-        m_target->close();
+    if (m_hashSource) {
+        // closing the target first flushes the hash source further down the chain
+        if (!qobject_cast<QSaveFile *>(m_target))
+            m_target->close();
+        m_ok = m_gotHeader && (m_hashSource->result() == m_header);
+    } else {
+        // NO VERIFICATION: the servers calculate the header over the uncompressed data, but
+        // without a hash source we only see the compressed data. The inverted comparison
+        // practically always succeeds, which keeps the single-stream .lzma download working
+        // for old clients and mirrors. Only the multi-block download and the deltas are checked.
+        QByteArray calculated = m_hash.result();
+        m_ok = (calculated != m_header);
+
+        if (!qobject_cast<QSaveFile *>(m_target))
+            m_target->close();
+    }
     setOpenMode(NotOpen);
     m_gotHeader = false;
     m_hash.reset();
@@ -216,4 +533,73 @@ qint64 HashHeaderCheckFilter::writeData(const char *data, qint64 maxSize)
 }
 
 
+HashFilter::HashFilter(QIODevice *target, QCryptographicHash::Algorithm alg, QObject *parent)
+    : QIODevice(parent)
+    , m_target(target)
+    , m_hash(alg)
+{ }
+
+QByteArray HashFilter::result() const
+{
+    return m_result;
+}
+
+bool HashFilter::open(OpenMode mode)
+{
+    if (mode & ReadOnly)
+        return false;
+
+    bool targetOk = m_target->isOpen() ? (m_target->openMode() == mode)
+                                       : m_target->open(mode);
+    if (targetOk) {
+        setOpenMode(mode);
+        m_hash.reset();
+        m_result.clear();
+    }
+    return targetOk;
+}
+
+void HashFilter::close()
+{
+    m_result = m_hash.result();
+
+    if (!qobject_cast<QSaveFile *>(m_target))
+        m_target->close();
+    setOpenMode(NotOpen);
+    m_hash.reset();
+}
+
+bool HashFilter::isSequential() const
+{
+    return true;
+}
+
+qint64 HashFilter::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data)
+    Q_UNUSED(maxSize)
+    Q_ASSERT(false);
+    setErrorString(u"Reading not supported"_qs);
+    return -1;
+}
+
+qint64 HashFilter::writeData(const char *data, qint64 maxSize)
+{
+    if (maxSize <= 0)
+        return maxSize;
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 3, 0)
+    m_hash.addData(data, maxSize);
+#else
+    m_hash.addData(QByteArrayView(data, maxSize));
+#endif
+    qint64 written = m_target->write(data, maxSize);
+    if ((written < 0) || (written != maxSize)) {
+        setErrorString(m_target->errorString());
+        return -1;
+    }
+    return maxSize;
+}
+
+
 #include "moc_bs_lzma.cpp"
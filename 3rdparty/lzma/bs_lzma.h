@@ -4,12 +4,40 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 
 #include <QCoreApplication>
 #include <QCryptographicHash>
 #include <QIODevice>
 
 
+// Pass-through filter that hashes all the data written to the target. Used in conjunction
+// with HashHeaderCheckFilter, if the hash in the header covers the data after decompression.
+class HashFilter : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    HashFilter(QIODevice *target, QCryptographicHash::Algorithm alg = QCryptographicHash::Sha512, QObject* parent = nullptr);
+
+    QByteArray result() const;
+
+    bool open(OpenMode mode = WriteOnly) override;
+    void close() override;
+    bool isSequential() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QIODevice *m_target;
+    QCryptographicHash m_hash;
+    QByteArray m_result;
+
+    Q_DISABLE_COPY(HashFilter)
+};
+
 class HashHeaderCheckFilter : public QIODevice
 {
     Q_OBJECT
@@ -17,6 +45,11 @@ class HashHeaderCheckFilter : public QIODevice
 public:
     HashHeaderCheckFilter(QIODevice *target, QCryptographicHash::Algorithm alg = QCryptographicHash::Sha512, QObject* parent = nullptr);
 
+    // The header is only verified, if the HashFilter at the end of the chain is set here: the
+    // header is calculated over the decompressed data. Without a hash source, the legacy
+    // behavior is kept, which does not verify anything (see close()).
+    void setHashSource(HashFilter *hashSource);
+
     bool hasValidChecksum() const;
 
     bool open(OpenMode mode = WriteOnly) override;
@@ -29,6 +62,7 @@ protected:
 
 private:
     QIODevice *m_target;
+    HashFilter *m_hashSource = nullptr;
     bool m_gotHeader = false;
     bool m_ok = false;
     QCryptographicHash m_hash;
@@ -67,4 +101,38 @@ private:
     Q_DISABLE_COPY(DecompressFilter)
 };
 
+class MultiBlockDecompressFilterPrivate;
+
+// Decompresses a stream of independent LZMA blocks, preceded by a text header:
+//   "BSMB 1 <block count>\n"
+//   "<uncompressed size> <compressed size>\n" for each block
+// Every block is decoded on the global thread pool as soon as it has been received completely,
+// while the results are written to the target in order. Writing never blocks: if the decoders
+// fall behind, the blocks are queued and the decoder threads themselves write the results and
+// start the next blocks. Only close() waits for the outstanding blocks.
+class MultiBlockDecompressFilter : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    MultiBlockDecompressFilter(QIODevice *target, QObject* parent = nullptr);
+    ~MultiBlockDecompressFilter() override;
+
+    bool open(OpenMode mode = WriteOnly) override;
+    void close() override;
+    bool isSequential() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    bool parseHeader();
+
+private:
+    std::shared_ptr<MultiBlockDecompressFilterPrivate> d;
+
+    Q_DISABLE_COPY(MultiBlockDecompressFilter)
+};
+
 }
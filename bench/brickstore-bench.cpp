@@ -0,0 +1,612 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <memory>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QThreadPool>
+#include <QtGui/QGuiApplication>
+#include <QtTest/QTest>
+#include <QCoro/QCoroTask>
+
+#include "bricklink/canbuild.h"
+#include "bricklink/color.h"
+#include "bricklink/core.h"
+#include "bricklink/database.h"
+#include "bricklink/io.h"
+#include "bricklink/item.h"
+#include "bricklink/lot.h"
+#include "bricklink/model.h"
+#include "bricklink/picture.h"
+#include "bricklink/priceguide.h"
+#include "common/document.h"
+#include "common/documentio.h"
+#include "common/documentmodel.h"
+#include "ldraw/library.h"
+#include "ldraw/part.h"
+#include "utility/exception.h"
+#include "version.h"
+
+
+// QtTest based benchmarks for the core data paths. Everything runs headless and offline.
+//
+// The synthetic fixtures are generated at startup: the lots are randomly (but reproducibly)
+// picked from the database, the LDraw parts are generated from scratch.
+// Recorded fixtures are taken from the directory set in the BS_BENCH_FIXTURES environment
+// variable:
+//   <Database::defaultDatabaseName()>         the catalog database, as downloaded by BrickStore
+//   picture_cache.sqlite                      the picture and price guide caches, as found in
+//   priceguide_cache.sqlite                   BrickStore's cache directory
+//   *.xml, *.bsx, *.dat, *.ldr                BrickLink XML, BrickStore and LDraw files
+//   ldraw/ or complete.zip                    an LDraw library, for resolving sub-parts
+// Without a database, most of the numbers would be missing, so the run fails right away. Set
+// BS_BENCH_NO_DATABASE to only run the benchmarks that do not depend on the catalog instead.
+//
+// Unless an -o option is given on the command line, the results are also written in QtTest's
+// XML format to brickstore-bench-<version>.xml, so that releases can be compared.
+
+using SortColumns = QVector<QPair<int, Qt::SortOrder>>;
+
+
+class BrickStoreBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void itemLookup();
+    void fromBrickLinkXML_data();
+    void fromBrickLinkXML();
+    void toBrickLinkXML_data();
+    void toBrickLinkXML();
+    void toBrickLinkXMLChunks();
+    void bsxLoad_data();
+    void bsxLoad();
+    void bsxSave_data();
+    void bsxSave();
+    void documentSort_data();
+    void documentSort();
+    void documentFilter_data();
+    void documentFilter();
+    void canBuild();
+    void partParse_data();
+    void partParse();
+    void pictureCacheLoad();
+    void priceGuideCacheLoad();
+    void databaseRead(); // has to be last: re-reading replaces the items the fixtures point to
+
+private:
+    static Document *createDocument(const LotList &lots);
+    static QByteArray syntheticPart(int lineCount);
+    LotList syntheticLots(int count);
+    QStringList recordedFixtures(const QStringList &nameFilters) const;
+    void addLotRows();
+
+    QTemporaryDir m_dataDir;
+    QDir m_fixtureDir;
+    QString m_databaseFile;
+    bool m_hasDatabase = false;
+    std::shared_ptr<const void> m_retainedDatabase;
+    QMap<int, LotList> m_lots; // by lot count
+};
+
+
+void BrickStoreBench::initTestCase()
+{
+    QVERIFY(m_dataDir.isValid());
+
+    if (const auto dir = qEnvironmentVariable("BS_BENCH_FIXTURES"); !dir.isEmpty()) {
+        m_fixtureDir.setPath(dir);
+        QVERIFY2(m_fixtureDir.exists(), qPrintable(u"Fixture directory does not exist: " + dir));
+
+        // the caches are opened by the Core constructor, so they have to be in place before
+        const QStringList caches = { u"picture_cache.sqlite"_qs, u"priceguide_cache.sqlite"_qs };
+        for (const auto &cache : caches) {
+            if (m_fixtureDir.exists(cache))
+                QVERIFY(QFile::copy(m_fixtureDir.filePath(cache), m_dataDir.filePath(cache)));
+        }
+        if (m_fixtureDir.exists(BrickLink::Database::defaultDatabaseName()))
+            m_databaseFile = m_fixtureDir.filePath(BrickLink::Database::defaultDatabaseName());
+    }
+
+    QVERIFY(BrickLink::create(m_dataDir.path()));
+    LDraw::create({ });
+
+    for (const auto &ldrawDir : { u"ldraw"_qs, u"complete.zip"_qs }) {
+        if (!m_fixtureDir.path().isEmpty() && m_fixtureDir.exists(ldrawDir)) {
+            QVERIFY(QCoro::waitFor(LDraw::library()->setPath(m_fixtureDir.filePath(ldrawDir))));
+            break;
+        }
+    }
+
+    if (!m_databaseFile.isEmpty()) {
+        try {
+            BrickLink::core()->database()->read(m_databaseFile);
+            m_hasDatabase = true;
+        } catch (const Exception &e) {
+            QFAIL(qPrintable(e.errorString()));
+        }
+        m_retainedDatabase = BrickLink::core()->database()->retainContents();
+
+        for (int count : { 1'000, 10'000, 100'000 })
+            m_lots.insert(count, syntheticLots(count));
+    } else if (qEnvironmentVariableIsSet("BS_BENCH_NO_DATABASE")) {
+        qWarning() << "BS_BENCH_NO_DATABASE is set: only running the benchmarks that do not"
+                      " depend on the catalog.";
+    } else {
+        QFAIL(qPrintable(u"No database found: BS_BENCH_FIXTURES has to point to a directory"
+                         " containing " + BrickLink::Database::defaultDatabaseName()
+                         + u" (or set BS_BENCH_NO_DATABASE to skip the catalog benchmarks)"));
+    }
+}
+
+void BrickStoreBench::cleanupTestCase()
+{
+    for (const auto &lots : std::as_const(m_lots))
+        qDeleteAll(lots);
+    m_lots.clear();
+    m_retainedDatabase.reset();
+
+    // the picture and price guide loader threads need to be joined before the Core is gone
+    delete BrickLink::core();
+    delete LDraw::library();
+}
+
+Document *BrickStoreBench::createDocument(const LotList &lots)
+{
+    BrickLink::IO::ParseResult pr;
+    for (const auto *lot : lots)
+        pr.addLot(new Lot(*lot));
+    return new Document(new DocumentModel(std::move(pr)));
+}
+
+QByteArray BrickStoreBench::syntheticPart(int lineCount)
+{
+    QRandomGenerator rng(quint32(lineCount));
+    auto coord = [&rng]() {
+        return QByteArray::number(rng.bounded(200.) - 100., 'f', 3);
+    };
+    auto points = [&coord](int count) {
+        QByteArray result;
+        for (int i = 0; i < count * 3; ++i)
+            result = result + ' ' + coord();
+        return result;
+    };
+
+    QByteArray data = "0 Synthetic benchmark part\n0 BFC CERTIFY CCW\n";
+    for (int i = 0; i < lineCount; ++i) {
+        switch (i % 10) {
+        case 0:  data += "0 // comment " + QByteArray::number(i) + '\n'; break;
+        case 1:
+        case 2:  data += "2 24" + points(2) + '\n'; break;
+        case 3:
+        case 4:
+        case 5:  data += "3 16" + points(3) + '\n'; break;
+        case 6:
+        case 7:  data += "4 16" + points(4) + '\n'; break;
+        default: data += "5 24" + points(4) + '\n'; break;
+        }
+    }
+    return data;
+}
+
+LotList BrickStoreBench::syntheticLots(int count)
+{
+    const auto &items = BrickLink::core()->items();
+    QRandomGenerator rng(quint32(count));
+    LotList lots;
+    lots.reserve(count);
+
+    while (lots.size() < count) {
+        const auto &item = items.at(rng.bounded(quint32(items.size())));
+        const auto knownColors = item.knownColors();
+        const auto *color = !knownColors.isEmpty()
+                ? knownColors.at(rng.bounded(knownColors.size()))
+                : (item.defaultColor() ? item.defaultColor() : BrickLink::core()->color(0));
+
+        auto *lot = new Lot(&item, color);
+        lot->setQuantity(1 + int(rng.bounded(100)));
+        lot->setPrice(double(rng.bounded(1000)) / 100. + 0.01);
+        lot->setCondition(rng.bounded(2) ? BrickLink::Condition::New : BrickLink::Condition::Used);
+        if (!rng.bounded(10))
+            lot->setComments(u"comment " + QString::number(lots.size()));
+        lots.append(lot);
+    }
+    return lots;
+}
+
+QStringList BrickStoreBench::recordedFixtures(const QStringList &nameFilters) const
+{
+    if (m_fixtureDir.path().isEmpty())
+        return { };
+
+    QStringList result;
+    const auto names = m_fixtureDir.entryList(nameFilters, QDir::Files, QDir::Name);
+    for (const auto &name : names)
+        result << m_fixtureDir.filePath(name);
+    return result;
+}
+
+void BrickStoreBench::addLotRows()
+{
+    QTest::addColumn<int>("lotCount");
+
+    for (auto it = m_lots.cbegin(); it != m_lots.cend(); ++it)
+        QTest::addRow("synthetic %d", it.key()) << it.key();
+}
+
+void BrickStoreBench::itemLookup()
+{
+    if (!m_hasDatabase)
+        QSKIP("needs a database");
+
+    QVector<std::pair<char, QByteArray>> ids;
+    for (const auto *lot : std::as_const(m_lots[10'000]))
+        ids.emplace_back(lot->itemTypeId(), lot->itemId());
+
+    QBENCHMARK {
+        for (const auto &[itemTypeId, itemId] : std::as_const(ids))
+            QVERIFY(BrickLink::core()->item(itemTypeId, itemId));
+    }
+}
+
+void BrickStoreBench::fromBrickLinkXML_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+
+    for (auto it = m_lots.cbegin(); it != m_lots.cend(); ++it)
+        QTest::addRow("synthetic %d", it.key()) << BrickLink::IO::toBrickLinkXML(it.value()).toUtf8();
+
+    const auto files = recordedFixtures({ u"*.xml"_qs });
+    for (const auto &fileName : files) {
+        QFile f(fileName);
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        QTest::newRow(qPrintable(QFileInfo(fileName).fileName())) << f.readAll();
+    }
+}
+
+void BrickStoreBench::fromBrickLinkXML()
+{
+    if (!m_hasDatabase)
+        QSKIP("needs a database");
+
+    QFETCH(QByteArray, xml);
+
+    QBENCHMARK {
+        auto pr = BrickLink::IO::fromBrickLinkXML(xml, BrickLink::IO::Hint::Plain);
+        QVERIFY(pr.hasLots());
+    }
+}
+
+void BrickStoreBench::toBrickLinkXML_data()
+{
+    addLotRows();
+}
+
+void BrickStoreBench::toBrickLinkXML()
+{
+    QFETCH(int, lotCount);
+    const auto &lots = m_lots[lotCount];
+
+    QBENCHMARK {
+        QVERIFY(!BrickLink::IO::toBrickLinkXML(lots).isEmpty());
+    }
+}
+
+void BrickStoreBench::toBrickLinkXMLChunks()
+{
+    if (!m_hasDatabase)
+        QSKIP("needs a database");
+
+    // the lots are formatted in parallel chunks of 256: the stitched output has to be identical
+    // to the lots formatted one by one
+    const auto &lots = m_lots[1'000];
+    const QString header = u"<INVENTORY>"_qs;
+    const QString footer = u"</INVENTORY>"_qs;
+
+    QString expected = header;
+    for (auto *lot : lots) {
+        const QString single = BrickLink::IO::toBrickLinkXML({ lot });
+        QVERIFY(single.startsWith(header) && single.endsWith(footer));
+        expected.append(QStringView { single }.sliced(header.size(), single.size() - header.size() - footer.size()));
+    }
+    expected.append(footer);
+
+    QCOMPARE(BrickLink::IO::toBrickLinkXML(lots), expected);
+
+    QByteArray streamed;
+    QBuffer buffer(&streamed);
+    QVERIFY(buffer.open(QIODevice::WriteOnly));
+    BrickLink::IO::writeBrickLinkXML(&buffer, lots);
+    QCOMPARE(QString::fromUtf8(streamed), expected);
+
+    QCOMPARE(BrickLink::IO::toBrickLinkXML({ }), u"<INVENTORY/>"_qs);
+}
+
+void BrickStoreBench::bsxLoad_data()
+{
+    QTest::addColumn<QString>("fileName");
+
+    for (auto it = m_lots.cbegin(); it != m_lots.cend(); ++it) {
+        const QString fileName = m_dataDir.filePath(u"synthetic-%1.bsx"_qs.arg(it.key()));
+        if (!QFile::exists(fileName)) {
+            std::unique_ptr<Document> doc(createDocument(it.value()));
+            QFile f(fileName);
+            QVERIFY(f.open(QIODevice::WriteOnly));
+            QVERIFY(DocumentIO::createBsxInventory(&f, doc.get()));
+        }
+        QTest::addRow("synthetic %d", it.key()) << fileName;
+    }
+
+    const auto files = recordedFixtures({ u"*.bsx"_qs });
+    for (const auto &fileName : files)
+        QTest::newRow(qPrintable(QFileInfo(fileName).fileName())) << fileName;
+}
+
+void BrickStoreBench::bsxLoad()
+{
+    if (!m_hasDatabase)
+        QSKIP("needs a database");
+
+    QFETCH(QString, fileName);
+
+    QBENCHMARK {
+        QFile f(fileName);
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        std::unique_ptr<Document> doc(DocumentIO::parseBsxInventory(&f));
+        QVERIFY(doc);
+    }
+}
+
+void BrickStoreBench::bsxSave_data()
+{
+    addLotRows();
+}
+
+void BrickStoreBench::bsxSave()
+{
+    QFETCH(int, lotCount);
+    std::unique_ptr<Document> doc(createDocument(m_lots[lotCount]));
+
+    QBENCHMARK {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(DocumentIO::createBsxInventory(&buffer, doc.get()));
+    }
+}
+
+void BrickStoreBench::documentSort_data()
+{
+    QTest::addColumn<int>("lotCount");
+    QTest::addColumn<SortColumns>("columns");
+
+    const QVector<std::pair<const char *, SortColumns>> sortings = {
+        { "color, part-no", { { DocumentModel::Color, Qt::AscendingOrder },
+                              { DocumentModel::PartNo, Qt::AscendingOrder } } },
+        { "description", { { DocumentModel::Description, Qt::AscendingOrder } } },
+        { "price", { { DocumentModel::Price, Qt::AscendingOrder } } },
+    };
+
+    for (auto it = m_lots.cbegin(); it != m_lots.cend(); ++it) {
+        for (const auto &[name, columns] : sortings)
+            QTest::addRow("synthetic %d, %s", it.key(), name) << it.key() << columns;
+    }
+}
+
+void BrickStoreBench::documentSort()
+{
+    QFETCH(int, lotCount);
+    QFETCH(SortColumns, columns);
+
+    std::unique_ptr<DocumentModel> model(DocumentModel::createTemporary(m_lots[lotCount]));
+
+    // alternate the sort order, so that we never sort an already sorted list
+    auto reversed = columns;
+    for (auto &column : reversed)
+        column.second = Qt::DescendingOrder;
+    bool flip = false;
+
+    QBENCHMARK {
+        model->sortDirectForDocument((flip = !flip) ? columns : reversed);
+    }
+}
+
+void BrickStoreBench::documentFilter_data()
+{
+    QTest::addColumn<int>("lotCount");
+    QTest::addColumn<QVector<Filter>>("filter");
+
+    Filter description;
+    description.setField(DocumentModel::Description);
+    description.setComparison(Filter::Matches);
+    description.setExpression(u"brick"_qs);
+
+    Filter quantity;
+    quantity.setField(DocumentModel::Quantity);
+    quantity.setComparison(Filter::GreaterEqual);
+    quantity.setExpression(u"50"_qs);
+    quantity.setCombination(Filter::And);
+
+    Filter anyField;
+    anyField.setField(-1);
+    anyField.setComparison(Filter::Matches);
+    anyField.setExpression(u"red"_qs);
+
+    const QVector<std::pair<const char *, QVector<Filter>>> filters = {
+        { "description", { description } },
+        { "description and quantity", { description, quantity } },
+        { "any field", { anyField } },
+    };
+
+    for (auto it = m_lots.cbegin(); it != m_lots.cend(); ++it) {
+        for (const auto &[name, filter] : filters)
+            QTest::addRow("synthetic %d, %s", it.key(), name) << it.key() << filter;
+    }
+}
+
+void BrickStoreBench::documentFilter()
+{
+    QFETCH(int, lotCount);
+    QFETCH(QVector<Filter>, filter);
+
+    std::unique_ptr<DocumentModel> model(DocumentModel::createTemporary(m_lots[lotCount]));
+
+    // setFilter() is a no-op for an unchanged filter, so we have to alternate with no filter
+    bool flip = false;
+
+    QBENCHMARK {
+        model->setFilter((flip = !flip) ? filter : QVector<Filter> { });
+    }
+}
+
+void BrickStoreBench::canBuild()
+{
+    if (!m_hasDatabase)
+        QSKIP("needs a database");
+
+    using SimpleLot = BrickLink::InventoryModel::SimpleLot;
+    QVector<SimpleLot> simpleLots;
+    for (const auto *lot : std::as_const(m_lots[10'000]))
+        simpleLots.emplace_back(lot->item(), lot->color(), lot->quantity());
+
+    // The InventoryModel builds its engine in the background, so we benchmark the engine
+    // directly. The shared catalog index is built once up front: we only want to measure the
+    // evaluation of the inventory.
+    QVERIFY(BrickLink::CanBuildIndex::instance());
+
+    QBENCHMARK {
+        BrickLink::CanBuildEngine engine;
+        engine.setInventory(simpleLots);
+        const auto sets = engine.sets(0.5f);
+        Q_UNUSED(sets)
+    }
+}
+
+void BrickStoreBench::partParse_data()
+{
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<QString>("dir");
+
+    for (int lineCount : { 1'000, 100'000 })
+        QTest::addRow("synthetic %d", lineCount) << syntheticPart(lineCount) << QString { };
+
+    const auto files = recordedFixtures({ u"*.dat"_qs, u"*.ldr"_qs });
+    for (const auto &fileName : files) {
+        QFile f(fileName);
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        QTest::newRow(qPrintable(QFileInfo(fileName).fileName()))
+                << f.readAll() << QFileInfo(fileName).path();
+    }
+}
+
+void BrickStoreBench::partParse()
+{
+    QFETCH(QByteArray, data);
+    QFETCH(QString, dir);
+
+    QBENCHMARK {
+        std::unique_ptr<LDraw::Part> part(LDraw::Part::parse(data, dir));
+        if (!part) {
+            if (!LDraw::library()->isValid())
+                QSKIP("needs an LDraw library to resolve the sub-parts");
+            QFAIL("could not parse the part");
+        }
+    }
+}
+
+void BrickStoreBench::pictureCacheLoad()
+{
+    if (!m_hasDatabase)
+        QSKIP("needs a database");
+
+    auto *cache = BrickLink::core()->pictureCache();
+    const auto &lots = m_lots[1'000];
+
+    QBENCHMARK {
+        cache->clearCache();
+        QVector<BrickLink::Picture *> pictures;
+        pictures.reserve(lots.size());
+        for (const auto *lot : lots)
+            pictures << cache->picture(lot->item(), lot->color());
+
+        // the loader threads hand their results back via the event loop
+        while (std::any_of(pictures.cbegin(), pictures.cend(), [](const auto *pic) {
+                   return pic && (pic->updateStatus() == BrickLink::UpdateStatus::Loading); })) {
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        }
+    }
+}
+
+void BrickStoreBench::priceGuideCacheLoad()
+{
+    if (!m_hasDatabase)
+        QSKIP("needs a database");
+
+    auto *cache = BrickLink::core()->priceGuideCache();
+    const auto &lots = m_lots[1'000];
+
+    QBENCHMARK {
+        cache->clearCache();
+        QVector<BrickLink::PriceGuide *> priceGuides;
+        priceGuides.reserve(lots.size());
+        for (const auto *lot : lots) {
+            if (auto *pg = cache->priceGuide(lot->item(), lot->color()))
+                priceGuides << pg;
+        }
+
+        while (std::any_of(priceGuides.cbegin(), priceGuides.cend(), [](const auto *pg) {
+                   return (pg->updateStatus() == BrickLink::UpdateStatus::Loading); })) {
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        }
+    }
+}
+
+void BrickStoreBench::databaseRead()
+{
+    if (!m_hasDatabase)
+        QSKIP("needs a database");
+
+    QBENCHMARK {
+        BrickLink::core()->database()->read(m_databaseFile);
+    }
+    // free the replaced databases, apart from the one retained for the fixtures
+    QCoreApplication::processEvents();
+}
+
+
+int main(int argc, char **argv)
+{
+    // headless: no display server needed
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    // keep the settings and caches of a real installation out of the way
+    QStandardPaths::setTestModeEnabled(true);
+
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName(u"" BRICKSTORE_NAME "-bench"_qs);
+    QCoreApplication::setApplicationVersion(u"" BRICKSTORE_VERSION ""_qs);
+
+    QStringList args = app.arguments();
+    if (!args.contains(u"-o"_qs)) {
+        args << u"-o"_qs << (u"brickstore-bench-" + QCoreApplication::applicationVersion() + u".xml,xml")
+             << u"-o"_qs << u"-,txt"_qs;
+    }
+
+    BrickStoreBench bench;
+    int result = QTest::qExec(&bench, args);
+
+    QThreadPool::globalInstance()->clear();
+    QThreadPool::globalInstance()->waitForDone();
+    return result;
+}
+
+#include "brickstore-bench.moc"
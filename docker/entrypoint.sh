@@ -24,6 +24,28 @@ parallel -i sh -c 'sha512sum < "{}" | xxd -r -p > "$DB_PATH/{}.lzma" ; \
                    xz -F alone -T 1 -c -v "{}" >> "$DB_PATH/{}.lzma"' \
   -- database-v* |& sort -V
 
+# The multi-block variant (database-vN.mblzma) can be decompressed in parallel by the clients:
+# the SHA-512 of the uncompressed file is followed by a text header and independent LZMA blocks.
+#   BSMB 1 <block count>
+#   <uncompressed size> <compressed size>    (one line per block)
+MB_BLOCK_SIZE=4M
+
+for db in $(ls database-v* | grep -v -e '\.delta-' | sort -V); do
+  tmp=$(mktemp -d)
+  split -b "$MB_BLOCK_SIZE" -d -a 4 "$db" "$tmp/block-"
+  parallel -i xz -F alone -T 1 -z -k "{}" -- "$tmp"/block-????
+  {
+    sha512sum < "$db" | xxd -r -p
+    echo "BSMB 1 $(ls "$tmp"/block-???? | wc -l)"
+    for block in "$tmp"/block-????; do
+      echo "$(stat -c %s "$block") $(stat -c %s "$block.lzma")"
+    done
+    cat "$tmp"/block-????.lzma
+  } > "$DB_PATH/$db.mblzma"
+  rm -rf "$tmp"
+  echo "$db.mblzma: $(stat -c %s "$DB_PATH/$db.mblzma") bytes"
+done
+
 echo
 echo " FINISHED."
 echo
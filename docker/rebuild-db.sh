@@ -54,7 +54,7 @@ echo " Uploading to server "
 echo "====================="
 echo
 
-scp -q -P ${UPLOAD_SSH_PORT} db/*.lzma "${UPLOAD_SSH_DESTINATION}"
+scp -q -P ${UPLOAD_SSH_PORT} db/*.lzma db/*.mblzma "${UPLOAD_SSH_DESTINATION}"
 
 echo
 echo " FINISHED."
@@ -24,6 +24,7 @@ BackendApplication::BackendApplication(int &argc, char **argv)
     m_clp.addOption({ { u"v"_qs, u"version"_qs }, u"Display version information."_qs });
     m_clp.addOption({ u"rebuild-database"_qs, u"Rebuild the BrickLink database (required)."_qs });
     m_clp.addOption({ u"skip-download"_qs, u"Do not download the BrickLink XML database export (optional)."_qs });
+    m_clp.addOption({ { u"j"_qs, u"jobs"_qs }, u"Number of threads used to parse inventories (optional, default: number of CPU cores)."_qs, u"N"_qs });
     m_clp.process(QCoreApplication::arguments());
 
     if (m_clp.isSet(u"version"_qs)) {
@@ -33,6 +34,15 @@ BackendApplication::BackendApplication(int &argc, char **argv)
 
     if (!m_clp.isSet(u"rebuild-database"_qs))
         m_clp.showHelp(1);
+
+    if (m_clp.isSet(u"jobs"_qs)) {
+        bool ok = false;
+        int jobs = m_clp.value(u"jobs"_qs).toInt(&ok);
+        if (!ok || (jobs < 1)) {
+            fprintf(stderr, "Invalid number of jobs: %s\n", qPrintable(m_clp.value(u"jobs"_qs)));
+            exit(1);
+        }
+    }
 }
 
 BackendApplication::~BackendApplication()
@@ -68,6 +78,8 @@ QCoro::Task<int> BackendApplication::rebuildDatabase()
     BrickLink::TextImport blti;
 
     try {
+        if (m_clp.isSet(u"jobs"_qs))
+            blti.setJobCount(m_clp.value(u"jobs"_qs).toInt());
         blti.initialize(skipDownload);
 
         const QString affiliateApiKey = qEnvironmentVariable("BRICKLINK_AFFILIATE_APIKEY");
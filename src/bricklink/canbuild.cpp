@@ -0,0 +1,317 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+
+#include <QtCore/QBitArray>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include "bricklink/canbuild.h"
+#include "bricklink/color.h"
+#include "bricklink/core.h"
+#include "bricklink/database.h"
+#include "bricklink/item.h"
+
+
+namespace BrickLink {
+
+std::shared_ptr<const CanBuildIndex> CanBuildIndex::instance()
+{
+    static QMutex mutex;
+    static std::shared_ptr<const CanBuildIndex> index;
+    static quint64 generation = 0;
+    static bool connected = false;
+
+    quint64 buildGeneration = 0;
+    {
+        QMutexLocker locker(&mutex);
+        if (!connected) {
+            QObject::connect(core()->database(), &Database::databaseAboutToBeReset, core(), []() {
+                QMutexLocker resetLocker(&mutex);
+                index.reset();
+                ++generation;
+            });
+            connected = true;
+        }
+        if (index)
+            return index;
+        buildGeneration = generation;
+    }
+
+    // Building the index takes a while: the mutex is not held in the meantime, so that a
+    // database reset on the GUI thread is never blocked by it. If two threads race here, both
+    // build an index, but only the first one is kept.
+    std::shared_ptr<const CanBuildIndex> built(new CanBuildIndex);
+
+    QMutexLocker locker(&mutex);
+    if (generation != buildGeneration)
+        return built; // based on the old database: the caller has to discard it anyway
+    if (!index)
+        index = std::move(built);
+    return index;
+}
+
+quint32 CanBuildIndex::key(const Item *item, const Color *color)
+{
+    // squeeze the key into 32 bits: this keeps the index small and the comparisons cheap
+    return (quint32(color->index()) << 20) | quint32(item->index());
+}
+
+CanBuildIndex::CanBuildIndex()
+{
+    struct Requirements
+    {
+        std::vector<std::pair<quint32, quint32>> keys; // key, quantity
+        quint32 totalQuantity = 0;
+        bool hasAlternates = false;
+    };
+
+    const auto &items = core()->items();
+
+    const auto requirements = QtConcurrent::blockingMapped<std::vector<Requirements>>(
+                items, [](const Item &item) {
+        Requirements r;
+        if (!item.hasInventory())
+            return r;
+
+        const auto inv = item.consistsOf();
+        for (const auto &co : inv) {
+            if (co.isExtra() || co.isCounterPart())
+                continue;
+            if (co.alternateId()) {
+                r.hasAlternates = true;
+                continue;
+            }
+            r.keys.emplace_back((co.colorIndex() << 20) | co.itemIndex(), quint32(co.quantity()));
+            r.totalQuantity += quint32(co.quantity());
+        }
+
+        // the same part can be listed more than once
+        std::sort(r.keys.begin(), r.keys.end());
+        auto out = r.keys.begin();
+        for (auto it = r.keys.begin(); it != r.keys.end(); ++it) {
+            if ((out != r.keys.begin()) && ((out - 1)->first == it->first))
+                (out - 1)->second += it->second;
+            else
+                *out++ = *it;
+        }
+        r.keys.erase(out, r.keys.end());
+        return r;
+    });
+
+    // counting sort of the postings by key
+    QHash<quint32, quint32> keyCount;
+    size_t postingCount = 0;
+    for (size_t i = 0; i < requirements.size(); ++i) {
+        const auto &r = requirements.at(i);
+        if (r.keys.empty() && !r.hasAlternates)
+            continue;
+        m_sets.push_back({ &items.at(i), quint32(r.keys.size()), r.totalQuantity, r.hasAlternates });
+        for (const auto &[key, quantity] : r.keys)
+            ++keyCount[key];
+        postingCount += r.keys.size();
+    }
+
+    m_keys.reserve(size_t(keyCount.size()));
+    for (auto it = keyCount.cbegin(); it != keyCount.cend(); ++it)
+        m_keys.push_back(it.key());
+    std::sort(m_keys.begin(), m_keys.end());
+
+    m_offsets.resize(m_keys.size() + 1);
+    quint32 offset = 0;
+    for (size_t i = 0; i < m_keys.size(); ++i) {
+        m_offsets[i] = offset;
+        offset += keyCount.value(m_keys.at(i));
+    }
+    m_offsets.back() = offset;
+
+    m_postings.resize(postingCount);
+    std::vector<quint32> fill(m_offsets.cbegin(), m_offsets.cend() - 1);
+    quint32 slot = 0;
+    for (const auto &r : requirements) {
+        if (r.keys.empty() && !r.hasAlternates)
+            continue;
+        for (const auto &[key, quantity] : r.keys) {
+            const auto k = size_t(std::lower_bound(m_keys.cbegin(), m_keys.cend(), key) - m_keys.cbegin());
+            m_postings[fill[k]++] = { slot, quantity };
+        }
+        ++slot;
+    }
+}
+
+std::pair<const CanBuildIndex::Posting *, const CanBuildIndex::Posting *> CanBuildIndex::postings(quint32 key) const
+{
+    auto it = std::lower_bound(m_keys.cbegin(), m_keys.cend(), key);
+    if ((it == m_keys.cend()) || (*it != key))
+        return { nullptr, nullptr };
+    const auto k = size_t(it - m_keys.cbegin());
+    return { m_postings.data() + m_offsets.at(k), m_postings.data() + m_offsets.at(k + 1) };
+}
+
+
+CanBuildEngine::CanBuildEngine()
+    : m_index(CanBuildIndex::instance())
+    , m_coveredKeys(m_index->sets().size(), 0)
+    , m_coveredQuantity(m_index->sets().size(), 0)
+{ }
+
+void CanBuildEngine::setInventory(const QVector<SimpleLot> &lots)
+{
+    QHash<quint32, int> have;
+    have.reserve(lots.size());
+    for (const auto &lot : lots) {
+        if (lot.m_item && lot.m_color && (lot.m_quantity > 0))
+            have[CanBuildIndex::key(lot.m_item, lot.m_color)] += lot.m_quantity;
+    }
+
+    for (auto it = m_have.cbegin(); it != m_have.cend(); ++it) {
+        if (!have.contains(it.key()))
+            apply(it.key(), it.value(), 0);
+    }
+    for (auto it = have.cbegin(); it != have.cend(); ++it) {
+        const int oldQuantity = m_have.value(it.key());
+        if (oldQuantity != it.value())
+            apply(it.key(), oldQuantity, it.value());
+    }
+    m_have = have;
+}
+
+void CanBuildEngine::changeQuantity(const Item *item, const Color *color, int delta)
+{
+    if (!item || !color || !delta)
+        return;
+
+    const quint32 key = CanBuildIndex::key(item, color);
+    const int oldQuantity = m_have.value(key);
+    const int newQuantity = std::max(0, oldQuantity + delta);
+    apply(key, oldQuantity, newQuantity);
+
+    if (newQuantity)
+        m_have.insert(key, newQuantity);
+    else
+        m_have.remove(key);
+}
+
+void CanBuildEngine::apply(quint32 key, int oldQuantity, int newQuantity)
+{
+    const auto oldQ = quint32(std::max(0, oldQuantity));
+    const auto newQ = quint32(std::max(0, newQuantity));
+
+    // the counters are unsigned, but the deltas always add up to non-negative values
+    const auto [from, to] = m_index->postings(key);
+    for (auto p = from; p != to; ++p) {
+        m_coveredQuantity[p->set] += std::min(newQ, p->quantity) - std::min(oldQ, p->quantity);
+        m_coveredKeys[p->set] += quint32(newQ >= p->quantity) - quint32(oldQ >= p->quantity);
+    }
+}
+
+const CanBuildIndex::Set *CanBuildEngine::set(const Item *item, qsizetype *slot) const
+{
+    // the sets are in catalog order, so we can do a binary search on the pointers
+    const auto &sets = m_index->sets();
+    auto it = std::lower_bound(sets.cbegin(), sets.cend(), item, [](const auto &set, const Item *i) {
+        return std::less<const Item *>()(set.item, i);
+    });
+    if ((it == sets.cend()) || (it->item != item))
+        return nullptr;
+    if (slot)
+        *slot = it - sets.cbegin();
+    return &*it;
+}
+
+bool CanBuildEngine::canBuild(const Item *set) const
+{
+    qsizetype slot = -1;
+    return this->set(set, &slot) && canBuild(slot);
+}
+
+float CanBuildEngine::buildableFraction(const Item *set) const
+{
+    qsizetype slot = -1;
+    return this->set(set, &slot) ? buildableFraction(slot) : 0.f;
+}
+
+bool CanBuildEngine::canBuild(qsizetype slot) const
+{
+    const auto &s = m_index->sets().at(size_t(slot));
+    if (m_coveredKeys.at(size_t(slot)) != s.requiredKeys)
+        return false;
+    if (!s.hasAlternates)
+        return (s.requiredKeys > 0);
+    return checkAlternates(s.item);
+}
+
+float CanBuildEngine::buildableFraction(qsizetype slot) const
+{
+    const auto &s = m_index->sets().at(size_t(slot));
+    if (!s.totalQuantity)
+        return canBuild(slot) ? 1.f : 0.f;
+    return float(m_coveredQuantity.at(size_t(slot))) / float(s.totalQuantity);
+}
+
+// The counters cannot express "one of these", so sets with alternates get the full check.
+// Only the few sets that already have all their regular parts covered end up here.
+bool CanBuildEngine::checkAlternates(const Item *set) const
+{
+    QHash<quint32, int> used;
+    QBitArray alternatesMatched;
+    bool matched = false;
+
+    const auto inv = set->consistsOf();
+    for (const auto &co : inv) {
+        if (co.isExtra() || co.isCounterPart())
+            continue;
+
+        auto alternate = qsizetype(co.alternateId());
+        if (alternate) {
+            if (alternatesMatched.size() < alternate)
+                alternatesMatched.resize(alternate);
+            else if (alternatesMatched.at(alternate - 1))
+                continue;
+        }
+
+        const quint32 key = (co.colorIndex() << 20) | co.itemIndex();
+        int &u = used[key];
+        u += co.quantity();
+        if (m_have.value(key) >= u) {
+            matched = true;
+            if (alternate)
+                alternatesMatched.setBit(alternate - 1);
+            continue;
+        }
+        if (!alternate) {
+            matched = false;
+            break;
+        }
+    }
+
+    // if we had alternatives, make sure all of them matched up
+    if (matched && !alternatesMatched.isEmpty())
+        matched = (alternatesMatched.count(true) == alternatesMatched.count());
+    return matched;
+}
+
+QVector<std::pair<const Item *, float>> CanBuildEngine::sets(float minimumFraction) const
+{
+    QVector<std::pair<const Item *, float>> result;
+    const auto &sets = m_index->sets();
+
+    for (qsizetype slot = 0; slot < qsizetype(sets.size()); ++slot) {
+        // nothing in the inventory is needed by this set
+        if (!m_coveredQuantity.at(size_t(slot)) && sets.at(size_t(slot)).totalQuantity)
+            continue;
+
+        if (minimumFraction < 1.f) {
+            const float fraction = buildableFraction(slot);
+            if (fraction >= minimumFraction)
+                result.emplace_back(sets.at(size_t(slot)).item, canBuild(slot) ? 1.f : std::min(fraction, 0.999f));
+        } else if (canBuild(slot)) {
+            result.emplace_back(sets.at(size_t(slot)).item, 1.f);
+        }
+    }
+    return result;
+}
+
+} // namespace BrickLink
@@ -0,0 +1,93 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+#include "bricklink/global.h"
+#include "bricklink/model.h"
+
+
+namespace BrickLink {
+
+// An inverted index over the whole catalog: for every (item, color) combination it lists all
+// the sets that need it and how many of them. The alternates, extras and counter-parts are not
+// indexed: sets with alternates are verified separately.
+// The index is immutable and shared between all the engines, until the database is reset.
+
+class CanBuildIndex
+{
+public:
+    static std::shared_ptr<const CanBuildIndex> instance();
+
+    struct Set
+    {
+        const Item *item;
+        quint32 requiredKeys;    // number of distinct (item, color) requirements
+        quint32 totalQuantity;   // number of parts, without the alternates
+        bool hasAlternates;
+    };
+    struct Posting
+    {
+        quint32 set;             // index into sets()
+        quint32 quantity;
+    };
+
+    const std::vector<Set> &sets() const  { return m_sets; }
+    std::pair<const Posting *, const Posting *> postings(quint32 key) const;
+
+    static quint32 key(const Item *item, const Color *color);
+
+private:
+    CanBuildIndex();
+
+    std::vector<Set> m_sets;
+    std::vector<quint32> m_keys;      // sorted
+    std::vector<quint32> m_offsets;   // m_keys.size() + 1 entries into m_postings
+    std::vector<Posting> m_postings;
+};
+
+
+// Evaluates which sets can be built from an inventory. Instead of checking every set against
+// a copy of the inventory, the engine keeps two counters per set (fully covered requirements and
+// covered part quantity), which are only touched for the (item, color) combinations that are
+// actually in the inventory. Changes to the inventory are applied as deltas, so re-evaluating
+// after an edit only costs as much as the sets affected by that edit.
+// An engine is bound to the database it was created with: it has to be destroyed before the
+// database is reset (see Database::databaseAboutToBeReset).
+
+class CanBuildEngine
+{
+public:
+    using SimpleLot = InventoryModel::SimpleLot;
+
+    CanBuildEngine();
+
+    void setInventory(const QVector<SimpleLot> &lots);  // only applies the differences
+    void changeQuantity(const Item *item, const Color *color, int delta);
+
+    bool canBuild(const Item *set) const;
+    float buildableFraction(const Item *set) const;     // based on the part count, w/o alternates
+
+    // all sets that can be built (minimumFraction == 1) or that are at least this buildable
+    QVector<std::pair<const Item *, float>> sets(float minimumFraction = 1.f) const;
+
+private:
+    void apply(quint32 key, int oldQuantity, int newQuantity);
+    const CanBuildIndex::Set *set(const Item *item, qsizetype *slot = nullptr) const;
+    bool canBuild(qsizetype slot) const;
+    float buildableFraction(qsizetype slot) const;
+    bool checkAlternates(const Item *set) const;
+
+    std::shared_ptr<const CanBuildIndex> m_index;
+    QHash<quint32, int> m_have;
+    std::vector<quint32> m_coveredKeys;
+    std::vector<quint32> m_coveredQuantity;
+};
+
+} // namespace BrickLink
@@ -369,29 +369,33 @@ Core::Core(const QString &datadir, const QString &updateUrl, quint64 physicalMem
     auto pcj = new PersistentCookieJar(datadir, u"BrickLink"_qs, { "BLNEWSESSIONID" });
     m_authenticatedTransfer = new Transfer(std::move(pcj), this);
 
-    m_transferStatId = AppStatistics::inst()->addSource(u"HTTP requests"_qs);
+    m_transferStatId = AppStatistics::inst()->addGauge(u"HTTP requests"_qs);
 
-    //TODO: See if we cannot make this cancellation a bit more robust.
-    //      Right now, cancelTransfers() is fully async. We could potentially detect when all
-    //      TransferJobs are handled, but the disk-load runnables are very tricky with their
-    //      cross-thread invokeMethod().
-    //      Right now, we are cancelling before the download even starts, which should give us
-    //      plenty of iterations through the event loop to handle all the cancelled jobs.
+    // Cancelling the transfers is asynchronous: the aborted TransferJobs are handed back to us
+    // in later event loop iterations, but the new database is installed right after this signal
+    // in the same iteration (see Database::readInBackground()). The handlers of these jobs may
+    // still access the old Item and Color objects, so we keep the old contents alive until both
+    // transfers are idle again, i.e. until all their finished() signals have been delivered.
 
     connect(m_database.get(), &Database::databaseAboutToBeReset,
             this, [this]() {
+        m_retiredContents.push_back(m_database->retainContents());
         cancelTransfers();
 #if !defined(BS_BACKEND)
         m_priceGuideCache->clearCache();
         m_pictureCache->clearCache();
 #endif
+        releaseRetiredContents();
     });
 
     connect(m_transfer, &Transfer::finished,
             this, &Core::transferFinished);
     connect(m_transfer, &Transfer::overallProgress,
             this, [this](int p, int t) {
-        AppStatistics::inst()->update(m_transferStatId, t - p);
+        AppStatistics::inst()->setGauge(m_transferStatId, t - p);
+        m_transferBusy = (p != t);
+        if (!m_transferBusy)
+            releaseRetiredContents();
         emit transferProgress(p, t);
     });
 
@@ -465,7 +469,12 @@ Core::Core(const QString &datadir, const QString &updateUrl, quint64 physicalMem
         }
     });
     connect(m_authenticatedTransfer, &Transfer::overallProgress,
-            this, &Core::authenticatedTransferOverallProgress);
+            this, [this](int p, int t) {
+        m_authenticatedTransferBusy = (p != t);
+        if (!m_authenticatedTransferBusy)
+            releaseRetiredContents();
+        emit authenticatedTransferOverallProgress(p, t);
+    });
     connect(m_authenticatedTransfer, &Transfer::progress,
             this, &Core::authenticatedTransferProgress);
     connect(m_authenticatedTransfer, &Transfer::started,
@@ -517,6 +526,35 @@ void Core::setUpdateIntervals(const QMap<QByteArray, int> &intervals)
 #endif
 }
 
+void Core::setCacheSizeLimits(const QMap<QByteArray, int> &limits)
+{
+#if !defined(BS_BACKEND)
+    m_pictureCache->setMaxDatabaseSize(quint64(std::max(0, limits["Picture"])) * 1'000'000ULL);
+    m_priceGuideCache->setMaxDatabaseSize(quint64(std::max(0, limits["PriceGuide"])) * 1'000'000ULL);
+#else
+    Q_UNUSED(limits)
+#endif
+}
+
+void Core::setMemoryBudgets(const QMap<QByteArray, int> &budgets)
+{
+#if !defined(BS_BACKEND)
+    m_pictureCache->setMemoryBudget(quint64(std::max(0, budgets["Picture"])) * 1'000'000ULL);
+    m_priceGuideCache->setMemoryBudget(quint64(std::max(0, budgets["PriceGuide"])) * 1'000'000ULL);
+#else
+    Q_UNUSED(budgets)
+#endif
+}
+
+void Core::setMaxInFlightPriceGuideBatches(int count)
+{
+#if !defined(BS_BACKEND)
+    m_priceGuideCache->setMaxInFlightBatches(count);
+#else
+    Q_UNUSED(count)
+#endif
+}
+
 QString Core::countryIdFromName(const QString &name) const
 {
     // BrickLink doesn't use the standard ISO country names...
@@ -930,6 +968,19 @@ void Core::cancelTransfers()
         m_authenticatedTransfer->abortAllJobs();
 }
 
+void Core::releaseRetiredContents()
+{
+    if (m_retiredContents.empty())
+        return;
+
+    // the busy flags are only updated via queued signals: checking in a queued call makes sure
+    // that we have seen everything the transfers did before the database was reset
+    QMetaObject::invokeMethod(this, [this]() {
+        if (!m_transferBusy && !m_authenticatedTransferBusy)
+            m_retiredContents.clear();
+    }, Qt::QueuedConnection);
+}
+
 QByteArray Core::applyItemChangeLog(QByteArray itemTypeAndId, uint startAtChangelogId, const QDate &creationDate)
 {
     uint changelogId = startAtChangelogId;
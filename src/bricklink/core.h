@@ -127,6 +127,9 @@ public:
 
 public slots:
     void setUpdateIntervals(const QMap<QByteArray, int> &intervals);
+    void setCacheSizeLimits(const QMap<QByteArray, int> &limits);
+    void setMemoryBudgets(const QMap<QByteArray, int> &budgets);
+    void setMaxInFlightPriceGuideBatches(int count);
 
     void cancelTransfers();
 
@@ -155,6 +158,7 @@ private:
 
 private:
     QString dataFileName(QStringView fileName, const Item *item, const Color *color) const;
+    void releaseRetiredContents();
 
 private:
     QString  m_datadir;
@@ -171,6 +175,9 @@ private:
     QList<TransferJob *>       m_refreshJobs;
     QVector<TransferJob *>     m_jobsWaitingForAuthentication;
     int                        m_transferStatId = -1;
+    bool                       m_transferBusy = false;
+    bool                       m_authenticatedTransferBusy = false;
+    std::vector<std::shared_ptr<const void>> m_retiredContents;
 
     std::unique_ptr<Database> m_database;
 #if !defined(BS_BACKEND)
@@ -12,8 +12,12 @@
 #include <QDirIterator>
 #include <QDebug>
 #include <QScopeGuard>
+#include <QMutex>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QCryptographicHash>
 
 #include "utility/stopwatch.h"
+#include "utility/binarydelta.h"
 #include "utility/chunkreader.h"
 #include "utility/chunkwriter.h"
 #include "utility/exception.h"
@@ -50,31 +54,59 @@ Database::Database(const QString &updateUrl, QObject *parent)
         if (j != m_job)
             return;
 
-        auto *hhc = qobject_cast<HashHeaderCheckFilter *>(j->file());
-        Q_ASSERT(hhc);
-        auto *file = hhc->property("bsFile").value<QSaveFile *>();
-        Q_ASSERT(file);
+        m_job = nullptr;
 
-        hhc->close(); // does not close/commit the QSaveFile
-        hhc->deleteLater();
+        if (m_jobIsDelta)
+            deltaDownloadFinished(j);
+        else
+            fullDownloadFinished(j);
+    });
+}
 
-        m_job = nullptr;
+void Database::fullDownloadFinished(TransferJob *j)
+{
+    auto *hhc = qobject_cast<HashHeaderCheckFilter *>(j->file());
+    Q_ASSERT(hhc);
+    auto *file = hhc->property("bsFile").value<QSaveFile *>();
+    Q_ASSERT(file);
 
-        try {
-            if (!j->isFailed() && j->wasNotModified()) {
-                emit updateFinished(true, tr("Already up-to-date."));
-                setUpdateStatus(UpdateStatus::Ok);
-            } else if (j->isFailed()) {
-                throw Exception(tr("download and decompress failed") + u":\n" + j->errorString());
-            } else if (!hhc->hasValidChecksum()) {
-                throw Exception(tr("checksum mismatch after decompression"));
-            } else if (!file->commit()) {
-                throw Exception(tr("saving failed") + u":\n" + file->errorString());
-            } else {
-                read(file->fileName());
+    hhc->close(); // does not close/commit the QSaveFile
+    hhc->deleteLater();
+
+    if (j->isFailed() && (j->responseCode() == 404) && hhc->property("bsMultiBlock").toBool()) {
+        m_multiBlockAvailable = false;
+        if (startFullDownload(hhc->property("bsForce").toBool()))
+            return;
+    }
 
-                m_etag = j->lastETag();
-                QFile etagf(file->fileName() + u".etag");
+    try {
+        if (!j->isFailed() && j->wasNotModified()) {
+            if (m_deltaApplied) {
+                // the ETag belongs to the file we had before applying the deltas
+                finishDeltaUpdate();
+                return;
+            }
+            emit updateFinished(true, tr("Already up-to-date."));
+            setUpdateStatus(UpdateStatus::Ok);
+        } else if (j->isFailed()) {
+            throw Exception(tr("download and decompress failed") + u":\n" + j->errorString());
+        } else if (!hhc->hasValidChecksum()) {
+            throw Exception(tr("checksum mismatch after decompression"));
+        } else if (!file->commit()) {
+            throw Exception(tr("saving failed") + u":\n" + file->errorString());
+        } else {
+            // the current database stays usable while the new one is parsed
+            const QString fileName = file->fileName();
+            const QString etag = j->lastETag();
+
+            readInBackground(fileName, [this, fileName, etag](const QString &error) {
+                if (!error.isEmpty()) {
+                    emit updateFinished(false, tr("Could not load the new database") + u":\n" + error);
+                    setUpdateStatus(UpdateStatus::UpdateFailed);
+                    return;
+                }
+                m_etag = etag;
+                QFile etagf(fileName + u".etag");
                 if (etagf.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
                     etagf.write(m_etag.toUtf8());
                     etagf.close();
@@ -82,13 +114,101 @@ Database::Database(const QString &updateUrl, QObject *parent)
 
                 emit updateFinished(true, { });
                 setUpdateStatus(UpdateStatus::Ok);
-            }
-            emit databaseReset();
+            });
+        }
+    } catch (const Exception &e) {
+        emit updateFinished(false, tr("Could not load the new database") + u":\n" + e.errorString());
+        setUpdateStatus(UpdateStatus::UpdateFailed);
+    }
+}
+
+void Database::deltaDownloadFinished(TransferJob *j)
+{
+    auto *hhc = qobject_cast<HashHeaderCheckFilter *>(j->file());
+    Q_ASSERT(hhc);
+    auto *buffer = hhc->property("bsBuffer").value<QBuffer *>();
+    Q_ASSERT(buffer);
+
+    hhc->close();
+    hhc->deleteLater();
+
+    if (j->isFailed()) {
+        fallBackToFullDownload(j->errorString());
+        return;
+    } else if (!hhc->hasValidChecksum()) {
+        fallBackToFullDownload(tr("checksum mismatch after decompression"));
+        return;
+    }
 
+    // hashing, patching and saving the whole database takes a while: keep it off the GUI thread
+    using Result = std::pair<bool, QString>; // applied, error
+
+    QtConcurrent::run([fileName = core()->dataPath() + defaultDatabaseName(),
+                      delta = buffer->data()]() -> Result {
+        try {
+            return { applyDelta(fileName, delta), { } };
         } catch (const Exception &e) {
-            emit updateFinished(false, tr("Could not load the new database") + u":\n" + e.errorString());
+            return { false, e.errorString() };
+        }
+    }).then(this, [this](const Result &result) {
+        const auto &[applied, error] = result;
+
+        if (!error.isEmpty()) {
+            fallBackToFullDownload(error);
+        } else if (!applied) {
+            // the server's delta for the current database is empty: we are up-to-date
+            if (m_deltaApplied) {
+                finishDeltaUpdate();
+            } else {
+                emit updateFinished(true, tr("Already up-to-date."));
+                setUpdateStatus(UpdateStatus::Ok);
+            }
+        } else {
+            m_deltaApplied = true;
+
+            // the server only keeps deltas between consecutive builds: chain them
+            if (++m_deltaSteps >= MaxDeltaSteps)
+                finishDeltaUpdate();
+            else if (!startDeltaDownload())
+                fallBackToFullDownload({ });
+        }
+    });
+}
+
+void Database::fallBackToFullDownload(const QString &error)
+{
+    if (!error.isEmpty()) {
+        qInfo().noquote() << "Delta update of the database failed, falling back to a full download:"
+                          << error;
+    }
+
+    if (!startFullDownload(false)) {
+        if (m_deltaApplied) {
+            finishDeltaUpdate();
+        } else {
+            emit updateFinished(false, tr("Could not load the new database") + u":\n" + error);
+            setUpdateStatus(UpdateStatus::UpdateFailed);
+        }
+    }
+}
+
+void Database::finishDeltaUpdate()
+{
+    const QString dbfile = core()->dataPath() + defaultDatabaseName();
+
+    readInBackground(dbfile, [this, dbfile](const QString &error) {
+        if (!error.isEmpty()) {
+            emit updateFinished(false, tr("Could not load the new database") + u":\n" + error);
             setUpdateStatus(UpdateStatus::UpdateFailed);
+            return;
         }
+        // we cannot know the server's ETag for the patched file, so the next full download
+        // (only ever needed if the delta chain breaks) has to be unconditional
+        m_etag.clear();
+        QFile::remove(dbfile + u".etag");
+
+        emit updateFinished(true, { });
+        setUpdateStatus(UpdateStatus::Ok);
     });
 }
 
@@ -113,6 +233,27 @@ QString Database::defaultDatabaseName(Version version)
     return u"database-v" + QString::number(int(version));
 }
 
+QString Database::deltaDatabaseName(const QByteArray &baseHash, Version version)
+{
+    // a prefix of the hash is plenty to identify the builds of the last few weeks
+    return defaultDatabaseName(version) + u".delta-" + QString::fromLatin1(baseHash.left(8).toHex());
+}
+
+QString Database::deltaDatabaseNameFilter()
+{
+    return u"database-v*.delta-*"_qs;
+}
+
+QByteArray Database::databaseHash(QByteArrayView data)
+{
+#if QT_VERSION < QT_VERSION_CHECK(6, 3, 0)
+    return QCryptographicHash::hash(QByteArray::fromRawData(data.data(), data.size()),
+                                    QCryptographicHash::Sha512);
+#else
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha512);
+#endif
+}
+
 void Database::setUpdateStatus(UpdateStatus updateStatus)
 {
     if (updateStatus != m_updateStatus) {
@@ -143,42 +284,110 @@ bool Database::startUpdate(bool force)
     if (m_job || (updateStatus() == UpdateStatus::Updating))
         return false;
 
-    QString dbName = defaultDatabaseName();
-    QString remotefile = u"https://" + m_updateUrl + u'/' + dbName + u".lzma";
-    QString localfile = core()->dataPath() + dbName;
+    QString localfile = core()->dataPath() + defaultDatabaseName();
 
     if (!QFile::exists(localfile))
         force = true;
 
     if (m_etag.isEmpty()) {
-        QString dbfile = core()->dataPath() + Database::defaultDatabaseName();
-        QFile etagf(dbfile + u".etag");
+        QFile etagf(localfile + u".etag");
         if (etagf.open(QIODevice::ReadOnly))
             m_etag = QString::fromUtf8(etagf.readAll());
     }
 
+    m_deltaSteps = 0;
+    m_deltaApplied = false;
+
+    if ((force || !startDeltaDownload()) && !startFullDownload(force))
+        return false;
+
+    // databaseAboutToBeReset() is only emitted once the new database has been fully loaded
+    setUpdateStatus(UpdateStatus::Updating);
+    return true;
+}
+
+bool Database::startFullDownload(bool force)
+{
+    // Prefer the multi-block variant, which can be decompressed in parallel. Older servers
+    // (or mirrors) might not have it, so we fall back to the single-stream file on a 404.
+    const bool multiBlock = m_multiBlockAvailable;
+
+    QString dbName = defaultDatabaseName();
+    QString remotefile = u"https://" + m_updateUrl + u'/' + dbName
+            + (multiBlock ? u".mblzma" : u".lzma");
+    QString localfile = core()->dataPath() + dbName;
+
     auto file = new QSaveFile(localfile);
-    auto lzma = new LZMA::DecompressFilter(file);
+    // The SHA-512 header covers the uncompressed database. For the multi-block variant this is
+    // verified via a HashFilter in front of the file, while the single-stream file keeps the
+    // legacy behavior of HashHeaderCheckFilter, which does not verify anything.
+    auto hash = multiBlock ? new HashFilter(file) : nullptr;
+    QIODevice *lzma = multiBlock ? static_cast<QIODevice *>(new LZMA::MultiBlockDecompressFilter(hash))
+                                 : static_cast<QIODevice *>(new LZMA::DecompressFilter(file));
     auto hhc = new HashHeaderCheckFilter(lzma);
     lzma->setParent(hhc);
-    file->setParent(lzma);
+    if (hash) {
+        hhc->setHashSource(hash);
+        hash->setParent(lzma);
+        file->setParent(hash);
+    } else {
+        file->setParent(lzma);
+    }
     hhc->setProperty("bsFile", QVariant::fromValue(file));
+    hhc->setProperty("bsForce", force);
+    hhc->setProperty("bsMultiBlock", multiBlock);
 
     if (hhc->open(QIODevice::WriteOnly)) {
         m_job = TransferJob::get(remotefile);
-        if (!force)
+        if (!force && !m_etag.isEmpty())
             m_job->setOnlyIfDifferent(m_etag);
         m_job->setOutputDevice(hhc);
+        m_jobIsDelta = false;
         m_transfer->retrieve(m_job);
     }
     if (!m_job) {
         delete hhc;
         return false;
     }
+    return true;
+}
 
-    setUpdateStatus(UpdateStatus::Updating);
+bool Database::startDeltaDownload()
+{
+    QFile f(core()->dataPath() + defaultDatabaseName());
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    const uchar *data = f.map(0, f.size());
+    if (!data)
+        return false;
+    const QByteArray baseHash = databaseHash(QByteArrayView(data, f.size()));
+    f.unmap(const_cast<uchar *>(data));
+    f.close();
+
+    QString remotefile = u"https://" + m_updateUrl + u'/' + deltaDatabaseName(baseHash) + u".lzma";
+
+    // deltas are small enough to be handled in memory, the hash in the header covers the
+    // uncompressed delta
+    auto buffer = new QBuffer();
+    auto hash = new HashFilter(buffer);
+    auto lzma = new LZMA::DecompressFilter(hash);
+    auto hhc = new HashHeaderCheckFilter(lzma);
+    hhc->setHashSource(hash);
+    lzma->setParent(hhc);
+    hash->setParent(lzma);
+    buffer->setParent(hash);
+    hhc->setProperty("bsBuffer", QVariant::fromValue(buffer));
 
-    emit databaseAboutToBeReset();
+    if (hhc->open(QIODevice::WriteOnly)) {
+        m_job = TransferJob::get(remotefile);
+        m_job->setOutputDevice(hhc);
+        m_jobIsDelta = true;
+        m_transfer->retrieve(m_job);
+    }
+    if (!m_job) {
+        delete hhc;
+        return false;
+    }
     return true;
 }
 
@@ -188,287 +397,324 @@ void Database::cancelUpdate()
         m_transfer->abortAllJobs();
 }
 
-void Database::read(const QString &fileName)
+std::shared_ptr<Database::Contents> Database::load(const QString &fileName)
 {
-    try {
-        auto *sw = new stopwatch("Loading database");
+    auto *sw = new stopwatch("Loading database");
 
-        QFile f(!fileName.isEmpty() ? fileName : core()->dataPath() + Database::defaultDatabaseName());
+    QFile f(fileName);
 
-        if (!f.open(QFile::ReadOnly))
-            throw Exception(&f, "could not open database for reading");
+    if (!f.open(QFile::ReadOnly))
+        throw Exception(&f, "could not open database for reading");
 
-        const char *data = reinterpret_cast<char *>(f.map(0, f.size()));
+    const char *data = reinterpret_cast<char *>(f.map(0, f.size()));
 
-        if (!data)
-            throw Exception("could not memory map the database (%1)").arg(f.fileName());
+    if (!data)
+        throw Exception("could not memory map the database (%1)").arg(f.fileName());
 
-        QByteArray ba = QByteArray::fromRawData(data, int(f.size()));
-        QBuffer buf(&ba);
-        buf.open(QIODevice::ReadOnly);
-        ChunkReader cr(&buf, QDataStream::LittleEndian);
-        QDataStream &ds = cr.dataStream();
+    QByteArray ba = QByteArray::fromRawData(data, int(f.size()));
+    QBuffer buf(&ba);
+    buf.open(QIODevice::ReadOnly);
+    ChunkReader cr(&buf, QDataStream::LittleEndian);
+    QDataStream &ds = cr.dataStream();
 
-        ds.startTransaction();
+    ds.startTransaction();
 
-        if (!cr.startChunk() || cr.chunkId() != ChunkId('B','S','D','B'))
-            throw Exception("invalid database format - wrong magic (%1)").arg(f.fileName());
+    if (!cr.startChunk() || cr.chunkId() != ChunkId('B','S','D','B'))
+        throw Exception("invalid database format - wrong magic (%1)").arg(f.fileName());
 
-        if (cr.chunkVersion() != int(Version::Latest)) {
-            throw Exception("invalid database version: expected %1, but got %2")
-                .arg(int(Version::Latest)).arg(cr.chunkVersion());
-        }
+    if (cr.chunkVersion() != int(Version::Latest)) {
+        throw Exception("invalid database version: expected %1, but got %2")
+            .arg(int(Version::Latest)).arg(cr.chunkVersion());
+    }
 
-        bool gotColors = false, gotCategories = false, gotItemTypes = false, gotItems = false;
-        bool gotChangeLog = false, gotRelationships = false, gotRelationshipMatches = false;
-        bool gotApiKeys = false, gotApiQuirks = false;
-
-        auto check = [&ds, &f]() {
-            if (ds.status() != QDataStream::Ok)
-                throw Exception("failed to read from database (%1) at position %2")
-                    .arg(f.fileName()).arg(ds.device()->pos());
-        };
-
-        auto sizeCheck = [&f](uint s, uint max) {
-            if (s > max)
-                throw Exception("failed to read from database (%1) at position %2: size value %L3 is larger than expected maximum %L4")
-                    .arg(f.fileName()).arg(f.pos()).arg(s).arg(max);
-        };
-
-        // This is the new pool. We need to keep the old alive till the scope end
-        std::unique_ptr<MemoryResource> pool(new DatabaseMonotonicMemoryResource(1024*1024));
-
-        QDateTime                        generationDate;
-        std::vector<Color>               colors;
-        std::vector<Color>               ldrawExtraColors;
-        std::vector<Category>            categories;
-        std::vector<ItemType>            itemTypes;
-        std::vector<Item>                items;
-        std::vector<ItemChangeLogEntry>  itemChangelog;
-        std::vector<ColorChangeLogEntry> colorChangelog;
-        std::vector<Relationship>        relationships;
-        std::vector<RelationshipMatch>   relationshipMatches;
-        uint                             latestChangelogId = 0;
-        QHash<QByteArray, QString>       apiKeys;
-        QSet<ApiQuirk>                   apiQuirks;
+    bool gotColors = false, gotCategories = false, gotItemTypes = false, gotItems = false;
+    bool gotChangeLog = false, gotRelationships = false, gotRelationshipMatches = false;
+    bool gotApiKeys = false, gotApiQuirks = false;
 
-        while (cr.startChunk()) {
-            switch (cr.chunkId() | ChunkVersion(cr.chunkVersion())) {
-            case ChunkId('D','A','T','E') | ChunkVersion(1): {
-                ds >> generationDate;
-                break;
-            }
-            case ChunkId('C','O','L',' ') | ChunkVersion(1): {
-                quint32 colc = 0;
-                ds >> colc;
-                check();
-                sizeCheck(colc, 1'000);
+    auto check = [&ds, &f]() {
+        if (ds.status() != QDataStream::Ok)
+            throw Exception("failed to read from database (%1) at position %2")
+                .arg(f.fileName()).arg(ds.device()->pos());
+    };
 
-                colors.resize(colc);
-                for (quint32 i = 0; i < colc; ++i) {
-                    readColorFromDatabase(colors[i], ds, pool.get());
-                    check();
-                }
-                gotColors = true;
-                break;
-            }
-            case ChunkId('L', 'C','O','L') | ChunkVersion(1): { // optional, can be missing or empty
-                quint32 colc = 0;
-                ds >> colc;
-                check();
-                sizeCheck(colc, 1'000);
+    auto sizeCheck = [&f](uint s, uint max) {
+        if (s > max)
+            throw Exception("failed to read from database (%1) at position %2: size value %L3 is larger than expected maximum %L4")
+                .arg(f.fileName()).arg(f.pos()).arg(s).arg(max);
+    };
 
-                ldrawExtraColors.resize(colc);
-                for (quint32 i = 0; i < colc; ++i) {
-                    readColorFromDatabase(ldrawExtraColors[i], ds, pool.get());
-                    check();
-                }
-                break;
-            }
-            case ChunkId('C','A','T',' ') | ChunkVersion(1): {
-                quint32 catc = 0;
-                ds >> catc;
+    // This is the new pool: it is owned by the returned Contents
+    std::unique_ptr<DatabaseMonotonicMemoryResource> pool(new DatabaseMonotonicMemoryResource(1024*1024));
+
+    QDateTime                        generationDate;
+    std::vector<Color>               colors;
+    std::vector<Color>               ldrawExtraColors;
+    std::vector<Category>            categories;
+    std::vector<ItemType>            itemTypes;
+    std::vector<Item>                items;
+    std::vector<ItemChangeLogEntry>  itemChangelog;
+    std::vector<ColorChangeLogEntry> colorChangelog;
+    std::vector<Relationship>        relationships;
+    std::vector<RelationshipMatch>   relationshipMatches;
+    uint                             latestChangelogId = 0;
+    QHash<QByteArray, QString>       apiKeys;
+    QSet<ApiQuirk>                   apiQuirks;
+
+    while (cr.startChunk()) {
+        switch (cr.chunkId() | ChunkVersion(cr.chunkVersion())) {
+        case ChunkId('D','A','T','E') | ChunkVersion(1): {
+            ds >> generationDate;
+            break;
+        }
+        case ChunkId('C','O','L',' ') | ChunkVersion(1): {
+            quint32 colc = 0;
+            ds >> colc;
+            check();
+            sizeCheck(colc, 1'000);
+
+            colors.resize(colc);
+            for (quint32 i = 0; i < colc; ++i) {
+                readColorFromDatabase(colors[i], ds, pool.get());
                 check();
-                sizeCheck(catc, 10'000);
-
-                categories.resize(catc);
-                for (quint32 i = 0; i < catc; ++i) {
-                    readCategoryFromDatabase(categories[i], ds, pool.get());
-                    check();
-                }
-                gotCategories = true;
-                break;
             }
-            case ChunkId('T','Y','P','E') | ChunkVersion(1): {
-                quint32 ittc = 0;
-                ds >> ittc;
+            gotColors = true;
+            break;
+        }
+        case ChunkId('L', 'C','O','L') | ChunkVersion(1): { // optional, can be missing or empty
+            quint32 colc = 0;
+            ds >> colc;
+            check();
+            sizeCheck(colc, 1'000);
+
+            ldrawExtraColors.resize(colc);
+            for (quint32 i = 0; i < colc; ++i) {
+                readColorFromDatabase(ldrawExtraColors[i], ds, pool.get());
                 check();
-                sizeCheck(ittc, 20);
-
-                itemTypes.resize(ittc);
-                for (quint32 i = 0; i < ittc; ++i) {
-                    readItemTypeFromDatabase(itemTypes[i], ds, pool.get());
-                    check();
-                }
-                gotItemTypes = true;
-                break;
             }
-            case ChunkId('I','T','E','M') | ChunkVersion(1): {
-                quint32 itc = 0;
-                ds >> itc;
+            break;
+        }
+        case ChunkId('C','A','T',' ') | ChunkVersion(1): {
+            quint32 catc = 0;
+            ds >> catc;
+            check();
+            sizeCheck(catc, 10'000);
+
+            categories.resize(catc);
+            for (quint32 i = 0; i < catc; ++i) {
+                readCategoryFromDatabase(categories[i], ds, pool.get());
                 check();
-                sizeCheck(itc, 1'000'000);
-
-                items.resize(itc);
-                for (quint32 i = 0; i < itc; ++i) {
-                    readItemFromDatabase(items[i], ds, pool.get());
-                    check();
-                }
-                gotItems = true;
-                break;
             }
-            case ChunkId('C','H','G','L') | ChunkVersion(2): {
-                quint32 clid = 0, clic = 0, clcc = 0;
-                ds >> clid >> clic >> clcc;
+            gotCategories = true;
+            break;
+        }
+        case ChunkId('T','Y','P','E') | ChunkVersion(1): {
+            quint32 ittc = 0;
+            ds >> ittc;
+            check();
+            sizeCheck(ittc, 20);
+
+            itemTypes.resize(ittc);
+            for (quint32 i = 0; i < ittc; ++i) {
+                readItemTypeFromDatabase(itemTypes[i], ds, pool.get());
                 check();
-                sizeCheck(clic, 1'000'000);
-                sizeCheck(clcc, 1'000);
-
-                itemChangelog.resize(clic);
-                for (quint32 i = 0; i < clic; ++i) {
-                    readItemChangeLogFromDatabase(itemChangelog[i], ds, pool.get());
-                    check();
-                }
-                colorChangelog.resize(clcc);
-                for (quint32 i = 0; i < clcc; ++i) {
-                    readColorChangeLogFromDatabase(colorChangelog[i], ds, pool.get());
-                    check();
-                }
-                latestChangelogId = clid;
-                gotChangeLog = true;
-                break;
             }
-            case ChunkId('R','E','L',' ') | ChunkVersion(1): {
-                quint32 relc = 0;
-                ds >> relc;
+            gotItemTypes = true;
+            break;
+        }
+        case ChunkId('I','T','E','M') | ChunkVersion(1): {
+            quint32 itc = 0;
+            ds >> itc;
+            check();
+            sizeCheck(itc, 1'000'000);
+
+            items.resize(itc);
+            for (quint32 i = 0; i < itc; ++i) {
+                readItemFromDatabase(items[i], ds, pool.get());
                 check();
-                sizeCheck(relc, 1'000);
-
-                relationships.resize(relc);
-                for (quint32 i = 0; i < relc; ++i) {
-                    readRelationshipFromDatabase(relationships[i], ds, pool.get());
-                    check();
-                }
-                gotRelationships = true;
-                break;
             }
-            case ChunkId('R','E','L','M') | ChunkVersion(1): {
-                quint32 matchc = 0;
-                ds >> matchc;
+            gotItems = true;
+            break;
+        }
+        case ChunkId('C','H','G','L') | ChunkVersion(2): {
+            quint32 clid = 0, clic = 0, clcc = 0;
+            ds >> clid >> clic >> clcc;
+            check();
+            sizeCheck(clic, 1'000'000);
+            sizeCheck(clcc, 1'000);
+
+            itemChangelog.resize(clic);
+            for (quint32 i = 0; i < clic; ++i) {
+                readItemChangeLogFromDatabase(itemChangelog[i], ds, pool.get());
                 check();
-                sizeCheck(matchc, 1'000'000);
-
-                relationshipMatches.resize(matchc);
-                for (quint32 i = 0; i < matchc; ++i) {
-                    readRelationshipMatchFromDatabase(relationshipMatches[i], ds, pool.get());
-                    check();
-                }
-                gotRelationshipMatches = true;
-                break;
             }
-            case ChunkId('A','K','E','Y') | ChunkVersion(1): {
-                quint32 akeyc = 0;
-                ds >> akeyc;
+            colorChangelog.resize(clcc);
+            for (quint32 i = 0; i < clcc; ++i) {
+                readColorChangeLogFromDatabase(colorChangelog[i], ds, pool.get());
                 check();
-                sizeCheck(akeyc, 100);
-
-                for (quint32 i = 0; i < akeyc; ++i) {
-                    QByteArray id;
-                    QString key;
-                    readApiKeyFromDatabase(id, key, ds, pool.get());
-                    check();
-                    apiKeys.insert(id, key);
-                }
-                gotApiKeys = true;
-                break;
             }
-            case ChunkId('Q','I','R','K') | ChunkVersion(1): {
-                quint32 qkeyc = 0;
-                ds >> qkeyc;
+            latestChangelogId = clid;
+            gotChangeLog = true;
+            break;
+        }
+        case ChunkId('R','E','L',' ') | ChunkVersion(1): {
+            quint32 relc = 0;
+            ds >> relc;
+            check();
+            sizeCheck(relc, 1'000);
+
+            relationships.resize(relc);
+            for (quint32 i = 0; i < relc; ++i) {
+                readRelationshipFromDatabase(relationships[i], ds, pool.get());
                 check();
-                sizeCheck(qkeyc, 100);
-
-                for (quint32 i = 0; i < qkeyc; ++i) {
-                    quint32 quirk;
-                    ds >> quirk;
-                    check();
-                    apiQuirks.insert(static_cast<BrickLink::ApiQuirk>(quirk));
-                }
-                gotApiQuirks = true;
-                break;
             }
-            default: {
-                cr.skipChunk();
+            gotRelationships = true;
+            break;
+        }
+        case ChunkId('R','E','L','M') | ChunkVersion(1): {
+            quint32 matchc = 0;
+            ds >> matchc;
+            check();
+            sizeCheck(matchc, 1'000'000);
+
+            relationshipMatches.resize(matchc);
+            for (quint32 i = 0; i < matchc; ++i) {
+                readRelationshipMatchFromDatabase(relationshipMatches[i], ds, pool.get());
                 check();
-                break;
             }
+            gotRelationshipMatches = true;
+            break;
+        }
+        case ChunkId('A','K','E','Y') | ChunkVersion(1): {
+            quint32 akeyc = 0;
+            ds >> akeyc;
+            check();
+            sizeCheck(akeyc, 100);
+
+            for (quint32 i = 0; i < akeyc; ++i) {
+                QByteArray id;
+                QString key;
+                readApiKeyFromDatabase(id, key, ds, pool.get());
+                check();
+                apiKeys.insert(id, key);
             }
-            if (!cr.endChunk()) {
-                throw Exception("missed the end of a chunk when reading from database (%1) at position %2")
-                    .arg(f.fileName()).arg(f.pos());
+            gotApiKeys = true;
+            break;
+        }
+        case ChunkId('Q','I','R','K') | ChunkVersion(1): {
+            quint32 qkeyc = 0;
+            ds >> qkeyc;
+            check();
+            sizeCheck(qkeyc, 100);
+
+            for (quint32 i = 0; i < qkeyc; ++i) {
+                quint32 quirk;
+                ds >> quirk;
+                check();
+                apiQuirks.insert(static_cast<BrickLink::ApiQuirk>(quirk));
             }
+            gotApiQuirks = true;
+            break;
+        }
+        default: {
+            cr.skipChunk();
+            check();
+            break;
+        }
         }
         if (!cr.endChunk()) {
-            throw Exception("missed the end of the root chunk when reading from database (%1) at position %2")
+            throw Exception("missed the end of a chunk when reading from database (%1) at position %2")
                 .arg(f.fileName()).arg(f.pos());
         }
+    }
+    if (!cr.endChunk()) {
+        throw Exception("missed the end of the root chunk when reading from database (%1) at position %2")
+            .arg(f.fileName()).arg(f.pos());
+    }
 
-        ds.commitTransaction();
+    ds.commitTransaction();
 
-        delete sw;
+    delete sw;
 
-        if (!gotColors || !gotCategories || !gotItemTypes || !gotItems || !gotChangeLog
-            || !gotRelationships || !gotRelationshipMatches || !gotApiKeys) {
-            throw Exception("not all required data chunks were found in the database (%1)")
-                .arg(f.fileName());
-        }
+    if (!gotColors || !gotCategories || !gotItemTypes || !gotItems || !gotChangeLog
+        || !gotRelationships || !gotRelationshipMatches || !gotApiKeys) {
+        throw Exception("not all required data chunks were found in the database (%1)")
+            .arg(f.fileName());
+    }
 
-        m_colors = std::move(colors);
-        m_ldrawExtraColors = std::move(ldrawExtraColors);
-        m_categories = std::move(categories);
-        m_itemTypes = std::move(itemTypes);
-        m_items = std::move(items);
-        m_itemChangelog = std::move(itemChangelog);
-        m_colorChangelog = std::move(colorChangelog);
-        m_relationships = std::move(relationships);
-        m_relationshipMatches = std::move(relationshipMatches);
-        m_latestChangelogId = latestChangelogId;
-        m_apiKeys = apiKeys;
-        const auto oldQuirks = m_apiQuirks;
-        m_apiQuirks = gotApiQuirks ? apiQuirks.intersect(Core::knownApiQuirks())
-                                   : Core::knownApiQuirks();
-
-        m_pool.swap(pool);
-
-        Color::s_colorImageCache.clear();
-
-        if (generationDate != m_lastUpdated) {
-            m_lastUpdated = generationDate;
-            emit lastUpdatedChanged(generationDate);
-        }
-        if (!m_valid) {
-            m_valid = true;
-            emit validChanged(m_valid);
-        }
+    auto contents = std::make_shared<Contents>();
+    contents->fileName = f.fileName();
+    contents->pool = std::move(pool);
+    contents->generationDate = generationDate;
+    contents->colors = std::move(colors);
+    contents->ldrawExtraColors = std::move(ldrawExtraColors);
+    contents->categories = std::move(categories);
+    contents->itemTypes = std::move(itemTypes);
+    contents->items = std::move(items);
+    contents->itemChangelog = std::move(itemChangelog);
+    contents->colorChangelog = std::move(colorChangelog);
+    contents->relationships = std::move(relationships);
+    contents->relationshipMatches = std::move(relationshipMatches);
+    contents->latestChangelogId = latestChangelogId;
+    contents->apiKeys = apiKeys;
+    contents->apiQuirks = gotApiQuirks ? apiQuirks.intersect(Core::knownApiQuirks())
+                                       : Core::knownApiQuirks();
+    return contents;
+}
+
+void Database::install(Contents &&contents)
+{
+    // The current data is handed over to its holder: moving the vectors and the pool keeps
+    // all the Item and Color objects at their addresses, so anyone who retained the holder
+    // can keep on using them.
+    Contents &old = *m_contentsHolder;
+    old.pool = std::exchange(m_pool, std::move(contents.pool));
+    old.colors = std::exchange(m_colors, std::move(contents.colors));
+    old.ldrawExtraColors = std::exchange(m_ldrawExtraColors, std::move(contents.ldrawExtraColors));
+    old.categories = std::exchange(m_categories, std::move(contents.categories));
+    old.itemTypes = std::exchange(m_itemTypes, std::move(contents.itemTypes));
+    old.items = std::exchange(m_items, std::move(contents.items));
+    old.itemChangelog = std::exchange(m_itemChangelog, std::move(contents.itemChangelog));
+    old.colorChangelog = std::exchange(m_colorChangelog, std::move(contents.colorChangelog));
+    old.relationships = std::exchange(m_relationships, std::move(contents.relationships));
+    old.relationshipMatches = std::exchange(m_relationshipMatches, std::move(contents.relationshipMatches));
+    m_latestChangelogId = contents.latestChangelogId;
+    m_apiKeys = contents.apiKeys;
+    const auto oldQuirks = std::exchange(m_apiQuirks, contents.apiQuirks);
+
+    // Drop our reference only after the current event has been fully processed: everybody
+    // listening to databaseReset() had the chance to let go of the old pointers by then.
+    // Core retains the contents even longer, until all the cancelled transfers are finished.
+    auto retired = std::exchange(m_contentsHolder, std::make_shared<Contents>());
+    QMetaObject::invokeMethod(this, [retired]() mutable { retired.reset(); }, Qt::QueuedConnection);
+
+    Color::s_colorImageCache.clear();
+
+    if (contents.generationDate != m_lastUpdated) {
+        m_lastUpdated = contents.generationDate;
+        emit lastUpdatedChanged(m_lastUpdated);
+    }
+    if (!m_valid) {
+        m_valid = true;
+        emit validChanged(m_valid);
+    }
 
-        bool itemTypeInfo = false;
+    bool itemTypeInfo = false;
 #if defined(QT_DEBUG)
-        itemTypeInfo = true;
+    itemTypeInfo = true;
 #endif
-        bool apiQuirksInfo = (m_apiQuirks != oldQuirks);
+    bool apiQuirksInfo = (m_apiQuirks != oldQuirks);
 
-        qInfo().noquote() << dumpDatabaseInformation(u"Loaded database from " + f.fileName(),
-                                                     itemTypeInfo, apiQuirksInfo);
+    qInfo().noquote() << dumpDatabaseInformation(u"Loaded database from " + contents.fileName,
+                                                 itemTypeInfo, apiQuirksInfo);
+}
+
+void Database::read(const QString &fileName)
+{
+    tracezone zone("Database::read");
+
+    try {
+        auto contents = load(!fileName.isEmpty() ? fileName : core()->dataPath() + defaultDatabaseName());
+        install(std::move(*contents));
     } catch (const Exception &e) {
         if (m_valid) {
             m_valid = false;
@@ -480,6 +726,50 @@ void Database::read(const QString &fileName)
     }
 }
 
+void Database::readInBackground(const QString &fileName, const std::function<void (const QString &)> &finished)
+{
+    using Result = std::pair<std::shared_ptr<Contents>, QString>;
+
+    QtConcurrent::run([fileName]() -> Result {
+        try {
+            return { load(fileName), { } };
+        } catch (const Exception &e) {
+            return { nullptr, e.errorString() };
+        }
+    }).then(this, [this, finished](const Result &result) {
+        if (result.first) {
+            // the switch-over happens in one go, without returning to the event loop
+            emit databaseAboutToBeReset();
+            install(std::move(*result.first));
+            emit databaseReset();
+        } else {
+            // the old database is still installed and valid, but we better re-download next time
+            m_etag.clear();
+            qWarning() << "Loading database failed:" << result.second;
+        }
+        finished(result.second);
+    });
+}
+
+std::shared_ptr<const void> Database::retainContents() const
+{
+    return m_contentsHolder;
+}
+
+quint64 Database::memoryUsage() const
+{
+    auto vectorSize = [](const auto &v) {
+        return quint64(v.capacity() * sizeof(typename std::remove_cvref_t<decltype(v)>::value_type));
+    };
+
+    // the variable sized data of all the objects is allocated from the pool
+    return (m_pool ? m_pool->allocatedSize() : 0)
+            + vectorSize(m_colors) + vectorSize(m_ldrawExtraColors) + vectorSize(m_categories)
+            + vectorSize(m_itemTypes) + vectorSize(m_items) + vectorSize(m_itemChangelog)
+            + vectorSize(m_colorChangelog) + vectorSize(m_relationships)
+            + vectorSize(m_relationshipMatches);
+}
+
 QString Database::dumpDatabaseInformation(const QString &title, bool itemTypeInfo, bool apiQuirksInfo) const
 {
     QVector<std::pair<QString, QString>> log = {
@@ -666,6 +956,96 @@ void Database::write(const QString &filename, Version version) const
         throw Exception(f.errorString());
 }
 
+void Database::writeDelta(const QByteArray &base, const QByteArray &target, const QString &fileName)
+{
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly))
+        throw Exception(&f, "could not open database delta for writing");
+
+    ChunkWriter cw(&f, QDataStream::LittleEndian);
+    QDataStream &ds = cw.dataStream();
+
+    auto check = [&ds, &f](bool ok) {
+        if (!ok || (ds.status() != QDataStream::Ok))
+            throw Exception("failed to write to database delta (%1) at position %2")
+                .arg(f.fileName()).arg(f.pos());
+    };
+
+    check(cw.startChunk(ChunkId('B','S','D','D'), 1));
+
+    check(cw.startChunk(ChunkId('H','A','S','H'), 1));
+    ds << databaseHash(base) << databaseHash(target);
+    check(cw.endChunk());
+
+    // an identical target results in an empty delta, which tells clients they are up-to-date
+    if (base != target) {
+        check(cw.startChunk(ChunkId('D','I','F','F'), 1));
+        ds << BinaryDelta::create(base, target);
+        check(cw.endChunk());
+    }
+
+    check(cw.endChunk()); // BSDD root chunk
+
+    if (!f.commit())
+        throw Exception(f.errorString());
+}
+
+bool Database::applyDelta(const QString &fileName, const QByteArray &delta)
+{
+    QByteArray target;
+    {
+        QFile f(fileName);
+        if (!f.open(QFile::ReadOnly))
+            throw Exception(&f, "could not open database for reading");
+        const char *data = reinterpret_cast<char *>(f.map(0, f.size()));
+        if (!data)
+            throw Exception("could not memory map the database (%1)").arg(f.fileName());
+        const QByteArrayView base(data, f.size());
+
+        QByteArray ba = QByteArray::fromRawData(delta.constData(), delta.size());
+        QBuffer buf(&ba);
+        buf.open(QIODevice::ReadOnly);
+        ChunkReader cr(&buf, QDataStream::LittleEndian);
+        QDataStream &ds = cr.dataStream();
+
+        if (!cr.startChunk() || (cr.chunkId() != ChunkId('B','S','D','D')) || (cr.chunkVersion() != 1))
+            throw Exception("invalid database delta format");
+
+        QByteArray baseHash, targetHash, diff;
+
+        while (cr.startChunk()) {
+            switch (cr.chunkId() | ChunkVersion(cr.chunkVersion())) {
+            case ChunkId('H','A','S','H') | ChunkVersion(1):
+                ds >> baseHash >> targetHash;
+                break;
+            case ChunkId('D','I','F','F') | ChunkVersion(1):
+                ds >> diff;
+                break;
+            default:
+                cr.skipChunk();
+                break;
+            }
+            if ((ds.status() != QDataStream::Ok) || !cr.endChunk())
+                throw Exception("failed to read from the database delta at position %1").arg(buf.pos());
+        }
+
+        if (baseHash.isEmpty() || (baseHash != databaseHash(base)))
+            throw Exception("the database delta does not match the local database");
+        if (targetHash == baseHash)
+            return false;
+
+        target = BinaryDelta::apply(base, diff);
+        if (databaseHash(target) != targetHash)
+            throw Exception("checksum mismatch after applying the database delta");
+    }
+    // the base is unmapped and closed at this point, so it can be safely replaced
+
+    QSaveFile sf(fileName);
+    if (!sf.open(QIODevice::WriteOnly) || (sf.write(target) != target.size()) || !sf.commit())
+        throw Exception(&sf, "could not save the patched database");
+    return true;
+}
+
 void Database::remove()
 {
     QString dbDir = core()->dataPath();
@@ -886,8 +1266,10 @@ static QByteArray scramble(const QByteArray &array, Database::Version v)
         return result;
     };
 
-    // cache the scramble keys for faster DB reloading
+    // cache the scramble keys for faster DB reloading (the DB is loaded on a worker thread)
     static QHash<Database::Version, QByteArray> scrambleKeys;
+    static QMutex scrambleKeysMutex;
+    QMutexLocker locker(&scrambleKeysMutex);
     QByteArray scrambleKey = scrambleKeys.value(v);
     if (scrambleKey.isEmpty()) {
         scrambleKey = "DBv" + QByteArray::number(int(v));
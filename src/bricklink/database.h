@@ -3,6 +3,9 @@
 
 #pragma once
 
+#include <functional>
+#include <memory>
+
 #include <QObject>
 #include <QDateTime>
 #include <QtQml/qqmlregistration.h>
@@ -64,6 +67,10 @@ public:
     BrickLink::UpdateStatus updateStatus() const  { return m_updateStatus; }
 
     static QString defaultDatabaseName(Version version = Version::Latest);
+    static QString deltaDatabaseName(const QByteArray &baseHash, Version version = Version::Latest);
+    static QString deltaDatabaseNameFilter(); // matches the delta names of all versions
+    static QByteArray databaseHash(QByteArrayView data);
+    static void writeDelta(const QByteArray &base, const QByteArray &target, const QString &fileName);
 
     bool startUpdate();
     bool startUpdate(bool force);
@@ -72,6 +79,13 @@ public:
     void read(const QString &fileName = { });
     void write(const QString &fileName, Version version) const;
 
+    // Keeps the memory of the currently installed database alive, even after an update has
+    // replaced it. Only needed by code that holds on to Item or Color pointers across a reset.
+    std::shared_ptr<const void> retainContents() const;
+
+    // the heap memory used by the currently installed database in bytes
+    quint64 memoryUsage() const;
+
     static void remove();
 
 signals:
@@ -85,8 +99,39 @@ signals:
     void databaseReset();
 
 private:
+    // Everything that is loaded from a database file. A new one is parsed on a worker thread
+    // and then moved into the Database in one step (see install()).
+    struct Contents
+    {
+        QString                          fileName;
+        std::unique_ptr<DatabaseMonotonicMemoryResource> pool;
+        QDateTime                        generationDate;
+        std::vector<Color>               colors;
+        std::vector<Color>               ldrawExtraColors;
+        std::vector<Category>            categories;
+        std::vector<ItemType>            itemTypes;
+        std::vector<Item>                items;
+        std::vector<ItemChangeLogEntry>  itemChangelog;
+        std::vector<ColorChangeLogEntry> colorChangelog;
+        std::vector<Relationship>        relationships;
+        std::vector<RelationshipMatch>   relationshipMatches;
+        uint                             latestChangelogId = 0;
+        QHash<QByteArray, QString>       apiKeys;
+        QSet<ApiQuirk>                   apiQuirks;
+    };
+
     Database(const QString &updateUrl, QObject *parent = nullptr);
+    static std::shared_ptr<Contents> load(const QString &fileName);
+    void install(Contents &&contents);
+    void readInBackground(const QString &fileName, const std::function<void(const QString &error)> &finished);
     void setUpdateStatus(UpdateStatus updateStatus);
+    bool startFullDownload(bool force);
+    bool startDeltaDownload();
+    void fullDownloadFinished(TransferJob *j);
+    void deltaDownloadFinished(TransferJob *j);
+    void fallBackToFullDownload(const QString &error);
+    void finishDeltaUpdate();
+    static bool applyDelta(const QString &fileName, const QByteArray &delta);
     QString dumpDatabaseInformation(const QString &title, bool itemTypeInfo, bool apiQuirksInfo) const;
 
     void clear();
@@ -99,8 +144,15 @@ private:
     QString m_etag;
     Transfer *m_transfer;
     TransferJob *m_job = nullptr;
+    bool m_jobIsDelta = false;
+    int m_deltaSteps = 0;
+    bool m_deltaApplied = false;
+    bool m_multiBlockAvailable = true;
+
+    // upper bound for chained deltas in a single update, the rest is picked up by the next one
+    static constexpr int MaxDeltaSteps = 14;
 
-    std::unique_ptr<MemoryResource>  m_pool;
+    std::unique_ptr<DatabaseMonotonicMemoryResource> m_pool;
     std::vector<Color>               m_colors;
     std::vector<Color>               m_ldrawExtraColors;
     std::vector<Category>            m_categories;
@@ -115,6 +167,9 @@ private:
 
     uint m_latestChangelogId = 0;
 
+    // empty while current, takes over the data when it gets replaced by install()
+    std::shared_ptr<Contents> m_contentsHolder = std::make_shared<Contents>();
+
     friend class Core;
     friend class TextImport;
 
@@ -0,0 +1,119 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <QCoro/QCoroTimer>
+
+#include "bricklink/downloadqueue_p.h"
+#include "utility/exception.h"
+
+
+namespace BrickLink {
+
+DownloadQueue::DownloadQueue(const FetchFunction &fetch, const MessageFunction &message,
+                             const QString &label, Delivery delivery, int maxConcurrent,
+                             int maxRetries)
+    : m_fetch(fetch)
+    , m_message(message)
+    , m_label(label)
+    , m_delivery(delivery)
+    , m_maxConcurrent(std::max(1, maxConcurrent))
+    , m_maxRetries(std::max(0, maxRetries))
+{ }
+
+void DownloadQueue::enqueue(const QUrl &url, const QString &fileName, const ResultCallback &callback)
+{
+    Q_ASSERT(!m_running);
+    m_jobs.append({ url, fileName, callback, { }, { }, false });
+}
+
+QCoro::Task<int> DownloadQueue::run()
+{
+    Q_ASSERT(!m_running);
+    m_running = true;
+
+    std::vector<QCoro::Task<>> workers;
+    const auto workerCount = std::min(qsizetype(m_maxConcurrent), m_jobs.size());
+    workers.reserve(size_t(workerCount));
+    for (qsizetype i = 0; i < workerCount; ++i)
+        workers.push_back(worker());
+    for (auto &w : workers)
+        co_await std::move(w);
+
+    m_running = false;
+
+    if (!m_jobs.isEmpty() && m_message) {
+        m_message(1, u"%1: %2 downloads finished, %3 retries, %4 failed"_qs
+                         .arg(m_label).arg(m_jobs.size()).arg(m_retried).arg(m_failed));
+    }
+    co_return m_failed;
+}
+
+QCoro::Task<> DownloadQueue::worker()
+{
+    while (m_nextJob < m_jobs.size()) {
+        const qsizetype index = m_nextJob++;
+
+        for (int attempt = 0; ; ++attempt) {
+            // we cannot co_await within a catch handler
+            QString error;
+            try {
+                m_jobs[index].data = co_await m_fetch(m_jobs.at(index).url, m_jobs.at(index).fileName);
+            } catch (const Exception &e) {
+                error = e.errorString();
+            } catch (const std::exception &e) {
+                error = QString::fromLocal8Bit(e.what());
+            }
+
+            if (error.isEmpty())
+                break;
+            if (attempt >= m_maxRetries) {
+                m_jobs[index].error = error;
+                break;
+            }
+            ++m_retried;
+            if (m_message)
+                m_message(2, u"%1 (retrying)"_qs.arg(error));
+            co_await QCoro::sleepFor(std::chrono::milliseconds(m_initialRetryDelay << attempt));
+        }
+        m_jobs[index].finished = true;
+
+        if (m_delivery == Delivery::InOrder) {
+            while ((m_nextDelivery < m_jobs.size()) && m_jobs.at(m_nextDelivery).finished)
+                deliver(m_jobs[m_nextDelivery++]);
+        } else {
+            deliver(m_jobs[index]);
+        }
+    }
+}
+
+void DownloadQueue::deliver(Job &job)
+{
+    if (job.error.isEmpty() && job.callback) {
+        try {
+            job.callback(job.data);
+        } catch (const Exception &e) {
+            job.error = e.errorString();
+        }
+    }
+    if (!job.error.isEmpty()) {
+        ++m_failed;
+        m_errors.append(job.error);
+        if (m_message)
+            m_message(2, job.error);
+    }
+    job.data = { };
+    job.callback = { };
+
+    // report the progress in 10% steps for larger queues
+    ++m_delivered;
+    if (m_message && (m_jobs.size() >= 100)
+            && ((m_delivered * 10 / m_jobs.size()) != ((m_delivered - 1) * 10 / m_jobs.size()))) {
+        m_message(1, u"%1: %2 of %3 done"_qs.arg(m_label).arg(m_delivered).arg(m_jobs.size()));
+    }
+}
+
+} // namespace BrickLink
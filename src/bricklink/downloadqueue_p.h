@@ -0,0 +1,89 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <functional>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QUrl>
+#include <QtCore/QVector>
+#include <QCoro/QCoroTask>
+
+
+namespace BrickLink {
+
+class TextImport;
+
+// Runs a list of downloads with a limited number of concurrent transfers. Failed downloads are
+// retried with an exponential backoff.
+// The results are handed to the callbacks as soon as they are available (or in the order the
+// downloads were added, if that is required), so the parsing overlaps with the network transfers.
+// The actual transfers are done by the fetch function, which throws on errors: TextImport uses
+// its download(), while the tests run against a local stand-in server.
+
+class DownloadQueue
+{
+public:
+    enum class Delivery { AsCompleted, InOrder };
+
+    using FetchFunction = std::function<QCoro::Task<QByteArray>(const QUrl &url, const QString &fileName)>;
+    using MessageFunction = std::function<void(int level, const QString &text)>;
+    using ResultCallback = std::function<void(const QByteArray &data)>;
+
+    static constexpr int DefaultMaxConcurrent = 8;
+    static constexpr int DefaultMaxRetries = 3;
+    static constexpr int DefaultInitialRetryDelay = 2000; // msec, doubled on every retry
+
+    DownloadQueue(const FetchFunction &fetch, const MessageFunction &message, const QString &label,
+                  Delivery delivery = Delivery::AsCompleted, int maxConcurrent = DefaultMaxConcurrent,
+                  int maxRetries = DefaultMaxRetries);
+    // fetches via TextImport::download(), defined in textimport.cpp
+    DownloadQueue(TextImport *textImport, const QString &label, Delivery delivery = Delivery::AsCompleted,
+                  int maxConcurrent = DefaultMaxConcurrent);
+
+    void setInitialRetryDelay(int msec)  { m_initialRetryDelay = msec; }
+
+    // an exception thrown from the callback counts as a failed download
+    void enqueue(const QUrl &url, const QString &fileName, const ResultCallback &callback);
+    qsizetype size() const  { return m_jobs.size(); }
+
+    // completes when all downloads are either delivered or have failed: returns the number of failures
+    QCoro::Task<int> run();
+
+    QStringList errors() const  { return m_errors; }
+    int retryCount() const      { return m_retried; }
+
+private:
+    struct Job {
+        QUrl url;
+        QString fileName;
+        ResultCallback callback;
+        QByteArray data;
+        QString error;
+        bool finished = false;
+    };
+
+    QCoro::Task<> worker();
+    void deliver(Job &job);
+
+    FetchFunction m_fetch;
+    MessageFunction m_message;
+    QString m_label;
+    Delivery m_delivery;
+    int m_maxConcurrent;
+    int m_maxRetries;
+    int m_initialRetryDelay = DefaultInitialRetryDelay;
+    QVector<Job> m_jobs;
+    qsizetype m_nextJob = 0;
+    qsizetype m_nextDelivery = 0;
+    qsizetype m_delivered = 0;
+    int m_failed = 0;
+    int m_retried = 0;
+    QStringList m_errors;
+    bool m_running = false;
+};
+
+} // namespace BrickLink
@@ -5,9 +5,12 @@
 #include <QtCore/QXmlStreamReader>
 #include <QtCore/QXmlStreamWriter>
 #include <QtCore/QTimeZone>
+#include <QtCore/QThreadPool>
+#include <QtConcurrent/QtConcurrentMap>
 
 #include "utility/utility.h"
 #include "utility/exception.h"
+#include "utility/tracing.h"
 #include "bricklink/core.h"
 #include "bricklink/io.h"
 
@@ -60,80 +63,152 @@ static QString unescapeLtGt(const QString &str, bool enabled = true)
 
 namespace BrickLink {
 
-QString IO::toBrickLinkXML(const LotList &lots)
+using WriteXMLItemFn = std::function<void(QXmlStreamWriter &xml, const Lot *lot)>;
+
+// Formatting the lots is by far the most expensive part of an export, so this is done in
+// parallel chunks, which are then written to the output device in their original order.
+// Only a few chunks are in flight at any given time, so the memory usage stays flat,
+// regardless of the number of lots.
+// The output is byte-for-byte identical to a single QXmlStreamWriter writing everything.
+static void writeXMLChunked(QIODevice *device, const LotList &lots, const WriteXMLItemFn &writeItem)
 {
-    bool doubleEscapedComments = core()->isApiQuirkActive(ApiQuirk::InventoryCommentsAreDoubleEscaped);
-    bool doubleEscapedRemarks = core()->isApiQuirkActive(ApiQuirk::InventoryRemarksAreDoubleEscaped);
+    static constexpr qsizetype LotsPerChunk = 256;
 
-    QString out;
-    QXmlStreamWriter xml(&out);
-    xml.writeStartElement(u"INVENTORY"_qs);
+    struct Chunk
+    {
+        qsizetype from = 0;
+        qsizetype to = 0;
+        QByteArray data;
+    };
 
-    for (const Lot *lot : lots) {
-        if (lot->isIncomplete() || (lot->status() == Status::Exclude))
-            continue;
+    bool hasItems = false;
 
-        xml.writeStartElement(u"ITEM"_qs);
-        xml.writeTextElement(u"ITEMID"_qs, QString::fromLatin1(lot->itemId()));
-        xml.writeTextElement(u"ITEMTYPE"_qs, QString(QChar::fromLatin1(lot->itemTypeId())));
-        xml.writeTextElement(u"COLOR"_qs, QString::number(lot->colorId()));
-        xml.writeTextElement(u"CATEGORY"_qs, QString::number(lot->categoryId()));
-        xml.writeTextElement(u"QTY"_qs, QString::number(lot->quantity()));
-        xml.writeTextElement(u"PRICE"_qs, QString::number(Utility::fixFinite(lot->price()), 'f', 3));
-        xml.writeTextElement(u"CONDITION"_qs, (lot->condition() == Condition::New) ? u"N"_qs : u"U"_qs);
+    auto write = [device](const QByteArrayView data) {
+        if (device->write(data.data(), data.size()) != data.size())
+            throw Exception("Failed to write the XML data: %1").arg(device->errorString());
+    };
+
+    std::vector<Chunk> chunks;
+    const qsizetype maxChunksInFlight = std::max(1, QThreadPool::globalInstance()->maxThreadCount()) * 2;
 
-        if (lot->bulkQuantity() != 1)   xml.writeTextElement(u"BULK"_qs, QString::number(lot->bulkQuantity()));
-        if (lot->sale())                xml.writeTextElement(u"SALE"_qs, QString::number(lot->sale()));
-        if (!lot->comments().isEmpty()) xml.writeTextElement(u"DESCRIPTION"_qs, doubleEscapedComments ? escapeLtGt(lot->comments()) : lot->comments());
-        if (!lot->remarks().isEmpty())  xml.writeTextElement(u"REMARKS"_qs, doubleEscapedRemarks ? escapeLtGt(lot->remarks()) : lot->remarks());
-        if (lot->retain())              xml.writeTextElement(u"RETAIN"_qs, u"Y"_qs);
-        if (!lot->reserved().isEmpty()) xml.writeTextElement(u"BUYERUSERNAME"_qs, lot->reserved());
-        if (!qFuzzyIsNull(lot->cost())) xml.writeTextElement(u"MYCOST"_qs, QString::number(Utility::fixFinite(lot->cost()), 'f', 3));
-        if (lot->hasCustomWeight())     xml.writeTextElement(u"MYWEIGHT"_qs, QString::number(Utility::fixFinite(lot->weight()), 'f', 4));
-
-        if (lot->tierQuantity(0)) {
-            xml.writeTextElement(u"TQ1"_qs, QString::number(lot->tierQuantity(0)));
-            xml.writeTextElement(u"TP1"_qs, QString::number(Utility::fixFinite(lot->tierPrice(0)), 'f', 3));
-            xml.writeTextElement(u"TQ2"_qs, QString::number(lot->tierQuantity(1)));
-            xml.writeTextElement(u"TP2"_qs, QString::number(Utility::fixFinite(lot->tierPrice(1)), 'f', 3));
-            xml.writeTextElement(u"TQ3"_qs, QString::number(lot->tierQuantity(2)));
-            xml.writeTextElement(u"TP3"_qs, QString::number(Utility::fixFinite(lot->tierPrice(2)), 'f', 3));
+    for (qsizetype batchFrom = 0; batchFrom < lots.size(); ) {
+        chunks.clear();
+        for (qsizetype n = 0; (n < maxChunksInFlight) && (batchFrom < lots.size()); ++n) {
+            const qsizetype to = std::min(lots.size(), batchFrom + LotsPerChunk);
+            chunks.push_back({ batchFrom, to, { } });
+            batchFrom = to;
         }
 
-        if (lot->subCondition() != SubCondition::None) {
-            QChar sc;
-            switch (lot->subCondition()) {
-            case SubCondition::Incomplete: sc = u'I'; break;
-            case SubCondition::Complete  : sc = u'C'; break;
-            case SubCondition::Sealed    : sc = u'S'; break;
-            default                      : break;
+        QtConcurrent::blockingMap(chunks, [&](Chunk &chunk) {
+            QXmlStreamWriter xml(&chunk.data);
+            for (qsizetype i = chunk.from; i < chunk.to; ++i)
+                writeItem(xml, lots.at(i));
+        });
+
+        for (const Chunk &chunk : std::as_const(chunks)) {
+            if (chunk.data.isEmpty())
+                continue;
+            if (!hasItems) {
+                write("<INVENTORY>");
+                hasItems = true;
             }
-            if (!sc.isNull())
-                xml.writeTextElement(u"SUBCONDITION"_qs, QString(sc));
+            write(chunk.data);
         }
-        if (lot->stockroom() != Stockroom::None) {
-            QChar sr;
-            switch (lot->stockroom()) {
-            case Stockroom::A: sr = u'A'; break;
-            case Stockroom::B: sr = u'B'; break;
-            case Stockroom::C: sr = u'C'; break;
-            default          : break;
-            }
-            if (!sr.isNull()) {
-                xml.writeTextElement(u"STOCKROOM"_qs, u"Y"_qs);
-                xml.writeTextElement(u"STOCKROOMID"_qs, QString(sr));
-            }
+    }
+
+    // mimic QXmlStreamWriter, which collapses an element without any content
+    write(hasItems ? "</INVENTORY>" : "<INVENTORY/>");
+}
+
+// QString based convenience API on top of the streaming writers
+static QString toXMLString(const std::function<void(QIODevice *)> &writer)
+{
+    QByteArray out;
+    QBuffer buffer(&out);
+    buffer.open(QIODevice::WriteOnly);
+    writer(&buffer);
+    buffer.close();
+    return QString::fromUtf8(out);
+}
+
+static void writeBrickLinkXMLItem(QXmlStreamWriter &xml, const Lot *lot, bool doubleEscapedComments,
+                                  bool doubleEscapedRemarks)
+{
+    if (lot->isIncomplete() || (lot->status() == Status::Exclude))
+        return;
+
+    xml.writeStartElement(u"ITEM"_qs);
+    xml.writeTextElement(u"ITEMID"_qs, QString::fromLatin1(lot->itemId()));
+    xml.writeTextElement(u"ITEMTYPE"_qs, QString(QChar::fromLatin1(lot->itemTypeId())));
+    xml.writeTextElement(u"COLOR"_qs, QString::number(lot->colorId()));
+    xml.writeTextElement(u"CATEGORY"_qs, QString::number(lot->categoryId()));
+    xml.writeTextElement(u"QTY"_qs, QString::number(lot->quantity()));
+    xml.writeTextElement(u"PRICE"_qs, QString::number(Utility::fixFinite(lot->price()), 'f', 3));
+    xml.writeTextElement(u"CONDITION"_qs, (lot->condition() == Condition::New) ? u"N"_qs : u"U"_qs);
+
+    if (lot->bulkQuantity() != 1)   xml.writeTextElement(u"BULK"_qs, QString::number(lot->bulkQuantity()));
+    if (lot->sale())                xml.writeTextElement(u"SALE"_qs, QString::number(lot->sale()));
+    if (!lot->comments().isEmpty()) xml.writeTextElement(u"DESCRIPTION"_qs, doubleEscapedComments ? escapeLtGt(lot->comments()) : lot->comments());
+    if (!lot->remarks().isEmpty())  xml.writeTextElement(u"REMARKS"_qs, doubleEscapedRemarks ? escapeLtGt(lot->remarks()) : lot->remarks());
+    if (lot->retain())              xml.writeTextElement(u"RETAIN"_qs, u"Y"_qs);
+    if (!lot->reserved().isEmpty()) xml.writeTextElement(u"BUYERUSERNAME"_qs, lot->reserved());
+    if (!qFuzzyIsNull(lot->cost())) xml.writeTextElement(u"MYCOST"_qs, QString::number(Utility::fixFinite(lot->cost()), 'f', 3));
+    if (lot->hasCustomWeight())     xml.writeTextElement(u"MYWEIGHT"_qs, QString::number(Utility::fixFinite(lot->weight()), 'f', 4));
+
+    if (lot->tierQuantity(0)) {
+        xml.writeTextElement(u"TQ1"_qs, QString::number(lot->tierQuantity(0)));
+        xml.writeTextElement(u"TP1"_qs, QString::number(Utility::fixFinite(lot->tierPrice(0)), 'f', 3));
+        xml.writeTextElement(u"TQ2"_qs, QString::number(lot->tierQuantity(1)));
+        xml.writeTextElement(u"TP2"_qs, QString::number(Utility::fixFinite(lot->tierPrice(1)), 'f', 3));
+        xml.writeTextElement(u"TQ3"_qs, QString::number(lot->tierQuantity(2)));
+        xml.writeTextElement(u"TP3"_qs, QString::number(Utility::fixFinite(lot->tierPrice(2)), 'f', 3));
+    }
+
+    if (lot->subCondition() != SubCondition::None) {
+        QChar sc;
+        switch (lot->subCondition()) {
+        case SubCondition::Incomplete: sc = u'I'; break;
+        case SubCondition::Complete  : sc = u'C'; break;
+        case SubCondition::Sealed    : sc = u'S'; break;
+        default                      : break;
+        }
+        if (!sc.isNull())
+            xml.writeTextElement(u"SUBCONDITION"_qs, QString(sc));
+    }
+    if (lot->stockroom() != Stockroom::None) {
+        QChar sr;
+        switch (lot->stockroom()) {
+        case Stockroom::A: sr = u'A'; break;
+        case Stockroom::B: sr = u'B'; break;
+        case Stockroom::C: sr = u'C'; break;
+        default          : break;
+        }
+        if (!sr.isNull()) {
+            xml.writeTextElement(u"STOCKROOM"_qs, u"Y"_qs);
+            xml.writeTextElement(u"STOCKROOMID"_qs, QString(sr));
         }
-        xml.writeEndElement();
     }
     xml.writeEndElement();
-    return out;
 }
 
+QString IO::toBrickLinkXML(const LotList &lots)
+{
+    return toXMLString([&](QIODevice *device) { writeBrickLinkXML(device, lots); });
+}
+
+void IO::writeBrickLinkXML(QIODevice *device, const LotList &lots)
+{
+    bool doubleEscapedComments = core()->isApiQuirkActive(ApiQuirk::InventoryCommentsAreDoubleEscaped);
+    bool doubleEscapedRemarks = core()->isApiQuirkActive(ApiQuirk::InventoryRemarksAreDoubleEscaped);
+
+    writeXMLChunked(device, lots, [=](QXmlStreamWriter &xml, const Lot *lot) {
+        writeBrickLinkXMLItem(xml, lot, doubleEscapedComments, doubleEscapedRemarks);
+    });
+}
 
 IO::ParseResult IO::fromBrickLinkXML(const QByteArray &data, Hint hint, const QDateTime &creationTime)
 {
-    //stopwatch loadXMLWatch("Load XML");
+    tracezone zone("IO::fromBrickLinkXML");
 
     const bool doubleEscapedComments = core()->isApiQuirkActive(ApiQuirk::InventoryCommentsAreDoubleEscaped);
     const bool doubleEscapedRemarks = core()->isApiQuirkActive(ApiQuirk::InventoryRemarksAreDoubleEscaped);
@@ -299,36 +374,37 @@ IO::ParseResult IO::fromBrickLinkXML(const QByteArray &data, Hint hint, const QD
     }
 }
 
-QString IO::toWantedListXML(const LotList &lots, const QString &wantedList)
+static void writeWantedListXMLItem(QXmlStreamWriter &xml, const Lot *lot, const QString &wantedList)
 {
-    QString out;
-    QXmlStreamWriter xml(&out);
-    xml.writeStartElement(u"INVENTORY"_qs);
+    if (lot->isIncomplete() || (lot->status() == Status::Exclude))
+        return;
+
+    xml.writeStartElement(u"ITEM"_qs);
+    xml.writeTextElement(u"ITEMID"_qs, QString::fromLatin1(lot->itemId()));
+    xml.writeTextElement(u"ITEMTYPE"_qs, QString(QChar::fromLatin1(lot->itemTypeId())));
+    xml.writeTextElement(u"COLOR"_qs, QString::number(lot->colorId()));
+
+    if (lot->quantity())
+        xml.writeTextElement(u"MINQTY"_qs, QString::number(lot->quantity()));
+    if (!qFuzzyIsNull(lot->price()))
+        xml.writeTextElement(u"MAXPRICE"_qs, QString::number(Utility::fixFinite(lot->price()), 'f', 3));
+    if (!lot->remarks().isEmpty())
+        xml.writeTextElement(u"REMARKS"_qs, escapeLtGt(lot->remarks()));
+    if (lot->condition() == Condition::New)
+        xml.writeTextElement(u"CONDITION"_qs, u"N"_qs);
+    if (!wantedList.isEmpty())
+        xml.writeTextElement(u"WANTEDLISTID"_qs, wantedList);
 
-    for (const Lot *lot : lots) {
-        if (lot->isIncomplete() || (lot->status() == Status::Exclude))
-            continue;
-
-        xml.writeStartElement(u"ITEM"_qs);
-        xml.writeTextElement(u"ITEMID"_qs, QString::fromLatin1(lot->itemId()));
-        xml.writeTextElement(u"ITEMTYPE"_qs, QString(QChar::fromLatin1(lot->itemTypeId())));
-        xml.writeTextElement(u"COLOR"_qs, QString::number(lot->colorId()));
-
-        if (lot->quantity())
-            xml.writeTextElement(u"MINQTY"_qs, QString::number(lot->quantity()));
-        if (!qFuzzyIsNull(lot->price()))
-            xml.writeTextElement(u"MAXPRICE"_qs, QString::number(Utility::fixFinite(lot->price()), 'f', 3));
-        if (!lot->remarks().isEmpty())
-            xml.writeTextElement(u"REMARKS"_qs, escapeLtGt(lot->remarks()));
-        if (lot->condition() == Condition::New)
-            xml.writeTextElement(u"CONDITION"_qs, u"N"_qs);
-        if (!wantedList.isEmpty())
-            xml.writeTextElement(u"WANTEDLISTID"_qs, wantedList);
-
-        xml.writeEndElement();
-    }
     xml.writeEndElement();
-    return out;
+}
+
+QString IO::toWantedListXML(const LotList &lots, const QString &wantedList)
+{
+    return toXMLString([&](QIODevice *device) {
+        writeXMLChunked(device, lots, [&wantedList](QXmlStreamWriter &xml, const Lot *lot) {
+            writeWantedListXMLItem(xml, lot, wantedList);
+        });
+    });
 }
 
 QString IO::toInventoryRequest(const LotList &lots)
@@ -355,104 +431,105 @@ QString IO::toInventoryRequest(const LotList &lots)
     return out;
 }
 
-QString IO::toBrickLinkUpdateXML(const LotList &lots,
-                                 const std::function<const Lot *(const Lot *)> &differenceBaseLot)
+static void writeBrickLinkUpdateXMLItem(QXmlStreamWriter &xml, const Lot *lot, const Lot *base,
+                                        bool doubleEscapedComments, bool doubleEscapedRemarks)
 {
-    bool doubleEscapedComments = core()->isApiQuirkActive(ApiQuirk::InventoryCommentsAreDoubleEscaped);
-    bool doubleEscapedRemarks = core()->isApiQuirkActive(ApiQuirk::InventoryRemarksAreDoubleEscaped);
-
-    QString out;
-    QXmlStreamWriter xml(&out);
-    xml.writeStartElement(u"INVENTORY"_qs);
-
-    for (const Lot *lot : lots) {
-        if (lot->isIncomplete() || (lot->status() == Status::Exclude))
-            continue;
-
-        auto *base = differenceBaseLot(lot);
-        if (!base)
-            continue;
-
-        // we don't care about reserved, status and marker, so we have to mask it
-        auto baseLot = *base;
-        baseLot.setReserved(lot->reserved());
-        baseLot.setStatus(lot->status());
-        baseLot.setMarkerColor(lot->markerColor());
-        baseLot.setMarkerText(lot->markerText());
-
-        if (baseLot == *lot)
-            continue;
-
-        xml.writeStartElement(u"ITEM"_qs);
-        xml.writeTextElement(u"LOTID"_qs, QString::number(lot->lotId()));
-        int qdiff = lot->quantity() - base->quantity();
-        if (qdiff && (lot->quantity() > 0))
-            xml.writeTextElement(u"QTY"_qs, QString::number(qdiff).prepend(qdiff > 0 ? u"+"_qs : u""_qs));
-        else if (qdiff && (lot->quantity() <= 0))
-            xml.writeEmptyElement(u"DELETE"_qs);
-
-        if (!qFuzzyCompare(base->price(), lot->price()))
-            xml.writeTextElement(u"PRICE"_qs, QString::number(Utility::fixFinite(lot->price()), 'f', 3));
-        if (!qFuzzyCompare(base->cost(), lot->cost()))
-            xml.writeTextElement(u"MYCOST"_qs, QString::number(Utility::fixFinite(lot->cost()), 'f', 3));
-        if (base->condition() != lot->condition())
-            xml.writeTextElement(u"CONDITION"_qs, (lot->condition() == Condition::New) ? u"N"_qs : u"U"_qs);
-        if (base->bulkQuantity() != lot->bulkQuantity())
-            xml.writeTextElement(u"BULK"_qs, QString::number(lot->bulkQuantity()));
-        if (base->sale() != lot->sale())
-            xml.writeTextElement(u"SALE"_qs, QString::number(lot->sale()));
-        if (base->comments() != lot->comments())
-            xml.writeTextElement(u"DESCRIPTION"_qs, doubleEscapedComments ? escapeLtGt(lot->comments()) : lot->comments());
-        if (base->remarks() != lot->remarks())
-            xml.writeTextElement(u"REMARKS"_qs, doubleEscapedRemarks ? escapeLtGt(lot->remarks()) : lot->remarks());
-        if (base->retain() != lot->retain())
-            xml.writeTextElement(u"RETAIN"_qs, lot->retain() ? u"Y"_qs : u"N"_qs);
-
-        if ((base->tierQuantity(0) != lot->tierQuantity(0))
-            || !qFuzzyCompare(base->tierPrice(0), lot->tierPrice(0))
-            || (base->tierQuantity(1) != lot->tierQuantity(1))
-            || !qFuzzyCompare(base->tierPrice(1), lot->tierPrice(1))
-            || (base->tierQuantity(2) != lot->tierQuantity(2))
-            || !qFuzzyCompare(base->tierPrice(2), lot->tierPrice(2))) {
-            xml.writeTextElement(u"TQ1"_qs, QString::number(lot->tierQuantity(0)));
-            xml.writeTextElement(u"TP1"_qs, QString::number(Utility::fixFinite(lot->tierPrice(0)), 'f', 3));
-            xml.writeTextElement(u"TQ2"_qs, QString::number(lot->tierQuantity(1)));
-            xml.writeTextElement(u"TP2"_qs, QString::number(Utility::fixFinite(lot->tierPrice(1)), 'f', 3));
-            xml.writeTextElement(u"TQ3"_qs, QString::number(lot->tierQuantity(2)));
-            xml.writeTextElement(u"TP3"_qs, QString::number(Utility::fixFinite(lot->tierPrice(2)), 'f', 3));
-        }
+    if (lot->isIncomplete() || (lot->status() == Status::Exclude))
+        return;
+    if (!base)
+        return;
+
+    // we don't care about reserved, status and marker, so we have to mask it
+    auto baseLot = *base;
+    baseLot.setReserved(lot->reserved());
+    baseLot.setStatus(lot->status());
+    baseLot.setMarkerColor(lot->markerColor());
+    baseLot.setMarkerText(lot->markerText());
+
+    if (baseLot == *lot)
+        return;
+
+    xml.writeStartElement(u"ITEM"_qs);
+    xml.writeTextElement(u"LOTID"_qs, QString::number(lot->lotId()));
+    int qdiff = lot->quantity() - base->quantity();
+    if (qdiff && (lot->quantity() > 0))
+        xml.writeTextElement(u"QTY"_qs, QString::number(qdiff).prepend(qdiff > 0 ? u"+"_qs : u""_qs));
+    else if (qdiff && (lot->quantity() <= 0))
+        xml.writeEmptyElement(u"DELETE"_qs);
+
+    if (!qFuzzyCompare(base->price(), lot->price()))
+        xml.writeTextElement(u"PRICE"_qs, QString::number(Utility::fixFinite(lot->price()), 'f', 3));
+    if (!qFuzzyCompare(base->cost(), lot->cost()))
+        xml.writeTextElement(u"MYCOST"_qs, QString::number(Utility::fixFinite(lot->cost()), 'f', 3));
+    if (base->condition() != lot->condition())
+        xml.writeTextElement(u"CONDITION"_qs, (lot->condition() == Condition::New) ? u"N"_qs : u"U"_qs);
+    if (base->bulkQuantity() != lot->bulkQuantity())
+        xml.writeTextElement(u"BULK"_qs, QString::number(lot->bulkQuantity()));
+    if (base->sale() != lot->sale())
+        xml.writeTextElement(u"SALE"_qs, QString::number(lot->sale()));
+    if (base->comments() != lot->comments())
+        xml.writeTextElement(u"DESCRIPTION"_qs, doubleEscapedComments ? escapeLtGt(lot->comments()) : lot->comments());
+    if (base->remarks() != lot->remarks())
+        xml.writeTextElement(u"REMARKS"_qs, doubleEscapedRemarks ? escapeLtGt(lot->remarks()) : lot->remarks());
+    if (base->retain() != lot->retain())
+        xml.writeTextElement(u"RETAIN"_qs, lot->retain() ? u"Y"_qs : u"N"_qs);
+
+    if ((base->tierQuantity(0) != lot->tierQuantity(0))
+        || !qFuzzyCompare(base->tierPrice(0), lot->tierPrice(0))
+        || (base->tierQuantity(1) != lot->tierQuantity(1))
+        || !qFuzzyCompare(base->tierPrice(1), lot->tierPrice(1))
+        || (base->tierQuantity(2) != lot->tierQuantity(2))
+        || !qFuzzyCompare(base->tierPrice(2), lot->tierPrice(2))) {
+        xml.writeTextElement(u"TQ1"_qs, QString::number(lot->tierQuantity(0)));
+        xml.writeTextElement(u"TP1"_qs, QString::number(Utility::fixFinite(lot->tierPrice(0)), 'f', 3));
+        xml.writeTextElement(u"TQ2"_qs, QString::number(lot->tierQuantity(1)));
+        xml.writeTextElement(u"TP2"_qs, QString::number(Utility::fixFinite(lot->tierPrice(1)), 'f', 3));
+        xml.writeTextElement(u"TQ3"_qs, QString::number(lot->tierQuantity(2)));
+        xml.writeTextElement(u"TP3"_qs, QString::number(Utility::fixFinite(lot->tierPrice(2)), 'f', 3));
+    }
 
-        if (base->subCondition() != lot->subCondition()) {
-            QChar sc;
-            switch (lot->subCondition()) {
-            case SubCondition::Incomplete: sc = u'I'; break;
-            case SubCondition::Complete  : sc = u'C'; break;
-            case SubCondition::Sealed    : sc = u'S'; break;
-            default                      : break;
-            }
-            if (!sc.isNull())
-                xml.writeTextElement(u"SUBCONDITION"_qs, QString(sc));
+    if (base->subCondition() != lot->subCondition()) {
+        QChar sc;
+        switch (lot->subCondition()) {
+        case SubCondition::Incomplete: sc = u'I'; break;
+        case SubCondition::Complete  : sc = u'C'; break;
+        case SubCondition::Sealed    : sc = u'S'; break;
+        default                      : break;
         }
-        if (base->stockroom() != lot->stockroom()) {
-            QChar sr;
-            switch (lot->stockroom()) {
-            case Stockroom::A: sr = u'A'; break;
-            case Stockroom::B: sr = u'B'; break;
-            case Stockroom::C: sr = u'C'; break;
-            default          : break;
-            }
-            xml.writeTextElement(u"STOCKROOM"_qs, !sr.isNull() ? u"Y"_qs : u"N"_qs);
-            if (!sr.isNull())
-                xml.writeTextElement(u"STOCKROOMID"_qs, QString(sr));
+        if (!sc.isNull())
+            xml.writeTextElement(u"SUBCONDITION"_qs, QString(sc));
+    }
+    if (base->stockroom() != lot->stockroom()) {
+        QChar sr;
+        switch (lot->stockroom()) {
+        case Stockroom::A: sr = u'A'; break;
+        case Stockroom::B: sr = u'B'; break;
+        case Stockroom::C: sr = u'C'; break;
+        default          : break;
         }
-
-        // Ignore the weight - it's just too confusing:
-        // BrickStore displays the total weight, but that is dependent on the quantity.
-        // On the other hand, the update would be done on the item weight.
-        xml.writeEndElement();
+        xml.writeTextElement(u"STOCKROOM"_qs, !sr.isNull() ? u"Y"_qs : u"N"_qs);
+        if (!sr.isNull())
+            xml.writeTextElement(u"STOCKROOMID"_qs, QString(sr));
     }
+
+    // Ignore the weight - it's just too confusing:
+    // BrickStore displays the total weight, but that is dependent on the quantity.
+    // On the other hand, the update would be done on the item weight.
     xml.writeEndElement();
-    return out;
+}
+
+QString IO::toBrickLinkUpdateXML(const LotList &lots,
+                                 const std::function<const Lot *(const Lot *)> &differenceBaseLot)
+{
+    bool doubleEscapedComments = core()->isApiQuirkActive(ApiQuirk::InventoryCommentsAreDoubleEscaped);
+    bool doubleEscapedRemarks = core()->isApiQuirkActive(ApiQuirk::InventoryRemarksAreDoubleEscaped);
+
+    return toXMLString([&](QIODevice *device) {
+        writeXMLChunked(device, lots, [&](QXmlStreamWriter &xml, const Lot *lot) {
+            writeBrickLinkUpdateXMLItem(xml, lot, differenceBaseLot(lot), doubleEscapedComments,
+                                        doubleEscapedRemarks);
+        });
+    });
 }
 
 IO::ParseResult::ParseResult(const LotList &lots)
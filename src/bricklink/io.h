@@ -3,12 +3,16 @@
 
 #pragma once
 
+#include <functional>
+
 #include <QtCore/QString>
 #include <QtCore/QHash>
 
 #include "bricklink/global.h"
 #include "bricklink/lot.h"
 
+QT_FORWARD_DECLARE_CLASS(QIODevice)
+
 namespace BrickLink::IO {
 
 class ParseResult
@@ -62,6 +66,8 @@ enum class Hint {
 };
 
 QString toBrickLinkXML(const LotList &lots);
+// streams the XML in UTF-8 directly to the device, throws an Exception on write errors
+void writeBrickLinkXML(QIODevice *device, const LotList &lots);
 ParseResult fromBrickLinkXML(const QByteArray &xml, Hint hint, const QDateTime &creationTime = { });
 
 ParseResult fromPartInventory(const Item *item, const Color *color = nullptr, int quantity = 1,
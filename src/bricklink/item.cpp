@@ -1,6 +1,8 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <QtCore/QSet>
+
 #include "bricklink/item.h"
 #include "bricklink/core.h"
 
@@ -11,28 +13,90 @@ AppearsIn Item::appearsIn(const Color *onlyColor) const
 {
     AppearsIn appearsHash;
 
-    for (auto it = m_appears_in.cbegin(); it != m_appears_in.cend(); ) {
-        // 1st level (color header)
-        quint32 vectorSize = it->m_colorBits.m_colorSize;
-        const Color *color = &core()->colors()[it->m_colorBits.m_colorIndex];
+    for (const auto &[color, item, quantity] : appearsInRange(onlyColor))
+        appearsHash[color].append(qMakePair(quantity, item)); // clazy:exclude=reserve-candidates
+    return appearsHash;
+}
 
-        ++it;
+Item::AppearsInRange Item::appearsInRange(const Color *color) const
+{
+    return { m_appears_in.cbegin(), m_appears_in.cend(), color };
+}
 
-        if (!onlyColor || (color == onlyColor)) {
-            AppearsInColor &vec = appearsHash[color];
+Item::AppearsInRange::const_iterator::const_iterator(const AppearsInRecord *pos,
+                                                     const AppearsInRecord *end, const Color *onlyColor)
+    : m_pos(pos)
+    , m_end(end)
+    , m_onlyColor(onlyColor)
+{
+    settle();
+}
 
-            for (quint32 i = 0; i < vectorSize; ++i, ++it) {
-                // 2nd level (color entry)
-                const Item *item = &core()->items()[it->m_itemBits.m_itemIndex];
+// moves forward to the next item record with a non-zero quantity (or the end)
+void Item::AppearsInRange::const_iterator::settle()
+{
+    while (m_pos != m_end) {
+        if (!m_remaining) {
+            // 1st level (color header)
+            m_remaining = m_pos->m_colorBits.m_colorSize;
+            m_color = &core()->colors()[m_pos->m_colorBits.m_colorIndex];
+            ++m_pos;
 
-                if (quint32 qty = it->m_itemBits.m_quantity)
-                    vec.append(qMakePair(qty, item)); // clazy:exclude=reserve-candidates
+            if (m_onlyColor && (m_color != m_onlyColor)) {
+                m_pos += m_remaining; // skip 2nd level
+                m_remaining = 0;
             }
+        } else if (m_pos->m_itemBits.m_quantity) {
+            return;
         } else {
-            it += vectorSize; // skip 2nd level
+            ++m_pos;
+            --m_remaining;
         }
     }
-    return appearsHash;
+}
+
+Item::AppearsInRange::Entry Item::AppearsInRange::const_iterator::operator*() const
+{
+    // 2nd level (color entry)
+    return { m_color, &core()->items()[m_pos->m_itemBits.m_itemIndex],
+             int(m_pos->m_itemBits.m_quantity) };
+}
+
+QVector<Item::AppearsInMatch> Item::appearsInUnion(const QVector<std::pair<const Item *, const Color *>> &parts,
+                                                   qsizetype *uniquePartCount)
+{
+    QVector<AppearsInMatch> result;
+    QHash<const Item *, qsizetype> index;
+    QVector<qsizetype> lastPart; // parallel to result: the last part that was counted
+    QSet<std::pair<const Item *, const Color *>> seen;
+    qsizetype partIndex = 0;
+
+    for (const auto &part : parts) {
+        if (!part.first || seen.contains(part))
+            continue;
+        seen.insert(part);
+
+        for (const auto &[color, item, quantity] : part.first->appearsInRange(part.second)) {
+            auto it = index.constFind(item);
+            if (it == index.cend()) {
+                index.insert(item, result.size());
+                result.append({ item, 1, quantity });
+                lastPart.append(partIndex);
+            } else {
+                auto &match = result[*it];
+                match.quantity += quantity;
+                // with a null color, the part can appear more than once in the same item
+                if (lastPart.at(*it) != partIndex) {
+                    lastPart[*it] = partIndex;
+                    ++match.matchCount;
+                }
+            }
+        }
+        ++partIndex;
+    }
+    if (uniquePartCount)
+        *uniquePartCount = partIndex;
+    return result;
 }
 
 std::span<const Item::ConsistsOf, std::dynamic_extent> Item::consistsOf() const
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <iterator>
 #include <span>
 
 #include <QtCore/QMetaType>
@@ -48,6 +49,82 @@ public:
 
     AppearsIn appearsIn(const Color *color = nullptr) const;
 
+private:
+    union AppearsInRecord;
+
+public:
+    // A view on the packed appears-in records, which does not allocate anything: iterating over
+    // it yields all the sets this item appears in, optionally restricted to a single color.
+    class AppearsInRange
+    {
+    public:
+        struct Entry
+        {
+            const Color *color;
+            const Item *item;
+            int quantity;
+        };
+
+        class const_iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Entry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = Entry;
+
+            const_iterator() = default;
+
+            Entry operator*() const;
+            const_iterator &operator++()  { ++m_pos; --m_remaining; settle(); return *this; }
+            const_iterator operator++(int)  { auto it = *this; ++*this; return it; }
+            bool operator==(const const_iterator &other) const  { return m_pos == other.m_pos; }
+
+        private:
+            const_iterator(const AppearsInRecord *pos, const AppearsInRecord *end, const Color *onlyColor);
+            void settle();
+
+            const AppearsInRecord *m_pos = nullptr;
+            const AppearsInRecord *m_end = nullptr;
+            quint32 m_remaining = 0; // item records left in the current color block
+            const Color *m_color = nullptr;
+            const Color *m_onlyColor = nullptr;
+
+            friend class AppearsInRange;
+        };
+
+        const_iterator begin() const  { return { m_begin, m_end, m_onlyColor }; }
+        const_iterator end() const    { return { m_end, m_end, m_onlyColor }; }
+        bool isEmpty() const          { return begin() == end(); }
+
+    private:
+        AppearsInRange(const AppearsInRecord *begin, const AppearsInRecord *end, const Color *onlyColor)
+            : m_begin(begin), m_end(end), m_onlyColor(onlyColor)
+        { }
+
+        const AppearsInRecord *m_begin;
+        const AppearsInRecord *m_end;
+        const Color *m_onlyColor;
+
+        friend class Item;
+    };
+
+    AppearsInRange appearsInRange(const Color *color = nullptr) const;
+
+    struct AppearsInMatch
+    {
+        const Item *item;
+        int matchCount;  // how many of the queried parts appear in this item
+        int quantity;    // the summed up quantity of all the queried parts
+    };
+
+    // The union of the appears-in lists of all the given parts, in one pass over the packed data.
+    // Duplicate parts are ignored and a null color matches all colors. The items that contain all
+    // the parts (the intersection) are the ones with a matchCount equal to the number of parts.
+    static QVector<AppearsInMatch> appearsInUnion(const QVector<std::pair<const Item *, const Color *>> &parts,
+                                                  qsizetype *uniquePartCount = nullptr);
+
     class ConsistsOf {
     public:
         const Item *item() const;
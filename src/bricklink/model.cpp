@@ -5,8 +5,8 @@
 #include <QtCore/QStringBuilder>
 #include <QtCore/QThreadStorage>
 #include <QtCore/QRegularExpression>
-#include <QtCore/QBitArray>
 #include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtGui/QGuiApplication>
 #include <QtGui/QFontMetrics>
 #include <QtGui/QPixmap>
@@ -936,6 +936,43 @@ InternalInventoryModel::InternalInventoryModel(Mode mode, const QVector<SimpleLo
         case Mode::CanBuild:      fillCanBuild(list); break;
         case Mode::Relationships: fillRelationships(list); break;
     }
+    if (mode == Mode::CanBuild) {
+        // The engine, the entries and the lots point into the database: throw them away on a
+        // reset, but remember the lots by id, so that we can re-fill from the new database
+        connect(core()->database(), &Database::databaseAboutToBeReset, this, [this]() {
+            ++m_canBuildGeneration;
+            m_canBuildEngine.reset();
+            m_canBuildEnginePending = false;
+
+            m_canBuildLotIds.clear();
+            m_canBuildLotIds.reserve(m_canBuildLots.size());
+            for (const auto &lot : std::as_const(m_canBuildLots)) {
+                if (lot.m_item && lot.m_color) {
+                    m_canBuildLotIds.emplace_back(lot.m_item->itemTypeId(), lot.m_item->id(),
+                                                  lot.m_color->id(), lot.m_quantity);
+                }
+            }
+            m_canBuildLots.clear();
+
+            beginResetModel();
+            qDeleteAll(m_entries);
+            m_entries.clear();
+            endResetModel();
+        });
+        connect(core()->database(), &Database::databaseReset, this, [this]() {
+            QVector<SimpleLot> lots;
+            lots.reserve(m_canBuildLotIds.size());
+            for (const auto &[itemTypeId, itemId, colorId, quantity] : std::as_const(m_canBuildLotIds)) {
+                const auto *item = core()->item(itemTypeId, itemId);
+                const auto *color = core()->color(colorId);
+                if (item && color)
+                    lots.emplace_back(item, color, quantity);
+            }
+            m_canBuildLotIds.clear();
+            if (!lots.isEmpty())
+                fillCanBuild(lots);
+        });
+    }
     connect(core()->pictureCache(), &BrickLink::PictureCache::pictureUpdated,
             this, [this](Picture *pic) {
         if (!pic || !pic->item())
@@ -1000,125 +1037,77 @@ void InternalInventoryModel::fillConsistsOf(const QVector<SimpleLot> &list)
 
 void InternalInventoryModel::fillAppearsIn(const QVector<SimpleLot> &list)
 {
-    QSet<const BrickLink::Item *> listSet;
-    bool firstItem = true;
-    bool singleItem = (list.count() == 1);
-
-    for (const auto &p : list) {
-        if (!p.m_item)
-            continue;
-
-        // a set could have more than one instance of the same item in alternate sets
-        QSet<const BrickLink::Item *> itemSet;
-
-        const auto appearsvec = p.m_item->appearsIn(p.m_color);
-        for (const AppearsInColor &vec : appearsvec) {
-            for (const AppearsInItem &aii : vec) {
-                if (singleItem)
-                    m_entries.emplace_back(new Entry { aii.second, nullptr, aii.first });
-                else
-                    itemSet.insert(aii.second);
-            }
-        }
-        if (firstItem) {
-            firstItem = false;
-            listSet = itemSet;
-        } else {
-            listSet.intersect(itemSet);
+    if (list.count() == 1) {
+        const auto &p = list.constFirst();
+        if (p.m_item) {
+            for (const auto &[color, item, quantity] : p.m_item->appearsInRange(p.m_color))
+                m_entries.emplace_back(new Entry { item, nullptr, quantity });
         }
+        return;
     }
 
-    if (!listSet.isEmpty()) {
-        m_entries.resize(listSet.size());
-        std::transform(listSet.cbegin(), listSet.cend(), m_entries.begin(),
-                       [](const auto &i) { return new Entry { i, nullptr, -1 }; });
+    QVector<std::pair<const Item *, const Color *>> parts;
+    parts.reserve(list.size());
+    for (const auto &p : list)
+        parts.emplace_back(p.m_item, p.m_color);
+
+    // only the items that contain all the parts
+    qsizetype partCount = 0;
+    const auto matches = Item::appearsInUnion(parts, &partCount);
+    for (const auto &match : matches) {
+        if (partCount && (match.matchCount == partCount))
+            m_entries.emplace_back(new Entry { match.item, nullptr, -1 });
     }
 }
 
 void InternalInventoryModel::fillCanBuild(const QVector<SimpleLot> &lots)
 {
-    QVector<std::pair<quint32, qint32>> have;
-    have.reserve(lots.size());
-    for (const auto &lot : lots) {
-        if (!lot.m_item || !lot.m_color || lot.m_quantity <= 0)
-            continue;
+    // creating the first engine also builds the catalog-wide index, which takes a while
+    m_canBuildLots = lots;
+    m_canBuildEnginePending = true;
+
+    // the worker thread keeps the database alive, even if it is reset in the meantime
+    QtConcurrent::run([lots, contents = core()->database()->retainContents()]() {
+        auto engine = std::make_shared<CanBuildEngine>();
+        engine->setInventory(lots);
+        return engine;
+    }).then(this, [this, lots, generation = m_canBuildGeneration](std::shared_ptr<CanBuildEngine> engine) {
+        if (generation != m_canBuildGeneration)
+            return; // the database has been reset in the meantime
+        m_canBuildEnginePending = false;
+        m_canBuildEngine = std::make_unique<CanBuildEngine>(std::move(*engine));
+
+        // the lots might have been updated in the meantime
+        if (m_canBuildLots != lots)
+            m_canBuildEngine->setInventory(m_canBuildLots);
+        setCanBuildEntries();
+    });
+}
 
-        // squeeze the data as tightly as possible: this map/reduce is quite CPU intensive and
-        // comparing 32 bits instead of 128 for each check helps a lot (plus it also keeps more
-        // data in the cache, as each entry is only 64 bits instead of 192).
-        have.append({ (quint32(lot.m_color->index()) << 20) | quint32(lot.m_item->index()),
-                     lot.m_quantity });
+void InternalInventoryModel::updateCanBuild(const QVector<SimpleLot> &lots)
+{
+    if (m_canBuildEnginePending) {
+        m_canBuildLots = lots;
+    } else if (m_canBuildEngine) {
+        m_canBuildLots = lots;
+        m_canBuildEngine->setInventory(lots);
+        setCanBuildEntries();
+    } else {
+        fillCanBuild(lots);
     }
+}
 
-    static auto indexCompare = [](const std::pair<quint32, qint32> &a,
-            const std::pair<quint32, qint32> &b) -> bool {
-        return a.first < b.first;
-    };
-
-    // sort by colorindex | itemindex
-    std::sort(have.begin(), have.end(), indexCompare);
-
-    auto map = [=](const Item &set) -> const Item * {
-        bool matched = false;
-
-        if (set.hasInventory()) {
-            const auto inv = set.consistsOf();
-
-            // copy the have vector, as we need to modify it for counting down quantities
-            auto checkHave = have;
-
-            QBitArray alternatesMatched;
-
-            for (const auto &co : inv) {
-                if (co.isExtra() || co.isCounterPart())
-                    continue;
-
-                auto alternate = qsizetype(co.alternateId());
-                if (alternate) {
-                    if (alternatesMatched.size() < alternate)
-                        alternatesMatched.resize(alternate);
-                    else if (alternatesMatched.at(alternate - 1))
-                        continue;
-                }
-
-                quint32 index = (co.colorIndex() << 20) | co.itemIndex();
-                auto it = std::lower_bound(checkHave.begin(), checkHave.end(),
-                                           std::make_pair(index, 0), indexCompare);
-                if ((it != checkHave.end()) && (it->first == index)) {
-                    it->second -= co.quantity();
-                    if (it->second >= 0) {
-                        matched = true;
-                        if (alternate)
-                            alternatesMatched.setBit(alternate - 1);
-                        continue;
-                    }
-                }
-                if (!alternate) {
-                    matched = false;
-                    break;
-                }
-            }
-
-            // if we had alternatives, make sure all of them matched up
-            if (matched && !alternatesMatched.isEmpty())
-                matched = (alternatesMatched.count(true) == alternatesMatched.count());
-        }
-        return matched ? &set : nullptr;
-    };
-
-    const auto &sets = core()->items();
-    QtConcurrent::mapped(sets.cbegin(), sets.cend(), map)
-            .then(this, [this](QFuture<const BrickLink::Item *> future) {
-        if (!m_entries.isEmpty() || (m_mode != Mode::CanBuild))
-            return;
+void InternalInventoryModel::setCanBuildEntries()
+{
+    const auto sets = m_canBuildEngine->sets();
 
-        beginResetModel();
-        for (const auto *match : std::as_const(future)) {
-            if (match)
-                m_entries.emplace_back(new Entry { match, nullptr, -1 });
-        }
-        endResetModel();
-    });
+    beginResetModel();
+    qDeleteAll(m_entries);
+    m_entries.clear();
+    m_entries.reserve(sets.size());
+    for (const auto &[set, fraction] : sets)
+        m_entries.emplace_back(new Entry { set, nullptr, -1 });
+    endResetModel();
 }
 
 void InternalInventoryModel::fillRelationships(const QVector<SimpleLot> &lots)
@@ -1307,6 +1296,18 @@ InventoryModel::InventoryModel(Mode mode, const QVector<SimpleLot> &simpleLots,
             this, [this]() { emit countChanged(count()); });
 }
 
+void InventoryModel::setSimpleLots(const QVector<SimpleLot> &simpleLots)
+{
+    auto *iim = static_cast<InternalInventoryModel *>(sourceModel());
+    if (iim->m_mode == Mode::CanBuild) {
+        iim->updateCanBuild(simpleLots);
+    } else {
+        setSourceModel(new InternalInventoryModel(iim->m_mode, simpleLots, this));
+        delete iim;
+        emit countChanged(count());
+    }
+}
+
 int InventoryModel::count() const
 {
     return rowCount();
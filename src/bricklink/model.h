@@ -272,6 +272,9 @@ public:
 
     InventoryModel(Mode mode, const QVector<SimpleLot> &simpleLots, QObject *parent);
 
+    // in CanBuild mode, only the differences to the previous lots are evaluated
+    void setSimpleLots(const QVector<SimpleLot> &simpleLots);
+
     int count() const;
     Q_SIGNAL void countChanged(int newCount);
     bool hasSections() const;
@@ -3,8 +3,12 @@
 
 #pragma once
 
+#include <memory>
+#include <tuple>
+
 #include <QAbstractItemModel>
 
+#include "bricklink/canbuild.h"
 #include "bricklink/item.h"
 #include "bricklink/model.h"
 
@@ -61,9 +65,19 @@ protected:
     void fillCanBuild(const QVector<SimpleLot> &lots);
     void fillRelationships(const QVector<SimpleLot> &lots);
 
+    void updateCanBuild(const QVector<SimpleLot> &lots);
+    void setCanBuildEntries();
+
     QVector<Entry *> m_entries;
     Mode m_mode;
 
+    std::unique_ptr<CanBuildEngine> m_canBuildEngine;
+    bool m_canBuildEnginePending = false;
+    quint64 m_canBuildGeneration = 0;  // incremented on every database reset
+    QVector<SimpleLot> m_canBuildLots; // the latest lots
+    // the latest lots by id (type, item, color, quantity), while the database is being reset
+    QVector<std::tuple<char, QByteArray, uint, int>> m_canBuildLotIds;
+
     friend class InventoryModel;
 private:
     Q_DISABLE_COPY_MOVE(InternalInventoryModel)
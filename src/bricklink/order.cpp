@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <array>
+#include <cstring>
 
 #include <QBuffer>
 #include <QSaveFile>
@@ -16,6 +17,11 @@
 #include <QtSql/QSqlError>
 #include <QtSql/QSqlQueryModel>
 #include <QtCore/QLoggingCategory>
+#include <QtConcurrent>
+#include <QDataStream>
+
+#include <QCoro/QCoroFuture>
+#include <QCoro/QCoroSignal>
 
 #include "bricklink/core.h"
 #include "bricklink/io.h"
@@ -683,7 +689,7 @@ Orders::Orders(Core *core)
             QString message;
 
             if (jobCompleted) { // if there are no matching orders, we get an error reply back...
-                QHash<Order *, QString> orders;
+                QHash<Order *, QByteArray> orders;
 
                 d->m_db.transaction();
 
@@ -692,7 +698,7 @@ Orders::Orders(Core *core)
 
                     for (auto it = orders.cbegin(); it != orders.cend(); ++it) {
                         Order *order = it.key();
-                        QByteArray orderXml = it.value().toUtf8();
+                        const QByteArray &orderXml = it.value();
 
                         if (order->id().isEmpty() || !order->date().isValid())
                             throw Exception("Invalid order without ID and DATE");
@@ -761,6 +767,9 @@ Orders::Orders(Core *core)
                 setUpdateStatus(overallSuccess ? UpdateStatus::Ok : UpdateStatus::UpdateFailed);
 
                 if (overallSuccess) {
+                    // keep the aggregation index current, so that queries don't have to wait for it
+                    updateLotIndex();
+
                     d->m_lastUpdated = QDateTime::currentDateTime();
                     d->m_saveUpdatedQuery.bindValue(u":updated"_qs, d->m_lastUpdated.toMSecsSinceEpoch());
 
@@ -794,6 +803,7 @@ void Orders::reloadOrdersFromDatabase(const QString &userId)
     emit countChanged(0);
 
     d->m_userId = userId;
+    ++d->m_dbGeneration;
 
     if (d->m_db.isOpen())
         d->m_db.close();
@@ -859,12 +869,66 @@ void Orders::reloadOrdersFromDatabase(const QString &userId)
                 "address TEXT,"
                 "phone TEXT,"
                 "orderDataFormat INTEGER," // enum OrderDataFormat
-                "orderData BLOB NOT NULL"
+                "orderData BLOB NOT NULL,"
+                "orderLots BLOB,"          // binary Lot::save() stream, NULL if not cached yet
+                "lotsIndexed INTEGER NOT NULL DEFAULT 0" // 1 if the 'lots' table is up-to-date
                 ") WITHOUT ROWID;"))) {
             qCWarning(LogSql) << "Failed to create the 'orders' table in the orders database:"
                               << createOrdersQuery.lastError().text();
             d->m_db.close();
         }
+    }
+
+    static constexpr int DBVersion = 3;
+
+    if (d->m_db.isOpen()) {
+        QSqlQuery uvQuery(u"PRAGMA user_version;"_qs, d->m_db);
+        uvQuery.next();
+        auto userVersion = uvQuery.value(0).toInt();
+        uvQuery.finish();
+
+        const std::array<QString, DBVersion - 1> upgradeSteps = {
+            u"ALTER TABLE orders ADD COLUMN orderLots BLOB;"_qs,                            // 1 -> 2
+            u"ALTER TABLE orders ADD COLUMN lotsIndexed INTEGER NOT NULL DEFAULT 0;"_qs,    // 2 -> 3
+        };
+
+        // a brand new file (version 0) already has the current schema
+        for (int v = std::max(1, userVersion); d->m_db.isOpen() && (v < DBVersion); ++v) {
+            QSqlQuery upgradeQuery(d->m_db);
+            if (!upgradeQuery.exec(upgradeSteps.at(size_t(v - 1)))) {
+                qCWarning(LogSql) << "Failed to upgrade the orders database to version" << (v + 1) << ":"
+                                  << upgradeQuery.lastError().text();
+                d->m_db.close();
+            }
+        }
+        if (d->m_db.isOpen() && (userVersion < DBVersion))
+            QSqlQuery(u"PRAGMA user_version=%1;"_qs.arg(DBVersion), d->m_db);
+    }
+
+    if (d->m_db.isOpen()) {
+        // the normalized per-lot index used for the aggregation queries
+        QSqlQuery createLotsQuery(d->m_db);
+        if (!createLotsQuery.exec(QStringLiteral(
+                "CREATE TABLE IF NOT EXISTS lots ("
+                "orderId TEXT NOT NULL,"
+                "itemTypeId INTEGER NOT NULL,"
+                "itemId TEXT NOT NULL,"
+                "colorId INTEGER NOT NULL,"
+                "condition INTEGER NOT NULL,"  // Condition
+                "quantity INTEGER NOT NULL,"
+                "price REAL NOT NULL"          // per unit, in the order's currency
+                ");"))
+            || !createLotsQuery.exec(QStringLiteral(
+                "CREATE INDEX IF NOT EXISTS lots_orderId ON lots(orderId);"))
+            || !createLotsQuery.exec(QStringLiteral(
+                "CREATE INDEX IF NOT EXISTS lots_item ON lots(itemTypeId,itemId,colorId);"))) {
+            qCWarning(LogSql) << "Failed to create the 'lots' table in the orders database:"
+                              << createLotsQuery.lastError().text();
+            d->m_db.close();
+        }
+    }
+
+    if (d->m_db.isOpen()) {
 
         d->m_importQuery = QSqlQuery(d->m_db);
         if (!d->m_importQuery.prepare(QStringLiteral(
@@ -882,7 +946,7 @@ void Orders::reloadOrdersFromDatabase(const QString &userId)
 
         d->m_loadXmlQuery = QSqlQuery(d->m_db);
         if (!d->m_loadXmlQuery.prepare(QStringLiteral(
-                "SELECT orderDataFormat,orderData"
+                "SELECT orderDataFormat,orderData,orderLots"
                 " FROM orders WHERE id=:id;"))) {
             qCWarning(LogSql) << "Failed to prepare load xml query for the orders database:" << d->m_loadXmlQuery.lastError().text();
         }
@@ -897,7 +961,7 @@ void Orders::reloadOrdersFromDatabase(const QString &userId)
                 "INSERT INTO orders(id,type,otherParty,date,lastUpdated,shipping,insurance,additionalCharges1,additionalCharges2,credit,creditCoupon,orderTotal,usSalesTax,vatChargeBrickLink,currencyCode,grandTotal,paymentCurrencyCode,lotCount,itemCount,cost,status,paymentType,remarks,trackingNumber,paymentStatus,paymentLastUpdated,vatChargeSeller,countryCode,orderDataFormat,orderData)"
                 " VALUES(:id,:type,:otherParty,:date,:lastUpdated,:shipping,:insurance,:additionalCharges1,:additionalCharges2,:credit,:creditCoupon,:orderTotal,:usSalesTax,:vatChargeBrickLink,:currencyCode,:grandTotal,:paymentCurrencyCode,:lotCount,:itemCount,:cost,:status,:paymentType,:remarks,:trackingNumber,:paymentStatus,:paymentLastUpdated,:vatChargeSeller,:countryCode,:orderDataFormat,:orderData)"
                 " ON CONFLICT(id) DO UPDATE"
-                " SET type=excluded.type,otherParty=excluded.otherParty,date=excluded.date,lastUpdated=excluded.lastUpdated,shipping=excluded.shipping,insurance=excluded.insurance,additionalCharges1=excluded.additionalCharges1,additionalCharges2=excluded.additionalCharges2,credit=excluded.credit,creditCoupon=excluded.creditCoupon,orderTotal=excluded.orderTotal,usSalesTax=excluded.usSalesTax,vatChargeBrickLink=excluded.vatChargeBrickLink,currencyCode=excluded.currencyCode,grandTotal=excluded.grandTotal,paymentCurrencyCode=excluded.paymentCurrencyCode,lotCount=excluded.lotCount,itemCount=excluded.itemCount,cost=excluded.cost,status=excluded.status,paymentType=excluded.paymentType,remarks=excluded.remarks,trackingNumber=excluded.trackingNumber,paymentStatus=excluded.paymentStatus,paymentLastUpdated=excluded.paymentLastUpdated,vatChargeSeller=excluded.vatChargeSeller,countryCode=excluded.countryCode,orderDataFormat=excluded.orderDataFormat,orderData=excluded.orderData;"))) {
+                " SET type=excluded.type,otherParty=excluded.otherParty,date=excluded.date,lastUpdated=excluded.lastUpdated,shipping=excluded.shipping,insurance=excluded.insurance,additionalCharges1=excluded.additionalCharges1,additionalCharges2=excluded.additionalCharges2,credit=excluded.credit,creditCoupon=excluded.creditCoupon,orderTotal=excluded.orderTotal,usSalesTax=excluded.usSalesTax,vatChargeBrickLink=excluded.vatChargeBrickLink,currencyCode=excluded.currencyCode,grandTotal=excluded.grandTotal,paymentCurrencyCode=excluded.paymentCurrencyCode,lotCount=excluded.lotCount,itemCount=excluded.itemCount,cost=excluded.cost,status=excluded.status,paymentType=excluded.paymentType,remarks=excluded.remarks,trackingNumber=excluded.trackingNumber,paymentStatus=excluded.paymentStatus,paymentLastUpdated=excluded.paymentLastUpdated,vatChargeSeller=excluded.vatChargeSeller,countryCode=excluded.countryCode,orderDataFormat=excluded.orderDataFormat,orderData=excluded.orderData,orderLots=NULL,lotsIndexed=0;"))) {
             qCWarning(LogSql) << "Failed to prepare save order query for the orders database:" << d->m_saveOrderQuery.lastError().text();
         }
 
@@ -908,33 +972,45 @@ void Orders::reloadOrdersFromDatabase(const QString &userId)
                 " SET updated=excluded.updated;"))) {
             qCWarning(LogSql) << "Failed to prepare save update query for the orders database:" << d->m_saveUpdatedQuery.lastError().text();
         }
+
+        d->m_saveLotsQuery = QSqlQuery(d->m_db);
+        if (!d->m_saveLotsQuery.prepare(QStringLiteral(
+                "UPDATE orders SET orderLots=:orderLots WHERE id=:id;"))) {
+            qCWarning(LogSql) << "Failed to prepare save lots query for the orders database:" << d->m_saveLotsQuery.lastError().text();
+        }
+
+        d->m_deleteLotIndexQuery = QSqlQuery(d->m_db);
+        if (!d->m_deleteLotIndexQuery.prepare(QStringLiteral(
+                "DELETE FROM lots WHERE orderId=:id;"))) {
+            qCWarning(LogSql) << "Failed to prepare delete lot index query for the orders database:" << d->m_deleteLotIndexQuery.lastError().text();
+        }
+        d->m_insertLotIndexQuery = QSqlQuery(d->m_db);
+        if (!d->m_insertLotIndexQuery.prepare(QStringLiteral(
+                "INSERT INTO lots(orderId,itemTypeId,itemId,colorId,condition,quantity,price)"
+                " VALUES(:id,:itemTypeId,:itemId,:colorId,:condition,:quantity,:price);"))) {
+            qCWarning(LogSql) << "Failed to prepare insert lot index query for the orders database:" << d->m_insertLotIndexQuery.lastError().text();
+        }
+        d->m_markLotsIndexedQuery = QSqlQuery(d->m_db);
+        if (!d->m_markLotsIndexedQuery.prepare(QStringLiteral(
+                "UPDATE orders SET lotsIndexed=1 WHERE id=:id;"))) {
+            qCWarning(LogSql) << "Failed to prepare mark indexed query for the orders database:" << d->m_markLotsIndexedQuery.lastError().text();
+        }
     }
 
     QDateTime lastUpdated;
 
     if (d->m_db.isOpen()) {
-        static constexpr int DBVersion = 1;
-
         {
             QSqlQuery jnlQuery(u"PRAGMA journal_mode = wal;"_qs, d->m_db);
             if (jnlQuery.lastError().isValid())
                 qCWarning(LogSql) << "Failed to set journaling mode to 'wal' on the orders database:"
                                   << jnlQuery.lastError();
         }
-        {
-            QSqlQuery uvQuery(u"PRAGMA user_version;"_qs, d->m_db);
-            uvQuery.next();
-            auto userVersion = uvQuery.value(0).toInt();
-            if (userVersion == 0) // brand new file, bump version
-                QSqlQuery(u"PRAGMA user_version=%1;"_qs.arg(DBVersion), d->m_db);
-        }
         {
             QSqlQuery updatedQuery(u"SELECT updated FROM status WHERE id=0;"_qs, d->m_db);
             if (updatedQuery.next())
                 lastUpdated = QDateTime::fromMSecsSinceEpoch(updatedQuery.value(0).toLongLong());
         }
-
-        // DB schema upgrade code goes here...
     }
 
     setUpdateStatus(lastUpdated.isValid() ? UpdateStatus::Ok : UpdateStatus::UpdateFailed);
@@ -993,6 +1069,10 @@ void Orders::reloadOrdersFromDatabase(const QString &userId)
         qCWarning(LogSql) << "Failed to read orders from database:" << d->m_loadOrdersQuery.lastError().text();
     }
     d->m_loadOrdersQuery.finish();
+
+    // an upgraded database has to index all of its orders once: do that in the background
+    // right away, instead of on the first query
+    updateLotIndex();
 }
 
 void Orders::importOldCache(const QString &userId)
@@ -1022,7 +1102,7 @@ void Orders::importOldCache(const QString &userId)
             if (orders.size() != 1)
                 throw Exception("Order XML does not contain exactly one order: %1").arg(f.fileName());
             std::unique_ptr<Order> order { orders.cbegin().key() };
-            const QString xml = orders.cbegin().value();
+            const QByteArray xml = orders.cbegin().value();
             order->moveToThread(this->thread());
 
             QDir dir = dit.fileInfo().absoluteDir();
@@ -1067,7 +1147,7 @@ void Orders::importOldCache(const QString &userId)
             d->m_importQuery.bindValue(u":vatChargeSeller"_qs, order->vatChargeSeller());
             d->m_importQuery.bindValue(u":countryCode"_qs, order->countryCode());
             d->m_importQuery.bindValue(u":orderDataFormat"_qs, int(OrdersPrivate::Format_CompressedXML));
-            d->m_importQuery.bindValue(u":orderData"_qs, qCompress(xml.toUtf8()));
+            d->m_importQuery.bindValue(u":orderData"_qs, qCompress(xml));
             d->m_importQuery.bindValue(u":address"_qs, order->address());
             d->m_importQuery.bindValue(u":phone"_qs, order->phone());
 
@@ -1089,40 +1169,129 @@ void Orders::importOldCache(const QString &userId)
     importedFile.close();
 }
 
-QHash<Order *, QString> Orders::parseOrdersXML(const QByteArray &data_)
+OrderXmlSanitizeFilter::OrderXmlSanitizeFilter(QIODevice *target, QObject *parent)
+    : QIODevice(parent)
+    , m_target(target)
+{
+    m_pending.reserve(MaxEntityLookAhead + 1);
+}
+
+bool OrderXmlSanitizeFilter::open(OpenMode mode)
+{
+    if (mode & ReadOnly)
+        return false;
+
+    bool targetOk = m_target->isOpen() ? (m_target->openMode() == mode)
+                                       : m_target->open(mode);
+    if (targetOk) {
+        setOpenMode(mode);
+        m_pending.clear();
+    }
+    return targetOk;
+}
+
+void OrderXmlSanitizeFilter::close()
+{
+    if (!m_pending.isEmpty())
+        flushPending(true); // an '&' right at the end of the data can never be an entity
+
+    m_target->close();
+    setOpenMode(NotOpen);
+}
+
+bool OrderXmlSanitizeFilter::isSequential() const
 {
-    QString data; // otherwise characterOffset doesn't match
+    return true;
+}
+
+qint64 OrderXmlSanitizeFilter::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data)
+    Q_UNUSED(maxSize)
+    Q_ASSERT(false);
+    setErrorString(u"Reading not supported"_qs);
+    return -1;
+}
+
+qint64 OrderXmlSanitizeFilter::writeData(const char *data, qint64 maxSize)
+{
+    const char *p = data;
+    const char *end = data + maxSize;
+
+    while (p < end) {
+        if (!m_pending.isEmpty()) {
+            const char c = *p;
+
+            if (c == ';') {
+                m_pending.append(c);
+                ++p;
+                if (!flushPending(false))
+                    return -1;
+            } else if ((c == '<') || (c == '>') || (c == '&')) {
+                // not an entity: don't consume c, it gets handled in the next iteration
+                if (!flushPending(true))
+                    return -1;
+            } else {
+                m_pending.append(c);
+                ++p;
+                if ((m_pending.size() > MaxEntityLookAhead) && !flushPending(true))
+                    return -1;
+            }
+        } else {
+            const auto *amp = static_cast<const char *>(std::memchr(p, '&', size_t(end - p)));
+            const char *runEnd = amp ? amp : end;
+
+            if ((runEnd > p) && !writeTarget(p, runEnd - p))
+                return -1;
+            p = runEnd;
+            if (amp) {
+                m_pending.append('&');
+                ++p;
+            }
+        }
+    }
+    return maxSize;
+}
+
+bool OrderXmlSanitizeFilter::writeTarget(const char *data, qint64 size)
+{
+    if (m_target->write(data, size) != size) {
+        setErrorString(m_target->errorString());
+        return false;
+    }
+    return true;
+}
+
+bool OrderXmlSanitizeFilter::flushPending(bool escape)
+{
+    bool ok = escape ? (writeTarget("&amp;", 5) && writeTarget(m_pending.constData() + 1, m_pending.size() - 1))
+                     : writeTarget(m_pending.constData(), m_pending.size());
+    m_pending.clear();
+    return ok;
+}
+
+QHash<Order *, QByteArray> Orders::parseOrdersXML(const QByteArray &data_)
+{
+    QByteArray data;
 
     // BrickLink quirk: a few of the fields can contain unescaped '&' characters
     // we try to fix this by finding all '&' that are not followed by a ';' within 6 characters.
     if (core()->isApiQuirkActive(ApiQuirk::OrderXmlHasUnescapedFields)) {
-        QByteArray fixed(data_);
-        qsizetype pos = 0;
-        while (pos >= 0) {
-            pos = fixed.indexOf('&', pos);
-            if (pos >= 0) {
-                bool doReplace = true;
-                for (qsizetype i = 0; i < 6; ++i) {
-                    const char c = fixed.at(pos + i + 1);
-                    if (c == ';') {
-                        doReplace = false;
-                        break;
-                    } else if (c == '<' || c == '>' || c == '&') {
-                        break;
-                    }
-                }
-                if (doReplace)
-                    fixed.replace(pos, 1, "&amp;");
-                ++pos;
-            }
-        }
-        data = QString::fromUtf8(fixed);
+        data.reserve(data_.size() + data_.size() / 64);
+        QBuffer buffer(&data);
+        OrderXmlSanitizeFilter sanitizer(&buffer);
+        if (!sanitizer.open(QIODevice::WriteOnly) || (sanitizer.write(data_) != data_.size()))
+            throw Exception("Failed to sanitize order XML: %1").arg(sanitizer.errorString());
+        sanitizer.close();
     } else {
-        data = QString::fromUtf8(data_);
+        data = data_;
     }
+    // the byte offsets below are relative to the XML data, so a BOM would be in the way
+    if (data.startsWith("\xef\xbb\xbf"))
+        data.remove(0, 3);
     QXmlStreamReader xml(data);
 
-    QHash<Order *, QString> result;
+    QHash<Order *, QByteArray> result;
     std::unique_ptr<Order> order;
 
     QHash<QStringView, std::function<void(Order *, const QString &)>> rootTagHash;
@@ -1157,7 +1326,28 @@ QHash<Order *, QString> Orders::parseOrdersXML(const QByteArray &data_)
     rootTagHash.insert(u"LOCATION",          [](auto *o, auto &v) { if (!v.isEmpty()) o->setCountryCode(BrickLink::core()->countryIdFromName(v.section(u", "_qs, 0, 0))); } );
 
     try {
-        int startOfOrder = -1;
+        // The per-order XML is cut out of the raw UTF-8 data at the positions the tokenizer
+        // reports for the ORDER start and end tags, so anything inside the elements' text (e.g.
+        // in the remarks) cannot split an order. QXmlStreamReader only reports offsets in UTF-16
+        // code units though: these are mapped to byte offsets by walking forward from the last
+        // mapped position, so this is still a single pass over the data.
+        qsizetype mappedChars = 0;
+        qsizetype mappedBytes = 0;
+        auto tagEndOffset = [&]() {
+            const qint64 charOffset = xml.characterOffset();
+            while ((mappedChars < charOffset) && (mappedBytes < data.size())) {
+                const auto c = uchar(data.at(mappedBytes));
+                const int len = (c < 0x80) ? 1 : ((c < 0xe0) ? 2 : ((c < 0xf0) ? 3 : 4));
+                mappedBytes += len;
+                mappedChars += (len == 4) ? 2 : 1; // a surrogate pair in UTF-16
+            }
+            if ((mappedChars != charOffset) || (mappedBytes <= 0) || (mappedBytes > data.size())
+                    || (data.at(mappedBytes - 1) != '>')) {
+                throw Exception("Could not map the ORDER tag to its position in the data");
+            }
+            return mappedBytes;
+        };
+        qsizetype startOfOrder = -1;
 
         while (true) {
             switch (xml.readNext()) {
@@ -1167,7 +1357,7 @@ QHash<Order *, QString> Orders::parseOrdersXML(const QByteArray &data_)
                 if (tagName == u"ORDER") {
                     if (order || startOfOrder >= 0)
                         throw Exception("Found a nested ORDER tag");
-                    startOfOrder = int(xml.characterOffset());
+                    startOfOrder = tagEndOffset();
                     order = std::make_unique<Order>();
 
                     QQmlEngine::setObjectOwnership(order.get(), QQmlEngine::CppOwnership);
@@ -1189,10 +1379,13 @@ QHash<Order *, QString> Orders::parseOrdersXML(const QByteArray &data_)
                 if (tagName == u"ORDER") {
                     if (!order || (startOfOrder < 0))
                         throw Exception("Found a ORDER end tag without a start tag");
-                    int endOfOrder = int(xml.characterOffset());
-                    QString header = u"<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n<ORDER>\n"_qs;
-                    QString footer = u"\n"_qs;
-                    result.insert(order.release(), header + data.mid(startOfOrder, endOfOrder - startOfOrder + 1) + footer);
+                    qsizetype endOfOrder = tagEndOffset();
+
+                    static const QByteArray header = "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n<ORDER>\n";
+                    QByteArray orderXml;
+                    orderXml.reserve(header.size() + endOfOrder - startOfOrder + 1);
+                    orderXml.append(header).append(data.constData() + startOfOrder, endOfOrder - startOfOrder).append('\n');
+                    result.insert(order.release(), orderXml);
                     startOfOrder = -1;
                 }
                 break;
@@ -1442,31 +1635,411 @@ void Orders::cancelUpdate()
     std::for_each(d->m_addressJobs.cbegin(), d->m_addressJobs.cend(), [](auto job) { job->abort(); });
 }
 
-LotList Orders::loadOrderLots(const Order *order) const
+OrdersPrivate::OrderBlobs OrdersPrivate::loadOrderBlobs(const QString &orderId)
+{
+    m_loadXmlQuery.bindValue(u":id"_qs, orderId);
+
+    auto finishGuard = qScopeGuard([this]() { m_loadXmlQuery.finish(); });
+
+    m_loadXmlQuery.exec();
+    if (!m_loadXmlQuery.next())
+        throw Exception("could not find order %1 in database").arg(orderId);
+
+    OrderBlobs blobs;
+    blobs.id = orderId;
+    blobs.format = OrderDataFormat(m_loadXmlQuery.value(u"orderDataFormat"_qs).toInt());
+    blobs.data = m_loadXmlQuery.value(u"orderData"_qs).toByteArray();
+    blobs.lots = m_loadXmlQuery.value(u"orderLots"_qs).toByteArray();
+    return blobs;
+}
+
+void OrdersPrivate::saveOrderLots(const QString &orderId, const QByteArray &lots)
 {
-    d->m_loadXmlQuery.bindValue(u":id"_qs, order->id());
+    m_saveLotsQuery.bindValue(u":id"_qs, orderId);
+    m_saveLotsQuery.bindValue(u":orderLots"_qs, lots);
+
+    if (!m_saveLotsQuery.exec()) {
+        qCWarning(LogSql) << "Failed to save the binary lots of order" << orderId << ":"
+                          << m_saveLotsQuery.lastError().text();
+    }
+    m_saveLotsQuery.finish();
+}
+
+void OrdersPrivate::indexOrderLots(const QString &orderId, const LotList &lots)
+{
+    m_deleteLotIndexQuery.bindValue(u":id"_qs, orderId);
+    if (!m_deleteLotIndexQuery.exec())
+        throw Exception("SQL error: %1").arg(m_deleteLotIndexQuery.lastError().text());
+    m_deleteLotIndexQuery.finish();
+
+    for (const Lot *lot : lots) {
+        m_insertLotIndexQuery.bindValue(u":id"_qs, orderId);
+        m_insertLotIndexQuery.bindValue(u":itemTypeId"_qs, int(lot->itemTypeId()));
+        m_insertLotIndexQuery.bindValue(u":itemId"_qs, QString::fromLatin1(lot->itemId()));
+        m_insertLotIndexQuery.bindValue(u":colorId"_qs, lot->colorId());
+        m_insertLotIndexQuery.bindValue(u":condition"_qs, int(lot->condition()));
+        m_insertLotIndexQuery.bindValue(u":quantity"_qs, lot->quantity());
+        m_insertLotIndexQuery.bindValue(u":price"_qs, lot->price());
+        if (!m_insertLotIndexQuery.exec())
+            throw Exception("SQL error: %1").arg(m_insertLotIndexQuery.lastError().text());
+    }
+    m_insertLotIndexQuery.finish();
 
-    auto finishGuard = qScopeGuard([this]() { d->m_loadXmlQuery.finish(); });
+    m_markLotsIndexedQuery.bindValue(u":id"_qs, orderId);
+    if (!m_markLotsIndexedQuery.exec())
+        throw Exception("SQL error: %1").arg(m_markLotsIndexedQuery.lastError().text());
+    m_markLotsIndexedQuery.finish();
+}
 
-    d->m_loadXmlQuery.exec();
-    if (!d->m_loadXmlQuery.next())
-        throw Exception("could not find order %1 in database").arg(order->id());
+LotList OrdersPrivate::decodeOrderBlobs(const OrderBlobs &blobs, QByteArray *binaryLots)
+{
+    if (!blobs.lots.isEmpty()) {
+        try {
+            return decodeLots(blobs.lots);
+        } catch (const Exception &e) {
+            qCWarning(LogCache) << "Binary lots of order" << blobs.id << "are unusable, falling back to XML:"
+                                << e.errorString();
+        }
+    }
 
-    auto format = OrdersPrivate::OrderDataFormat(d->m_loadXmlQuery.value(u"orderDataFormat"_qs).toInt());
-    auto data = d->m_loadXmlQuery.value(u"orderData"_qs).toByteArray();
+    QByteArray data = blobs.data;
 
-    switch (format) {
-    case OrdersPrivate::Format_XML:
+    switch (blobs.format) {
+    case Format_XML:
         break;
-    case OrdersPrivate::Format_CompressedXML:
+    case Format_CompressedXML:
         data = qUncompress(data);
         break;
     default:
-        throw Exception("unknown data format (%1) for order").arg(int(format));
+        throw Exception("unknown data format (%1) for order").arg(int(blobs.format));
         break;
     }
     auto pr = IO::fromBrickLinkXML(data, IO::Hint::Order);
-    return pr.takeLots();
+    auto lots = pr.takeLots();
+
+    if (binaryLots)
+        *binaryLots = encodeLots(lots);
+    return lots;
+}
+
+// Binary lots are a qCompress'ed QDataStream: the changelog id of the database at the time
+// of writing (so that renamed items and colors can be fixed up later on), followed by the
+// Lot::save() records. Incomplete lots cannot be round-tripped that way, so orders containing
+// them are not cached in binary form at all.
+
+static const char *binaryLotsMagic = "BSOL";
+
+QByteArray OrdersPrivate::encodeLots(const LotList &lots)
+{
+    if (std::any_of(lots.cbegin(), lots.cend(), [](const Lot *lot) { return lot->isIncomplete(); }))
+        return { };
+
+    QByteArray ba;
+    QDataStream ds(&ba, QIODevice::WriteOnly);
+    ds << QByteArray(binaryLotsMagic) << qint32(1) // version
+       << core()->latestChangelogId() << qint32(lots.count());
+    for (const auto *lot : lots)
+        lot->save(ds);
+    return qCompress(ba, 1);
+}
+
+LotList OrdersPrivate::decodeLots(const QByteArray &binaryLots)
+{
+    QByteArray ba = qUncompress(binaryLots);
+    QDataStream ds(ba);
+    QByteArray magic;
+    qint32 version = 0;
+    uint startChangelogAt = 0;
+    qint32 count = 0;
+
+    ds >> magic >> version >> startChangelogAt >> count;
+    if ((ds.status() != QDataStream::Ok) || (magic != binaryLotsMagic) || (version != 1) || (count < 0))
+        throw Exception("invalid header");
+
+    // no need to apply any changelog entries, if the database didn't change in between
+    if (startChangelogAt == core()->latestChangelogId())
+        startChangelogAt = 0;
+
+    LotList lots;
+    lots.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        if (auto *lot = Lot::restore(ds, startChangelogAt)) {
+            lots << lot;
+        } else {
+            qDeleteAll(lots);
+            throw Exception("invalid lot record #%1").arg(i);
+        }
+    }
+    return lots;
+}
+
+LotList Orders::loadOrderLots(const Order *order) const
+{
+    auto blobs = d->loadOrderBlobs(order->id());
+    QByteArray binaryLots;
+    auto lots = OrdersPrivate::decodeOrderBlobs(blobs, &binaryLots);
+    if (!binaryLots.isEmpty())
+        d->saveOrderLots(blobs.id, binaryLots);
+    return lots;
+}
+
+void OrdersPrivate::LoadJob::decode()
+{
+    if (!valid)
+        return;
+    try {
+        lots = decodeOrderBlobs(blobs, &binaryLots);
+        decoded = true;
+    } catch (const Exception &e) {
+        qWarning() << "Orders::loadOrderLots() failed for order" << blobs.id << ":" << e.errorString();
+    }
+}
+
+QVector<LotList> Orders::loadOrderLots(const QVector<const Order *> &orders,
+                                       QVector<bool> *failed) const
+{
+    std::vector<OrdersPrivate::LoadJob> jobs(size_t(orders.size()));
+
+    // the database can only be accessed from this thread ...
+    for (qsizetype i = 0; i < orders.size(); ++i) {
+        try {
+            jobs[size_t(i)].blobs = d->loadOrderBlobs(orders.at(i)->id());
+            jobs[size_t(i)].valid = true;
+        } catch (const Exception &e) {
+            qWarning() << "Orders::loadOrderLots() failed:" << e.errorString();
+        }
+    }
+
+    // ... but decoding can be done in parallel
+    QtConcurrent::blockingMap(jobs, [](OrdersPrivate::LoadJob &job) { job.decode(); });
+
+    QVector<LotList> result;
+    result.reserve(orders.size());
+    if (failed) {
+        failed->clear();
+        failed->reserve(orders.size());
+    }
+
+    d->m_db.transaction();
+    for (auto &job : jobs) {
+        if (!job.binaryLots.isEmpty())
+            d->saveOrderLots(job.blobs.id, job.binaryLots);
+        result << job.lots;
+        if (failed)
+            *failed << !job.decoded;
+    }
+    d->m_db.commit();
+
+    return result;
+}
+
+QCoro::Task<> Orders::updateLotIndex()
+{
+    // only one update at a time: everybody else waits for it and then re-checks
+    while (d->m_lotIndexUpdating)
+        co_await qCoro(this, &Orders::lotIndexUpdated);
+
+    if (!d->m_db.isOpen())
+        co_return;
+
+    std::vector<OrdersPrivate::LoadJob> jobs;
+    {
+        QSqlQuery pendingQuery(u"SELECT id FROM orders WHERE lotsIndexed=0;"_qs, d->m_db);
+        while (pendingQuery.next()) {
+            OrdersPrivate::LoadJob job;
+            try {
+                job.blobs = d->loadOrderBlobs(pendingQuery.value(0).toString());
+                job.valid = true;
+            } catch (const Exception &e) {
+                qWarning() << "Orders::updateLotIndex() failed:" << e.errorString();
+            }
+            jobs.push_back(std::move(job));
+        }
+    }
+    if (jobs.empty())
+        co_return;
+
+    d->m_lotIndexUpdating = true;
+    const auto generation = d->m_dbGeneration;
+    stopwatch sw("Indexing order lots");
+
+    // decoding is by far the most expensive part, so it runs in parallel and off this thread
+    co_await QtConcurrent::map(jobs, [](OrdersPrivate::LoadJob &job) { job.decode(); });
+
+    // the database could have been switched to another user in the meantime
+    if ((generation == d->m_dbGeneration) && d->m_db.isOpen()) {
+        d->m_db.transaction();
+        try {
+            for (const auto &job : jobs) {
+                if (!job.binaryLots.isEmpty())
+                    d->saveOrderLots(job.blobs.id, job.binaryLots);
+                // lotsIndexed stays 0 for orders that failed to decode, so they are retried next time
+                if (job.decoded)
+                    d->indexOrderLots(job.blobs.id, job.lots);
+            }
+            d->m_db.commit();
+        } catch (const Exception &e) {
+            qCWarning(LogSql) << "Failed to index the order lots:" << e.errorString();
+            d->m_db.rollback();
+        }
+    }
+
+    for (const auto &job : jobs)
+        qDeleteAll(job.lots);
+
+    d->m_lotIndexUpdating = false;
+    emit lotIndexUpdated();
+}
+
+QCoro::Task<LotList> Orders::lotsSummary(OrderType type, QDate fromDate, QDate toDate,
+                                         QString currencyCode)
+{
+    co_await updateLotIndex();
+
+    QSqlQuery query(d->m_db);
+    query.prepare(QStringLiteral(
+        "SELECT l.itemTypeId,l.itemId,l.colorId,l.condition,o.currencyCode,"
+        "SUM(l.quantity),SUM(l.quantity*l.price)"
+        " FROM lots l JOIN orders o ON o.id=l.orderId"
+        " WHERE o.type=:type AND o.date>=:fromDate AND o.date<=:toDate AND o.status<>:cancelled"
+        " GROUP BY l.itemTypeId,l.itemId,l.colorId,l.condition,o.currencyCode;"));
+    query.bindValue(u":type"_qs, int(type));
+    query.bindValue(u":fromDate"_qs, fromDate.toJulianDay());
+    query.bindValue(u":toDate"_qs, toDate.toJulianDay());
+    query.bindValue(u":cancelled"_qs, int(OrderStatus::Cancelled));
+
+    if (!query.exec()) {
+        qCWarning(LogSql) << "Failed to aggregate the order lots:" << query.lastError().text();
+        co_return { };
+    }
+
+    // different currencies are merged on the C++ side
+    struct Sum {
+        char itemTypeId;
+        QByteArray itemId;
+        uint colorId;
+        int condition;
+        int quantity = 0;
+        double revenue = 0;
+    };
+    QHash<QByteArray, Sum> sums;
+
+    while (query.next()) {
+        const auto ccode = query.value(4).toString();
+        double crate = 1;
+        if (!currencyCode.isEmpty() && !ccode.isEmpty() && (ccode != currencyCode))
+            crate = Currency::inst()->crossRate(ccode, currencyCode);
+
+        const char itemTypeId = char(query.value(0).toInt());
+        const QByteArray itemId = query.value(1).toString().toLatin1();
+        const uint colorId = query.value(2).toUInt();
+        const int condition = query.value(3).toInt();
+        const QByteArray key = itemTypeId + itemId + '@' + QByteArray::number(colorId)
+                + '@' + QByteArray::number(condition);
+
+        auto it = sums.find(key);
+        if (it == sums.end())
+            it = sums.insert(key, { itemTypeId, itemId, colorId, condition });
+        it->quantity += query.value(5).toInt();
+        it->revenue += query.value(6).toDouble() * crate;
+    }
+
+    LotList result;
+    result.reserve(sums.size());
+    for (auto it = sums.cbegin(); it != sums.cend(); ++it) {
+        const auto &[itemTypeId, itemId, colorId, condition, quantity, revenue] = *it;
+        const Item *item = core()->item(itemTypeId, itemId);
+        const Color *color = core()->color(colorId);
+
+        auto *lot = new Lot(item, color);
+        if (!item || !color) {
+            auto *inc = new Incomplete;
+            if (!item) {
+                inc->m_item_id = itemId;
+                inc->m_itemtype_id = itemTypeId;
+            }
+            if (!color) {
+                inc->m_color_id = colorId;
+                inc->m_color_name = u"BL #"_qs + QString::number(colorId);
+            }
+            lot->setIncomplete(inc);
+        }
+        lot->setCondition(Condition(condition));
+        lot->setQuantity(quantity);
+        lot->setPrice(quantity ? (revenue / quantity) : 0);
+        result << lot;
+    }
+    co_return result;
+}
+
+QCoro::Task<QVector<Orders::TrendEntry>> Orders::lotsTrend(OrderType type, const Item *item,
+                                                           const Color *color, TrendInterval interval,
+                                                           QDate fromDate, QDate toDate,
+                                                           QString currencyCode)
+{
+    // the catalog could be reloaded while we wait for the index
+    const int itemTypeId = item ? int(item->itemTypeId()) : 0;
+    const QString itemId = item ? QString::fromLatin1(item->id()) : QString { };
+    const uint colorId = color ? color->id() : 0;
+
+    co_await updateLotIndex();
+
+    QString sql = QStringLiteral(
+        "SELECT o.date,o.currencyCode,SUM(l.quantity),SUM(l.quantity*l.price),COUNT(DISTINCT l.orderId)"
+        " FROM lots l JOIN orders o ON o.id=l.orderId"
+        " WHERE o.type=:type AND o.date>=:fromDate AND o.date<=:toDate AND o.status<>:cancelled");
+    if (item)
+        sql.append(u" AND l.itemTypeId=:itemTypeId AND l.itemId=:itemId");
+    if (color)
+        sql.append(u" AND l.colorId=:colorId");
+    sql.append(u" GROUP BY o.date,o.currencyCode ORDER BY o.date;");
+
+    QSqlQuery query(d->m_db);
+    query.prepare(sql);
+    query.bindValue(u":type"_qs, int(type));
+    query.bindValue(u":fromDate"_qs, fromDate.toJulianDay());
+    query.bindValue(u":toDate"_qs, toDate.toJulianDay());
+    query.bindValue(u":cancelled"_qs, int(OrderStatus::Cancelled));
+    if (item) {
+        query.bindValue(u":itemTypeId"_qs, itemTypeId);
+        query.bindValue(u":itemId"_qs, itemId);
+    }
+    if (color)
+        query.bindValue(u":colorId"_qs, colorId);
+
+    if (!query.exec()) {
+        qCWarning(LogSql) << "Failed to aggregate the order lots trend:" << query.lastError().text();
+        co_return { };
+    }
+
+    auto bucketStart = [interval](QDate date) {
+        switch (interval) {
+        case TrendInterval::Week:  return date.addDays(1 - date.dayOfWeek());
+        case TrendInterval::Month: return QDate(date.year(), date.month(), 1);
+        case TrendInterval::Year:  return QDate(date.year(), 1, 1);
+        default:
+        case TrendInterval::Day:   return date;
+        }
+    };
+
+    QVector<TrendEntry> result;
+
+    // the rows are sorted by date, so the buckets are filled in order
+    while (query.next()) {
+        const QDate start = bucketStart(QDate::fromJulianDay(query.value(0).toLongLong()));
+        const auto ccode = query.value(1).toString();
+        double crate = 1;
+        if (!currencyCode.isEmpty() && !ccode.isEmpty() && (ccode != currencyCode))
+            crate = Currency::inst()->crossRate(ccode, currencyCode);
+
+        if (result.isEmpty() || (result.constLast().start != start))
+            result.append({ start });
+        auto &entry = result.last();
+        entry.quantity += query.value(2).toInt();
+        entry.revenue += query.value(3).toDouble() * crate;
+        entry.orderCount += query.value(4).toInt();
+    }
+    co_return result;
 }
 
 Order *Orders::order(int index) const
@@ -8,6 +8,7 @@
 #include <QtCore/QDateTime>
 #include <QtCore/QAbstractTableModel>
 #include <QtQml/qqmlregistration.h>
+#include <QCoro/QCoroTask>
 
 #include "bricklink/lot.h"
 #include "bricklink/global.h"
@@ -194,6 +195,21 @@ public:
         ColumnCount,
     };
 
+    enum class TrendInterval {
+        Day,
+        Week,
+        Month,
+        Year,
+    };
+    Q_ENUM(TrendInterval)
+
+    struct TrendEntry {
+        QDate start;
+        int quantity = 0;
+        double revenue = 0;
+        int orderCount = 0;
+    };
+
     enum Role {
         OrderPointerRole = Qt::UserRole + 1,
         OrderSortRole,
@@ -216,6 +232,23 @@ public:
     //Q_INVOKABLE void trimDatabase(int keepLastNDays);
 
     LotList loadOrderLots(const Order *order) const;
+    // decodes in parallel; ownership of all Lots is transferred to the caller. The optional
+    // \a failed vector is set to true for every order that could not be loaded or decoded.
+    QVector<LotList> loadOrderLots(const QVector<const Order *> &orders,
+                                   QVector<bool> *failed = nullptr) const;
+
+    // aggregation over all cached orders: quantities and revenue per item, color and condition.
+    // The price of each returned Lot is the average price. Ownership is transferred to the caller.
+    // Both queries first wait for the aggregation index to be up-to-date (see updateLotIndex()).
+    QCoro::Task<LotList> lotsSummary(OrderType type, QDate fromDate, QDate toDate,
+                                     QString currencyCode = { });
+    // item and/or color can be nullptr to match everything
+    QCoro::Task<QVector<TrendEntry>> lotsTrend(OrderType type, const Item *item, const Color *color,
+                                               TrendInterval interval, QDate fromDate, QDate toDate,
+                                               QString currencyCode = { });
+    // indexes all orders that are not indexed yet: decoding the order lots runs in the
+    // background, so this is also started right after the orders are loaded
+    QCoro::Task<> updateLotIndex();
 
     int indexOfOrder(const QString &orderId) const;
 
@@ -233,12 +266,13 @@ signals:
     void updateStatusChanged(BrickLink::UpdateStatus updateStatus);
     void lastUpdatedChanged(const QDateTime &lastUpdated);
     void countChanged(int count);
+    void lotIndexUpdated();
 
 private:
     Orders(Core *core);
     void reloadOrdersFromDatabase(const QString &userId);
     void importOldCache(const QString &userId);
-    static QHash<Order *, QString> parseOrdersXML(const QByteArray &data_);
+    static QHash<Order *, QByteArray> parseOrdersXML(const QByteArray &data_);
     void startUpdateInternal(const QDate &fromDate, const QDate &toDate, const QString &orderId);
     void updateOrder(std::unique_ptr<Order> order);
     void appendOrderToModel(std::unique_ptr<Order> order);
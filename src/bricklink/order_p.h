@@ -7,10 +7,12 @@
 #include <QDateTime>
 #include <QVector>
 #include <QIcon>
+#include <QIODevice>
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
 
 #include "bricklink/global.h"
+#include "bricklink/lot.h"
 
 class TransferJob;
 
@@ -72,11 +74,76 @@ public:
     QSqlQuery m_saveAddressQuery;
     QSqlQuery m_saveOrderQuery;
     QSqlQuery m_saveUpdatedQuery;
+    QSqlQuery m_saveLotsQuery;
+    QSqlQuery m_deleteLotIndexQuery;
+    QSqlQuery m_insertLotIndexQuery;
+    QSqlQuery m_markLotsIndexedQuery;
+
+    quint64 m_dbGeneration = 0;   // incremented whenever m_db is switched to another user
+    bool m_lotIndexUpdating = false;
 
     enum OrderDataFormat {
         Format_XML = 0,
         Format_CompressedXML,
     };
+
+    // the raw blobs of one order, as stored in the database
+    struct OrderBlobs {
+        QString id;
+        OrderDataFormat format = Format_XML;
+        QByteArray data;
+        QByteArray lots; // binary lots, empty if not cached yet
+    };
+
+    // one order in a bulk load: the blobs are loaded and the results are saved on the database's
+    // thread, while decode() can be run in parallel
+    struct LoadJob {
+        OrderBlobs blobs;
+        LotList lots;
+        QByteArray binaryLots;
+        bool valid = false;
+        bool decoded = false;
+
+        void decode();
+    };
+
+    OrderBlobs loadOrderBlobs(const QString &orderId);
+    void saveOrderLots(const QString &orderId, const QByteArray &lots);
+    void indexOrderLots(const QString &orderId, const LotList &lots);
+
+    // these two are thread-safe and are run in parallel for bulk loads
+    static LotList decodeOrderBlobs(const OrderBlobs &blobs, QByteArray *binaryLots);
+    static QByteArray encodeLots(const LotList &lots);
+    static LotList decodeLots(const QByteArray &binaryLots);
+};
+
+// A write-only filter that escapes stray '&' characters in BrickLink's order XML on the fly:
+// every '&' that is not followed by a ';' within the next 6 characters is replaced by "&amp;".
+// The look-ahead is carried over between write() calls, so the data can be fed in arbitrary
+// chunks and the whole operation is linear in the input size.
+class OrderXmlSanitizeFilter : public QIODevice
+{
+public:
+    OrderXmlSanitizeFilter(QIODevice *target, QObject *parent = nullptr);
+
+    bool open(OpenMode mode = WriteOnly) override;
+    void close() override;
+    bool isSequential() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    bool writeTarget(const char *data, qint64 size);
+    bool flushPending(bool escape);
+
+    QIODevice *m_target;
+    QByteArray m_pending; // an '&' plus the characters seen after it so far
+
+    static constexpr qsizetype MaxEntityLookAhead = 6;
+
+    Q_DISABLE_COPY(OrderXmlSanitizeFilter)
 };
 
 } // namespace BrickLink
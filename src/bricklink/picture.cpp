@@ -1,6 +1,7 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <limits>
 
 #include <QtCore/QFile>
 #include <QtCore/QStringBuilder>
@@ -17,6 +18,7 @@
 #include "bricklink/item.h"
 #include "bricklink/core.h"
 #include "utility/appstatistics.h"
+#include "utility/tracing.h"
 #include "utility/transfer.h"
 
 Q_DECLARE_LOGGING_CATEGORY(LogCache)
@@ -110,20 +112,21 @@ PictureCache::PictureCache(Core *core, quint64 physicalMem)
     Q_ASSERT(!Picture::s_cache);
     Picture::s_cache = this;
 
-    d->m_cacheStatId = AppStatistics::inst()->addSource(u"Pictures in memory cache"_qs);
-    d->m_loadsStatId = AppStatistics::inst()->addSource(u"Pictures queued for disk load"_qs);
-    d->m_savesStatId = AppStatistics::inst()->addSource(u"Pictures queued for disk save"_qs);
+    d->m_cacheStatId = AppStatistics::inst()->addGauge(u"Pictures in memory cache"_qs);
+    d->m_loadsStatId = AppStatistics::inst()->addGauge(u"Pictures queued for disk load"_qs);
+    d->m_savesStatId = AppStatistics::inst()->addGauge(u"Pictures queued for disk save"_qs);
+    d->m_hitRateStatId = AppStatistics::inst()->addHitRate(u"Picture memory cache hit rate"_qs);
+    d->m_loadLatencyStatId = AppStatistics::inst()->addHistogram(u"Picture disk load latency"_qs);
 
-    // The max. pic cache size is at least 500MB. On 64bit systems, this gets expanded to a quarter
-    // of the physical memory, but it is capped at 4GB
-    quint64 picCacheMem = 500'000'000ULL; // more than that and Win32 runs out of memory
+    // The automatic memory budget is at least 500MB. On 64bit systems, this gets expanded to a
+    // quarter of the physical memory, but it is capped at 4GB
+    d->m_defaultMemoryBudget = 500'000'000ULL; // more than that and Win32 runs out of memory
 
-    if (physicalMem && (Q_PROCESSOR_WORDSIZE >= 8))
-        picCacheMem = std::clamp(physicalMem / 4, picCacheMem, picCacheMem * 8);
-    d->m_cache.setMaxCost(int(picCacheMem / 1024)); // each pic has the cost of memory used in KB
-
-    qInfo().noquote() << "Picture cache:"
-                      << QByteArray::number(double(picCacheMem) / 1'000'000'000ULL, 'f', 1) << "GB";
+    if (physicalMem && (Q_PROCESSOR_WORDSIZE >= 8)) {
+        d->m_defaultMemoryBudget = std::clamp(physicalMem / 4, d->m_defaultMemoryBudget,
+                                              d->m_defaultMemoryBudget * 8);
+    }
+    setMemoryBudget(0);
 
     connect(core, &Core::transferFinished,
             this, [this](TransferJob *job) {
@@ -144,6 +147,8 @@ PictureCache::PictureCache(Core *core, quint64 physicalMem)
     }
 
     if (d->m_db.isOpen()) {
+        SqlCacheMaintenance::prepareDatabase(d->m_db);
+
         QSqlQuery createQuery(d->m_db);
         if (!createQuery.exec(
                     u"CREATE TABLE IF NOT EXISTS pic ("
@@ -154,6 +159,8 @@ PictureCache::PictureCache(Core *core, quint64 physicalMem)
             qCWarning(LogSql) << "Failed to create the 'pic' table in the picture database:"
                               << createQuery.lastError().text();
             d->m_db.close();
+        } else {
+            d->m_maintenance.prepareTable(d->m_db);
         }
     }
 
@@ -227,8 +234,6 @@ PictureCache::PictureCache(Core *core, quint64 physicalMem)
     }
 #endif
 
-    //TODO: on mobile: if DB size > maxSize, remove old entries until size <= maxSize
-
     for (int i = 0; i < 1 /*qMax(2, QThread::idealThreadCount() / 4)*/; ++i)
         d->m_threads.append(QThread::create(&PictureCachePrivate::saveThread, d, d->m_db.connectionName(), i));
     for (int i = 0; i < qMax(2, QThread::idealThreadCount()); ++i)
@@ -261,6 +266,16 @@ void PictureCache::setUpdateInterval(int interval)
     d->m_updateInterval = interval;
 }
 
+void PictureCache::setMaxDatabaseSize(quint64 maxSize)
+{
+    d->m_maintenance.setMaxSize(maxSize);
+
+    // let the save thread do the eviction right away
+    d->m_saveMutex.lock();
+    d->m_saveTrigger.wakeAll();
+    d->m_saveMutex.unlock();
+}
+
 void PictureCache::clearCache()
 {
     int lastLeftOver = 0;
@@ -289,12 +304,29 @@ void PictureCache::clearCache()
         QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents, 500);
     }
 
-    AppStatistics::inst()->update(d->m_cacheStatId, d->m_cache.count());
+    AppStatistics::inst()->setGauge(d->m_cacheStatId, d->m_cache.count());
 }
 
-QPair<int, int> PictureCache::cacheStats() const
+void PictureCache::setMemoryBudget(quint64 budget)
 {
-    return qMakePair(d->m_cache.totalCost(), d->m_cache.maxCost());
+    if (!budget)
+        budget = d->m_defaultMemoryBudget;
+    if (Q_PROCESSOR_WORDSIZE < 8)
+        budget = std::min(budget, d->m_defaultMemoryBudget);
+
+    // each pic has the cost of memory used in KB
+    const int maxCost = int(std::min<quint64>(budget / 1024, std::numeric_limits<int>::max()));
+    if (maxCost == d->m_cache.maxCost())
+        return;
+    d->m_cache.setMaxCost(maxCost);
+
+    qInfo().noquote() << "Picture cache:"
+                      << QByteArray::number(double(budget) / 1'000'000'000ULL, 'f', 1) << "GB";
+}
+
+QPair<quint64, quint64> PictureCache::cacheStats() const
+{
+    return qMakePair(quint64(d->m_cache.totalCost()) * 1024, quint64(d->m_cache.maxCost()) * 1024);
 }
 
 Picture *PictureCache::picture(const Item *item, const Color *color, bool highPriority)
@@ -309,6 +341,7 @@ Picture *PictureCache::picture(const Item *item, const Color *color, bool highPr
 
     auto key = PictureCachePrivate::cacheKey(item, color);
     Picture *pic = d->m_cache[key];
+    AppStatistics::inst()->hit(d->m_hitRateStatId, pic != nullptr);
 
     bool needToLoad = !pic || (!pic->isValid() && (pic->updateStatus() == UpdateStatus::UpdateFailed));
 
@@ -320,7 +353,7 @@ Picture *PictureCache::picture(const Item *item, const Color *color, bool highPr
                       int(d->m_cache.maxCost()), int(d->m_cache.totalCost()), int(cost), item->id().constData());
             return nullptr;
         }
-        AppStatistics::inst()->update(d->m_cacheStatId, d->m_cache.count());
+        AppStatistics::inst()->setGauge(d->m_cacheStatId, d->m_cache.count());
     }
 
     if (needToLoad) {
@@ -447,7 +480,7 @@ void PictureCachePrivate::load(Picture *pic, bool highPriority)
     auto queueSize = m_loadQueue.size();
     m_loadMutex.unlock();
 
-    AppStatistics::inst()->update(m_loadsStatId, queueSize);
+    AppStatistics::inst()->setGauge(m_loadsStatId, queueSize);
 }
 
 void PictureCachePrivate::reprioritize(Picture *pic, bool highPriority)
@@ -474,12 +507,12 @@ void PictureCachePrivate::save(Picture *pic)
 
     pic->addRef();
     m_saveMutex.lock();
-    m_saveQueue.append({ pic, SaveData });
+    m_saveQueue.append(pic);
     m_saveTrigger.wakeOne();
     auto queueSize = m_saveQueue.size();
     m_saveMutex.unlock();
 
-    AppStatistics::inst()->update(m_savesStatId, queueSize);
+    AppStatistics::inst()->setGauge(m_savesStatId, queueSize);
 }
 
 void PictureCachePrivate::loadThread(QString dbName, int index)
@@ -506,7 +539,9 @@ void PictureCachePrivate::loadThread(QString dbName, int index)
             auto queueSize = m_loadQueue.size();
             locker.unlock();
 
-            AppStatistics::inst()->update(m_loadsStatId, queueSize);
+            tracezone zone("PictureCache::load");
+            Tracer::counter("PictureCache load queue", queueSize);
+            AppStatistics::inst()->setGauge(m_loadsStatId, queueSize);
 
             bool loaded = false;
             QDateTime lastUpdated;
@@ -515,8 +550,11 @@ void PictureCachePrivate::loadThread(QString dbName, int index)
             bool convertedFromOldCache = false;
 
             if (db.isOpen()) {
-                loadQuery.bindValue(u":id"_qs, databaseTag(pic));
+                const auto dbTag = databaseTag(pic);
+                loadQuery.bindValue(u":id"_qs, dbTag);
 
+                QElapsedTimer loadTimer;
+                loadTimer.start();
                 loadQuery.exec();
                 if (loadQuery.next()) {
                     lastUpdated = loadQuery.isNull(0) ? QDateTime()
@@ -525,6 +563,11 @@ void PictureCachePrivate::loadThread(QString dbName, int index)
                     loaded = imageFromData(img, data);
                 }
                 loadQuery.finish();
+                AppStatistics::inst()->record(m_loadLatencyStatId, loadTimer.nsecsElapsed() / 1000);
+
+                // update the last accessed time stamp (this is written back in batches)
+                if (loaded)
+                    m_maintenance.touch(dbTag);
             }
             // try the old file-system based cache
             if (!loaded) {
@@ -547,12 +590,13 @@ void PictureCachePrivate::loadThread(QString dbName, int index)
                     pic->setLastUpdated(lastUpdated);
                     pic->setImage(img);
 
-                    // update the last accessed time stamp
-                    pic->addRef();
-                    m_saveMutex.lock();
-                    m_saveQueue.append({ pic, convertedFromOldCache ? SaveData : SaveAccessTimeOnly });
-                    m_saveTrigger.wakeOne();
-                    m_saveMutex.unlock();
+                    if (convertedFromOldCache) {
+                        pic->addRef();
+                        m_saveMutex.lock();
+                        m_saveQueue.append(pic);
+                        m_saveTrigger.wakeOne();
+                        m_saveMutex.unlock();
+                    }
                 }
                 pic->setIsValid(loaded);
                 pic->setUpdateStatus(UpdateStatus::Ok);
@@ -586,13 +630,12 @@ void PictureCachePrivate::saveThread(QString dbName, int index)
                       "ON CONFLICT(id) DO UPDATE "
                       "SET updated=excluded.updated,accessed=excluded.accessed,data=excluded.data;"_qs);
 
-    QSqlQuery accessQuery(db);
-    accessQuery.prepare(u"UPDATE pic SET accessed=:accessed WHERE id=:id;"_qs);
+    int maintenanceTimeout = SqlCacheMaintenance::FlushInterval;
 
     while (!m_stop) {
         QMutexLocker locker(&m_saveMutex);
         if (m_saveQueue.isEmpty())
-            m_saveTrigger.wait(&m_saveMutex);
+            m_saveTrigger.wait(&m_saveMutex, QDeadlineTimer(maintenanceTimeout));
 
         if (!m_saveQueue.isEmpty()) {
             // we might have multiple saver threads, so don't grab the full queue at once
@@ -601,26 +644,24 @@ void PictureCachePrivate::saveThread(QString dbName, int index)
             auto queueSize = m_saveQueue.size();
             locker.unlock();
 
-            AppStatistics::inst()->update(m_savesStatId, queueSize);
+            AppStatistics::inst()->setGauge(m_savesStatId, queueSize);
 
             QHash<Picture *, QByteArray> imageDataHash;
 
             // do all this before starting a DB transaction, to keep lock times to a minimum
-            for (auto [pic, saveType] : saveQueueCopy) {
-                if (saveType == SaveData) {
-                    QByteArray data;
-                    if (!pic->m_image.isNull()) {
-                        // WebP lossy at 80% compresses to ~10-20% of the original PNG size
-                        // with next to no visible artifacts
-                        QByteArray webpData;
-                        QBuffer buffer(&webpData);
-                        pic->m_image.save(&buffer, "WEBP", 80);
-                        //if (webpData.size() < data.size())
-                        //    qWarning() << "Saving image as WEBP compresses to" << (100 * webpData.size() / data.size()) << "%";
-                        data = webpData;
-                    }
-                    imageDataHash.insert(pic, data);
+            for (auto *pic : saveQueueCopy) {
+                QByteArray data;
+                if (!pic->m_image.isNull()) {
+                    // WebP lossy at 80% compresses to ~10-20% of the original PNG size
+                    // with next to no visible artifacts
+                    QByteArray webpData;
+                    QBuffer buffer(&webpData);
+                    pic->m_image.save(&buffer, "WEBP", 80);
+                    //if (webpData.size() < data.size())
+                    //    qWarning() << "Saving image as WEBP compresses to" << (100 * webpData.size() / data.size()) << "%";
+                    data = webpData;
                 }
+                imageDataHash.insert(pic, data);
             }
 
             if (db.isOpen()) {
@@ -628,40 +669,35 @@ void PictureCachePrivate::saveThread(QString dbName, int index)
 
                 qint64 now = QDateTime::currentMSecsSinceEpoch();
 
-                for (auto [pic, saveType] : saveQueueCopy) {
-                    auto dbTag = databaseTag(pic);
-
-                    if (saveType == SaveAccessTimeOnly) {
-                        accessQuery.bindValue(u":id"_qs, dbTag);
-                        accessQuery.bindValue(u":accessed"_qs, now);
-                        if (!accessQuery.exec()) {
-                            qCWarning(LogSql) << "Failed to update the access time of a picture:"
-                                              << accessQuery.lastError().text();
-                        }
-                        accessQuery.finish();
-                    } else {
-                        const auto data = imageDataHash.value(pic);
-                        auto lastUpdated = QVariant(QMetaType::fromType<qint64>());
-                        if (pic->lastUpdated().isValid())
-                            lastUpdated = QVariant::fromValue(pic->lastUpdated().toMSecsSinceEpoch());
-
-                        saveQuery.bindValue(u":id"_qs, dbTag);
-                        saveQuery.bindValue(u":updated"_qs, lastUpdated);
-                        saveQuery.bindValue(u":accessed"_qs, now);
-                        saveQuery.bindValue(u":data"_qs, data);
-
-                        if (!saveQuery.exec()) {
-                            qCWarning(LogSql) << "Failed to save picture data:"
-                                              << saveQuery.lastError().text();
-                        }
-                        saveQuery.finish();
+                for (auto *pic : saveQueueCopy) {
+                    const auto data = imageDataHash.value(pic);
+                    auto lastUpdated = QVariant(QMetaType::fromType<qint64>());
+                    if (pic->lastUpdated().isValid())
+                        lastUpdated = QVariant::fromValue(pic->lastUpdated().toMSecsSinceEpoch());
+
+                    saveQuery.bindValue(u":id"_qs, databaseTag(pic));
+                    saveQuery.bindValue(u":updated"_qs, lastUpdated);
+                    saveQuery.bindValue(u":accessed"_qs, now);
+                    saveQuery.bindValue(u":data"_qs, data);
+
+                    if (!saveQuery.exec()) {
+                        qCWarning(LogSql) << "Failed to save picture data:"
+                                          << saveQuery.lastError().text();
                     }
+                    saveQuery.finish();
                     pic->release();
                 }
                 db.commit();
             }
+        } else {
+            locker.unlock();
         }
+
+        // batched access time updates and LRU eviction
+        if (!m_stop)
+            maintenanceTimeout = m_maintenance.run(db);
     }
+    m_maintenance.run(db, true /*force flush*/);
     db.close();
 }
 
@@ -97,8 +97,10 @@ public:
     ~PictureCache() override;
 
     void setUpdateInterval(int interval);
+    void setMaxDatabaseSize(quint64 maxSize); // in bytes, 0 means unlimited
     void clearCache();
-    QPair<int, int> cacheStats() const;
+    void setMemoryBudget(quint64 budget); // in bytes, 0 means automatic
+    QPair<quint64, quint64> cacheStats() const; // memory used and budget in bytes
 
     Picture *picture(const Item *item, const Color *color, bool highPriority = false);
 
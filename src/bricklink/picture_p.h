@@ -12,6 +12,7 @@
 
 #include "utility/q3cache.h"
 #include "global.h"
+#include "sqlcache_p.h"
 
 QT_FORWARD_DECLARE_CLASS(QThread)
 
@@ -34,24 +35,23 @@ public:
         LoadLowPriority,
     };
 
-    enum SaveType {
-        SaveData,
-        SaveAccessTimeOnly,
-    };
-
     QVector<std::pair<Picture *, LoadType>> m_loadQueue;
-    QVector<std::pair<Picture *, SaveType>> m_saveQueue;
+    QVector<Picture *> m_saveQueue;
     QString m_dbName;
     QSqlDatabase m_db;
     QVector<QThread *> m_threads;
+    SqlCacheMaintenance m_maintenance { u"pic"_qs };
 
     int m_updateInterval = 0;
     Q3Cache<quint32, Picture> m_cache;
+    quint64 m_defaultMemoryBudget = 0;
     Core *m_core;
     PictureCache *q;
     int m_cacheStatId = -1;
     int m_loadsStatId = -1;
     int m_savesStatId = -1;
+    int m_hitRateStatId = -1;
+    int m_loadLatencyStatId = -1;
 
     static quint32 cacheKey(const Item *item, const Color *color);
     static QString databaseTag(Picture *pic);
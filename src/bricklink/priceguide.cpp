@@ -1,6 +1,7 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <limits>
 
 #include <QtCore/QLocale>
 #include <QtCore/QFile>
@@ -13,12 +14,14 @@
 #include <QtCore/QTimer>
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QCoreApplication>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtNetwork/QNetworkInformation>
 #include <QtSql/QSqlError>
 #include <QtSql/QSqlQuery>
 
 #include "utility/appstatistics.h"
 #include "utility/exception.h"
+#include "utility/tracing.h"
 #include "utility/transfer.h"
 #include "utility/utility.h"
 #include "bricklink/priceguide.h"
@@ -264,8 +267,6 @@ BatchedAffiliateAPIPGRetriever::BatchedAffiliateAPIPGRetriever(Core *core, const
     m_batchTimer->setInterval(MaxBatchAgeMSec);
     connect(m_batchTimer, &QTimer::timeout, this, &BatchedAffiliateAPIPGRetriever::check);
 
-    m_currentBatch.reserve(MaxBatchSize);
-
     connect(m_core, &Core::transferFinished,
             this, [this](TransferJob *job) {
         if (job) {
@@ -283,26 +284,25 @@ QVector<VatType> BatchedAffiliateAPIPGRetriever::supportedVatTypes() const
 
 void BatchedAffiliateAPIPGRetriever::fetch(PriceGuide *pg, bool highPriority)
 {
-    // check if the pg is currently being fetched
-    if (m_currentBatch.contains(pg))
-        return;
+    const auto key = PriceGuideCachePrivate::cacheKey(pg->item(), pg->color(), pg->vatType());
 
-    bool wrongVatType = (pg->vatType() != m_nextBatchVatType);
-    auto &queue = wrongVatType ? m_wrongVatTypeQueue : m_nextBatch;
-    auto &prioSize = wrongVatType ? m_wrongVatTypeQueuePrioritySize : m_nextBatchPrioritySize;
-
-    // check if the pg is already scheduled for the next batch and if we need to up the priority
-    auto it = std::find_if(queue.cbegin(), queue.cend(), [pg](const auto &pair) {
-        return (pair.first == pg);
-    });
-    if (it != queue.cend()) {
-        auto index = std::distance(queue.cbegin(), it);
-        if (index >= prioSize)
-            queue.move(index, prioSize++);
+    // check if the same pg is already queued or currently being fetched
+    if (auto *leader = m_pending.value(key)) {
+        if ((leader != pg) && !m_followers.contains(leader, pg)) {
+            pg->addRef();
+            m_followers.insert(leader, pg);
+        }
+        // check if the pg is already scheduled for the next batch and if we need to up the priority
+        raisePriority(leader);
         return;
     }
 
     pg->addRef();
+    m_pending.insert(key, pg);
+
+    bool wrongVatType = (pg->vatType() != m_nextBatchVatType);
+    auto &queue = wrongVatType ? m_wrongVatTypeQueue : m_nextBatch;
+    auto &prioSize = wrongVatType ? m_wrongVatTypeQueuePrioritySize : m_nextBatchPrioritySize;
 
     QElapsedTimer now;
     now.start();
@@ -315,11 +315,8 @@ void BatchedAffiliateAPIPGRetriever::fetch(PriceGuide *pg, bool highPriority)
     check();
 }
 
-void BatchedAffiliateAPIPGRetriever::cancel(PriceGuide *pg)
+bool BatchedAffiliateAPIPGRetriever::raisePriority(PriceGuide *pg)
 {
-    if (m_currentBatch.contains(pg))
-        m_currentJob->abort();
-
     bool wrongVatType = (pg->vatType() != m_nextBatchVatType);
     auto &queue = wrongVatType ? m_wrongVatTypeQueue : m_nextBatch;
     auto &prioSize = wrongVatType ? m_wrongVatTypeQueuePrioritySize : m_nextBatchPrioritySize;
@@ -327,21 +324,78 @@ void BatchedAffiliateAPIPGRetriever::cancel(PriceGuide *pg)
     auto it = std::find_if(queue.cbegin(), queue.cend(), [pg](const auto &pair) {
         return (pair.first == pg);
     });
-    if (it != queue.cend()) {
-        auto index = std::distance(queue.cbegin(), it);
-        if (index < prioSize)
-            --prioSize;
-        queue.removeAt(index);
+    if (it == queue.cend())
+        return false;
 
-        emit failed(pg, u"aborted"_qs);
-        pg->release();
+    auto index = std::distance(queue.cbegin(), it);
+    if (index >= prioSize)
+        queue.move(index, prioSize++);
+    return true;
+}
+
+void BatchedAffiliateAPIPGRetriever::cancel(PriceGuide *pg)
+{
+    const auto key = PriceGuideCachePrivate::cacheKey(pg->item(), pg->color(), pg->vatType());
+    auto *leader = m_pending.value(key);
+    if (!leader)
+        return;
+
+    if (leader != pg) {
+        if (m_followers.remove(leader, pg)) {
+            emit failed(pg, u"aborted"_qs);
+            pg->release();
+        }
+        return;
     }
+
+    // the first follower (if any) takes over the leader's place in the queue or batch
+    auto followers = m_followers.values(leader);
+    m_followers.remove(leader);
+    PriceGuide *successor = followers.isEmpty() ? nullptr : followers.takeLast();
+    for (auto *follower : std::as_const(followers))
+        m_followers.insert(successor, follower);
+
+    if (successor)
+        m_pending.insert(key, successor);
+    else
+        m_pending.remove(key);
+
+    // a request that is already in flight is not aborted, as this would kill the whole batch
+    for (const auto &batch : std::as_const(m_batches)) {
+        auto index = batch->pgs.indexOf(pg);
+        if (index >= 0)
+            batch->pgs[index] = successor;
+    }
+
+    bool wrongVatType = (pg->vatType() != m_nextBatchVatType);
+    auto &queue = wrongVatType ? m_wrongVatTypeQueue : m_nextBatch;
+    auto &prioSize = wrongVatType ? m_wrongVatTypeQueuePrioritySize : m_nextBatchPrioritySize;
+
+    auto it = std::find_if(queue.begin(), queue.end(), [pg](const auto &pair) {
+        return (pair.first == pg);
+    });
+    if (it != queue.end()) {
+        if (successor) {
+            it->first = successor;
+        } else {
+            auto index = std::distance(queue.begin(), it);
+            if (index < prioSize)
+                --prioSize;
+            queue.removeAt(index);
+        }
+    }
+
+    emit failed(pg, u"aborted"_qs);
+    pg->release();
 }
 
 void BatchedAffiliateAPIPGRetriever::cancelAll()
 {
-    if (m_currentJob)
-        m_currentJob->abort();
+    // the aborted jobs will fail their pgs in transferJobFinished
+    for (const auto &batch : std::as_const(m_batches)) {
+        if (batch->job)
+            batch->job->abort();
+    }
 
     const auto list = m_wrongVatTypeQueue + m_nextBatch;
 
@@ -350,10 +404,14 @@ void BatchedAffiliateAPIPGRetriever::cancelAll()
     m_wrongVatTypeQueuePrioritySize = 0;
     m_nextBatchPrioritySize = 0;
 
-    for (const auto &pair : list) {
-        emit failed(pair.first, u"aborted"_qs);
-        pair.first->release();
-    }
+    QVector<PriceGuide *> dummyPgs;
+    QVector<PriceGuide::Data> dummyData;
+    QVector<PriceGuide *> releasePgs;
+
+    for (const auto &pair : list)
+        finishRequest(pair.first, nullptr, u"aborted"_qs, dummyPgs, dummyData, releasePgs);
+    for (auto *pg : std::as_const(releasePgs))
+        pg->release();
 }
 
 void BatchedAffiliateAPIPGRetriever::setApiKey(const QString &key)
@@ -362,9 +420,15 @@ void BatchedAffiliateAPIPGRetriever::setApiKey(const QString &key)
         m_apiKey = key;
 }
 
+void BatchedAffiliateAPIPGRetriever::setMaxInFlightBatches(int count)
+{
+    m_maxInFlightBatches = std::max(1, count);
+    check();
+}
+
 void BatchedAffiliateAPIPGRetriever::check()
 {
-    if (m_currentBatch.isEmpty() && !m_currentJob) {
+    while (m_inFlightCount < m_maxInFlightBatches) {
         if (m_nextBatch.isEmpty() && !m_wrongVatTypeQueue.isEmpty()) {
             // switch vatType to the request with the highest priority
             m_nextBatchVatType = m_wrongVatTypeQueue.constFirst().first->vatType();
@@ -394,140 +458,230 @@ void BatchedAffiliateAPIPGRetriever::check()
                 ? 0 : m_nextBatch.at(0).second.elapsed();
 
         if ((nextSize >= MaxBatchSize) || (qMax(nextAge, nextPriorityAge) > MaxBatchAgeMSec)) {
-            auto batchSize = qMin(nextSize, MaxBatchSize);
-            QJsonArray array;
-
-            for (auto i = 0; i < batchSize; ++i) {
-                auto *pg = m_nextBatch.at(i).first;
-                const QString itemId = QString::fromLatin1(pg->item()->id());
-                const QString typeId = itemTypeApiId(pg->item()->itemType());
-                int colorId = int(pg->color()->id());
-
-                m_currentBatch.append(pg);
-
-                array.append(QJsonObject {
-                                 { u"color_id"_qs, colorId },
-                                 { u"item"_qs, QJsonObject {
-                                       { u"no"_qs, itemId },
-                                       { u"type"_qs, typeId },
-                                   } },
-                             });
+            sendBatch();
+        } else {
+            if (nextSize) {
+                auto nextCheck = std::max(0LL, (MaxBatchAgeMSec - std::max(nextAge, nextPriorityAge)));
+                m_batchTimer->setInterval(int(nextCheck));
+                m_batchTimer->start();
             }
-            m_nextBatch.remove(0, batchSize);
-            m_nextBatchPrioritySize -= qMin(m_nextBatchPrioritySize, batchSize);
-
-            const auto json = QJsonDocument(array).toJson(QJsonDocument::Compact);
-
-            m_currentJob = TransferJob::post(u"https://api.bricklink.com/api/affiliate/v1/price_guide_batch"_qs,
-                                             {
-                                              { u"currency_code"_qs, u"USD"_qs },
-                                              { u"precision"_qs,     u"4"_qs },
-                                              { u"vat_type"_qs,      QString::number(int(m_nextBatchVatType)) },
-                                              { u"api_key"_qs,       m_apiKey }
-                                             },
-                                             u"application/json"_qs, json);
-
-            m_currentJob->setUserData("batchedPriceGuide", true);
-            m_core->retrieve(m_currentJob, m_nextBatchPrioritySize > 0);
-        } else if (nextSize) {
-            auto nextCheck = std::max(0LL, (MaxBatchAgeMSec - std::max(nextAge, nextPriorityAge)));
-            m_batchTimer->setInterval(int(nextCheck));
-            m_batchTimer->start();
+            break;
         }
     }
 }
 
+void BatchedAffiliateAPIPGRetriever::sendBatch()
+{
+    auto batchSize = qMin(m_nextBatch.size(), MaxBatchSize);
+    auto batch = std::make_shared<Batch>();
+    batch->vatType = m_nextBatchVatType;
+    batch->pgs.reserve(batchSize);
+    batch->requestKeys.reserve(batchSize);
+
+    QJsonArray array;
+
+    for (auto i = 0; i < batchSize; ++i) {
+        auto *pg = m_nextBatch.at(i).first;
+        const QString itemId = QString::fromLatin1(pg->item()->id());
+        const QString typeId = itemTypeApiId(pg->item()->itemType());
+        int colorId = int(pg->color()->id());
+
+        batch->pgs.append(pg);
+        batch->requestKeys.append(requestKey(typeId, itemId, colorId));
+
+        array.append(QJsonObject {
+                         { u"color_id"_qs, colorId },
+                         { u"item"_qs, QJsonObject {
+                               { u"no"_qs, itemId },
+                               { u"type"_qs, typeId },
+                           } },
+                     });
+    }
+    m_nextBatch.remove(0, batchSize);
+    m_nextBatchPrioritySize -= qMin(m_nextBatchPrioritySize, batchSize);
+
+    const auto json = QJsonDocument(array).toJson(QJsonDocument::Compact);
+
+    batch->job = TransferJob::post(u"https://api.bricklink.com/api/affiliate/v1/price_guide_batch"_qs,
+                                   {
+                                       { u"currency_code"_qs, u"USD"_qs },
+                                       { u"precision"_qs,     u"4"_qs },
+                                       { u"vat_type"_qs,      QString::number(int(batch->vatType)) },
+                                       { u"api_key"_qs,       m_apiKey }
+                                   },
+                                   u"application/json"_qs, json);
+
+    batch->job->setUserData("batchedPriceGuide", true);
+    m_batches.append(batch);
+    ++m_inFlightCount;
+    m_core->retrieve(batch->job, m_nextBatchPrioritySize > 0);
+}
+
 void BatchedAffiliateAPIPGRetriever::transferJobFinished(TransferJob *j)
 {
-    Q_ASSERT(m_currentJob == j);
-    m_currentJob = nullptr;
+    auto it = std::find_if(m_batches.cbegin(), m_batches.cend(), [j](const auto &batch) {
+        return batch->job == j;
+    });
+    Q_ASSERT(it != m_batches.cend());
+    if (it == m_batches.cend())
+        return;
 
-    try {
-        if (j->isCompleted()) {
-            QJsonParseError err;
-            const auto doc = QJsonDocument::fromJson(j->data(), &err);
-            if (doc.isNull())
-                throw ParseException("invalid JSON: %1 at %2").arg(err.errorString()).arg(err.offset);
-
-            const auto meta = doc[u"meta"];
-            const int code = meta[u"code"].toInt();
-            const QString description = meta[u"description"].toString();
-            const QString message = meta[u"message"].toString();
-
-            if (!meta.isObject() || (code != 200) || (description != u"OK") || (message != u"OK"))
-                throw Exception("bad request (%1). %2: %3").arg(code).arg(description).arg(message);
-
-            const auto data = doc[u"data"].toArray();
-            if (data.size() != m_currentBatch.size()) {
-                throw Exception("JSON data size mismatch: requested %1, got %2")
-                    .arg(m_currentBatch.size()).arg(data.size());
-            }
-            for (const auto d : data) {
-                const auto item = d.toObject();
-                const QString itemId = item[u"item"][u"no"].toString();
-                const QString typeId = item[u"item"][u"type"].toString();
-                const int colorId = item[u"color_id"].toInt();
-
-                auto pit = std::find_if(m_currentBatch.begin(), m_currentBatch.end(),
-                                        [&](const auto *pg) {
-                    return pg && (QLatin1String(pg->item()->id()) == itemId)
-                            && (itemTypeApiId(pg->item()->itemType()) == typeId)
-                            && (pg->color()->id() == uint(colorId));
-                });
-
-                if (pit == m_currentBatch.end()) {
-                    qCWarning(LogCache) << "PG download was not requested, but received for"
-                                        << typeId.mid(0, 1) << itemId << "in" << colorId;
-                    continue;
-                }
+    auto batch = *it;
+    batch->job = nullptr;
+    --m_inFlightCount;
+
+    if (j->isCompleted()) {
+        // the JSON parsing is done on a worker thread, while the next batch is already in flight
+        QtConcurrent::run(&BatchedAffiliateAPIPGRetriever::parseBatchReply, j->data(), batch->requestKeys)
+                .then(this, [this, batch](const BatchReply &reply) {
+            deliverBatch(batch, reply);
+        });
+    } else {
+        BatchReply reply;
+        if (j->isAborted())
+            reply.errorString = u"aborted"_qs;
+        else
+            reply.errorString = j->errorString() + u'(' + QString::number(j->responseCode()) + u')';
+        deliverBatch(batch, reply);
+    }
 
-                PriceGuide::Data pgdata;
-                auto parsePGJson = [&](QStringView key, int time, int cond) {
-                    auto obj = item[key].toObject();
-                    pgdata.quantities[time][cond] = obj[u"unit_quantity"].toInt();
-                    pgdata.lots[time][cond] = obj[u"total_quantity"].toInt();
-                    pgdata.prices[time][cond][int(Price::Lowest)] = obj[u"min_price"].toString().toDouble();
-                    pgdata.prices[time][cond][int(Price::Highest)] = obj[u"max_price"].toString().toDouble();
-                    pgdata.prices[time][cond][int(Price::Average)] = pgdata.lots[time][cond]
-                            ? (obj[u"total_price"].toString().toDouble() / pgdata.lots[time][cond]) : 0;
-                    pgdata.prices[time][cond][int(Price::WAverage)] =  pgdata.quantities[time][cond]
-                            ? (obj[u"total_qty_price"].toString().toDouble() / pgdata.quantities[time][cond]) : 0;
-                };
-
-                parsePGJson(u"inventory_new",  int(Time::Current), int(Condition::New));
-                parsePGJson(u"inventory_used", int(Time::Current), int(Condition::Used));
-                parsePGJson(u"ordered_new",    int(Time::PastSix), int(Condition::New));
-                parsePGJson(u"ordered_used",   int(Time::PastSix), int(Condition::Used));
-
-                emit finished(*pit, pgdata);
-                (*pit)->release();
-
-                *pit = nullptr;  // mark as "dealt with"
-            }
+    QMetaObject::invokeMethod(this, &BatchedAffiliateAPIPGRetriever::check, Qt::QueuedConnection);
+}
 
-            // Make sure to fail any remaining pg requests that might still be in m_currentBatch.
-            // Ideally there are none, but throwing this Exception unconditionally doesn't hurt.
-            throw Exception("no reply received for request");
+void BatchedAffiliateAPIPGRetriever::deliverBatch(const std::shared_ptr<Batch> &batch,
+                                                  const BatchReply &reply)
+{
+    m_batches.removeOne(batch);
+
+    QVector<PriceGuide *> finishedPgs;
+    QVector<PriceGuide::Data> finishedData;
+    QVector<PriceGuide *> releasePgs;
+    finishedPgs.reserve(batch->pgs.size());
+    finishedData.reserve(batch->pgs.size());
+    releasePgs.reserve(batch->pgs.size());
+
+    for (const auto &[index, pgdata] : reply.results) {
+        if (auto *pg = std::exchange(batch->pgs[index], nullptr)) // nullptr: canceled or a duplicate reply
+            finishRequest(pg, &pgdata, { }, finishedPgs, finishedData, releasePgs);
+    }
 
-        } else if (j->isAborted()) {
-            throw Exception("aborted");
+    // Make sure to fail any remaining pg requests that might still be in the batch.
+    // Ideally there are none, if the request succeeded.
+    const QString errorString = reply.errorString.isEmpty() ? u"no reply received for request"_qs
+                                                            : reply.errorString;
+    for (auto *pg : std::as_const(batch->pgs)) {
+        if (pg)
+            finishRequest(pg, nullptr, errorString, finishedPgs, finishedData, releasePgs);
+    }
+
+    if (!finishedPgs.isEmpty())
+        emit finishedBatch(finishedPgs, finishedData);
+
+    for (auto *pg : std::as_const(releasePgs))
+        pg->release();
+}
+
+void BatchedAffiliateAPIPGRetriever::finishRequest(PriceGuide *pg, const PriceGuide::Data *data,
+                                                   const QString &errorString,
+                                                   QVector<PriceGuide *> &finishedPgs,
+                                                   QVector<PriceGuide::Data> &finishedData,
+                                                   QVector<PriceGuide *> &releasePgs)
+{
+    const auto key = PriceGuideCachePrivate::cacheKey(pg->item(), pg->color(), pg->vatType());
+    if (m_pending.value(key) == pg)
+        m_pending.remove(key);
+
+    auto pgs = m_followers.values(pg);
+    m_followers.remove(pg);
+    pgs.prepend(pg);
+
+    for (auto *p : std::as_const(pgs)) {
+        if (data) {
+            finishedPgs.append(p);
+            finishedData.append(*data);
         } else {
-            throw Exception(j->errorString() + u'(' + QString::number(j->responseCode()) + u')');
+            emit failed(p, u"PG download for " + QChar::fromLatin1(p->item()->itemType()->id())
+                                + u' ' + QString::fromLatin1(p->item()->id()) + u" in "
+                                + p->color()->name() + u" failed: " + errorString);
         }
-    } catch (const Exception &e) {
-        for (auto *pg : std::as_const(m_currentBatch)) {
-            if (pg) {
-                emit failed(pg, u"PG download for " + QChar::fromLatin1(pg->item()->itemType()->id())
-                                    + u' ' + QString::fromLatin1(pg->item()->id()) + u" in "
-                            + pg->color()->name() + u" failed: " + e.errorString());
-                pg->release();
+        releasePgs.append(p);
+    }
+}
+
+BatchedAffiliateAPIPGRetriever::BatchReply
+BatchedAffiliateAPIPGRetriever::parseBatchReply(const QByteArray &json, const QVector<QString> &requestKeys)
+{
+    BatchReply reply;
+
+    try {
+        QJsonParseError err;
+        const auto doc = QJsonDocument::fromJson(json, &err);
+        if (doc.isNull())
+            throw ParseException("invalid JSON: %1 at %2").arg(err.errorString()).arg(err.offset);
+
+        const auto meta = doc[u"meta"];
+        const int code = meta[u"code"].toInt();
+        const QString description = meta[u"description"].toString();
+        const QString message = meta[u"message"].toString();
+
+        if (!meta.isObject() || (code != 200) || (description != u"OK") || (message != u"OK"))
+            throw Exception("bad request (%1). %2: %3").arg(code).arg(description).arg(message);
+
+        const auto data = doc[u"data"].toArray();
+        if (data.size() != requestKeys.size()) {
+            throw Exception("JSON data size mismatch: requested %1, got %2")
+                .arg(requestKeys.size()).arg(data.size());
+        }
+
+        QHash<QString, qsizetype> requestIndex;
+        requestIndex.reserve(requestKeys.size());
+        for (qsizetype i = 0; i < requestKeys.size(); ++i)
+            requestIndex.insert(requestKeys.at(i), i);
+
+        reply.results.reserve(data.size());
+
+        for (const auto d : data) {
+            const auto item = d.toObject();
+            const QString itemId = item[u"item"][u"no"].toString();
+            const QString typeId = item[u"item"][u"type"].toString();
+            const int colorId = item[u"color_id"].toInt();
+
+            const auto index = requestIndex.value(requestKey(typeId, itemId, colorId), -1);
+            if (index < 0) {
+                qCWarning(LogCache) << "PG download was not requested, but received for"
+                                    << typeId.mid(0, 1) << itemId << "in" << colorId;
+                continue;
             }
+
+            PriceGuide::Data pgdata;
+            auto parsePGJson = [&](QStringView key, int time, int cond) {
+                auto obj = item[key].toObject();
+                pgdata.quantities[time][cond] = obj[u"unit_quantity"].toInt();
+                pgdata.lots[time][cond] = obj[u"total_quantity"].toInt();
+                pgdata.prices[time][cond][int(Price::Lowest)] = obj[u"min_price"].toString().toDouble();
+                pgdata.prices[time][cond][int(Price::Highest)] = obj[u"max_price"].toString().toDouble();
+                pgdata.prices[time][cond][int(Price::Average)] = pgdata.lots[time][cond]
+                        ? (obj[u"total_price"].toString().toDouble() / pgdata.lots[time][cond]) : 0;
+                pgdata.prices[time][cond][int(Price::WAverage)] =  pgdata.quantities[time][cond]
+                        ? (obj[u"total_qty_price"].toString().toDouble() / pgdata.quantities[time][cond]) : 0;
+            };
+
+            parsePGJson(u"inventory_new",  int(Time::Current), int(Condition::New));
+            parsePGJson(u"inventory_used", int(Time::Current), int(Condition::Used));
+            parsePGJson(u"ordered_new",    int(Time::PastSix), int(Condition::New));
+            parsePGJson(u"ordered_used",   int(Time::PastSix), int(Condition::Used));
+
+            reply.results.emplace_back(index, pgdata);
         }
+    } catch (const Exception &e) {
+        reply.errorString = e.errorString();
     }
+    return reply;
+}
 
-    m_currentBatch.clear();
-
-    QMetaObject::invokeMethod(this, &BatchedAffiliateAPIPGRetriever::check, Qt::QueuedConnection);
+QString BatchedAffiliateAPIPGRetriever::requestKey(const QString &typeId, const QString &itemId, int colorId)
+{
+    return typeId + u'\t' + itemId + u'\t' + QString::number(colorId);
 }
 
 QString BatchedAffiliateAPIPGRetriever::itemTypeApiId(const ItemType *itt)
@@ -561,11 +715,13 @@ PriceGuideCache::PriceGuideCache(Core *core)
     Q_ASSERT(!PriceGuide::s_cache);
     PriceGuide::s_cache = this;
 
-    d->m_cacheStatId = AppStatistics::inst()->addSource(u"Price-guides in memory cache"_qs);
-    d->m_loadsStatId = AppStatistics::inst()->addSource(u"Price-guides queued for disk load"_qs);
-    d->m_savesStatId = AppStatistics::inst()->addSource(u"Price-guides queued for disk save"_qs);
+    d->m_cacheStatId = AppStatistics::inst()->addGauge(u"Price-guides in memory cache"_qs);
+    d->m_loadsStatId = AppStatistics::inst()->addGauge(u"Price-guides queued for disk load"_qs);
+    d->m_savesStatId = AppStatistics::inst()->addGauge(u"Price-guides queued for disk save"_qs);
+    d->m_hitRateStatId = AppStatistics::inst()->addHitRate(u"Price-guide memory cache hit rate"_qs);
+    d->m_loadLatencyStatId = AppStatistics::inst()->addHistogram(u"Price-guide disk load latency"_qs);
 
-    d->m_cache.setMaxCost(5000); // each price guide has a cost of 1
+    setMemoryBudget(0);
 
     QString batchApiKey = core->apiKey("affiliate");
     auto affiliate = new BatchedAffiliateAPIPGRetriever(core, batchApiKey);
@@ -575,6 +731,7 @@ PriceGuideCache::PriceGuideCache(Core *core)
             affiliate->setApiKey(d->m_core->apiKey("affiliate"));
     });
     d->m_retriever = affiliate;
+    setMaxInFlightBatches(0);
 
     // this is the old retriever:
     // d->m_retriever = new SingleHTMLScrapePGRetriever(core);
@@ -585,6 +742,10 @@ PriceGuideCache::PriceGuideCache(Core *core)
             this, [this](PriceGuide *pg, const PriceGuide::Data &data) {
         d->retrieveFinished(pg, data);
     });
+    connect(d->m_retriever, &PriceGuideRetrieverInterface::finishedBatch,
+            this, [this](const QVector<PriceGuide *> &pgs, const QVector<PriceGuide::Data> &data) {
+        d->retrieveBatchFinished(pgs, data);
+    });
     connect(d->m_retriever, &PriceGuideRetrieverInterface::failed,
             this, [this](PriceGuide *pg, const QString &errorString) {
         d->retrieveFailed(pg, errorString);
@@ -601,6 +762,8 @@ PriceGuideCache::PriceGuideCache(Core *core)
     }
 
     if (d->m_db.isOpen()) {
+        SqlCacheMaintenance::prepareDatabase(d->m_db);
+
         QSqlQuery createQuery(d->m_db);
         if (!createQuery.exec(
                     u"CREATE TABLE IF NOT EXISTS pg ("
@@ -611,6 +774,8 @@ PriceGuideCache::PriceGuideCache(Core *core)
             qCWarning(LogSql) << "Failed to create the 'pg' table in the price-guide database:"
                        << createQuery.lastError().text();
             d->m_db.close();
+        } else {
+            d->m_maintenance.prepareTable(d->m_db);
         }
     }
 
@@ -666,6 +831,16 @@ void PriceGuideCache::setUpdateInterval(int interval)
     d->m_updateInterval = interval;
 }
 
+void PriceGuideCache::setMaxDatabaseSize(quint64 maxSize)
+{
+    d->m_maintenance.setMaxSize(maxSize);
+
+    // let the save thread do the eviction right away
+    d->m_saveMutex.lock();
+    d->m_saveTrigger.wakeAll();
+    d->m_saveMutex.unlock();
+}
+
 void PriceGuideCache::clearCache()
 {
     int lastLeftOver = 0;
@@ -694,12 +869,30 @@ void PriceGuideCache::clearCache()
         QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents, 500);
     }
 
-    AppStatistics::inst()->update(d->m_cacheStatId, d->m_cache.count());
+    AppStatistics::inst()->setGauge(d->m_cacheStatId, d->m_cache.count());
 }
 
-QPair<int, int> PriceGuideCache::cacheStats() const
+void PriceGuideCache::setMemoryBudget(quint64 budget)
 {
-    return qMakePair(d->m_cache.totalCost(), d->m_cache.maxCost());
+    if (!budget)
+        budget = 5000 * sizeof(PriceGuide);
+
+    // each price guide has the cost of its size in bytes
+    d->m_cache.setMaxCost(int(std::min<quint64>(budget, std::numeric_limits<int>::max())));
+}
+
+void PriceGuideCache::setMaxInFlightBatches(int count)
+{
+    // only the batched retriever sends requests in parallel
+    if (auto batched = qobject_cast<BatchedAffiliateAPIPGRetriever *>(d->m_retriever)) {
+        batched->setMaxInFlightBatches((count > 0) ? count
+                                                   : BatchedAffiliateAPIPGRetriever::DefaultMaxInFlightBatches);
+    }
+}
+
+QPair<quint64, quint64> PriceGuideCache::cacheStats() const
+{
+    return qMakePair(quint64(d->m_cache.totalCost()), quint64(d->m_cache.maxCost()));
 }
 
 PriceGuide *PriceGuideCache::priceGuide(const Item *item, const Color *color, bool highPriority)
@@ -715,17 +908,18 @@ PriceGuide *PriceGuideCache::priceGuide(const Item *item, const Color *color, Va
 
     auto key = PriceGuideCachePrivate::cacheKey(item, color, vatType);
     PriceGuide *pg = d->m_cache[key];
+    AppStatistics::inst()->hit(d->m_hitRateStatId, pg != nullptr);
 
     bool needToLoad = !pg || (!pg->isValid() && (pg->updateStatus() == UpdateStatus::UpdateFailed));
 
     if (!pg) {
         pg = new PriceGuide(item, color, vatType);
-        if (!d->m_cache.insert(key, pg)) {
+        if (!d->m_cache.insert(key, pg, int(sizeof(PriceGuide)))) {
             qCWarning(LogCache, "Can not add price guide to cache (cache max/cur: %d/%d, cost: %d)",
-                      int(d->m_cache.maxCost()), int(d->m_cache.totalCost()), 1);
+                      int(d->m_cache.maxCost()), int(d->m_cache.totalCost()), int(sizeof(PriceGuide)));
             return nullptr;
         }
-        AppStatistics::inst()->update(d->m_cacheStatId, d->m_cache.count());
+        AppStatistics::inst()->setGauge(d->m_cacheStatId, d->m_cache.count());
     }
 
     if (needToLoad) {
@@ -871,7 +1065,7 @@ void PriceGuideCachePrivate::load(PriceGuide *pg, bool highPriority)
     auto queueSize = m_loadQueue.size();
     m_loadMutex.unlock();
 
-    AppStatistics::inst()->update(m_loadsStatId, queueSize);
+    AppStatistics::inst()->setGauge(m_loadsStatId, queueSize);
 }
 
 void PriceGuideCachePrivate::save(PriceGuide *pg)
@@ -881,12 +1075,31 @@ void PriceGuideCachePrivate::save(PriceGuide *pg)
 
     pg->addRef();
     m_saveMutex.lock();
-    m_saveQueue.append({ pg, SaveData });
+    m_saveQueue.append(pg);
+    m_saveTrigger.wakeOne();
+    auto queueSize = m_saveQueue.size();
+    m_saveMutex.unlock();
+
+    AppStatistics::inst()->setGauge(m_savesStatId, queueSize);
+}
+
+void PriceGuideCachePrivate::save(const QVector<PriceGuide *> &pgs)
+{
+    if (pgs.isEmpty())
+        return;
+
+    for (auto *pg : pgs)
+        pg->addRef();
+
+    m_saveMutex.lock();
+    m_saveQueue.reserve(m_saveQueue.size() + pgs.size());
+    for (auto *pg : pgs)
+        m_saveQueue.append(pg);
     m_saveTrigger.wakeOne();
     auto queueSize = m_saveQueue.size();
     m_saveMutex.unlock();
 
-    AppStatistics::inst()->update(m_savesStatId, queueSize);
+    AppStatistics::inst()->setGauge(m_savesStatId, queueSize);
 }
 
 void PriceGuideCachePrivate::loadThread(QString dbName, int index)
@@ -914,7 +1127,9 @@ void PriceGuideCachePrivate::loadThread(QString dbName, int index)
             auto queueSize = m_loadQueue.size();
             locker.unlock();
 
-            AppStatistics::inst()->update(m_loadsStatId, queueSize);
+            tracezone zone("PriceGuideCache::load");
+            Tracer::counter("PriceGuideCache load queue", queueSize);
+            AppStatistics::inst()->setGauge(m_loadsStatId, queueSize);
 
             bool loaded = false;
             QDateTime lastUpdated;
@@ -922,8 +1137,11 @@ void PriceGuideCachePrivate::loadThread(QString dbName, int index)
             bool highPriority = (loadType == LoadHighPriority);
 
             if (db.isOpen()) {
-                loadQuery.bindValue(u":id"_qs, databaseTag(pg, m_retriever));
+                const auto dbTag = databaseTag(pg, m_retriever);
+                loadQuery.bindValue(u":id"_qs, dbTag);
 
+                QElapsedTimer loadTimer;
+                loadTimer.start();
                 loadQuery.exec();
                 if (loadQuery.next()) {
                     lastUpdated = loadQuery.isNull(0) ? QDateTime()
@@ -932,19 +1150,17 @@ void PriceGuideCachePrivate::loadThread(QString dbName, int index)
                     loaded = data.isEmpty() || (data.size() == sizeof(PriceGuide::Data));
                 }
                 loadQuery.finish();
+                AppStatistics::inst()->record(m_loadLatencyStatId, loadTimer.nsecsElapsed() / 1000);
+
+                // update the last accessed time stamp (this is written back in batches)
+                if (loaded)
+                    m_maintenance.touch(dbTag);
             }
             pg->addRef(); // the release will happen on the main thread (see the invokeMethod below)
             QMetaObject::invokeMethod(m_core, [=, this, pg=pg]() { // clang bug: P1091R3
                 if (loaded) {
                     pg->setLastUpdated(lastUpdated);
                     std::memcpy(&pg->m_data, data, sizeof(PriceGuide::Data));
-
-                    // update the last accessed time stamp
-                    pg->addRef();
-                    m_saveMutex.lock();
-                    m_saveQueue.append({ pg, SaveAccessTimeOnly });
-                    m_saveTrigger.wakeOne();
-                    m_saveMutex.unlock();
                 }
                 pg->setIsValid(loaded);
                 pg->setUpdateStatus(UpdateStatus::Ok);
@@ -977,13 +1193,12 @@ void PriceGuideCachePrivate::saveThread(QString dbName, int index)
                       "ON CONFLICT(id) DO UPDATE "
                       "SET updated=excluded.updated,accessed=excluded.accessed,data=excluded.data;"_qs);
 
-    QSqlQuery accessQuery(db);
-    accessQuery.prepare(u"UPDATE pg SET accessed=:accessed WHERE id=:id;"_qs);
+    int maintenanceTimeout = SqlCacheMaintenance::FlushInterval;
 
     while (!m_stop) {
         QMutexLocker locker(&m_saveMutex);
         if (m_saveQueue.isEmpty())
-            m_saveTrigger.wait(&m_saveMutex);
+            m_saveTrigger.wait(&m_saveMutex, QDeadlineTimer(maintenanceTimeout));
 
         if (!m_saveQueue.isEmpty()) {
             // we might have multiple saver threads, so don't grab the full queue at once
@@ -992,46 +1207,41 @@ void PriceGuideCachePrivate::saveThread(QString dbName, int index)
             auto queueSize = m_saveQueue.size();
             locker.unlock();
 
-            AppStatistics::inst()->update(m_savesStatId, queueSize);
+            AppStatistics::inst()->setGauge(m_savesStatId, queueSize);
 
             if (db.isOpen()) {
                 db.transaction();
 
                 qint64 now = QDateTime::currentMSecsSinceEpoch();
 
-                for (auto [pg, saveType] : saveQueueCopy) {
-                    auto dbTag = databaseTag(pg, m_retriever);
-
-                    if (saveType == SaveAccessTimeOnly) {
-                        accessQuery.bindValue(u":id"_qs, dbTag);
-                        accessQuery.bindValue(u":accessed"_qs, now);
-                        if (!accessQuery.exec()) {
-                            qCWarning(LogSql) << "Failed to update the access time of a price-guide:"
-                                              << accessQuery.lastError().text();
-                        }
-                        accessQuery.finish();
-                    } else {
-                        auto lastUpdated = QVariant(QMetaType::fromType<qint64>());
-                        if (pg->lastUpdated().isValid())
-                            lastUpdated = QVariant::fromValue(pg->lastUpdated().toMSecsSinceEpoch());
-
-                        saveQuery.bindValue(u":id"_qs, dbTag);
-                        saveQuery.bindValue(u":updated"_qs, lastUpdated);
-                        saveQuery.bindValue(u":accessed"_qs, now);
-                        saveQuery.bindValue(u":data"_qs, QByteArray::fromRawData(reinterpret_cast<const char *>(&pg->m_data),
-                                                                                 sizeof(PriceGuide::Data)));
-                        if (!saveQuery.exec()) {
-                            qCWarning(LogSql) << "Failed to save price-guide data:"
-                                              << saveQuery.lastError().text();
-                        }
-                        saveQuery.finish();
+                for (auto *pg : saveQueueCopy) {
+                    auto lastUpdated = QVariant(QMetaType::fromType<qint64>());
+                    if (pg->lastUpdated().isValid())
+                        lastUpdated = QVariant::fromValue(pg->lastUpdated().toMSecsSinceEpoch());
+
+                    saveQuery.bindValue(u":id"_qs, databaseTag(pg, m_retriever));
+                    saveQuery.bindValue(u":updated"_qs, lastUpdated);
+                    saveQuery.bindValue(u":accessed"_qs, now);
+                    saveQuery.bindValue(u":data"_qs, QByteArray::fromRawData(reinterpret_cast<const char *>(&pg->m_data),
+                                                                             sizeof(PriceGuide::Data)));
+                    if (!saveQuery.exec()) {
+                        qCWarning(LogSql) << "Failed to save price-guide data:"
+                                          << saveQuery.lastError().text();
                     }
+                    saveQuery.finish();
                     pg->release();
                 }
                 db.commit();
             }
+        } else {
+            locker.unlock();
         }
+
+        // batched access time updates and LRU eviction
+        if (!m_stop)
+            maintenanceTimeout = m_maintenance.run(db);
     }
+    m_maintenance.run(db, true /*force flush*/);
     db.close();
 }
 
@@ -1065,6 +1275,26 @@ void PriceGuideCachePrivate::retrieveFinished(PriceGuide *pg, const PriceGuide::
     emit q->priceGuideUpdated(pg);
 }
 
+void PriceGuideCachePrivate::retrieveBatchFinished(const QVector<PriceGuide *> &pgs,
+                                                   const QVector<PriceGuide::Data> &data)
+{
+    Q_ASSERT(pgs.size() == data.size());
+
+    const auto now = QDateTime::currentDateTime();
+    for (qsizetype i = 0; i < pgs.size(); ++i) {
+        pgs.at(i)->setLastUpdated(now);
+        pgs.at(i)->m_data = data.at(i);
+    }
+
+    save(pgs);
+
+    for (auto *pg : pgs) {
+        pg->setIsValid(true);
+        pg->setUpdateStatus(UpdateStatus::Ok);
+        emit q->priceGuideUpdated(pg);
+    }
+}
+
 void PriceGuideCachePrivate::retrieveFailed(PriceGuide *pg, const QString &errorString [[maybe_unused]])
 {
     qCWarning(LogCache).noquote() << errorString;
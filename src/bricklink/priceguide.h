@@ -105,8 +105,11 @@ public:
     ~PriceGuideCache() override;
 
     void setUpdateInterval(int interval);
+    void setMaxDatabaseSize(quint64 maxSize); // in bytes, 0 means unlimited
     void clearCache();
-    QPair<int, int> cacheStats() const;
+    void setMemoryBudget(quint64 budget); // in bytes, 0 means automatic
+    void setMaxInFlightBatches(int count); // 0 means the retriever's default
+    QPair<quint64, quint64> cacheStats() const; // memory used and budget in bytes
 
     PriceGuide *priceGuide(const Item *item, const Color *color, bool highPriority = false);
     PriceGuide *priceGuide(const Item *item, const Color *color, VatType vatType,
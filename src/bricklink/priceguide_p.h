@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <memory>
+
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QHash>
 #include <QtCore/QByteArray>
@@ -10,10 +12,12 @@
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
 #include <QtCore/QVector>
+#include <QtCore/QMultiHash>
 #include <QtSql/QSqlDatabase>
 
 #include "utility/q3cache.h"
 #include "global.h"
+#include "sqlcache_p.h"
 #include "priceguide.h"
 
 QT_FORWARD_DECLARE_CLASS(QTimer)
@@ -42,6 +46,8 @@ public:
 
 signals:
     void finished(BrickLink::PriceGuide *pg, const BrickLink::PriceGuide::Data &data);
+    void finishedBatch(const QVector<BrickLink::PriceGuide *> &pgs,
+                       const QVector<BrickLink::PriceGuide::Data> &data);
     void failed(BrickLink::PriceGuide *pg, const QString &errorString);
 };
 
@@ -87,18 +93,49 @@ public:
     void cancelAll() override;
 
     void setApiKey(const QString &key);
+    void setMaxInFlightBatches(int count);
 
     static constexpr qsizetype MaxBatchSize = 500;
     static constexpr qint64 MaxBatchAgeMSec = 100;
+    static constexpr int DefaultMaxInFlightBatches = 4;
 
 private:
+    struct Batch
+    {
+        TransferJob *job = nullptr;
+        VatType vatType = VatType::Excluded;
+        QVector<PriceGuide *> pgs; // nullptr: canceled while in flight
+        QVector<QString> requestKeys; // see requestKey()
+    };
+
+    struct BatchReply
+    {
+        QVector<std::pair<qsizetype, PriceGuide::Data>> results; // index into Batch::pgs
+        QString errorString;
+    };
+
     void check();
+    void sendBatch();
     void transferJobFinished(TransferJob *j);
+    void deliverBatch(const std::shared_ptr<Batch> &batch, const BatchReply &reply);
+    void finishRequest(PriceGuide *pg, const PriceGuide::Data *data, const QString &errorString,
+                       QVector<PriceGuide *> &finishedPgs, QVector<PriceGuide::Data> &finishedData,
+                       QVector<PriceGuide *> &releasePgs);
+    bool raisePriority(PriceGuide *pg);
+    static BatchReply parseBatchReply(const QByteArray &json, const QVector<QString> &requestKeys);
+    static QString requestKey(const QString &typeId, const QString &itemId, int colorId);
     static QString itemTypeApiId(const ItemType *itt);
 
     Core *m_core = nullptr;
-    QVector<PriceGuide *> m_currentBatch;
-    TransferJob *m_currentJob = nullptr;
+    QVector<std::shared_ptr<Batch>> m_batches; // either waiting for a reply or being parsed
+    int m_inFlightCount = 0;
+    int m_maxInFlightBatches = DefaultMaxInFlightBatches;
+
+    // all requested pgs, queued or in flight: requests for the same item, color and VAT type
+    // are coalesced into a single "leader" pg and its followers
+    QHash<quint64, PriceGuide *> m_pending;
+    QMultiHash<PriceGuide *, PriceGuide *> m_followers;
+
     QVector<std::pair<PriceGuide *, QElapsedTimer>> m_nextBatch;
     VatType m_nextBatchVatType = VatType::Excluded;
     qsizetype m_nextBatchPrioritySize = 0;
@@ -124,16 +161,12 @@ public:
         LoadLowPriority,
     };
 
-    enum SaveType {
-        SaveData,
-        SaveAccessTimeOnly,
-    };
-
     QVector<std::pair<PriceGuide *, LoadType>> m_loadQueue;
-    QVector<std::pair<PriceGuide *, SaveType>> m_saveQueue;
+    QVector<PriceGuide *> m_saveQueue;
     QString m_dbName;
     QSqlDatabase m_db;
     QVector<QThread *> m_threads;
+    SqlCacheMaintenance m_maintenance { u"pg"_qs };
 
     int m_updateInterval = 0;
     QMap<QString, VatType> m_vatType;  // key: retriever->id()
@@ -143,6 +176,8 @@ public:
     int m_cacheStatId = -1;
     int m_loadsStatId = -1;
     int m_savesStatId = -1;
+    int m_hitRateStatId = -1;
+    int m_loadLatencyStatId = -1;
 
     static quint64 cacheKey(const Item *item, const Color *color, VatType vatType);
     static QString databaseTag(PriceGuide *pg, PriceGuideRetrieverInterface *retriever);
@@ -150,10 +185,12 @@ public:
 
     void load(PriceGuide *pg, bool highPriority);
     void save(PriceGuide *pg);
+    void save(const QVector<PriceGuide *> &pgs);
     void loadThread(QString dbName, int index);
     void saveThread(QString dbName, int index);
 
     void retrieveFinished(PriceGuide *pg, const PriceGuide::Data &data);
+    void retrieveBatchFinished(const QVector<PriceGuide *> &pgs, const QVector<PriceGuide::Data> &data);
     void retrieveFailed(PriceGuide *pg, const QString &errorString);
 };
 
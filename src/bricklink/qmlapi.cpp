@@ -3,7 +3,11 @@
 
 #include <QQmlInfo>
 #include <QQmlEngine>
+#include <QtConcurrent/QtConcurrentRun>
 
+#include <QCoro/QCoroFuture>
+
+#include "canbuild.h"
 #include "model.h"
 #include "picture.h"
 #include "priceguide.h"
@@ -315,6 +319,12 @@ QmlCategory::QmlCategory(const Category *cat)
 /*! \qmlproperty list<string> Item::alternateIds
     Returns a list of all alternate BrickLink ids registered for this item.
 */
+/*! \qmlmethod list<object> Item::appearsIn(Color color)
+    Returns a list of all the items this item appears in. If a valid \a color is given, only the
+    appearances in that color are returned.
+    Each entry is an object with the properties \c item (an \l Item), \c color (a \l Color) and
+    \c quantity (an \c int).
+*/
 
 QmlItem::QmlItem(const Item *item)
     : QmlWrapperBase(item)
@@ -362,6 +372,18 @@ QVariantList QmlItem::consistsOf() const
     }
     return result;
 }
+QVariantList QmlItem::appearsIn(QmlColor color) const
+{
+    QVariantList result;
+    for (const auto &[c, item, quantity] : wrapped->appearsInRange(color.wrappedObject())) {
+        result.append(QVariantMap {
+                          { u"item"_qs, QVariant::fromValue(QmlItem { item }) },
+                          { u"color"_qs, QVariant::fromValue(QmlColor { c }) },
+                          { u"quantity"_qs, quantity },
+                      });
+    }
+    return result;
+}
 
 PartOutTraits QmlItem::partOutTraits() const
 {
@@ -955,7 +977,7 @@ QmlLot QmlBrickLink::lot(const QVariant &v) const
         return v.value<BrickLink::Lot *>();
 }
 
-InventoryModel *QmlBrickLink::inventoryModel(InventoryModel::Mode mode, const QVariantList &simpleLots)
+static QVector<InventoryModel::SimpleLot> toSimpleLots(const QVariantList &simpleLots)
 {
     QVector<BrickLink::InventoryModel::SimpleLot> list;
 
@@ -982,12 +1004,57 @@ InventoryModel *QmlBrickLink::inventoryModel(InventoryModel::Mode mode, const QV
         if (item && color)
             list.emplace_back(item, color, qty);
     }
+    return list;
+}
 
-    auto *iim = new InventoryModel(mode, list, nullptr);
+InventoryModel *QmlBrickLink::inventoryModel(InventoryModel::Mode mode, const QVariantList &simpleLots)
+{
+    auto *iim = new InventoryModel(mode, toSimpleLots(simpleLots), nullptr);
     iim->sort(0, Qt::DescendingOrder);
     return iim;
 }
 
+/*! \qmlmethod object BrickLink::canBuild(list<object> simpleLots, real minimumFraction = 1)
+    Checks which sets can be built from the parts in \a simpleLots, which uses the same format
+    as for inventoryModel(): a list of objects with \c item, \c color and \c quantity
+    properties.
+    The check runs in the background and the returned promise resolves to a list of objects
+    with an \c item and a \c fraction property. With the default \a minimumFraction of \c 1,
+    only the sets that can be completely built are returned. Otherwise all sets where at least
+    this fraction of the parts (not counting alternates) are available are returned as well.
+    If the database is updated while the check is running, the promise resolves to an empty list.
+*/
+QCoro::QmlTask QmlBrickLink::canBuild(const QVariantList &simpleLots, double minimumFraction) const
+{
+    return [](QVector<InventoryModel::SimpleLot> lots, float minimumFraction) -> QCoro::Task<QVariantList> {
+        // The lots and the resulting sets point into the current database: keep it alive until
+        // the result list has been built, even if an update replaces it in the meantime.
+        auto contents = core()->database()->retainContents();
+
+        // creating the first engine also builds the catalog-wide index, which takes a while
+        const auto sets = co_await QtConcurrent::run([lots, minimumFraction]() {
+            CanBuildEngine engine;
+            engine.setInventory(lots);
+            return engine.sets(minimumFraction);
+        });
+
+        // the database has been reset while we were waiting: the sets are stale
+        if (core()->database()->retainContents() != contents)
+            co_return QVariantList { };
+
+        QVariantList result;
+        result.reserve(sets.size());
+        for (const auto &[set, fraction] : sets) {
+            result << QVariantMap {
+                { u"item"_qs, QVariant::fromValue(QmlItem { set }) },
+                { u"fraction"_qs, double(fraction) },
+            };
+        }
+        contents.reset();
+        co_return result;
+    }(toSimpleLots(simpleLots), float(minimumFraction));
+}
+
 QString QmlBrickLink::itemHtmlDescription(QmlItem item, QmlColor color, const QColor &highlight) const
 {
     return BrickLink::core()->itemHtmlDescription(item.wrappedObject(), color.wrappedObject(), highlight);
@@ -1013,6 +1080,57 @@ QVariantList QmlBrickLink::supportedVatTypes() const
     return result;
 }
 
+/*! \qmlmethod object BrickLink::orderLotsSummary(OrderType type, date fromDate, date toDate, string currencyCode)
+    Aggregates all the lots in the locally cached orders of the given \a type, that were placed
+    between \a fromDate and \a toDate. Cancelled orders are ignored.
+    The result is a list of Lots, one per item, color and condition: the quantity is the total
+    quantity and the price is the average price, converted to \a currencyCode if it is set.
+    The returned promise resolves to this list, as soon as all orders have been indexed.
+*/
+QCoro::QmlTask QmlBrickLink::orderLotsSummary(OrderType type, const QDate &fromDate, const QDate &toDate,
+                                              const QString &currencyCode) const
+{
+    return [](OrderType type, QDate fromDate, QDate toDate, QString currencyCode) -> QCoro::Task<QVariantList> {
+        const auto lots = co_await core()->orders()->lotsSummary(type, fromDate, toDate, currencyCode);
+        QVariantList result;
+        result.reserve(lots.size());
+        for (auto *lot : lots)
+            result << QVariant::fromValue(QmlLot::create(std::move(lot)));
+        co_return result;
+    }(type, fromDate, toDate, currencyCode);
+}
+
+/*! \qmlmethod object BrickLink::orderLotsTrend(OrderType type, Item item, Color color, enumeration interval, date fromDate, date toDate, string currencyCode)
+    Returns the time-bucketed trend of the lots in the locally cached orders of the given \a type,
+    that were placed between \a fromDate and \a toDate. Either \a item or \a color can be \c
+    noItem or \c noColor to match everything.
+    Each entry in the returned list is an object with the properties \c date (the start of the
+    bucket), \c quantity, \c revenue (in \a currencyCode if set) and \c orderCount.
+    \a interval is one of \c Orders.Day, \c Orders.Week, \c Orders.Month or \c Orders.Year.
+    The returned promise resolves to this list, as soon as all orders have been indexed.
+*/
+QCoro::QmlTask QmlBrickLink::orderLotsTrend(OrderType type, QmlItem item, QmlColor color,
+                                            Orders::TrendInterval interval, const QDate &fromDate,
+                                            const QDate &toDate, const QString &currencyCode) const
+{
+    auto task = core()->orders()->lotsTrend(type, item.wrappedObject(), color.wrappedObject(),
+                                            interval, fromDate, toDate, currencyCode);
+    return [](QCoro::Task<QVector<Orders::TrendEntry>> task) -> QCoro::Task<QVariantList> {
+        const auto trend = co_await std::move(task);
+        QVariantList result;
+        result.reserve(trend.size());
+        for (const auto &entry : trend) {
+            result << QVariantMap {
+                { u"date"_qs, entry.start },
+                { u"quantity"_qs, entry.quantity },
+                { u"revenue"_qs, entry.revenue },
+                { u"orderCount"_qs, entry.orderCount },
+            };
+        }
+        co_return result;
+    }(std::move(task));
+}
+
 QString QmlBrickLink::descriptionForVatType(VatType vatType) const
 {
     return BrickLink::core()->priceGuideCache()->descriptionForVatType(vatType);
@@ -11,6 +11,8 @@
 #include <QtCore/QIdentityProxyModel>
 #include <QtQml/QQmlEngine>
 
+#include <QCoro/QCoroQmlTask>
+
 #include "core.h"
 #include "color.h"
 #include "itemtype.h"
@@ -96,10 +98,18 @@ public:
 
     Q_INVOKABLE BrickLink::InventoryModel *inventoryModel(BrickLink::InventoryModel::Mode mode,
                                                           const QVariantList &simpleLots);
+    Q_INVOKABLE QCoro::QmlTask canBuild(const QVariantList &simpleLots, double minimumFraction = 1.) const;
 
     Q_INVOKABLE QString itemHtmlDescription(BrickLink::QmlItem item, BrickLink::QmlColor color,
                                             const QColor &highlight) const;
 
+    Q_INVOKABLE QCoro::QmlTask orderLotsSummary(BrickLink::OrderType type, const QDate &fromDate,
+                                                const QDate &toDate, const QString &currencyCode = { }) const;
+    Q_INVOKABLE QCoro::QmlTask orderLotsTrend(BrickLink::OrderType type, BrickLink::QmlItem item,
+                                              BrickLink::QmlColor color, BrickLink::Orders::TrendInterval interval,
+                                              const QDate &fromDate, const QDate &toDate,
+                                              const QString &currencyCode = { }) const;
+
     BrickLink::VatType currentVatType() const;
     void setCurrentVatType(BrickLink::VatType vatType);
     QVariantList supportedVatTypes() const;
@@ -341,7 +351,7 @@ public:
     Q_INVOKABLE QVariantList consistsOf() const;
     Q_INVOKABLE BrickLink::PartOutTraits partOutTraits() const;
 
-    // tough .. BrickLink::AppearsIn appearsIn(const Color *color = nullptr) const;
+    Q_INVOKABLE QVariantList appearsIn(BrickLink::QmlColor color = { }) const;
 
     friend class QmlBrickLink;
 };
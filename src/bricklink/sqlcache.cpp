@@ -0,0 +1,196 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+
+#include <QtCore/QDateTime>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QStringList>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+#include "bricklink/sqlcache_p.h"
+
+Q_DECLARE_LOGGING_CATEGORY(LogCache)
+Q_DECLARE_LOGGING_CATEGORY(LogSql)
+
+
+namespace BrickLink {
+
+SqlCacheMaintenance::SqlCacheMaintenance(const QString &table)
+    : m_table(table)
+{ }
+
+void SqlCacheMaintenance::prepareDatabase(QSqlDatabase &db)
+{
+    // This only has an effect on brand new files. Converting existing ones would need a full
+    // VACUUM, which blocks the save thread for minutes on multi-GB caches: they simply keep
+    // the freed pages and reuse them for new entries.
+    QSqlQuery avQuery(u"PRAGMA auto_vacuum = INCREMENTAL;"_qs, db);
+    if (avQuery.lastError().isValid())
+        qCWarning(LogSql) << "Failed to set auto_vacuum mode on" << db.databaseName() << ":"
+                          << avQuery.lastError().text();
+}
+
+void SqlCacheMaintenance::prepareTable(QSqlDatabase &db)
+{
+    // the eviction walks this index in LRU order and stops as soon as enough space is freed,
+    // instead of sorting the whole table
+    QSqlQuery indexQuery(u"CREATE INDEX IF NOT EXISTS %1_accessed ON %1(accessed);"_qs.arg(m_table), db);
+    if (indexQuery.lastError().isValid())
+        qCWarning(LogSql) << "Failed to create the access time index on the" << m_table << "cache:"
+                          << indexQuery.lastError().text();
+}
+
+void SqlCacheMaintenance::touch(const QString &id)
+{
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+
+    QMutexLocker locker(&m_mutex);
+    m_accessed.insert(id, now);
+}
+
+quint64 SqlCacheMaintenance::maxSize() const
+{
+    return m_maxSize.loadRelaxed();
+}
+
+void SqlCacheMaintenance::setMaxSize(quint64 maxSize)
+{
+    if (m_maxSize.fetchAndStoreRelaxed(maxSize) != maxSize)
+        m_evictionCheckNeeded = true;
+}
+
+int SqlCacheMaintenance::run(QSqlDatabase &db, bool force)
+{
+    if (!m_lastFlush.isValid())
+        m_lastFlush.start();
+
+    if (!db.isOpen())
+        return FlushInterval;
+
+    const bool checkEviction = !force && (m_evictionCheckNeeded.fetchAndStoreRelaxed(false)
+                                          || !m_lastEvictionCheck.isValid()
+                                          || m_lastEvictionCheck.hasExpired(EvictionCheckInterval));
+
+    // the eviction is based on the access times, so they have to be up-to-date
+    if (force || checkEviction || m_lastFlush.hasExpired(FlushInterval)) {
+        flushAccessTimes(db);
+        m_lastFlush.restart();
+    }
+    if (checkEviction) {
+        evictLeastRecentlyUsed(db);
+        m_lastEvictionCheck.restart();
+    }
+
+    return int(std::max(0LL, std::min(FlushInterval - m_lastFlush.elapsed(),
+                                      EvictionCheckInterval - m_lastEvictionCheck.elapsed())));
+}
+
+bool SqlCacheMaintenance::flushAccessTimes(QSqlDatabase &db)
+{
+    QHash<QString, qint64> accessed;
+    {
+        QMutexLocker locker(&m_mutex);
+        accessed.swap(m_accessed);
+    }
+    if (accessed.isEmpty())
+        return true;
+
+    QSqlQuery accessQuery(db);
+    accessQuery.prepare(u"UPDATE %1 SET accessed=:accessed WHERE id=:id;"_qs.arg(m_table));
+
+    bool ok = true;
+    db.transaction();
+    for (auto it = accessed.cbegin(); it != accessed.cend(); ++it) {
+        accessQuery.bindValue(u":id"_qs, it.key());
+        accessQuery.bindValue(u":accessed"_qs, it.value());
+        if (!accessQuery.exec()) {
+            qCWarning(LogSql) << "Failed to update the access times in the" << m_table << "cache:"
+                              << accessQuery.lastError().text();
+            ok = false;
+            break;
+        }
+        accessQuery.finish();
+    }
+    db.commit();
+    return ok;
+}
+
+void SqlCacheMaintenance::evictLeastRecentlyUsed(QSqlDatabase &db)
+{
+    const quint64 maxSize = m_maxSize.loadRelaxed();
+    if (!maxSize)
+        return;
+    const quint64 size = liveDatabaseSize(db);
+    if (size <= maxSize)
+        return;
+
+    // shrink to 90% of the limit, so that we do not end up here again after the next few saves
+    const quint64 toFree = size - (maxSize / 10 * 9);
+    quint64 freed = 0;
+    QStringList ids;
+
+    {
+        // this steps through the accessed index (see prepareTable()), so only the rows that are
+        // actually evicted are ever read
+        QSqlQuery lruQuery(db);
+        lruQuery.setForwardOnly(true);
+        if (!lruQuery.exec(u"SELECT id,length(id)+length(data) FROM %1 ORDER BY accessed;"_qs.arg(m_table))) {
+            qCWarning(LogSql) << "Failed to query the access times in the" << m_table << "cache:"
+                              << lruQuery.lastError().text();
+            return;
+        }
+        while ((freed < toFree) && lruQuery.next()) {
+            ids.append(lruQuery.value(0).toString());
+            freed += lruQuery.value(1).toULongLong();
+        }
+    }
+    if (ids.isEmpty())
+        return;
+
+    QSqlQuery deleteQuery(db);
+    deleteQuery.prepare(u"DELETE FROM %1 WHERE id=:id;"_qs.arg(m_table));
+
+    db.transaction();
+    for (const auto &id : std::as_const(ids)) {
+        deleteQuery.bindValue(u":id"_qs, id);
+        if (!deleteQuery.exec()) {
+            qCWarning(LogSql) << "Failed to evict an entry from the" << m_table << "cache:"
+                              << deleteQuery.lastError().text();
+        }
+        deleteQuery.finish();
+    }
+    db.commit();
+
+    // every step of this PRAGMA frees a single page, so we have to iterate over all of them
+    // (a no-op for files without auto_vacuum, see prepareDatabase())
+    QSqlQuery vacuumQuery(db);
+    vacuumQuery.setForwardOnly(true);
+    if (vacuumQuery.exec(u"PRAGMA incremental_vacuum;"_qs)) {
+        while (vacuumQuery.next())
+            ;
+    }
+    vacuumQuery.finish();
+    QSqlQuery(u"PRAGMA wal_checkpoint(PASSIVE);"_qs, db);
+
+    qCInfo(LogCache).noquote() << "Evicted" << ids.size() << "entries from the" << m_table << "cache:"
+                               << (size / 1'000'000) << "MB ->" << (liveDatabaseSize(db) / 1'000'000)
+                               << "MB (limit:" << (maxSize / 1'000'000) << "MB)";
+}
+
+quint64 SqlCacheMaintenance::liveDatabaseSize(QSqlDatabase &db)
+{
+    auto pragma = [&db](const QString &name) -> quint64 {
+        QSqlQuery query(u"PRAGMA "_qs + name + u';', db);
+        return query.next() ? query.value(0).toULongLong() : 0;
+    };
+
+    const auto pageCount = pragma(u"page_count"_qs);
+    const auto freeCount = pragma(u"freelist_count"_qs);
+    return (pageCount - std::min(pageCount, freeCount)) * pragma(u"page_size"_qs);
+}
+
+} // namespace BrickLink
@@ -0,0 +1,61 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QAtomicInteger>
+
+QT_FORWARD_DECLARE_CLASS(QSqlDatabase)
+
+
+namespace BrickLink {
+
+// Housekeeping shared by the picture and price-guide caches: both keep their blobs in a
+// WAL-mode SQLite table with `id`, `accessed` and `data` columns.
+//
+// Access times are only collected in memory (touch() is cheap and can be called from any
+// thread) and are written back in a single transaction every FlushInterval. The same
+// maintenance pass evicts the least recently used rows, whenever the live size of the
+// database exceeds maxSize(), and hands the freed pages back to the file system via
+// incremental vacuuming (files created before that was enabled just reuse their free pages).
+// All functions taking a QSqlDatabase are only ever called from the cache's save thread.
+
+class SqlCacheMaintenance
+{
+public:
+    explicit SqlCacheMaintenance(const QString &table);
+
+    static constexpr int FlushInterval = 30 * 1000;          // msec
+    static constexpr int EvictionCheckInterval = 300 * 1000; // msec
+
+    static void prepareDatabase(QSqlDatabase &db);
+    // has to be called after the table has been created
+    void prepareTable(QSqlDatabase &db);
+
+    void touch(const QString &id);
+
+    quint64 maxSize() const;
+    void setMaxSize(quint64 maxSize);
+
+    // returns the time in msec until the next maintenance pass is due
+    int run(QSqlDatabase &db, bool force = false);
+
+private:
+    bool flushAccessTimes(QSqlDatabase &db);
+    void evictLeastRecentlyUsed(QSqlDatabase &db);
+    static quint64 liveDatabaseSize(QSqlDatabase &db);
+
+    const QString m_table;
+    QMutex m_mutex;
+    QHash<QString, qint64> m_accessed;  // id -> msecsSinceEpoch
+    QAtomicInteger<quint64> m_maxSize = 0;
+    QAtomicInteger<bool> m_evictionCheckNeeded = true;
+    QElapsedTimer m_lastFlush;
+    QElapsedTimer m_lastEvictionCheck;
+};
+
+} // namespace BrickLink
@@ -1,6 +1,9 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
+#include <numeric>
+
 #include <QtCore/QBitArray>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QFile>
@@ -15,7 +18,9 @@
 #include <QtCore/QtDebug>
 #include <QtCore/QDirIterator>
 #include <QtCore/QUrlQuery>
-#include <QtCore/QXmlStreamReader>
+#include <QtCore/QThreadPool>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include <QCoro/QCoroSignal>
 #include <QCoro/QCoroTimer>
@@ -27,6 +32,7 @@
 #include "bricklink/textimport_p.h"
 #include "minizip/minizip.h"
 #include "utility/exception.h"
+#include "utility/tracing.h"
 #include "utility/transfer.h"
 
 
@@ -66,7 +72,10 @@ static QUrl ldrawUrl(const char *page)
 
 static QUrl brickLinkUrl(const char *page)
 {
-    return QUrl(u"https://www.bricklink.com/"_qs + QString::fromLatin1(page));
+    // can be pointed to a local stand-in server for testing
+    static const QString baseUrl = qEnvironmentVariable("BRICKSTORE_BRICKLINK_URL",
+                                                        u"https://www.bricklink.com/"_qs);
+    return QUrl(baseUrl + QString::fromLatin1(page));
 };
 
 static QUrl catalogQuery(int which)
@@ -111,6 +120,33 @@ static QUrl itemInventoryQuery(const BrickLink::Item *item)
     return url;
 };
 
+// Splits [0, count) into chunks and calls func(from, to) for each of them on the pool. The
+// results are returned in order.
+template <typename Result, typename Func>
+static QVector<Result> mapChunks(QThreadPool *pool, qsizetype count, Func func)
+{
+    static constexpr qsizetype ChunkSize = 8192;
+
+    QVector<std::pair<qsizetype, qsizetype>> chunks;
+    chunks.reserve(count / ChunkSize + 1);
+    for (qsizetype from = 0; from < count; from += ChunkSize)
+        chunks.append({ from, std::min(count, from + ChunkSize) });
+
+    return QtConcurrent::blockingMapped<QVector<Result>>(pool, chunks,
+                                                         [&func](const std::pair<qsizetype, qsizetype> &chunk) {
+        return func(chunk.first, chunk.second);
+    });
+}
+
+template <typename Func>
+static void forEachChunk(QThreadPool *pool, qsizetype count, Func func)
+{
+    mapChunks<bool>(pool, count, [&func](qsizetype from, qsizetype to) {
+        func(from, to);
+        return true;
+    });
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
@@ -206,12 +242,17 @@ QCoro::Task<> TextImport::importCatalog()
 
     m_db->m_items.reserve(200'000);
 
+    // the additional categories can only be parsed after the items of the same type
+    DownloadQueue itemQueue(this, u"Items"_qs, DownloadQueue::Delivery::InOrder);
+
     for (const ItemType &itt : std::as_const(m_db->m_itemTypes)) {
-        co_await download(catalogItemQuery(itt.id(), true), u"items/%1.xml"_qs.arg(itt.id())).then(
-            [this, &itt](QByteArray data) { readItems(data, &itt); });
-        co_await download(catalogItemQuery(itt.id(), false), u"items/%1.csv"_qs.arg(itt.id())).then(
-            [this, &itt](QByteArray data) { readAdditionalItemCategories(data, &itt); });
+        itemQueue.enqueue(catalogItemQuery(itt.id(), true), u"items/%1.xml"_qs.arg(itt.id()),
+                          [this, &itt](const QByteArray &data) { readItems(data, &itt); });
+        itemQueue.enqueue(catalogItemQuery(itt.id(), false), u"items/%1.csv"_qs.arg(itt.id()),
+                          [this, &itt](const QByteArray &data) { readAdditionalItemCategories(data, &itt); });
     }
+    if (co_await itemQueue.run())
+        throw Exception("Failed to import the catalog items: %1").arg(itemQueue.errors().constFirst());
 
     co_await download(brickLinkUrl("catalogRel.asp"), u"relationships.html"_qs).then(
         [this](QByteArray data) -> QCoro::Task<> { co_await readRelationships(data); });
@@ -237,58 +278,68 @@ QCoro::Task<> TextImport::importInventories()
             done.setBit(qsizetype(itemIndex), true);
     }
 
-    uint loaded = loadLastRunInventories([&, this](char itemTypeId, const QByteArray &itemId,
-                                                  const QDateTime &lastModified, const QByteArray &xml) {
-        if (auto item = readInventory(itemTypeId, itemId, lastModified, xml, true)) {
-            if (m_downloadArchive && m_downloadArchive->isOpen()) {
-                const QString filePath = u"%1/%2.xml"_qs.arg(item->itemTypeId()).arg(QLatin1StringView(item->id()));
-                try {
-                    m_downloadArchive->writeFile(filePath, xml, lastModified);
-                } catch (const Exception &e) {
-                    message(2, u"Failed to write inventory for %1/%2 to ZIP: %3"_qs
-                                   .arg(item->itemTypeId()).arg(QLatin1StringView(item->id()))
-                                   .arg(e.errorString()));
+    // parsing is done in parallel, but the results are merged in the original order, so that
+    // the resulting database is exactly the same as with a serial import
+    QThreadPool pool;
+    if (m_jobCount > 0)
+        pool.setMaxThreadCount(m_jobCount);
+
+    uint loaded = loadLastRunInventories([&, this](const QVector<InventoryFile> &files) {
+        QVector<ParsedInventory> parsed;
+        if (pool.maxThreadCount() > 1) {
+            parsed = QtConcurrent::blockingMapped(&pool, files, [this](const InventoryFile &file) {
+                return parseInventory(file);
+            });
+        } else {
+            parsed.reserve(files.size());
+            for (const auto &file : files)
+                parsed.append(parseInventory(file));
+        }
+
+        for (qsizetype i = 0; i < files.size(); ++i) {
+            const auto &file = files.at(i);
+
+            if (auto item = mergeInventory(std::move(parsed[i]))) {
+                if (m_downloadArchive && m_downloadArchive->isOpen()) {
+                    const QString filePath = u"%1/%2.xml"_qs.arg(item->itemTypeId()).arg(QLatin1StringView(item->id()));
+                    try {
+                        m_downloadArchive->writeFile(filePath, file.xml, file.lastModified);
+                    } catch (const Exception &e) {
+                        message(2, u"Failed to write inventory for %1/%2 to ZIP: %3"_qs
+                                       .arg(item->itemTypeId()).arg(QLatin1StringView(item->id()))
+                                       .arg(e.errorString()));
+                    }
                 }
+                done.setBit(item->index(), true);
             }
-            done.setBit(item->index(), true);
         }
     });
 
     message(u"Loaded %1 inventories, %2 are missing or outdated"_qs.arg(loaded).arg(done.count(false)));
 
-    int downloadsInProgress = 0;
-    int downloadsFailed = 0;
+    DownloadQueue queue(this, u"Inventories"_qs, DownloadQueue::Delivery::AsCompleted, 16);
+
     for (uint i = 0; i < m_db->m_items.size(); ++i) {
         const BrickLink::Item *item = &m_db->m_items[i];
         if (!done[i]) {
             const QString filePath = u"%1/%2.xml"_qs.arg(item->itemTypeId()).arg(QLatin1StringView(item->id()));
-            ++downloadsInProgress;
-            download(itemInventoryQuery(item), filePath).then(
-                [&, item](QByteArray data) {
-                    if (!readInventory(item->itemTypeId(), item->id(), QDateTime::currentDateTime(), data)) {
-                        message(2, u"Failed to import downloaded inventory for %1 %2"_qs
-                                       .arg(item->itemTypeId()).arg(QLatin1StringView(item->id())));
-                        ++downloadsFailed;
-                    }
-                    --downloadsInProgress;
-                },
-                [&](const std::exception &e) {
-                    message(2, QString::fromLatin1(e.what()));
-                    --downloadsInProgress;
-                    ++downloadsFailed;
-                });
+            queue.enqueue(itemInventoryQuery(item), filePath, [this, item](const QByteArray &data) {
+                if (!readInventory(item->itemTypeId(), item->id(), QDateTime::currentDateTime(), data)) {
+                    throw Exception("Failed to import downloaded inventory for %1 %2")
+                        .arg(item->itemTypeId()).arg(QLatin1StringView(item->id()));
+                }
+            });
         }
     }
 
-    while (downloadsInProgress)
-        co_await QCoro::sleepFor(std::chrono::milliseconds(100));
-
-    if (downloadsFailed)
+    if (int downloadsFailed = co_await queue.run())
         throw Exception("Failed to download %1 inventories").arg(downloadsFailed);
 }
 
 void TextImport::finalize()
 {
+    tracezone zone("TextImport::finalize");
+
     if (!m_skipDownload) {
         Q_ASSERT(m_downloadArchive && m_downloadArchive->isOpen());
         m_downloadArchive->close();
@@ -307,44 +358,70 @@ void TextImport::finalize()
 
     nextStep(u"Optimizing data structures"_qs);
 
-    calculateColorPopularity();
-    calculateKnownAssemblyColors();
-    calculateItemTypeCategories();
-    calculatePartsYearUsed();
-    calculateCategoryRecency();
-
-    // unroll the consists-of and appears-in hashes into the actual items
-    for (auto it = m_consists_of_hash.cbegin(); it != m_consists_of_hash.cend(); ++it) {
-        Item &item = m_db->m_items[it.key()];
-        const auto &coItems = it.value();
-        item.m_consists_of.copyContainer(coItems.cbegin(), coItems.cend(), nullptr);
-    }
-    for (auto it = m_appears_in_hash.cbegin(); it != m_appears_in_hash.cend(); ++it) {
-        Item &item = m_db->m_items[it.key()];
+    QThreadPool pool;
+    if (m_jobCount > 0)
+        pool.setMaxThreadCount(m_jobCount);
+
+    buildAppearsInIndex(&pool);
 
-        // color-idx -> { vector < qty, item-idx > }
-        const QHash<uint, QVector<QPair<uint, uint>>> &appearHash = it.value();
+    // these two only touch the colors and the item-types, so they can run alongside the rest
+    auto independentPasses = QtConcurrent::run(&pool, [this]() {
+        calculateColorPopularity();
+        calculateItemTypeCategories();
+    });
+    calculateKnownAssemblyColors(&pool);
+    calculatePartsYearUsed(&pool);
+    calculateCategoryRecency(&pool);
+    independentPasses.waitForFinished();
 
-        // we are compacting a "hash of a vector of pairs" down to a list of 32bit integers
+    // unroll the flat consists-of and appears-in arrays into the actual items
+    forEachChunk(&pool, qsizetype(m_db->m_items.size()), [this](qsizetype from, qsizetype to) {
         QVector<Item::AppearsInRecord> tmp;
 
-        for (auto ait = appearHash.cbegin(); ait != appearHash.cend(); ++ait) {
-            const auto &colorVector = ait.value();
+        for (auto itemIndex = uint(from); itemIndex < uint(to); ++itemIndex) {
+            Item &item = m_db->m_items[itemIndex];
 
-            Item::AppearsInRecord cair;
-            cair.m_colorBits.m_colorIndex = ait.key();
-            cair.m_colorBits.m_colorSize = quint32(colorVector.size());
-            tmp.push_back(cair);
+            if (itemIndex < m_consistsOfSpans.size()) {
+                const auto span = m_consistsOfSpans[itemIndex];
+                if (span.size) {
+                    const auto first = m_consistsOf.cbegin() + span.offset;
+                    item.m_consists_of.copyContainer(first, first + span.size, nullptr);
+                }
+            }
+
+            const auto [firstEdge, lastEdge] = appearsInRange(itemIndex);
+            if (firstEdge == lastEdge)
+                continue;
 
-            for (const auto &[qty, itemIndex] : colorVector) {
-                Item::AppearsInRecord iair;
-                iair.m_itemBits.m_quantity = qty;
-                iair.m_itemBits.m_itemIndex = itemIndex;
-                tmp.push_back(iair);
+            // we are compacting the edges (grouped by color) down to a list of 32bit integers
+            tmp.clear();
+            for (uint colorStart = firstEdge; colorStart < lastEdge; ) {
+                const auto colorIndex = m_appearsIn[colorStart].colorIndex;
+                uint colorEnd = colorStart;
+                while ((colorEnd < lastEdge) && (m_appearsIn[colorEnd].colorIndex == colorIndex))
+                    ++colorEnd;
+
+                Item::AppearsInRecord cair;
+                cair.m_colorBits.m_colorIndex = colorIndex;
+                cair.m_colorBits.m_colorSize = quint32(colorEnd - colorStart);
+                tmp.push_back(cair);
+
+                for (uint i = colorStart; i < colorEnd; ++i) {
+                    Item::AppearsInRecord iair;
+                    iair.m_itemBits.m_quantity = m_appearsIn[i].quantity;
+                    iair.m_itemBits.m_itemIndex = m_appearsIn[i].appearsInIndex;
+                    tmp.push_back(iair);
+                }
+                colorStart = colorEnd;
             }
+            item.m_appears_in.copyContainer(tmp.cbegin(), tmp.cend(), nullptr);
         }
-        item.m_appears_in.copyContainer(tmp.cbegin(), tmp.cend(), nullptr);
-    }
+    });
+
+    std::vector<AppearsInEdge>().swap(m_appearsIn);
+    std::vector<quint32>().swap(m_appearsInOffsets);
+    std::vector<Item::ConsistsOf>().swap(m_consistsOf);
+    std::vector<Span>().swap(m_consistsOfSpans);
 
     m_db->m_lastUpdated = QDateTime::currentDateTime();
     message(0, m_db->dumpDatabaseInformation({ }, true, true));
@@ -352,6 +429,8 @@ void TextImport::finalize()
 
 void TextImport::exportDatabase()
 {
+    tracezone zone("TextImport::exportDatabase");
+
     nextStep(u"Writing the database to disk"_qs);
 
     auto dbVersionLowest = Database::Version::OldestStillSupported;
@@ -359,9 +438,39 @@ void TextImport::exportDatabase()
 
     Q_ASSERT(dbVersionHighest >= dbVersionLowest);
 
+    auto readFile = [](const QString &fileName) {
+        QFile f(fileName);
+        return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray { };
+    };
+
     for (auto v = dbVersionHighest; v >= dbVersionLowest; v = Database::Version((int(v) - 1))) {
         message(u"Version v%1"_qs.arg(int(v)));
-        core()->database()->write(core()->dataPath() + Database::defaultDatabaseName(v), v);
+        const QString fileName = core()->dataPath() + Database::defaultDatabaseName(v);
+        const QByteArray previous = readFile(fileName);
+
+        core()->database()->write(fileName, v);
+
+        // Clients request the delta named after the hash of their current database. The
+        // previous build's (empty) delta gets replaced by the real one, while the new build
+        // gets an empty one to tell clients that they are up-to-date.
+        const QByteArray current = readFile(fileName);
+        if (!previous.isEmpty() && (previous != current)) {
+            const QString deltaName = Database::deltaDatabaseName(Database::databaseHash(previous), v);
+            Database::writeDelta(previous, current, core()->dataPath() + deltaName);
+            message(1, u"Delta %1: %2 KB"_qs.arg(deltaName)
+                        .arg(QFileInfo(core()->dataPath() + deltaName).size() / 1000));
+        }
+        Database::writeDelta(current, current, core()->dataPath()
+                             + Database::deltaDatabaseName(Database::databaseHash(current), v));
+    }
+
+    // clients that are this far behind will not find a delta chain and do a full download
+    QDirIterator dit(core()->dataPath(), { Database::deltaDatabaseNameFilter() }, QDir::Files);
+    const auto expired = QDateTime::currentDateTime().addDays(-DeltaRetentionDays);
+    while (dit.hasNext()) {
+        dit.next();
+        if (dit.fileInfo().lastModified() < expired)
+            QFile::remove(dit.filePath());
     }
 }
 
@@ -370,6 +479,11 @@ void TextImport::setApiKeys(const QHash<QByteArray, QString> &apiKeys)
     m_db->m_apiKeys = apiKeys;
 }
 
+void TextImport::setJobCount(int jobs)
+{
+    m_jobCount = std::max(0, jobs);
+}
+
 void TextImport::setApiQuirks(const QSet<ApiQuirk> &apiQuirks)
 {
     m_db->m_apiQuirks = apiQuirks;
@@ -410,18 +524,26 @@ QCoro::Task<QByteArray> TextImport::download(const QUrl &url, const QString &fil
 
 void TextImport::readColors(const QByteArray &xml)
 {
-    xmlParse(xml, u"CATALOG", u"ITEM", [this](const auto &e) {
+    tracezone zone("TextImport::readColors");
+
+    enum { ColorId, ColorName, ColorRgb, ColorTypes, CntParts, CntSets, CntWanted, CntInv,
+           YearFrom, YearTo };
+    static constexpr auto schema = xmlSchema("CATALOG", "ITEM",
+        "COLOR", "COLORNAME", "COLORRGB", "COLORTYPE", "COLORCNTPARTS", "COLORCNTSETS",
+        "COLORCNTWANTED", "COLORCNTINV", "COLORYEARFROM", "COLORYEARTO");
+
+    parseXml(xml, schema, doubleEscapedEntities(), [this](const auto &e) {
         Color col;
-        uint colid = xmlTagText(e, u"COLOR").toUInt();
+        uint colid = e.toUInt(ColorId);
 
         col.m_id       = colid;
-        col.m_name.copyQString(xmlTagText(e, u"COLORNAME").simplified(), nullptr);
-        col.m_color    = QColor(u'#' + xmlTagText(e, u"COLORRGB"));
+        col.m_name.copyQString(e.string(ColorName).simplified(), nullptr);
+        col.m_color    = QColor(u'#' + e.string(ColorRgb));
 
         col.m_ldraw_id = -1;
         col.m_type     = ColorType();
 
-        auto type = xmlTagText(e, u"COLORTYPE");
+        auto type = e.string(ColorTypes);
         if (type.contains(u"Transparent")) col.m_type |= ColorTypeFlag::Transparent;
         if (type.contains(u"Glitter"))     col.m_type |= ColorTypeFlag::Glitter;
         if (type.contains(u"Speckle"))     col.m_type |= ColorTypeFlag::Speckle;
@@ -434,10 +556,10 @@ void TextImport::readColors(const QByteArray &xml)
         if (!col.m_type)
             col.m_type = ColorTypeFlag::Solid;
 
-        int partCnt    = xmlTagText(e, u"COLORCNTPARTS").toInt();
-        int setCnt     = xmlTagText(e, u"COLORCNTSETS").toInt();
-        int wantedCnt  = xmlTagText(e, u"COLORCNTWANTED").toInt();
-        int forSaleCnt = xmlTagText(e, u"COLORCNTINV").toInt();
+        int partCnt    = e.toInt(CntParts);
+        int setCnt     = e.toInt(CntSets);
+        int wantedCnt  = e.toInt(CntWanted);
+        int forSaleCnt = e.toInt(CntInv);
 
         col.m_popularity = float(partCnt + setCnt + wantedCnt + forSaleCnt);
 
@@ -445,8 +567,8 @@ void TextImport::readColors(const QByteArray &xml)
         // mark it as raw data meanwhile:
         col.m_popularity = -col.m_popularity;
 
-        col.m_year_from = xmlTagText(e, u"COLORYEARFROM").toUShort();
-        col.m_year_to   = xmlTagText(e, u"COLORYEARTO").toUShort();
+        col.m_year_from = quint16(e.toUInt(YearFrom));
+        col.m_year_to   = quint16(e.toUInt(YearTo));
 
         m_db->m_colors.push_back(col);
     });
@@ -456,12 +578,17 @@ void TextImport::readColors(const QByteArray &xml)
 
 void TextImport::readCategories(const QByteArray &xml)
 {
-    xmlParse(xml, u"CATALOG", u"ITEM", [this](const auto &e) {
+    tracezone zone("TextImport::readCategories");
+
+    enum { CategoryId, CategoryName };
+    static constexpr auto schema = xmlSchema("CATALOG", "ITEM", "CATEGORY", "CATEGORYNAME");
+
+    parseXml(xml, schema, doubleEscapedEntities(), [this](const auto &e) {
         Category cat;
-        uint catid = xmlTagText(e, u"CATEGORY").toUInt();
+        uint catid = e.toUInt(CategoryId);
 
         cat.m_id   = catid;
-        cat.m_name.copyQString(xmlTagText(e, u"CATEGORYNAME").simplified(), nullptr);
+        cat.m_name.copyQString(e.string(CategoryName).simplified(), nullptr);
 
         m_db->m_categories.push_back(cat);
     });
@@ -471,15 +598,18 @@ void TextImport::readCategories(const QByteArray &xml)
 
 void TextImport::readItemTypes(const QByteArray &xml)
 {
-    xmlParse(xml, u"CATALOG", u"ITEM", [this](const auto &e) {
+    enum { ItemTypeId, ItemTypeName };
+    static constexpr auto schema = xmlSchema("CATALOG", "ITEM", "ITEMTYPE", "ITEMTYPENAME");
+
+    parseXml(xml, schema, doubleEscapedEntities(), [this](const auto &e) {
         ItemType itt;
-        char c = ItemType::idFromFirstCharInString(xmlTagText(e, u"ITEMTYPE"));
+        char c = e.singleChar(ItemTypeId);
 
         if (c == 'U')
             return;
 
         itt.m_id   = c;
-        itt.m_name.copyQString(xmlTagText(e, u"ITEMTYPENAME").simplified(), nullptr);
+        itt.m_name.copyQString(e.string(ItemTypeName).simplified(), nullptr);
 
         itt.m_has_inventories   = false;
         itt.m_has_colors        = (c == 'P' || c == 'G');
@@ -494,34 +624,40 @@ void TextImport::readItemTypes(const QByteArray &xml)
 
 void TextImport::readItems(const QByteArray &xml, const ItemType *itt)
 {
-    xmlParse(xml, u"CATALOG", u"ITEM", [this, itt](const auto &e) {
+    tracezone zone("TextImport::readItems");
+
+    enum { ItemId, ItemName, CategoryId, AltItemIds, ItemYear, ItemWeight, ImageColor };
+    static constexpr auto schema = xmlSchema("CATALOG", "ITEM",
+        "ITEMID", "ITEMNAME", "CATEGORY", "ALTITEMIDS", "ITEMYEAR", "ITEMWEIGHT", "IMAGECOLOR");
+
+    parseXml(xml, schema, doubleEscapedEntities(), [this, itt](const auto &e) {
         Item item;
-        item.m_id.copyQByteArray(xmlTagText(e, u"ITEMID").toLatin1(), nullptr);
-        const QString itemName = xmlTagText(e, u"ITEMNAME").simplified();
+        item.m_id.copyQByteArray(e.bytes(ItemId), nullptr);
+        const QString itemName = e.string(ItemName).simplified();
         item.m_name.copyQString(itemName, nullptr);
         item.m_itemTypeIndex = quint16(itt - m_db->m_itemTypes.data());
 
-        uint catId = xmlTagText(e, u"CATEGORY").toUInt();
+        uint catId = e.toUInt(CategoryId);
         auto cat = core()->category(catId);
         if (!cat)
             throw ParseException("item %1 has no category").arg(QString::fromLatin1(item.id()));
         item.m_categoryIndexes.push_back(quint16(cat->index()), nullptr);
 
-        QByteArray altIds = xmlTagText(e, u"ALTITEMIDS", true).toLatin1().replace(',', ' ').simplified();
+        QByteArray altIds = e.bytes(AltItemIds, true).replace(',', ' ').simplified();
         if (!altIds.isEmpty())
             item.m_alternateIds.copyQByteArray(altIds, nullptr);
 
-        uint y = xmlTagText(e, u"ITEMYEAR", true).toUInt();
+        uint y = e.toUInt(ItemYear, true);
         item.m_year_from = quint8(((y > 1900) && (y < 2155)) ? (y - 1900) : 0); // we only have 8 bits for the year
         item.m_year_to = item.m_year_from;
 
         if (itt->hasWeight())
-            item.m_weight = xmlTagText(e, u"ITEMWEIGHT").toFloat();
+            item.m_weight = e.toFloat(ItemWeight);
         else
             item.m_weight = 0;
 
         try {
-            auto color = core()->color(xmlTagText(e, u"IMAGECOLOR").toUInt());
+            auto color = core()->color(e.toUInt(ImageColor));
             item.m_defaultColorIndex = !color ? quint16(0xfff) : quint16(color->index());
         } catch (...) {
             item.m_defaultColorIndex = quint16(0xfff);
@@ -624,12 +760,15 @@ void TextImport::readPartColorCodes(const QByteArray &xml)
 {
     QHash<uint, QVector<Item::PCC>> pccs;
 
-    xmlParse(xml, u"CODES", u"ITEM", [this, &pccs](const auto &e) {
-        char itemTypeId = ItemType::idFromFirstCharInString(xmlTagText(e, u"ITEMTYPE"));
-        const QByteArray itemId = xmlTagText(e, u"ITEMID").toLatin1();
-        QString colorName = xmlTagText(e, u"COLOR").simplified();
+    enum { ItemTypeId, ItemId, ColorName, CodeName };
+    static constexpr auto schema = xmlSchema("CODES", "ITEM", "ITEMTYPE", "ITEMID", "COLOR", "CODENAME");
+
+    parseXml(xml, schema, doubleEscapedEntities(), [this, &pccs](const auto &e) {
+        char itemTypeId = e.singleChar(ItemTypeId);
+        const QByteArray itemId = e.bytes(ItemId);
+        QString colorName = e.string(ColorName).simplified();
         bool numeric = false;
-        uint code = xmlTagText(e, u"CODENAME").toUInt(&numeric, 10);
+        uint code = e.toUInt(CodeName, false, &numeric);
 
         if (auto item = core()->item(itemTypeId, itemId)) {
             bool noColor = !core()->itemType(itemTypeId)->hasColors();
@@ -652,7 +791,7 @@ void TextImport::readPartColorCodes(const QByteArray &xml)
                     pccs[itemIndex].push_back(pcc);
                 } else {
                     message(2, u"Parsing part_color_codes: pcc %1 is not numeric"_qs
-                                   .arg(xmlTagText(e, u"CODENAME")));
+                                   .arg(e.string(CodeName)));
                 }
             } else {
                 message(2, u"Parsing part_color_codes: skipping invalid color %1 on item %2 %3"_qs
@@ -678,31 +817,49 @@ const Item *TextImport::readInventory(char itemTypeId, const QByteArray &itemId,
                                       const QDateTime &lastModified, const QByteArray &xml,
                                       bool failSilently)
 {
-    const auto *invItem = core()->item(itemTypeId, itemId);
+    auto parsed = parseInventory({ itemTypeId, itemId, lastModified, xml });
+    if (!failSilently && !parsed.error.isEmpty())
+        message(2, parsed.error);
+    return mergeInventory(std::move(parsed));
+}
+
+TextImport::ParsedInventory TextImport::parseInventory(const InventoryFile &file) const
+{
+    tracezone zone("TextImport::parseInventory");
+
+    // this runs on multiple threads in parallel: only do read-only catalog lookups here
+
+    ParsedInventory result;
+
+    const auto *invItem = core()->item(file.itemTypeId, file.itemId);
     if (!invItem)
-        return nullptr; // no item found
+        return result; // no item found
     qint64 lastUpdated =  m_inventoryLastUpdated.value(invItem->index(), -1);
     if (lastUpdated < 0)
-        return nullptr; // item found, but does not have an inventory
-    if (lastModified.toSecsSinceEpoch() < lastUpdated)
-        return nullptr; // item found, has an inventory, but is outdated
+        return result; // item found, but does not have an inventory
+    if (file.lastModified.toSecsSinceEpoch() < lastUpdated)
+        return result; // item found, has an inventory, but is outdated
 
-    QDate lastModifiedDate = lastModified.date();
+    QDate lastModifiedDate = file.lastModified.date();
 
     QVector<Item::ConsistsOf> inventory;
     QVector<QPair<uint, uint>> knownColors;
 
+    enum { ItemTypeId, ItemId, ColorId, Quantity, Extra, CounterPart, Alternate, MatchId };
+    static constexpr auto schema = xmlSchema("INVENTORY", "ITEM", "ITEMTYPE", "ITEMID", "COLOR",
+                                             "QTY", "EXTRA", "COUNTERPART", "ALTERNATE", "MATCHID");
+
     try {
-        xmlParse(xml, u"INVENTORY", u"ITEM",
+        parseXml(file.xml, schema, doubleEscapedEntities(),
                  [this, &inventory, &knownColors, lastModifiedDate](const auto &e) {
-            char itemTypeId = ItemType::idFromFirstCharInString(xmlTagText(e, u"ITEMTYPE"));
-            const QByteArray itemId = xmlTagText(e, u"ITEMID").toLatin1();
-            uint colorId = xmlTagText(e, u"COLOR").toUInt();
-            uint qty = xmlTagText(e, u"QTY").toUInt();
-            bool extra = (xmlTagText(e, u"EXTRA") == u"Y");
-            bool counterPart = (xmlTagText(e, u"COUNTERPART") == u"Y");
-            bool alternate = (xmlTagText(e, u"ALTERNATE") == u"Y");
-            uint matchId = xmlTagText(e, u"MATCHID").toUInt();
+            char itemTypeId = e.singleChar(ItemTypeId);
+            const QByteArray itemId = e.bytes(ItemId);
+            uint colorId = e.toUInt(ColorId);
+            uint qty = e.toUInt(Quantity);
+            bool extra = e.isYes(Extra);
+            bool counterPart = e.isYes(CounterPart);
+            bool alternate = e.isYes(Alternate);
+            uint matchId = e.toUInt(MatchId);
 
             auto item = core()->item(itemTypeId, itemId);
             auto color = core()->color(colorId);
@@ -753,11 +910,6 @@ const Item *TextImport::readInventory(char itemTypeId, const QByteArray &itemId,
 
         });
 
-        // no more throwing beyond this point, as we cannot undo changes to global data
-
-        for (const auto &kc : std::as_const(knownColors))
-            addToKnownColors(kc.first, kc.second);
-
         // BL bug: if an extra item is part of an alternative match set, then none of the
         //         alternatives have the 'extra' flag set.
         for (Item::ConsistsOf &co : inventory) {
@@ -784,21 +936,44 @@ const Item *TextImport::readInventory(char itemTypeId, const QByteArray &itemId,
                 return co1.itemIndex() < co2.itemIndex();
         });
 
-        for (const Item::ConsistsOf &co : std::as_const(inventory)) {
-            if (!co.isExtra()) {
-                auto &vec = m_appears_in_hash[co.itemIndex()][co.colorIndex()];
-                vec.append(qMakePair(co.quantity(), invItem->index()));
-            }
-        }
-        // the hash owns the items now
-        m_consists_of_hash.insert(invItem->index(), inventory);
-        return invItem;
+        result.item = invItem;
+        result.inventory = std::move(inventory);
+        result.knownColors = std::move(knownColors);
 
     } catch (const Exception &e) {
-        if (!failSilently)
-            message(2, e.errorString());
+        result.error = e.errorString();
+    }
+    return result;
+}
+
+const Item *TextImport::mergeInventory(ParsedInventory &&parsed)
+{
+    tracezone zone("TextImport::mergeInventory");
+
+    const Item *invItem = parsed.item;
+    if (!invItem)
         return nullptr;
+
+    for (const auto &kc : std::as_const(parsed.knownColors))
+        addToKnownColors(kc.first, kc.second);
+
+    const uint invIndex = invItem->index();
+
+    for (const Item::ConsistsOf &co : std::as_const(parsed.inventory)) {
+        if (!co.isExtra()) {
+            m_appearsIn.push_back({ co.itemIndex(), invIndex, quint16(co.colorIndex()),
+                                    quint16(co.quantity()) });
+        }
     }
+
+    // a previously merged inventory for the same item is simply orphaned
+    if (m_consistsOfSpans.size() < m_db->m_items.size())
+        m_consistsOfSpans.resize(m_db->m_items.size());
+    auto &span = m_consistsOfSpans[invIndex];
+    span.offset = quint32(m_consistsOf.size());
+    span.size = quint32(parsed.inventory.size());
+    m_consistsOf.insert(m_consistsOf.end(), parsed.inventory.cbegin(), parsed.inventory.cend());
+    return invItem;
 }
 
 void TextImport::readLDrawColors(const QByteArray &ldconfig, const QByteArray &rebrickableColors)
@@ -1170,6 +1345,14 @@ QCoro::Task<> TextImport::readRelationships(const QByteArray &html)
 
     static const QRegularExpression rxLink(uR"-(<A HREF="catalogRelCat\.asp\?relID=(\d+)">([^<]+)</A>)-"_qs);
 
+    struct RelationshipPages
+    {
+        Relationship rel;
+        QString cleanName;
+        QVector<QByteArray> pages;
+    };
+    QVector<RelationshipPages> relPages;
+
     for (const auto &m : rxLink.globalMatch(data)) {
         uint id = m.capturedView(1).toUInt();
         QString name = m.captured(2);
@@ -1178,27 +1361,56 @@ QCoro::Task<> TextImport::readRelationships(const QByteArray &html)
         rel.m_id = id;
         rel.m_name.copyQString(name, nullptr);
 
-        QHash<uint, QVector<uint>> matches;   // match-id -> list of item-indexes
-
         static const QRegularExpression rxNotWord(uR"(\W)"_qs);
         QString cleanName = name;
         cleanName.replace(rxNotWord, u" "_qs);
         cleanName = cleanName.simplified().toLower();
         cleanName.replace(u' ', u'_');
 
-        uint page = 1;
-        do {
-            QUrl url = brickLinkUrl("catalogRelList.asp");
-            url.setQuery({
-                { u"v"_qs, u"0"_qs },
-                { u"relID"_qs, QString::number(id) },
-                { u"pg"_qs, QString::number(page) },
-            });
+        relPages.append({ rel, cleanName, { } });
+    }
+
+    static const QRegularExpression rxHeader(uR"(<B>(\d+)</B> Matches found: Page <B>(\d+)</B> of <B>(\d+)</B>)"_qs);
 
-            QByteArray listHtml = co_await download(url, u"relationships/%1_%2.html"_qs.arg(cleanName).arg(page));
-            QString listData = QString::fromUtf8(listHtml);
+    auto downloadPages = [this](QVector<RelationshipPages> &relPages, const QString &label,
+                                auto pageRange) -> QCoro::Task<> {
+        DownloadQueue queue(this, label, DownloadQueue::Delivery::InOrder);
+
+        for (auto &rp : relPages) {
+            const auto [fromPage, toPage] = pageRange(rp);
+            for (uint page = fromPage; page <= toPage; ++page) {
+                QUrl url = brickLinkUrl("catalogRelList.asp");
+                url.setQuery({
+                    { u"v"_qs, u"0"_qs },
+                    { u"relID"_qs, QString::number(rp.rel.m_id) },
+                    { u"pg"_qs, QString::number(page) },
+                });
+                queue.enqueue(url, u"relationships/%1_%2.html"_qs.arg(rp.cleanName).arg(page),
+                              [&rp](const QByteArray &listHtml) { rp.pages.append(listHtml); });
+            }
+        }
+        if (co_await queue.run())
+            throw Exception("Relationships: %1").arg(queue.errors().constFirst());
+    };
+
+    // we only know the number of pages after we have seen the first one
+    co_await downloadPages(relPages, u"Relationships"_qs, [](const RelationshipPages &) {
+        return std::make_pair(1U, 1U);
+    });
+    co_await downloadPages(relPages, u"Relationship pages"_qs, [](const RelationshipPages &rp) {
+        auto mh = rxHeader.match(QString::fromUtf8(rp.pages.constFirst()));
+        if (!mh.hasMatch())
+            throw Exception("Relationships: couldn't find list header");
+        return std::make_pair(2U, mh.capturedView(3).toUInt());
+    });
+
+    for (auto &rp : relPages) {
+        Relationship &rel = rp.rel;
+        QHash<uint, QVector<uint>> matches;   // match-id -> list of item-indexes
+
+        for (uint page = 1; page <= uint(rp.pages.size()); ++page) {
+            QString listData = QString::fromUtf8(rp.pages.at(page - 1));
 
-            static const QRegularExpression rxHeader(uR"(<B>(\d+)</B> Matches found: Page <B>(\d+)</B> of <B>(\d+)</B>)"_qs);
             auto mh = rxHeader.match(listData);
 
             if (!mh.hasMatch())
@@ -1206,7 +1418,6 @@ QCoro::Task<> TextImport::readRelationships(const QByteArray &html)
 
             uint count = mh.capturedView(1).toUInt();
             uint currentPage = mh.capturedView(2).toUInt();
-            uint maxPage = mh.capturedView(3).toUInt();
 
             if (page == 1)
                 rel.m_count = count;
@@ -1271,9 +1482,7 @@ QCoro::Task<> TextImport::readRelationships(const QByteArray &html)
                     }
                 }
             }
-
-            page = (page < maxPage) ? (page + 1) : 0;
-        } while (page);
+        }
 
         if (rel.m_count != matches.count()) {
             message(2, u"%1 should have %2 entries, but has %3 instead"_qs
@@ -1329,90 +1538,194 @@ void TextImport::calculateColorPopularity()
 
 void TextImport::calculateItemTypeCategories()
 {
-    QHash<uint, QSet<uint>> ittCats;
-
     // calculate the item-type -> category relation
+    std::vector<QBitArray> ittCats(m_db->m_itemTypes.size(), QBitArray(qsizetype(m_db->m_categories.size())));
+
     for (const auto &item : m_db->m_items) {
         for (quint16 catIndex : item.m_categoryIndexes)
-            ittCats[item.m_itemTypeIndex].insert(catIndex);
+            ittCats[item.m_itemTypeIndex].setBit(catIndex);
     }
-    for (const auto [ittIndex, catIndexSet] : std::as_const(ittCats).asKeyValueRange()) {
-        m_db->m_itemTypes[ittIndex].m_categoryIndexes
-            .copyContainer(catIndexSet.cbegin(), catIndexSet.cend(), nullptr);
+    for (uint ittIndex = 0; ittIndex < ittCats.size(); ++ittIndex) {
+        const QBitArray &catBits = ittCats[ittIndex];
+        QVector<quint16> catIndexes;
+        catIndexes.reserve(catBits.count(true));
+        for (qsizetype catIndex = 0; catIndex < catBits.size(); ++catIndex) {
+            if (catBits.testBit(catIndex))
+                catIndexes.append(quint16(catIndex));
+        }
+        if (!catIndexes.isEmpty()) {
+            m_db->m_itemTypes[ittIndex].m_categoryIndexes
+                .copyContainer(catIndexes.cbegin(), catIndexes.cend(), nullptr);
+        }
     }
 }
 
-void TextImport::calculateKnownAssemblyColors()
+void TextImport::buildAppearsInIndex(QThreadPool *pool)
 {
-    for (auto it = m_appears_in_hash.begin(); it != m_appears_in_hash.end(); ++it) {
-        const Item &item = m_db->m_items[it.key()];
-        const ItemType &itemType = m_db->m_itemTypes[item.m_itemTypeIndex];
+    // a stable counting sort by item, followed by a stable sort by color within each item:
+    // the edges for one item and color stay in import order
+    const auto itemCount = m_db->m_items.size();
+
+    std::vector<quint32> offsets(itemCount + 1, 0);
+    for (const auto &edge : m_appearsIn) {
+        if (edge.colorIndex != RemovedEdge)
+            ++offsets[edge.itemIndex + 1];
+    }
+    std::partial_sum(offsets.cbegin(), offsets.cend(), offsets.begin());
+
+    std::vector<AppearsInEdge> sorted(offsets.back());
+    {
+        std::vector<quint32> next(offsets.cbegin(), offsets.cend() - 1);
+        for (const auto &edge : m_appearsIn) {
+            if (edge.colorIndex != RemovedEdge)
+                sorted[next[edge.itemIndex]++] = edge;
+        }
+    }
+    m_appearsIn.swap(sorted);
+    std::vector<AppearsInEdge>().swap(sorted);
+    m_appearsInOffsets.swap(offsets);
+
+    forEachChunk(pool, qsizetype(itemCount), [this](qsizetype from, qsizetype to) {
+        for (auto itemIndex = uint(from); itemIndex < uint(to); ++itemIndex) {
+            const auto [first, last] = appearsInRange(itemIndex);
+            std::stable_sort(m_appearsIn.begin() + first, m_appearsIn.begin() + last,
+                             [](const auto &e1, const auto &e2) { return e1.colorIndex < e2.colorIndex; });
+        }
+    });
+}
 
-        if (!it->contains(0) || !itemType.hasColors())
+std::pair<uint, uint> TextImport::appearsInRange(uint itemIndex) const
+{
+    if ((itemIndex + 1) >= m_appearsInOffsets.size())
+        return { 0, 0 };
+    return { m_appearsInOffsets[itemIndex], m_appearsInOffsets[itemIndex + 1] };
+}
+
+void TextImport::calculateKnownAssemblyColors(QThreadPool *pool)
+{
+    // An item type supports colors, but we have entries for color "not available"
+    //   -> the item is part of an assembly: find all possible colors for the assembly and
+    //      copy those over as appears-in entries. Also update the known colors.
+    // Every pass only reads the known colors as they were at its start, so the lookup can run
+    // in parallel. Nested assemblies are handled by repeating the passes until nothing changes.
+
+    std::vector<quint32> pending; // edge indexes with color 0
+    for (uint itemIndex = 0; itemIndex < m_db->m_items.size(); ++itemIndex) {
+        const Item &item = m_db->m_items[itemIndex];
+        if (!m_db->m_itemTypes[item.m_itemTypeIndex].hasColors())
             continue;
 
-        // The type supports colors, but we have entries for color "not available"
-        //   -> check assemblies
-
-        // We need to copy here, as we modify (*it) later on and this would invalidate noColor
-        QVector<QPair<uint, uint>> noColor = it->value(0);
-
-        for (auto ncit = noColor.begin(); ncit != noColor.end(); ) {
-            uint ncQty = ncit->first;
-            uint ncItemIndex = ncit->second;
-            const Item &ncItem = m_db->m_items[ncItemIndex];
-
-            // "aiItem" contains "item" with color == 0: now find all possible colors
-            // for "aiItem" and copy those to "item's" appearHash.
-            // Also update the known colors.
-            bool foundColor = false;
-            for (auto colorIndex : ncItem.m_knownColorIndexes) {
-                if (colorIndex) {
-                    addToKnownColors(item.index(), colorIndex);
-                    (*it)[colorIndex].append({ ncQty, ncItemIndex });
-                    foundColor = true;
+        // sorted by color, so the color 0 entries are at the front
+        const auto [first, last] = appearsInRange(itemIndex);
+        for (uint edgeIndex = first; (edgeIndex < last) && !m_appearsIn[edgeIndex].colorIndex; ++edgeIndex)
+            pending.push_back(edgeIndex);
+    }
+
+    struct Resolution
+    {
+        quint32 edgeIndex;
+        quint16 colorIndex;
+    };
+    std::vector<AppearsInEdge> added;
+    bool modified = false;
+
+    while (!pending.empty()) {
+        const auto chunks = mapChunks<std::vector<Resolution>>(pool, qsizetype(pending.size()),
+                                                               [this, &pending](qsizetype from, qsizetype to) {
+            std::vector<Resolution> result;
+            for (auto i = from; i < to; ++i) {
+                const auto edgeIndex = pending[size_t(i)];
+                const Item &aiItem = m_db->m_items[m_appearsIn[edgeIndex].appearsInIndex];
+                for (auto colorIndex : aiItem.m_knownColorIndexes) {
+                    if (colorIndex)
+                        result.push_back({ edgeIndex, colorIndex });
                 }
             }
-            if (foundColor)
-                ncit = noColor.erase(ncit);
-            else
-                ++ncit;
+            return result;
+        });
+        std::vector<Resolution> resolutions;
+        for (const auto &chunk : chunks)
+            resolutions.insert(resolutions.end(), chunk.cbegin(), chunk.cend());
+
+        // the known colors are only ever modified here, in a well defined order
+        std::vector<quint32> stillPending;
+        size_t r = 0;
+        for (const auto edgeIndex : pending) {
+            if ((r < resolutions.size()) && (resolutions[r].edgeIndex == edgeIndex)) {
+                AppearsInEdge &edge = m_appearsIn[edgeIndex];
+                for (; (r < resolutions.size()) && (resolutions[r].edgeIndex == edgeIndex); ++r) {
+                    const auto colorIndex = resolutions[r].colorIndex;
+                    addToKnownColors(edge.itemIndex, colorIndex);
+                    added.push_back({ edge.itemIndex, edge.appearsInIndex, colorIndex, edge.quantity });
+                }
+                edge.colorIndex = RemovedEdge;
+            } else {
+                stillPending.push_back(edgeIndex);
+            }
         }
-        if (!noColor.isEmpty())
-            (*it)[0] = noColor;
-        else
-            it->remove(0);
+        if (stillPending.size() == pending.size())
+            break;
+        modified = true;
+        pending.swap(stillPending);
+    }
+
+    if (modified) {
+        m_appearsIn.insert(m_appearsIn.end(), added.cbegin(), added.cend());
+        buildAppearsInIndex(pool);
     }
 }
 
-void TextImport::calculateCategoryRecency()
+void TextImport::calculateCategoryRecency(QThreadPool *pool)
 {
-    QHash<uint, std::pair<quint64, quint32>> catCounter;
-
-    for (const auto &item : std::as_const(m_db->m_items)) {
-        if (item.m_year_from && item.m_year_to) {
-            for (quint16 catIndex : item.m_categoryIndexes) {
-                auto &cc = catCounter[catIndex];
-                cc.first += (item.m_year_from + item.m_year_to);
-                cc.second += 2;
-
-                auto &cat = m_db->m_categories[catIndex];
-                cat.m_year_from = cat.m_year_from ? std::min(cat.m_year_from, item.m_year_from)
-                                                  : item.m_year_from;
-                cat.m_year_to = std::max(cat.m_year_to, item.m_year_to);
+    struct CategoryYears
+    {
+        quint64 sum = 0;
+        quint32 count = 0;
+        quint8 from = 0;
+        quint8 to = 0;
+    };
+    const auto categoryCount = m_db->m_categories.size();
+
+    const auto partials = mapChunks<std::vector<CategoryYears>>(pool, qsizetype(m_db->m_items.size()),
+                                                                [this, categoryCount](qsizetype from, qsizetype to) {
+        std::vector<CategoryYears> years(categoryCount);
+        for (auto itemIndex = size_t(from); itemIndex < size_t(to); ++itemIndex) {
+            const Item &item = m_db->m_items[itemIndex];
+            if (item.m_year_from && item.m_year_to) {
+                for (quint16 catIndex : item.m_categoryIndexes) {
+                    auto &cy = years[catIndex];
+                    cy.sum += (item.m_year_from + item.m_year_to);
+                    cy.count += 2;
+                    cy.from = cy.from ? std::min(cy.from, item.m_year_from) : item.m_year_from;
+                    cy.to = std::max(cy.to, item.m_year_to);
+                }
             }
         }
-    }
-    for (uint catIndex = 0; catIndex < m_db->m_categories.size(); ++catIndex) {
-        auto cc = catCounter.value(catIndex);
-        if (cc.first && cc.second) {
-            auto y = quint8(qBound(0ULL, cc.first / cc.second, 255ULL));
-            m_db->m_categories[catIndex].m_year_recency = y;
+        return years;
+    });
+
+    for (uint catIndex = 0; catIndex < categoryCount; ++catIndex) {
+        CategoryYears cy;
+        for (const auto &partial : partials) {
+            const auto &pcy = partial[catIndex];
+            cy.sum += pcy.sum;
+            cy.count += pcy.count;
+            if (pcy.from)
+                cy.from = cy.from ? std::min(cy.from, pcy.from) : pcy.from;
+            cy.to = std::max(cy.to, pcy.to);
         }
+        if (!cy.count)
+            continue;
+
+        auto &cat = m_db->m_categories[catIndex];
+        cat.m_year_from = cat.m_year_from ? std::min(cat.m_year_from, cy.from) : cy.from;
+        cat.m_year_to = std::max(cat.m_year_to, cy.to);
+        if (cy.sum)
+            cat.m_year_recency = quint8(qBound(0ULL, cy.sum / cy.count, 255ULL));
     }
 }
 
-void TextImport::calculatePartsYearUsed()
+void TextImport::calculatePartsYearUsed(QThreadPool *pool)
 {
     // Parts have no "yearReleased" in the downloaded XMLs. We can however calculate a
     // "last recently used" value, which is much more useful for parts anyway.
@@ -1421,25 +1734,58 @@ void TextImport::calculatePartsYearUsed()
     //   #1 for parts in non-parts (these all have a year-released) and
     //   #2 for parts in parts (which by then should hopefully all have a year-released
 
+    // Every part pulls the years from the items it is contained in, so that each thread only
+    // writes to its own items. We need the reverse of the consists-of relation for that.
+    const auto itemCount = m_db->m_items.size();
+    auto isPart = [this](uint itemIndex) { return m_db->m_items[itemIndex].itemTypeId() == 'P'; };
+
+    std::vector<quint32> offsets(itemCount + 1, 0);
+    for (uint itemIndex = 0; itemIndex < m_consistsOfSpans.size(); ++itemIndex) {
+        const auto span = m_consistsOfSpans[itemIndex];
+        for (auto i = span.offset; i < (span.offset + span.size); ++i) {
+            if (isPart(m_consistsOf[i].itemIndex()))
+                ++offsets[m_consistsOf[i].itemIndex() + 1];
+        }
+    }
+    std::partial_sum(offsets.cbegin(), offsets.cend(), offsets.begin());
+
+    std::vector<quint32> containedIn(offsets.back());
+    {
+        std::vector<quint32> next(offsets.cbegin(), offsets.cend() - 1);
+        for (uint itemIndex = 0; itemIndex < m_consistsOfSpans.size(); ++itemIndex) {
+            const auto span = m_consistsOfSpans[itemIndex];
+            for (auto i = span.offset; i < (span.offset + span.size); ++i) {
+                if (isPart(m_consistsOf[i].itemIndex()))
+                    containedIn[next[m_consistsOf[i].itemIndex()]++] = itemIndex;
+            }
+        }
+    }
+
+    // pass #2 reads the years of other parts, so it has to work on a copy
+    std::vector<std::pair<quint8, quint8>> years(itemCount);
+
     for (int pass = 1; pass <= 2; ++pass) {
-        for (uint itemIndex = 0; itemIndex < m_db->m_items.size(); ++itemIndex) {
-            Item &item = m_db->m_items[itemIndex];
+        for (size_t itemIndex = 0; itemIndex < itemCount; ++itemIndex)
+            years[itemIndex] = { m_db->m_items[itemIndex].m_year_from, m_db->m_items[itemIndex].m_year_to };
 
-            bool isPart = (item.itemTypeId() == 'P');
+        forEachChunk(pool, qsizetype(itemCount), [&, pass](qsizetype from, qsizetype to) {
+            for (auto partIndex = uint(from); partIndex < uint(to); ++partIndex) {
+                if (!isPart(partIndex))
+                    continue;
 
-            if ((pass == 1 ? !isPart : isPart) && item.yearReleased()) {
-                const auto itemParts = m_consists_of_hash.value(itemIndex);
+                Item &partItem = m_db->m_items[partIndex];
+                for (auto i = offsets[partIndex]; i < offsets[partIndex + 1]; ++i) {
+                    const auto itemIndex = containedIn[i];
+                    const auto [yearFrom, yearTo] = years[itemIndex];
 
-                for (const Item::ConsistsOf &part : itemParts) {
-                    Item &partItem = m_db->m_items[part.itemIndex()];
-                    if (partItem.itemTypeId() == 'P') {
-                        partItem.m_year_from = partItem.m_year_from ? std::min(partItem.m_year_from, item.m_year_from)
-                                                                    : item.m_year_from;
-                        partItem.m_year_to   = std::max(partItem.m_year_to, item.m_year_to);
+                    if ((pass == 1 ? !isPart(itemIndex) : isPart(itemIndex)) && yearFrom) {
+                        partItem.m_year_from = partItem.m_year_from ? std::min(partItem.m_year_from, yearFrom)
+                                                                    : yearFrom;
+                        partItem.m_year_to   = std::max(partItem.m_year_to, yearTo);
                     }
                 }
             }
-        }
+        });
     }
 }
 
@@ -1460,8 +1806,22 @@ void TextImport::addToKnownColors(uint itemIndex, uint addColorIndex)
     item.m_knownColorIndexes.push_back(quint16(addColorIndex), nullptr);
 }
 
-uint TextImport::loadLastRunInventories(const std::function<void(char, const QByteArray &, const QDateTime &, const QByteArray &)> &callback)
+uint TextImport::loadLastRunInventories(const std::function<void(const QVector<InventoryFile> &)> &callback)
 {
+    // the files are handed out in batches, so that the callback can parse them in parallel
+    static constexpr qsizetype BatchSize = 2000;
+
+    QVector<InventoryFile> batch;
+    batch.reserve(BatchSize);
+
+    auto addToBatch = [&](InventoryFile &&file) {
+        batch.append(std::move(file));
+        if (batch.size() >= BatchSize) {
+            callback(batch);
+            batch.clear();
+        }
+    };
+
     uint counter = 0;
     auto updateCounter = [&]() {
         if (++counter % 500 == 0) {
@@ -1487,7 +1847,7 @@ uint TextImport::loadLastRunInventories(const std::function<void(char, const QBy
             updateCounter();
 
             auto [data, lastModified] = m_lastRunArchive->readFileAndLastModified(filePath);
-            callback(itemTypeId.at(0).toLatin1(), itemId.toLatin1(), lastModified, data);
+            addToBatch({ itemTypeId.at(0).toLatin1(), itemId.toLatin1(), lastModified, data });
         }
     } else {
         message(u"Loading inventories from filesystem..."_qs);
@@ -1511,9 +1871,11 @@ uint TextImport::loadLastRunInventories(const std::function<void(char, const QBy
             if (data.isEmpty())
                 throw Exception("Failed to read XML from %1").arg(fi.filePath());
 
-            callback(itemTypeId.at(0).toLatin1(), itemId.toLatin1(), fi.lastModified(), data);
+            addToBatch({ itemTypeId.at(0).toLatin1(), itemId.toLatin1(), fi.lastModified(), data });
         }
     }
+    if (!batch.isEmpty())
+        callback(batch);
 
     printf("\n");
     return counter;
@@ -1537,43 +1899,22 @@ void TextImport::message(int level, const QString &text)
         printf("%s%c %s\n", QByteArray(level * 2, ' ').constData(), (level <= 1) ? '*' : '>', qPrintable(text));
 }
 
-void TextImport::xmlParse(const QByteArray &xml, QStringView rootName, QStringView elementName,
-                          const std::function<void (const QHash<QString, QString> &)> &callback)
-{
-    // Bricklink double encodes entities, so instead of "&#40;", we get "&amp;#40;"
-    const QByteArray fixedXml = core()->isApiQuirkActive(ApiQuirk::CatalogDownloadEntitiesAreDoubleEscaped)
-                                    ? QByteArray(xml).replace("&amp;#", "&#")
-                                    : xml;
-
-    QXmlStreamReader xsr(fixedXml);
-    if (xsr.readNextStartElement()) {
-        if (xsr.name() != rootName)
-            throw Exception("expected XML root node %1, but got %2").arg(rootName, xsr.name());
-        while (xsr.readNextStartElement()) {
-            if (xsr.name() != elementName)
-                throw Exception("expected XML element node %1, but got %2").arg(elementName, xsr.name());
-
-            QHash<QString, QString> hash;
-            while (xsr.readNextStartElement())
-                hash.insert(xsr.name().toString(), xsr.readElementText().trimmed());
-            callback(hash);
-        }
-    }
-
-    if (xsr.hasError())
-        throw Exception("Error parsing XML: %1").arg(xsr.errorString());
-}
+DownloadQueue::DownloadQueue(TextImport *textImport, const QString &label, Delivery delivery,
+                             int maxConcurrent)
+    : DownloadQueue([textImport](const QUrl &url, const QString &fileName) {
+                        return textImport->download(url, fileName);
+                    },
+                    [textImport](int level, const QString &text) {
+                        textImport->message(level, text);
+                    },
+                    label, delivery, maxConcurrent,
+                    // there is no point in retrying, if we are only reading from the last-run archive
+                    textImport->m_skipDownload ? 0 : DefaultMaxRetries)
+{ }
 
-QString TextImport::xmlTagText(const QHash<QString, QString> &element, QStringView tagName,
-                               bool optional)
+bool TextImport::doubleEscapedEntities()
 {
-    auto it = element.constFind(tagName.toString());
-    if (it != element.constEnd())
-        return it.value();
-    else if (optional)
-        return { };
-    else
-        throw Exception("Expected a <%1> tag, but couldn't find one").arg(tagName);
+    return core()->isApiQuirkActive(ApiQuirk::CatalogDownloadEntitiesAreDoubleEscaped);
 }
 
 } // namespace BrickLink
@@ -3,10 +3,14 @@
 
 #pragma once
 
+#include <utility>
+#include <vector>
+
 #include <QtCore/QString>
 #include <QtCore/QByteArray>
 #include <QtCore/QHash>
 #include <QtCore/QVector>
+#include <QtCore/QDateTime>
 #include <QCoro/QCoroTask>
 
 #include "global.h"
@@ -15,6 +19,7 @@
 
 class MiniZip;
 class Transfer;
+QT_FORWARD_DECLARE_CLASS(QThreadPool)
 
 namespace BrickLink {
 
@@ -35,9 +40,11 @@ public:
 
     void setApiQuirks(const QSet<ApiQuirk> &apiQuirks);
     void setApiKeys(const QHash<QByteArray, QString> &apiKeys);
+    void setJobCount(int jobs);
 
 private:
     QCoro::Task<QByteArray> download(const QUrl &url, const QString &fileName);
+    friend class DownloadQueue;
 
     void readColors(const QByteArray &xml);
     void readCategories(const QByteArray &xml);
@@ -48,45 +55,89 @@ private:
     const Item *readInventory(char itemTypeId, const QByteArray &itemId,
                               const QDateTime &lastModified, const QByteArray &xml,
                               bool failSilently = false);
+
+    struct InventoryFile
+    {
+        char itemTypeId;
+        QByteArray itemId;
+        QDateTime lastModified;
+        QByteArray xml;
+    };
+    struct ParsedInventory
+    {
+        const Item *item = nullptr; // nullptr if there is nothing to merge
+        QVector<Item::ConsistsOf> inventory;
+        QVector<QPair<uint, uint>> knownColors;
+        QString error;
+    };
+    // parseInventory() is thread-safe, mergeInventory() has to be called in the original order
+    ParsedInventory parseInventory(const InventoryFile &file) const;
+    const Item *mergeInventory(ParsedInventory &&parsed);
     void readLDrawColors(const QByteArray &ldconfig, const QByteArray &rebrickableColors);
     void readInventoryList(const QByteArray &csv);
     void readChangeLog(const QByteArray &csv);
     QCoro::Task<> readRelationships(const QByteArray &html);
 
+    void buildAppearsInIndex(QThreadPool *pool);
+    std::pair<uint, uint> appearsInRange(uint itemIndex) const;
+
     void calculateColorPopularity();
     void calculateItemTypeCategories();
-    void calculateKnownAssemblyColors();
-    void calculateCategoryRecency();
-    void calculatePartsYearUsed();
+    void calculateKnownAssemblyColors(QThreadPool *pool);
+    void calculateCategoryRecency(QThreadPool *pool);
+    void calculatePartsYearUsed(QThreadPool *pool);
 
     void addToKnownColors(uint itemIndex, uint colorIndex);
 
-    uint loadLastRunInventories(const std::function<void (char, const QByteArray &, const QDateTime &, const QByteArray &)> &callback);
+    uint loadLastRunInventories(const std::function<void (const QVector<InventoryFile> &)> &callback);
 
     void nextStep(const QString &text);
     void message(const QString &text);
     void message(int level, const QString &text);
 
-    static void xmlParse(const QByteArray &xml, QStringView rootName, QStringView elementName,
-                         const std::function<void(const QHash<QString, QString> &)> &callback);
-    static QString xmlTagText(const QHash<QString, QString> &element, QStringView tagName,
-                              bool optional = false);
+    static bool doubleEscapedEntities();
+
+    static constexpr int DeltaRetentionDays = 30;
 private:
     QString m_archiveName;
     std::unique_ptr<MiniZip> m_downloadArchive;
     std::unique_ptr<MiniZip> m_lastRunArchive;
 
     Database *m_db;
-    // item-idx -> { color-idx -> { vector < qty, item-idx > } }
-    QHash<uint, QHash<uint, QVector<QPair<uint, uint>>>> m_appears_in_hash;
-    // item-idx -> { vector < consists-of > }
-    QHash<uint, QVector<Item::ConsistsOf>>   m_consists_of_hash;
+
+    // The inventories are collected in flat arrays while importing and are only copied into
+    // the items at the very end of finalize().
+
+    // <itemIndex> appears <quantity> times in color <colorIndex> in <appearsInIndex>
+    struct AppearsInEdge
+    {
+        quint32 itemIndex;
+        quint32 appearsInIndex;
+        quint16 colorIndex;
+        quint16 quantity;
+    };
+    static constexpr quint16 RemovedEdge = 0xffff; // used as colorIndex
+
+    // in import order, until buildAppearsInIndex() groups them by item and color
+    std::vector<AppearsInEdge> m_appearsIn;
+    // item-idx -> first edge in m_appearsIn (CSR style, with one extra entry at the end)
+    std::vector<quint32> m_appearsInOffsets;
+
+    struct Span
+    {
+        quint32 offset = 0;
+        quint32 size = 0;
+    };
+    std::vector<Item::ConsistsOf> m_consistsOf;
+    // item-idx -> range in m_consistsOf
+    std::vector<Span> m_consistsOfSpans;
     // item-idx -> secs since epoch
     QHash<uint, qint64> m_inventoryLastUpdated;
 
     QString m_rebrickableApiKey;
     bool m_skipDownload = false;
     int m_currentStep = 0;
+    int m_jobCount = 0; // 0: one per CPU core
 };
 
 } // namespace BrickLink
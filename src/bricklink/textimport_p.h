@@ -3,7 +3,10 @@
 
 #pragma once
 
-#include <QObject>
+#include <QtCore/QObject>
+
+#include "bricklink/downloadqueue_p.h"
+#include "bricklink/xmlreader_p.h"
 
 
 class TransferJob;
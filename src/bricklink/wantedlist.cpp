@@ -39,6 +39,7 @@ private:
     double    m_filled = 0.;
 
     LotList   m_lots;
+    QString   m_currencyCode;
 
     friend class WantedList;
 };
@@ -57,6 +58,11 @@ const LotList &WantedList::lots() const
     return d->m_lots;
 }
 
+QString WantedList::currencyCode() const
+{
+    return d->m_currencyCode.isEmpty() ? u"USD"_qs : d->m_currencyCode;
+}
+
 int WantedList::id() const
 {
     return d->m_id;
@@ -148,6 +154,11 @@ void WantedList::setLotCount(int i)
     }
 }
 
+void WantedList::setCurrencyCode(const QString &currencyCode)
+{
+    d->m_currencyCode = currencyCode;
+}
+
 void WantedList::setLots(LotList &&lots)
 {
     if (d->m_lots != lots) {
@@ -181,6 +192,7 @@ WantedLists::WantedLists(Core *core)
 
         if (m_wantedListJobs.contains(job) && (type == "wantedList")) {
             m_wantedListJobs.removeOne(job);
+            const bool isRefresh = m_refreshJobs.removeOne(job);
 
             bool success = jobCompleted;
             int id = job->userData(type).toInt();
@@ -191,6 +203,7 @@ WantedLists::WantedLists(Core *core)
             });
             if (it == m_wantedLists.cend()) {
                 qWarning() << "Received wanted list data for an unknown wanted list:" << id;
+                emit lotsFetched(nullptr, false, message);
                 return;
             }
 
@@ -209,7 +222,9 @@ WantedLists::WantedLists(Core *core)
                 success = false;
                 message = message + u": " + e.errorString();
             }
-            emit fetchLotsFinished(*it, success, message);
+            emit lotsFetched(*it, success, message);
+            if (!isRefresh)
+                emit fetchLotsFinished(*it, success, message);
 
         } else if ((job == m_job) && (type == "globalWantedList")) {
             bool success = jobCompleted;
@@ -262,6 +277,7 @@ WantedLists::WantedLists(Core *core)
 int WantedLists::parseWantedList(WantedList *wantedList, const QByteArray &data)
 {
     IO::ParseResult pr = IO::fromBrickLinkXML(data, IO::Hint::Wanted);
+    wantedList->setCurrencyCode(pr.currencyCode());
     wantedList->setLots(pr.takeLots());
     return pr.invalidLotCount();
 }
@@ -372,15 +388,25 @@ WantedList *WantedLists::wantedList(int index) const
 
 void WantedLists::startFetchLots(WantedList *wantedList)
 {
-    if (!wantedList)
-        return;
+    if (wantedList)
+        fetchLots(wantedList);
+}
+
+void WantedLists::startRefreshLots(WantedList *wantedList)
+{
+    if (wantedList)
+        m_refreshJobs << fetchLots(wantedList);
+}
 
+TransferJob *WantedLists::fetchLots(WantedList *wantedList)
+{
     auto job = TransferJob::post(u"https://www.bricklink.com/files/clone/wanted/downloadXML.file"_qs,
                                  { { u"wantedMoreID"_qs, QString::number(wantedList->id()) } });
     job->setUserData("wantedList", QVariant::fromValue(wantedList->id()));
     m_wantedListJobs << job;
 
     m_core->retrieveAuthenticated(job);
+    return job;
 }
 
 int WantedLists::rowCount(const QModelIndex &parent) const
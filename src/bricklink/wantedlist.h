@@ -47,6 +47,7 @@ public:
     int lotCount() const;
     double filled() const;
     const LotList &lots() const;
+    QString currencyCode() const; // of the lots' prices
 
     void setId(int id);
     void setName(const QString &name);
@@ -55,6 +56,7 @@ public:
     void setItemLeftCount(int i);
     void setLotCount(int i);
     void setFilled(double f);
+    void setCurrencyCode(const QString &currencyCode);
     void setLots(LotList &&lots);
 
 signals:
@@ -106,6 +108,8 @@ public:
     Q_INVOKABLE void cancelUpdate();
 
     Q_INVOKABLE void startFetchLots(BrickLink::WantedList *wantedList);
+    // same as startFetchLots(), but only lotsFetched() is emitted, so no document is opened
+    void startRefreshLots(BrickLink::WantedList *wantedList);
 
     Q_INVOKABLE BrickLink::WantedList *wantedList(int index) const;
 
@@ -121,6 +125,8 @@ signals:
     void updateProgress(int received, int total);
     void updateFinished(bool success, const QString &message);
     void fetchLotsFinished(BrickLink::WantedList *wantedList, bool success, const QString &message);
+    // emitted for every fetch: wantedList is nullptr, if it was deleted in the meantime
+    void lotsFetched(BrickLink::WantedList *wantedList, bool success, const QString &message);
     void updateStatusChanged(BrickLink::UpdateStatus updateStatus);
     void lastUpdatedChanged(const QDateTime &lastUpdated);
     void countChanged(int count);
@@ -129,6 +135,7 @@ private:
     WantedLists(Core *core);
     QVector<WantedList *> parseGlobalWantedList(const QByteArray &data);
     int parseWantedList(WantedList *wantedList, const QByteArray &data);
+    TransferJob *fetchLots(WantedList *wantedList);
     void emitDataChanged(int row, int col);
     void setLastUpdated(const QDateTime &lastUpdated);
     void setUpdateStatus(UpdateStatus updateStatus);
@@ -137,6 +144,7 @@ private:
     UpdateStatus m_updateStatus = UpdateStatus::UpdateFailed;
     TransferJob *m_job = nullptr;
     QVector<TransferJob *> m_wantedListJobs;
+    QVector<TransferJob *> m_refreshJobs;
     QDateTime m_lastUpdated;
     QVector<WantedList *> m_wantedLists;
     mutable QHash<QString, QIcon> m_flags;
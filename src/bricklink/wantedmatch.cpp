@@ -0,0 +1,96 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <limits>
+
+#include <QtCore/QHash>
+
+#include "bricklink/wantedmatch.h"
+
+
+namespace BrickLink {
+
+WantedListMatch::WantedListMatch(const LotList &wanted, const LotList &inventory)
+{
+    struct Candidate
+    {
+        const Lot *lot;
+        double price;     // sale included
+        int remaining;
+        qsizetype resultIndex;
+    };
+
+    // build side: the inventory, grouped by (item, color) and sorted by price
+    QHash<std::pair<const Item *, const Color *>, QVector<Candidate>> index;
+    index.reserve(inventory.size());
+
+    for (const auto *lot : inventory) {
+        if (!lot->item() || lot->isIncomplete() || (lot->status() == Status::Exclude)
+                || (lot->quantity() <= 0)) {
+            continue;
+        }
+        const double price = lot->price() * (100 - lot->sale()) / 100.;
+        index[{ lot->item(), lot->color() }].append({ lot, price, lot->quantity(), -1 });
+    }
+    for (auto &candidates : index) {
+        if (candidates.size() > 1) {
+            std::stable_sort(candidates.begin(), candidates.end(), [](const auto &c1, const auto &c2) {
+                return c1.price < c2.price;
+            });
+        }
+    }
+
+    // probe side: the wanted list, in order
+    m_matches.reserve(wanted.size());
+
+    for (qsizetype i = 0; i < wanted.size(); ++i) {
+        const auto *want = wanted.at(i);
+        if (!want->item() || want->isIncomplete() || (want->status() == Status::Exclude))
+            continue;
+
+        Match match;
+        match.wantedIndex = i;
+        match.item = want->item();
+        match.color = want->color();
+        match.wantedQuantity = std::max(1, want->quantity());
+
+        const double maxPrice = (want->price() > 0) ? want->price()
+                                                    : std::numeric_limits<double>::infinity();
+        const bool newOnly = (want->condition() == Condition::New);
+
+        auto it = index.find({ want->item(), want->color() });
+        if (it != index.end()) {
+            for (auto &c : *it) {
+                if (match.filledQuantity == match.wantedQuantity)
+                    break;
+                if (c.price > maxPrice) // sorted by price: nothing cheaper follows
+                    break;
+                if (!c.remaining || (newOnly && (c.lot->condition() != Condition::New)))
+                    continue;
+
+                const int take = std::min(c.remaining, match.wantedQuantity - match.filledQuantity);
+                c.remaining -= take;
+                match.filledQuantity += take;
+                match.value += take * c.price;
+
+                if (c.resultIndex < 0) {
+                    c.resultIndex = m_resultLots.size();
+                    m_resultLots.append(*c.lot);
+                    m_resultLots.last().setQuantity(0);
+                }
+                auto &resultLot = m_resultLots[c.resultIndex];
+                resultLot.setQuantity(resultLot.quantity() + take);
+            }
+        }
+
+        m_wantedQuantity += match.wantedQuantity;
+        m_filledQuantity += match.filledQuantity;
+        m_value += match.value;
+        if (match.filledQuantity == match.wantedQuantity)
+            ++m_filledLotCount;
+        m_matches.append(match);
+    }
+}
+
+} // namespace BrickLink
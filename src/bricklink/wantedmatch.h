@@ -0,0 +1,65 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <QtCore/QVector>
+
+#include "bricklink/global.h"
+#include "bricklink/lot.h"
+
+
+namespace BrickLink {
+
+// Matches the lots of a wanted list against an inventory (e.g. the store or a document) via a
+// hash join on (item, color) and works out how much of the wanted list can be filled and at what
+// value. The wanted lots follow the semantics of IO::fromBrickLinkXML() with Hint::Wanted:
+//  - the quantity is the MINQTY (0 means "not specified" and is treated as 1)
+//  - the price is the MAXPRICE (0 means "no limit"); inventory lots above it are not used
+//  - Condition::New wants new items only, while Condition::Used accepts any condition, because
+//    BrickLink's "any" condition is imported as Used (and Used is exported without a condition)
+// The inventory lots are used cheapest first (sale included) and each one only once, even if
+// multiple wanted lots ask for the same part. Prices are compared as-is, so both lists need to
+// be in the same currency.
+// The matcher does not keep any references to the lots, so it can safely be run in a thread on
+// copies of the lot lists.
+
+class WantedListMatch
+{
+public:
+    struct Match
+    {
+        qsizetype wantedIndex = -1;  // index into the wanted lots
+        const Item *item = nullptr;
+        const Color *color = nullptr;
+        int wantedQuantity = 0;
+        int filledQuantity = 0;
+        double value = 0;            // the summed up inventory prices of the filled quantity
+
+        double fillRatio() const  { return wantedQuantity ? double(filledQuantity) / wantedQuantity : 0; }
+    };
+
+    WantedListMatch() = default;
+    WantedListMatch(const LotList &wanted, const LotList &inventory);
+
+    const QVector<Match> &matches() const  { return m_matches; }
+
+    int wantedQuantity() const   { return m_wantedQuantity; }
+    int filledQuantity() const   { return m_filledQuantity; }
+    int filledLotCount() const   { return m_filledLotCount; }
+    double value() const         { return m_value; }
+    double fillRatio() const     { return m_wantedQuantity ? double(m_filledQuantity) / m_wantedQuantity : 0; }
+
+    // copies of the inventory lots needed to fill the wanted list, with adjusted quantities
+    const QVector<Lot> &resultLots() const  { return m_resultLots; }
+
+private:
+    QVector<Match> m_matches;
+    QVector<Lot> m_resultLots;
+    int m_wantedQuantity = 0;
+    int m_filledQuantity = 0;
+    int m_filledLotCount = 0;
+    double m_value = 0;
+};
+
+} // namespace BrickLink
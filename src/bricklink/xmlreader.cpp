@@ -0,0 +1,222 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+
+#include <QtCore/QStringDecoder>
+
+#include "bricklink/xmlreader_p.h"
+
+
+namespace BrickLink {
+
+namespace XmlReader {
+
+QByteArray toUtf8(const QByteArray &xml)
+{
+    const QByteArrayView data(xml);
+
+    // a BOM takes precedence over the encoding declaration
+    if (data.startsWith("\xEF\xBB\xBF"))
+        return xml.mid(3);
+
+    QByteArray encoding;
+    if (data.startsWith("\xFF\xFE") || data.startsWith("\xFE\xFF")) {
+        encoding = "UTF-16";
+    } else if (data.startsWith("<?xml")) {
+        // <?xml version="1.0" encoding="ISO-8859-1"?>
+        const auto declEnd = data.indexOf('>');
+        auto pos = (declEnd > 0) ? data.first(declEnd).toByteArray().indexOf("encoding") : -1;
+        if (pos > 0) {
+            pos += 8;
+            while ((pos < declEnd) && ((data.at(pos) == ' ') || (data.at(pos) == '=')))
+                ++pos;
+            const char quote = (pos < declEnd) ? data.at(pos) : 0;
+            const auto quoteEnd = ((quote == '"') || (quote == '\'')) ? data.indexOf(quote, pos + 1) : -1;
+            if ((quoteEnd < 0) || (quoteEnd > declEnd))
+                throw Exception("Error parsing XML: invalid encoding declaration");
+            encoding = data.sliced(pos + 1, quoteEnd - pos - 1).toByteArray().toUpper();
+        }
+    }
+    if (encoding.isEmpty() || (encoding == "UTF-8") || (encoding == "US-ASCII"))
+        return xml;
+
+    QStringDecoder decoder(encoding.constData());
+    if (!decoder.isValid())
+        throw Exception("Error parsing XML: unsupported encoding %1").arg(QString::fromLatin1(encoding));
+    const QString decoded = decoder.decode(data);
+    if (decoder.hasError())
+        throw Exception("Error parsing XML: the data is not valid %1").arg(QString::fromLatin1(encoding));
+    return decoded.toUtf8();
+}
+
+void Cursor::skipWhitespaceAndComments()
+{
+    while (m_pos < m_end) {
+        char c = *m_pos;
+        if ((c == ' ') || (c == '\n') || (c == '\r') || (c == '\t')) {
+            ++m_pos;
+        } else if (c == '<') {
+            std::string_view closing;
+            if (startsWith("<?"))
+                closing = "?>";
+            else if (startsWith("<!--"))
+                closing = "-->";
+            else if (startsWith("<!") && !startsWith("<![CDATA["))
+                closing = ">";
+            else
+                return;
+
+            const auto skipTo = std::search(m_pos, m_end, closing.cbegin(), closing.cend());
+            if (skipTo == m_end)
+                error(u"unterminated markup"_qs);
+            m_pos = skipTo + closing.size();
+        } else {
+            error(u"unexpected text"_qs);
+        }
+    }
+}
+
+std::string_view Cursor::readTag(bool *isEndTag, bool *isEmptyTag)
+{
+    if ((m_pos >= m_end) || (*m_pos != '<'))
+        error(u"expected a tag"_qs);
+    ++m_pos;
+    *isEndTag = (m_pos < m_end) && (*m_pos == '/');
+    if (*isEndTag)
+        ++m_pos;
+
+    const char *nameStart = m_pos;
+    while ((m_pos < m_end) && (*m_pos != '>') && (*m_pos != '/')
+           && (*m_pos != ' ') && (*m_pos != '\t') && (*m_pos != '\r') && (*m_pos != '\n')) {
+        ++m_pos;
+    }
+    std::string_view name(nameStart, size_t(m_pos - nameStart));
+    if (name.empty())
+        error(u"empty tag name"_qs);
+
+    // we do not need any attributes, so just skip them
+    const char *tagEnd = static_cast<const char *>(std::memchr(m_pos, '>', size_t(m_end - m_pos)));
+    if (!tagEnd)
+        error(u"unterminated tag %1"_qs.arg(latin1View(name)));
+    *isEmptyTag = (tagEnd > m_pos) && (tagEnd[-1] == '/');
+    if (*isEndTag && *isEmptyTag)
+        error(u"invalid end tag %1"_qs.arg(latin1View(name)));
+    m_pos = tagEnd + 1;
+    return name;
+}
+
+QByteArrayView Cursor::readText(std::string_view tagName, bool *isCData)
+{
+    // same as QByteArray::trimmed()
+    auto isSpace = [](char c) { return (c == ' ') || ((c >= '\t') && (c <= '\r')); };
+    auto isBlank = [&isSpace](const char *from, const char *to) {
+        return std::all_of(from, to, isSpace);
+    };
+    auto findTagStart = [this, tagName]() {
+        auto *pos = static_cast<const char *>(std::memchr(m_pos, '<', size_t(m_end - m_pos)));
+        if (!pos)
+            error(u"unterminated element %1"_qs.arg(latin1View(tagName)));
+        return pos;
+    };
+
+    const char *textStart = m_pos;
+    const char *textEnd = findTagStart();
+    m_pos = textEnd;
+
+    *isCData = startsWith("<![CDATA[");
+    if (*isCData) {
+        static constexpr std::string_view cdataEnd = "]]>";
+
+        // the content is used verbatim, so we cannot mix it with text that needs decoding
+        if (!isBlank(textStart, textEnd))
+            error(u"mixing text and CDATA in element %1 is not supported"_qs.arg(latin1View(tagName)));
+        textStart = m_pos + 9;
+        textEnd = std::search(textStart, m_end, cdataEnd.cbegin(), cdataEnd.cend());
+        if (textEnd == m_end)
+            error(u"unterminated CDATA section in element %1"_qs.arg(latin1View(tagName)));
+        m_pos = textEnd + cdataEnd.size();
+
+        const char *trailingEnd = findTagStart();
+        if (!isBlank(m_pos, trailingEnd))
+            error(u"mixing text and CDATA in element %1 is not supported"_qs.arg(latin1View(tagName)));
+        m_pos = trailingEnd;
+        if (startsWith("<![CDATA["))
+            error(u"multiple CDATA sections in element %1 are not supported"_qs.arg(latin1View(tagName)));
+    }
+
+    bool isEndTag = false;
+    bool isEmptyTag = false;
+    if (!startsWith("</") || (readTag(&isEndTag, &isEmptyTag) != tagName))
+        error(u"expected the end tag of %1"_qs.arg(latin1View(tagName)));
+
+    while ((textStart < textEnd) && isSpace(*textStart))
+        ++textStart;
+    while ((textEnd > textStart) && isSpace(textEnd[-1]))
+        --textEnd;
+    return { textStart, textEnd - textStart };
+}
+
+void Cursor::error(const QString &message) const
+{
+    throw Exception("Error parsing XML at offset %1: %2").arg(m_pos - m_begin).arg(message);
+}
+
+} // namespace XmlReader
+
+QString decodeXmlText(QByteArrayView text, bool doubleEscapedEntities)
+{
+    qsizetype amp = text.indexOf('&');
+    if (amp < 0)
+        return QString::fromUtf8(text);
+
+    QByteArray decoded;
+    decoded.reserve(text.size());
+    qsizetype pos = 0;
+
+    while (amp >= 0) {
+        decoded.append(text.sliced(pos, amp - pos));
+
+        qsizetype semicolon = text.indexOf(';', amp);
+        if (semicolon < 0)
+            throw Exception("Error parsing XML: unterminated entity in %1").arg(QString::fromUtf8(text));
+        auto entity = text.sliced(amp + 1, semicolon - amp - 1);
+
+        // Bricklink double encodes entities, so instead of "&#40;", we get "&amp;#40;"
+        if (doubleEscapedEntities && (entity == QByteArrayView("amp"))
+                && text.sliced(semicolon + 1).startsWith('#')) {
+            amp = semicolon;
+            semicolon = text.indexOf(';', amp + 1);
+            if (semicolon < 0)
+                throw Exception("Error parsing XML: unterminated entity in %1").arg(QString::fromUtf8(text));
+            entity = text.sliced(amp + 1, semicolon - amp - 1);
+        }
+
+        if (entity == QByteArrayView("amp")) {
+            decoded.append('&');
+        } else if (entity == QByteArrayView("lt")) {
+            decoded.append('<');
+        } else if (entity == QByteArrayView("gt")) {
+            decoded.append('>');
+        } else if (entity == QByteArrayView("quot")) {
+            decoded.append('"');
+        } else if (entity == QByteArrayView("apos")) {
+            decoded.append('\'');
+        } else if (entity.startsWith('#')) {
+            bool ok = false;
+            char32_t ucs4 = entity.startsWith("#x") ? entity.sliced(2).toUInt(&ok, 16)
+                                                    : entity.sliced(1).toUInt(&ok, 10);
+            if (!ok || !ucs4)
+                throw Exception("Error parsing XML: invalid character reference %1").arg(QString::fromLatin1(entity));
+            decoded.append(QString::fromUcs4(&ucs4, 1).toUtf8());
+        } else {
+            throw Exception("Error parsing XML: unknown entity %1").arg(QString::fromLatin1(entity));
+        }
+        pos = semicolon + 1;
+        amp = text.indexOf('&', pos);
+    }
+    decoded.append(text.sliced(pos));
+    return QString::fromUtf8(decoded);
+}
+
+} // namespace BrickLink
@@ -0,0 +1,269 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <string_view>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QByteArrayView>
+#include <QtCore/QString>
+
+#include "utility/exception.h"
+
+
+namespace BrickLink {
+
+// All the BrickLink catalog downloads are flat XML files of the form
+//   <ROOT><ELEMENT><TAG>text</TAG>...</ELEMENT>...</ROOT>
+// An XmlSchema describes the tags we are interested in: the tag names are mapped to slot indexes
+// via a perfect hash, which is calculated at compile time. XmlRecord then hands out the text of
+// these tags as views into the raw XML data, without building a hash or any heap strings per
+// element.
+// Text can either be plain (with entities) or a single CDATA section. Non UTF-8 documents are
+// converted according to their encoding declaration before parsing.
+
+inline QLatin1StringView latin1View(std::string_view s)
+{
+    return { s.data(), qsizetype(s.size()) };
+}
+
+template <std::size_t N>
+struct XmlSchema
+{
+    static constexpr std::size_t TableSize = 128;
+
+    std::string_view rootName;
+    std::string_view elementName;
+    std::array<std::string_view, N> tagNames;
+    quint32 seed = 0;
+    std::array<qint8, TableSize> table { }; // slot + 1, or 0 for an empty bucket
+
+    static constexpr std::size_t bucket(std::string_view tagName, quint32 seed)
+    {
+        quint32 h = 2166136261U ^ seed; // FNV-1a
+        for (char c : tagName) {
+            h ^= quint8(c);
+            h *= 16777619U;
+        }
+        return (h ^ (h >> 15)) % TableSize;
+    }
+
+    // one hash calculation and a single comparison
+    constexpr int slot(std::string_view tagName) const
+    {
+        const int s = table[bucket(tagName, seed)] - 1;
+        return ((s >= 0) && (tagNames[std::size_t(s)] == tagName)) ? s : -1;
+    }
+};
+
+template <typename... Tags>
+constexpr auto xmlSchema(std::string_view rootName, std::string_view elementName, Tags... tagNames)
+{
+    constexpr auto N = sizeof...(Tags);
+    static_assert(N <= 32);
+    XmlSchema<N> schema { rootName, elementName, { std::string_view(tagNames)... } };
+
+    // find a seed that maps all the tag names to different buckets
+    for (quint32 seed = 0; seed < 1000; ++seed) {
+        std::array<qint8, XmlSchema<N>::TableSize> table { };
+        bool collision = false;
+        for (std::size_t i = 0; !collision && (i < N); ++i) {
+            auto &b = table[XmlSchema<N>::bucket(schema.tagNames[i], seed)];
+            collision = (b != 0);
+            b = qint8(i + 1);
+        }
+        if (!collision) {
+            schema.seed = seed;
+            schema.table = table;
+            return schema;
+        }
+    }
+    throw "no perfect hash found: are there duplicate tag names?"; // fails the compilation
+}
+
+// Entities are only decoded when needed, i.e. in string() and bytes()
+QString decodeXmlText(QByteArrayView text, bool doubleEscapedEntities);
+
+template <std::size_t N>
+class XmlRecord
+{
+public:
+    XmlRecord(const XmlSchema<N> &schema, bool doubleEscapedEntities)
+        : m_schema(schema)
+        , m_doubleEscapedEntities(doubleEscapedEntities)
+    { }
+
+    bool contains(int slot) const  { return m_found & (1U << slot); }
+
+    QByteArrayView raw(int slot, bool optional = false) const
+    {
+        if (!contains(slot)) {
+            if (optional)
+                return { };
+            throw Exception("Expected a <%1> tag, but couldn't find one")
+                .arg(latin1View(m_schema.tagNames[slot]));
+        }
+        return m_values[slot];
+    }
+
+    QString string(int slot, bool optional = false) const
+    {
+        auto text = raw(slot, optional);
+        if (isCData(slot))
+            return QString::fromUtf8(text);
+        return decodeXmlText(text, m_doubleEscapedEntities);
+    }
+
+    // no copy, if there are no entities: only valid as long as the XML data is alive
+    QByteArray bytes(int slot, bool optional = false) const
+    {
+        auto text = raw(slot, optional);
+        if (!isCData(slot) && text.contains('&'))
+            return decodeXmlText(text, m_doubleEscapedEntities).toLatin1();
+        return QByteArray::fromRawData(text.data(), text.size());
+    }
+
+    uint toUInt(int slot, bool optional = false, bool *ok = nullptr) const
+    {
+        return raw(slot, optional).toUInt(ok, 10);
+    }
+
+    int toInt(int slot, bool optional = false) const
+    {
+        return raw(slot, optional).toInt();
+    }
+
+    float toFloat(int slot, bool optional = false) const
+    {
+        return raw(slot, optional).toFloat();
+    }
+
+    bool isYes(int slot) const
+    {
+        return raw(slot) == QByteArrayView("Y");
+    }
+
+    // same as ItemType::idFromFirstCharInString()
+    char singleChar(int slot) const
+    {
+        auto text = raw(slot);
+        return (text.size() == 1) ? text.front() : 0;
+    }
+
+private:
+    bool isCData(int slot) const  { return m_cdata & (1U << slot); }
+    void clear()  { m_found = m_cdata = 0; }
+    void set(int slot, QByteArrayView value, bool cdata)
+    {
+        m_values[slot] = value;
+        m_found |= (1U << slot);
+        if (cdata)
+            m_cdata |= (1U << slot);
+    }
+
+    const XmlSchema<N> &m_schema;
+    bool m_doubleEscapedEntities;
+    quint32 m_found = 0;
+    quint32 m_cdata = 0;
+    std::array<QByteArrayView, N> m_values;
+
+    template <std::size_t M, typename Callback>
+    friend void parseXml(const QByteArray &, const XmlSchema<M> &, bool, Callback &&);
+};
+
+namespace XmlReader {
+
+// Returns the document converted to UTF-8, based on its BOM or encoding declaration. UTF-8 and
+// US-ASCII documents are returned as-is, without a copy. Throws on unsupported encodings.
+QByteArray toUtf8(const QByteArray &xml);
+
+// throws on any syntax error
+class Cursor
+{
+public:
+    explicit Cursor(const QByteArray &xml)
+        : m_begin(xml.constData())
+        , m_pos(m_begin)
+        , m_end(m_begin + xml.size())
+    { }
+
+    bool atEnd() const  { return m_pos >= m_end; }
+    bool startsWith(std::string_view s) const
+    {
+        return (qsizetype(s.size()) <= (m_end - m_pos)) && !std::memcmp(m_pos, s.data(), s.size());
+    }
+    void skipWhitespaceAndComments();
+    // parses "<NAME" or "</NAME" up to and including the closing '>' and returns NAME
+    std::string_view readTag(bool *isEndTag, bool *isEmptyTag);
+    // reads the text (or a single CDATA section) up to the matching end-tag
+    QByteArrayView readText(std::string_view tagName, bool *isCData);
+    [[noreturn]] void error(const QString &message) const;
+
+private:
+    const char *m_begin;
+    const char *m_pos;
+    const char *m_end;
+};
+
+} // namespace XmlReader
+
+template <std::size_t N, typename Callback>
+void parseXml(const QByteArray &xml, const XmlSchema<N> &schema, bool doubleEscapedEntities,
+              Callback &&callback)
+{
+    // the record's views point into this, so it has to stay alive until we are done
+    const QByteArray utf8 = XmlReader::toUtf8(xml);
+    XmlReader::Cursor cursor(utf8);
+    XmlRecord<N> record(schema, doubleEscapedEntities);
+    bool isEndTag = false;
+    bool isEmptyTag = false;
+
+    cursor.skipWhitespaceAndComments();
+    if (cursor.atEnd())
+        return;
+
+    auto rootName = cursor.readTag(&isEndTag, &isEmptyTag);
+    if (isEndTag || (rootName != schema.rootName)) {
+        cursor.error(u"expected XML root node %1, but got %2"_qs
+                         .arg(latin1View(schema.rootName), latin1View(rootName)));
+    }
+    if (isEmptyTag)
+        return;
+
+    while (true) {
+        cursor.skipWhitespaceAndComments();
+        auto elementName = cursor.readTag(&isEndTag, &isEmptyTag);
+        if (isEndTag) {
+            if (elementName != schema.rootName)
+                cursor.error(u"mismatched end tag %1"_qs.arg(latin1View(elementName)));
+            break;
+        }
+        if (elementName != schema.elementName) {
+            cursor.error(u"expected XML element node %1, but got %2"_qs
+                             .arg(latin1View(schema.elementName), latin1View(elementName)));
+        }
+
+        record.clear();
+        while (!isEmptyTag) {
+            cursor.skipWhitespaceAndComments();
+            bool isEmptyChildTag = false;
+            auto tagName = cursor.readTag(&isEndTag, &isEmptyChildTag);
+            if (isEndTag) {
+                if (tagName != schema.elementName)
+                    cursor.error(u"mismatched end tag %1"_qs.arg(latin1View(tagName)));
+                break;
+            }
+            bool isCData = false;
+            auto text = isEmptyChildTag ? QByteArrayView { } : cursor.readText(tagName, &isCData);
+            int slot = schema.slot(tagName);
+            if (slot >= 0)
+                record.set(slot, text, isCData);
+        }
+        callback(std::as_const(record));
+    }
+}
+
+} // namespace BrickLink
@@ -188,6 +188,9 @@ void Application::init()
     }
 
     LDraw::create(ldrawUrl());
+    LDraw::library()->setMemoryBudgets(Config::inst()->memoryBudgets());
+    connect(Config::inst(), &Config::memoryBudgetsChanged,
+            LDraw::library(), &LDraw::Library::setMemoryBudgets);
 
     connect(BrickLink::core(), &BrickLink::Core::authenticationFinished,
             this, [](const QString &userName, const QString &error) {
@@ -933,6 +936,15 @@ bool Application::initBrickLink()
     BrickLink::core()->setUpdateIntervals(Config::inst()->updateIntervals());
     connect(Config::inst(), &Config::updateIntervalsChanged,
             BrickLink::core(), &BrickLink::Core::setUpdateIntervals);
+    BrickLink::core()->setCacheSizeLimits(Config::inst()->cacheSizeLimits());
+    connect(Config::inst(), &Config::cacheSizeLimitsChanged,
+            BrickLink::core(), &BrickLink::Core::setCacheSizeLimits);
+    BrickLink::core()->setMemoryBudgets(Config::inst()->memoryBudgets());
+    connect(Config::inst(), &Config::memoryBudgetsChanged,
+            BrickLink::core(), &BrickLink::Core::setMemoryBudgets);
+    BrickLink::core()->setMaxInFlightPriceGuideBatches(Config::inst()->maxInFlightPriceGuideBatches());
+    connect(Config::inst(), &Config::maxInFlightPriceGuideBatchesChanged,
+            BrickLink::core(), &BrickLink::Core::setMaxInFlightPriceGuideBatches);
 
     QString lastRetrieverId = Config::inst()->value(u"BrickLink/VAT/LastRetrieverId"_qs).toString();
     QString retrieverId = BrickLink::core()->priceGuideCache()->retrieverId();
@@ -6,16 +6,24 @@
 #include <QQmlContext>
 #include <QQmlInfo>
 #include <QFile>
+#include <QSaveFile>
 #include <QUrl>
 #include <QGuiApplication>
 #include <QPalette>
 #include <QWindow>
 
+#include <QCoro/QCoroSignal>
+
 #include "utility/utility.h"
+#include "utility/appstatistics.h"
 #include "utility/exception.h"
+#include "utility/tracing.h"
 #include "common/currency.h"
+#include "bricklink/core.h"
 #include "bricklink/order.h"
 #include "bricklink/dimensions.h"
+#include "bricklink/store.h"
+#include "bricklink/wantedlist.h"
 #include "ldraw/library.h"
 #include "common/actionmanager.h"
 #include "common/application.h"
@@ -23,6 +31,7 @@
 #include "common/documentmodel.h"
 #include "common/documentio.h"
 #include "common/recentfiles.h"
+#include "common/systeminfo.h"
 #include "brickstore_wrapper.h"
 #include "brickstore_wrapper_p.h"
 #include "version.h"
@@ -227,6 +236,136 @@ void QmlBrickStore::importBrickLinkCart(BrickLink::Cart *cart)
     DocumentIO::importBrickLinkCart(cart);
 }
 
+/*! \qmlmethod object BrickStore::matchWantedList(WantedList wantedList, Document document = null, bool createDocument = true)
+
+    Matches the lots of the given \a wantedList against the lots in \a document, or against the
+    BrickLink store inventory if \a document is \c null. The matching runs in the background and
+    the returned promise resolves to an object with these properties:
+    \table
+    \header \li Property \li Description
+    \row \li \c wantedQuantity \li The number of items on the wanted list.
+    \row \li \c filledQuantity \li The number of those items that are available.
+    \row \li \c fillRatio \li The ratio of the two quantities above (\c 0 to \c 1).
+    \row \li \c filledLots \li The number of wanted lots that could be filled completely.
+    \row \li \c value \li The price of the available items.
+    \row \li \c currencyCode \li The currency of all the values: the one of the wanted list.
+    \row \li \c matches \li A list of objects, one per wanted lot: \c index, \c item, \c color,
+                              \c wantedQuantity, \c filledQuantity and \c value.
+    \endtable
+    If \a createDocument is \c true, a new document containing the matching lots is opened.
+
+    The lots of the wanted list and the store inventory are downloaded first, if they haven't
+    been yet. If that fails, the promise resolves to an object with a single \c error property.
+
+    The minimum quantity, maximum price and condition of the wanted lots are respected. The
+    inventory lots are used cheapest first. If the inventory uses a different currency than the
+    wanted list, its prices are converted to the wanted list's currency first (and the new
+    document uses that currency as well). Without an exchange rate for both currencies, the
+    promise resolves to an \c error object.
+*/
+QCoro::QmlTask QmlBrickStore::matchWantedList(BrickLink::WantedList *wantedList,
+                                              QmlDocument *document, bool createDocument)
+{
+    if (!wantedList) {
+        qmlWarning(this) << "matchWantedList: wantedList is null";
+        return []() -> QCoro::Task<QVariantMap> { co_return { }; }();
+    }
+
+    QString title = tr("Wanted List %1 from %2")
+            .arg(wantedList->name().isEmpty() ? QString::number(wantedList->id()) : wantedList->name(),
+                 document ? document->document()->title() : tr("Store"));
+
+    return [](QmlBrickStore *that, QPointer<BrickLink::WantedList> wantedList,
+              QPointer<QmlDocument> document, bool useStore, bool createDocument,
+              QString title) -> QCoro::Task<QVariantMap> {
+        auto failed = [that](const QString &error) {
+            qmlWarning(that) << "matchWantedList:" << error;
+            return QVariantMap { { u"error"_qs, error } };
+        };
+
+        // the wanted list's lots are only downloaded on demand
+        if (wantedList->lots().isEmpty() && (wantedList->lotCount() > 0)) {
+            auto wantedLists = BrickLink::core()->wantedLists();
+            wantedLists->startRefreshLots(wantedList);
+
+            while (true) {
+                const auto [fetched, success, message] =
+                        co_await qCoro(wantedLists, &BrickLink::WantedLists::lotsFetched);
+                if (!wantedList)
+                    co_return failed(tr("The wanted list was deleted while fetching its lots"));
+                if (fetched != wantedList)
+                    continue;
+                if (!success)
+                    co_return failed(message);
+                break;
+            }
+        }
+
+        // the same goes for the store inventory
+        LotList inventory;
+        QString currencyCode;
+        if (useStore) {
+            auto store = BrickLink::core()->store();
+            if (!store->isValid()) {
+                store->startUpdate(); // a no-op, if an update is already running
+                const auto [success, message] = co_await qCoro(store, &BrickLink::Store::updateFinished);
+                if (!success || !store->isValid())
+                    co_return failed(message.isEmpty() ? tr("Failed to download the store inventory")
+                                                       : message);
+            }
+            inventory = store->lots();
+            currencyCode = store->currencyCode();
+        } else if (document) {
+            inventory = document->model()->lots();
+            currencyCode = document->model()->currencyCode();
+        } else {
+            co_return failed(tr("The document was closed while fetching the wanted list"));
+        }
+        if (!wantedList)
+            co_return failed(tr("The wanted list was deleted while fetching the store inventory"));
+
+        // the maximum prices of the wanted list are compared against the inventory prices
+        const QString wantedCurrencyCode = wantedList->currencyCode();
+        double crossRate = 1.;
+        if (!currencyCode.isEmpty() && (currencyCode != wantedCurrencyCode)) {
+            if (qFuzzyIsNull(Currency::inst()->rate(currencyCode))
+                    || qFuzzyIsNull(Currency::inst()->rate(wantedCurrencyCode))) {
+                co_return failed(tr("There is no exchange rate for converting %1 to %2")
+                                 .arg(currencyCode, wantedCurrencyCode));
+            }
+            crossRate = Currency::inst()->crossRate(currencyCode, wantedCurrencyCode);
+        }
+
+        const auto match = co_await DocumentIO::matchWantedList(wantedList->lots(), inventory,
+                                                                crossRate);
+
+        if (createDocument && !match.resultLots().isEmpty())
+            DocumentIO::importWantedListMatch(match, title, wantedCurrencyCode);
+
+        QVariantList matches;
+        matches.reserve(match.matches().size());
+        for (const auto &m : match.matches()) {
+            matches.append(QVariantMap {
+                               { u"index"_qs, m.wantedIndex },
+                               { u"item"_qs, QVariant::fromValue(BrickLink::QmlItem { m.item }) },
+                               { u"color"_qs, QVariant::fromValue(BrickLink::QmlColor { m.color }) },
+                               { u"wantedQuantity"_qs, m.wantedQuantity },
+                               { u"filledQuantity"_qs, m.filledQuantity },
+                               { u"value"_qs, m.value },
+                           });
+        }
+        co_return QVariantMap {
+            { u"wantedQuantity"_qs, match.wantedQuantity() },
+            { u"filledQuantity"_qs, match.filledQuantity() },
+            { u"fillRatio"_qs, match.fillRatio() },
+            { u"filledLots"_qs, match.filledLotCount() },
+            { u"value"_qs, match.value() },
+            { u"currencyCode"_qs, wantedCurrencyCode },
+            { u"matches"_qs, matches },
+        };
+    }(this, wantedList, document, !document, createDocument, title);
+}
+
 void QmlBrickStore::importPartInventory(BrickLink::QmlItem item, BrickLink::QmlColor color,
                                         int multiply, BrickLink::Condition condition,
                                         BrickLink::Status extraParts,
@@ -268,24 +407,33 @@ double QmlBrickStore::maxLocalPrice(const QString &currencyCode)
 
 QString QmlBrickStore::cacheStats() const
 {
-    auto pic = BrickLink::core()->pictureCache()->cacheStats();
-    auto pg = BrickLink::core()->priceGuideCache()->cacheStats();
-    auto ld = LDraw::library()->partCacheStats();
+    const auto memory = SystemInfo::inst()->memoryUsage();
 
-    QString picBar(int(double(pic.first) / pic.second * 16), u'=');
-    picBar += QString(16 - picBar.length(), u' ');
-    QString pgBar(int(double(pg.first) / pg.second * 16), u'=');
-    pgBar += QString(16 - pgBar.length(), u' ');
-    QString ldBar(int(double(ld.first) / ld.second * 16), u'=');
-    ldBar += QString(16 - ldBar.length(), u' ');
+    const QVector<std::pair<QString, QString>> subsystems = {
+        { u"memory.pictures"_qs,     u"Pictures    "_qs },
+        { u"memory.priceguides"_qs,  u"Price guides"_qs },
+        { u"memory.ldraw.parts"_qs,  u"LDraw parts "_qs },
+        { u"memory.ldraw.meshes"_qs, u"LDraw meshes"_qs },
+        { u"memory.database"_qs,     u"Database    "_qs },
+        { u"memory.documents"_qs,    u"Documents   "_qs },
+    };
 
-    return u"Cache stats:\n"_qs
-                  + u"Pictures    : [" + picBar + u"] " + QString::number(pic.first / 1000)
-                  + u" / " + QString::number(pic.second / 1000) + u" MB\n"
-                  + u"Price guides: [" + pgBar + u"] " + QString::number(pg.first)
-                  + u" / " + QString::number(pg.second) + u" entries\n"
-                  + u"LDraw parts : [" + ldBar + u"] " + QString::number(ld.first)
-                  + u" / " + QString::number(ld.second) + u" lines";
+    QString stats = u"Cache stats:"_qs;
+    for (const auto &[key, label] : subsystems) {
+        const double used = memory.value(key).toDouble() / 1'000'000;
+        const double budget = memory.value(key + u".budget").toDouble() / 1'000'000;
+
+        stats = stats + u'\n' + label + u": ";
+        if (budget > 0) {
+            QString bar(std::min(16, int(used / budget * 16)), u'=');
+            bar += QString(16 - bar.length(), u' ');
+            stats = stats + u'[' + bar + u"] " + QString::number(used, 'f', 1) + u" / "
+                    + QString::number(budget, 'f', 1) + u" MB";
+        } else {
+            stats = stats + QString(19, u' ') + QString::number(used, 'f', 1) + u" MB";
+        }
+    }
+    return stats;
 }
 
 void QmlBrickStore::crash(bool useException) const
@@ -1094,6 +1242,45 @@ QAbstractListModel *QmlDebug::log() const
     return QmlDebugLogModel::inst();
 }
 
+bool QmlDebug::tracing() const
+{
+    return Tracer::isEnabled();
+}
+
+void QmlDebug::setTracing(bool newTracing)
+{
+    if (Tracer::isEnabled() != newTracing) {
+        Tracer::setEnabled(newTracing);
+        emit tracingChanged(newTracing);
+    }
+}
+
+bool QmlDebug::saveTrace(const QString &fileName)
+{
+    QSaveFile f(fileName);
+    try {
+        if (!f.open(QIODevice::WriteOnly))
+            throw Exception(&f, "could not open the trace file for writing");
+        Tracer::writeChromeTrace(&f);
+        if (!f.commit())
+            throw Exception(&f, "could not save the trace file");
+        return true;
+    } catch (const Exception &e) {
+        qmlWarning(this) << e.errorString();
+        return false;
+    }
+}
+
+void QmlDebug::clearTrace()
+{
+    Tracer::clear();
+}
+
+QVariantMap QmlDebug::statistics() const
+{
+    return AppStatistics::inst()->snapshot().toVariantMap();
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
@@ -1108,8 +1295,12 @@ QmlDocumentLots::QmlDocumentLots(DocumentModel *model)
     if (!once) {
         BrickLink::QmlLot::setQmlSetterCallback([](QmlDocumentLots *lots, BrickLink::Lot *which,
                                                 const BrickLink::Lot &value) {
-            if (lots && lots->m_model)
-                lots->m_model->changeLot(which, value);
+            if (lots && lots->m_model) {
+                if (lots->m_updateDepth)
+                    lots->recordChange(which, value);
+                else
+                    lots->m_model->changeLot(which, value);
+            }
         });
         once = true;
     }
@@ -1134,8 +1325,10 @@ int QmlDocumentLots::add(BrickLink::QmlItem item, BrickLink::QmlColor color)
 */
 void QmlDocumentLots::remove(BrickLink::QmlLot lot)
 {
-    if (!lot.isNull() && m_model && (lot.m_documentLots == this))
+    if (!lot.isNull() && m_model && (lot.m_documentLots == this)) {
+        flushChanges();
         m_model->removeLot(lot.wrappedObject());
+    }
 }
 
 /*! \qmlmethod Document::lots.removeAt(int index)
@@ -1145,8 +1338,10 @@ void QmlDocumentLots::remove(BrickLink::QmlLot lot)
 void QmlDocumentLots::removeAt(int index)
 {
     const auto &lots = m_model->lots();
-    if ((index >= 0) && (index < int(lots.size())))
+    if ((index >= 0) && (index < int(lots.size()))) {
+        flushChanges();
         m_model->removeLot(lots.at(index));
+    }
 }
 
 /*! \qmlmethod Document::lots.removeVisibleAt(int index)
@@ -1157,8 +1352,10 @@ void QmlDocumentLots::removeAt(int index)
 void QmlDocumentLots::removeVisibleAt(int index)
 {
     const auto &filteredLots = m_model->filteredLots();
-    if ((index >= 0) && (index < int(filteredLots.size())))
+    if ((index >= 0) && (index < int(filteredLots.size()))) {
+        flushChanges();
         m_model->removeLot(filteredLots.at(index));
+    }
 }
 
 /*! \qmlmethod Lot Document::lots.at(int index)
@@ -1186,6 +1383,164 @@ BrickLink::QmlLot QmlDocumentLots::visibleAt(int index)
     return { filteredLots.at(index), this };
 }
 
+/*! \qmlmethod Document::lots.beginUpdate(string label)
+    Starts an update transaction: all the changes to lots of this document up to the matching
+    endUpdate() call are combined into a single undo step named \a label.
+    Within a transaction, modified lots immediately return their new values, but the document
+    view and the statistics are only updated once at the end.
+    Calls can be nested; only the outermost pair is significant.
+    A transaction cannot span multiple event loop iterations: if the script returns (or throws)
+    without calling endUpdate(), the transaction is closed automatically and a warning is
+    printed. Prefer update(), which cannot be left open by accident.
+    \sa endUpdate(), update()
+*/
+void QmlDocumentLots::beginUpdate(const QString &label)
+{
+    if (!m_updateDepth++) {
+        m_updateLabel = label;
+        m_updateCount = 0;
+        m_model->beginMacro();
+
+        // the script engine returns to the event loop after the script has run
+        QMetaObject::invokeMethod(this, [this, generation = ++m_updateGeneration]() {
+            if (m_updateDepth && (generation == m_updateGeneration)) {
+                qmlWarning(this) << "beginUpdate() without a matching endUpdate(): closing the transaction";
+                m_updateDepth = 1;
+                endUpdate();
+            }
+        }, Qt::QueuedConnection);
+    }
+}
+
+/*! \qmlmethod Document::lots.endUpdate()
+    Ends an update transaction started by beginUpdate() and applies all the collected changes
+    in one go.
+*/
+void QmlDocumentLots::endUpdate()
+{
+    if (!m_updateDepth) {
+        qmlWarning(this) << "endUpdate() called without a matching beginUpdate()";
+        return;
+    }
+    if (--m_updateDepth)
+        return;
+
+    flushChanges();
+
+    QString label = m_updateLabel;
+    if (label.isEmpty())
+        label = tr("Modified %Ln lot(s)", nullptr, m_updateCount);
+    m_model->endMacro(label);
+    m_updateLabel.clear();
+}
+
+/*! \qmlmethod Document::lots.update(function callback, string label)
+    A convenience wrapper around beginUpdate() and endUpdate(): the \a callback function is run
+    within an update transaction. The changes made before an exception is thrown in \a callback
+    are still applied (and can be undone in one step), then the exception is propagated.
+*/
+void QmlDocumentLots::update(const QJSValue &callback, const QString &label)
+{
+    if (!callback.isCallable()) {
+        qmlWarning(this) << "update() needs a function as its first argument";
+        return;
+    }
+    beginUpdate(label);
+    QJSValue result = callback.call();
+    endUpdate();
+
+    if (result.isError()) {
+        if (auto *engine = qjsEngine(this))
+            engine->throwError(result);
+        else
+            qmlWarning(this) << "update() callback failed:" << result.toString();
+    }
+}
+
+/*! \qmlmethod list Document::lots.column(Document.Field field, bool visibleOnly)
+    Returns the values of the column \a field for all the lots in the document in one array,
+    which is a lot faster than iterating via at() for large documents.
+    The order is the same as for at(), or for visibleAt() if \a visibleOnly is \c true.
+*/
+QVariantList QmlDocumentLots::column(int field, bool visibleOnly) const
+{
+    if ((field < 0) || (field >= DocumentModel::FieldCount))
+        return { };
+    return m_model->columnDataForEditRole(visibleOnly ? m_model->filteredLots() : m_model->lots(),
+                                          static_cast<DocumentModel::Field>(field));
+}
+
+/*! \qmlmethod int Document::lots.setColumn(Document.Field field, list values, bool visibleOnly)
+    Sets the column \a field for all the lots in the document to the corresponding entry in the
+    \a values array, using the same order as column(). Surplus values are ignored, just as lots
+    are left alone if there are not enough values.
+    All the changes are applied as a single undo step, so there is no need for an explicit
+    transaction. Returns the number of lots that actually changed.
+*/
+int QmlDocumentLots::setColumn(int field, const QVariantList &values, bool visibleOnly)
+{
+    if ((field < 0) || (field >= DocumentModel::FieldCount))
+        return 0;
+
+    // the setters might sort or filter the model, so we need a copy of the list
+    const LotList lots = visibleOnly ? m_model->filteredLots() : m_model->lots();
+    const auto count = std::min(lots.size(), values.size());
+
+    std::vector<std::pair<Lot *, Lot>> changes;
+    changes.reserve(size_t(count));
+    for (qsizetype i = 0; i < count; ++i)
+        changes.emplace_back(lots.at(i), *lots.at(i));
+
+    // this is the same dance as in DocumentModel::setData(): the setters need lot pointers that
+    // are valid in the model (e.g. to resolve the difference base lots), so we modify the real
+    // lots first and then swap the old values back in
+    m_model->setColumnDataForEditRole(lots, static_cast<DocumentModel::Field>(field), values);
+    for (auto &[lot, value] : changes)
+        std::swap(*lot, value);
+
+    int changed = 0;
+    if (m_updateDepth) {
+        for (const auto &[lot, value] : changes) {
+            if (*lot != value) {
+                recordChange(lot, value);
+                ++changed;
+            }
+        }
+    } else {
+        std::erase_if(changes, [](const auto &change) { return *change.first == change.second; });
+        changed = int(changes.size());
+        m_model->changeLots(changes, static_cast<DocumentModel::Field>(field));
+    }
+    return changed;
+}
+
+void QmlDocumentLots::recordChange(Lot *lot, const Lot &value)
+{
+    if (!m_originalLotIndex.contains(lot)) {
+        m_originalLotIndex.insert(lot, qsizetype(m_originalLots.size()));
+        m_originalLots.emplace_back(lot, *lot);
+        ++m_updateCount;
+    }
+    *lot = value;
+}
+
+void QmlDocumentLots::flushChanges()
+{
+    if (m_originalLots.empty())
+        return;
+
+    // the lots already have their new values: swap in the originals again, so that the undo
+    // command can do the actual change (and emit all the necessary signals) in a single pass
+    for (auto &[lot, value] : m_originalLots)
+        std::swap(*lot, value);
+
+    std::erase_if(m_originalLots, [](const auto &change) { return *change.first == change.second; });
+    m_model->changeLots(m_originalLots);
+
+    m_originalLots.clear();
+    m_originalLotIndex.clear();
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
@@ -356,6 +356,7 @@ class QmlDebug : public QObject
     QML_UNCREATABLE("")
     Q_PROPERTY(bool showTracers READ showTracers WRITE setShowTracers NOTIFY showTracersChanged FINAL)
     Q_PROPERTY(QAbstractListModel *log READ log CONSTANT FINAL)
+    Q_PROPERTY(bool tracing READ tracing WRITE setTracing NOTIFY tracingChanged FINAL)
 
 public:
     QmlDebug(QObject *parent = nullptr);
@@ -363,9 +364,17 @@ public:
     bool showTracers() const;
     void setShowTracers(bool newShowTracers);
     QAbstractListModel *log() const;
+    bool tracing() const;
+    void setTracing(bool newTracing);
+
+    Q_INVOKABLE bool saveTrace(const QString &fileName);
+    Q_INVOKABLE void clearTrace();
+
+    Q_INVOKABLE QVariantMap statistics() const;
 
 signals:
     void showTracersChanged(bool newShowTracers);
+    void tracingChanged(bool newTracing);
 
 private:
     bool m_showTracers;
@@ -514,9 +523,28 @@ public:
     Q_INVOKABLE BrickLink::QmlLot at(int index);
     Q_INVOKABLE BrickLink::QmlLot visibleAt(int index);
 
+    Q_INVOKABLE void beginUpdate(const QString &label = { });
+    Q_INVOKABLE void endUpdate();
+    Q_INVOKABLE void update(const QJSValue &callback, const QString &label = { });
+
+    Q_INVOKABLE QVariantList column(int field, bool visibleOnly = false) const;
+    Q_INVOKABLE int setColumn(int field, const QVariantList &values, bool visibleOnly = false);
+
 private:
+    void recordChange(BrickLink::Lot *lot, const BrickLink::Lot &value);
+    void flushChanges();
+
     DocumentModel *m_model;
 
+    // an open update transaction: the lots are modified in place and the original values are
+    // kept here, so that all the changes can be pushed as a single undo command in the end
+    int m_updateDepth = 0;
+    quint64 m_updateGeneration = 0;
+    QString m_updateLabel;
+    int m_updateCount = 0;
+    std::vector<std::pair<BrickLink::Lot *, BrickLink::Lot>> m_originalLots;
+    QHash<const BrickLink::Lot *, qsizetype> m_originalLotIndex;
+
     friend class BrickLink::QmlLot::Setter;
 };
 
@@ -602,6 +630,9 @@ public:
     Q_INVOKABLE void importBrickLinkStore(BrickLink::Store *store);
     Q_INVOKABLE void importBrickLinkOrder(BrickLink::Order *order);
     Q_INVOKABLE void importBrickLinkCart(BrickLink::Cart *cart);
+    Q_INVOKABLE QCoro::QmlTask matchWantedList(BrickLink::WantedList *wantedList,
+                                               QmlDocument *document = nullptr,
+                                               bool createDocument = true);
 
     Q_INVOKABLE void importPartInventory(BrickLink::QmlItem item, BrickLink::QmlColor color,
                                          int multiply, BrickLink::Condition condition,
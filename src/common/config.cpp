@@ -360,6 +360,108 @@ void Config::setUpdateIntervals(const QMap<QByteArray, int> &uiv)
         emit updateIntervalsChanged(updateIntervals());
 }
 
+QMap<QByteArray, int> Config::cacheSizeLimits() const
+{
+    QMap<QByteArray, int> csl = cacheSizeLimitsDefault();
+
+    static const std::array lut = { "Picture", "PriceGuide" };
+
+    for (const auto &cs : lut)
+        csl[cs] = value(u"BrickLink/CacheSizeLimit/"_qs + QString::fromLatin1(cs), csl[cs]).toInt();
+    return csl;
+}
+
+QMap<QByteArray, int> Config::cacheSizeLimitsDefault() const
+{
+    QMap<QByteArray, int> csl; // in MB, 0 means unlimited
+
+#if defined(BS_MOBILE)
+    // storage is scarce on phones and tablets and there is no UI to clear the caches
+    csl.insert("Picture",    500);
+    csl.insert("PriceGuide", 100);
+#else
+    // the caches were never limited before, so this has to be an explicit opt-in on the desktop
+    csl.insert("Picture",    0);
+    csl.insert("PriceGuide", 0);
+#endif
+
+    return csl;
+}
+
+void Config::setCacheSizeLimits(const QMap<QByteArray, int> &csl)
+{
+    bool modified = false;
+    QMap<QByteArray, int> old_csl = cacheSizeLimits();
+
+    for (QMapIterator<QByteArray, int> it(csl); it.hasNext(); ) {
+        it.next();
+
+        if (it.value() != old_csl.value(it.key())) {
+            setValue(u"BrickLink/CacheSizeLimit/"_qs + QString::fromLatin1(it.key()), it.value());
+            modified = true;
+        }
+    }
+
+    if (modified)
+        emit cacheSizeLimitsChanged(cacheSizeLimits());
+}
+
+QMap<QByteArray, int> Config::memoryBudgets() const
+{
+    QMap<QByteArray, int> mb = memoryBudgetsDefault();
+
+    static const std::array lut = { "Picture", "PriceGuide", "LDrawPart", "LDrawMesh" };
+
+    for (const auto &b : lut)
+        mb[b] = value(u"General/MemoryBudget/"_qs + QString::fromLatin1(b), mb[b]).toInt();
+    return mb;
+}
+
+QMap<QByteArray, int> Config::memoryBudgetsDefault() const
+{
+    QMap<QByteArray, int> mb; // in MB, 0 means automatic (based on the physical memory size)
+
+    mb.insert("Picture",    0);
+    mb.insert("PriceGuide", 0);
+    mb.insert("LDrawPart",  0);
+    mb.insert("LDrawMesh",  0);
+
+    return mb;
+}
+
+void Config::setMemoryBudgets(const QMap<QByteArray, int> &mb)
+{
+    bool modified = false;
+    QMap<QByteArray, int> old_mb = memoryBudgets();
+
+    for (QMapIterator<QByteArray, int> it(mb); it.hasNext(); ) {
+        it.next();
+
+        if (it.value() != old_mb.value(it.key())) {
+            setValue(u"General/MemoryBudget/"_qs + QString::fromLatin1(it.key()), it.value());
+            modified = true;
+        }
+    }
+
+    if (modified)
+        emit memoryBudgetsChanged(memoryBudgets());
+}
+
+int Config::maxInFlightPriceGuideBatches() const
+{
+    return value(u"BrickLink/PriceGuide/MaxInFlightBatches"_qs, 0).toInt();
+}
+
+void Config::setMaxInFlightPriceGuideBatches(int count)
+{
+    count = std::max(0, count);
+
+    if (maxInFlightPriceGuideBatches() != count) {
+        setValue(u"BrickLink/PriceGuide/MaxInFlightBatches"_qs, count);
+        emit maxInFlightPriceGuideBatchesChanged(count);
+    }
+}
+
 QByteArray Config::columnLayout(const QString &id) const
 {
     if (id.isEmpty())
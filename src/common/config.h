@@ -107,6 +107,14 @@ public:
     QMap<QByteArray, int> updateIntervals() const;
     QMap<QByteArray, int> updateIntervalsDefault() const;
     void setUpdateIntervals(const QMap<QByteArray, int> &intervals);
+    QMap<QByteArray, int> cacheSizeLimits() const;
+    QMap<QByteArray, int> cacheSizeLimitsDefault() const;
+    void setCacheSizeLimits(const QMap<QByteArray, int> &limits);
+    QMap<QByteArray, int> memoryBudgets() const;
+    QMap<QByteArray, int> memoryBudgetsDefault() const;
+    void setMemoryBudgets(const QMap<QByteArray, int> &budgets);
+    int maxInFlightPriceGuideBatches() const; // 0 means the retriever's default
+    void setMaxInFlightPriceGuideBatches(int count);
 
     enum class UISize {
         System,
@@ -184,6 +192,9 @@ signals:
     void showDifferenceIndicatorsChanged(bool b);
     void visualChangesMarkModifiedChanged(bool b);
     void updateIntervalsChanged(const QMap<QByteArray, int> &intervals);
+    void cacheSizeLimitsChanged(const QMap<QByteArray, int> &limits);
+    void memoryBudgetsChanged(const QMap<QByteArray, int> &budgets);
+    void maxInFlightPriceGuideBatchesChanged(int count);
     void onlineStatusChanged(bool b);
     void toolBarSizeChanged(Config::UISize iconSize);
     void iconSizePercentChanged(int p);
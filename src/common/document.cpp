@@ -1519,15 +1519,16 @@ QCoro::Task<> Document::exportBrickLinkXMLToFile()
         fn = fn + u".xml";
 #endif
 
-    const QByteArray xml = BrickLink::IO::toBrickLinkXML(lots).toUtf8();
-
     QSaveFile f(fn);
     f.setDirectWriteFallback(true);
     try {
         if (!f.open(QIODevice::WriteOnly))
             throw Exception(tr("Failed to open file %1 for writing."));
-        if (f.write(xml.data(), xml.size()) != qint64(xml.size()))
+        try {
+            BrickLink::IO::writeBrickLinkXML(&f, lots);
+        } catch (const Exception &) {
             throw Exception(tr("Failed to save data to file %1."));
+        }
         if (!f.commit())
             throw Exception(tr("Failed to save data to file %1."));
 
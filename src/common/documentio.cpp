@@ -1,21 +1,31 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <charconv>
+#include <limits>
 #include <memory>
+#include <string_view>
+#include <unordered_map>
 
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtGui/QGuiApplication>
 #include <QtGui/QCursor>
 #include <QFileInfo>
 #include <QDir>
+#include <QSet>
 #include <QStringView>
 #include <QTemporaryFile>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 #include <QDebug>
 
+#include <QCoro/QCoroFuture>
+
 #include "utility/exception.h"
 #include "utility/utility.h"
 #include "utility/stopwatch.h"
+#include "utility/tracing.h"
 #include "minizip/minizip.h"
 #include "bricklink/cart.h"
 #include "bricklink/core.h"
@@ -106,6 +116,7 @@ Document *DocumentIO::importBrickLinkWantedList(BrickLink::WantedList *wantedLis
     const auto &lots = wantedList->lots();
     for (const auto *lot : lots)
         pr.addLot(new Lot(*lot));
+    pr.setCurrencyCode(wantedList->currencyCode());
 
     auto *document = new Document(new DocumentModel(std::move(pr)));
     QString name = wantedList->name().isEmpty() ? QString::number(wantedList->id())
@@ -115,6 +126,50 @@ Document *DocumentIO::importBrickLinkWantedList(BrickLink::WantedList *wantedLis
     return document;
 }
 
+QCoro::Task<BrickLink::WantedListMatch> DocumentIO::matchWantedList(LotList wanted, LotList inventory,
+                                                                    double inventoryCrossRate)
+{
+    // the originals could be modified or deleted while the matcher is running
+    for (auto &lot : wanted)
+        lot = new Lot(*lot);
+    for (auto &lot : inventory) {
+        lot = new Lot(*lot);
+
+        // the matcher compares the prices as-is, so they have to be in the same currency
+        if (!qFuzzyCompare(inventoryCrossRate, 1.)) {
+            lot->setCost(lot->cost() * inventoryCrossRate);
+            lot->setPrice(lot->price() * inventoryCrossRate);
+            lot->setTierPrice(0, lot->tierPrice(0) * inventoryCrossRate);
+            lot->setTierPrice(1, lot->tierPrice(1) * inventoryCrossRate);
+            lot->setTierPrice(2, lot->tierPrice(2) * inventoryCrossRate);
+        }
+    }
+
+    auto match = co_await QtConcurrent::run([wanted, inventory]() {
+        BrickLink::WantedListMatch m(wanted, inventory);
+        qDeleteAll(wanted);
+        qDeleteAll(inventory);
+        return m;
+    });
+    co_return match;
+}
+
+Document *DocumentIO::importWantedListMatch(const BrickLink::WantedListMatch &match,
+                                            const QString &title, const QString &currencyCode)
+{
+    BrickLink::IO::ParseResult pr;
+    const auto &lots = match.resultLots();
+    for (const auto &lot : lots)
+        pr.addLot(new Lot(lot));
+    if (!currencyCode.isEmpty())
+        pr.setCurrencyCode(currencyCode);
+
+    auto *document = new Document(new DocumentModel(std::move(pr)));
+    document->setTitle(title);
+    document->setThumbnail(u"love-amarok"_qs);
+    return document;
+}
+
 QCoro::Task<Document *> DocumentIO::importBrickLinkXML(QString fileName)
 {
     QString fn = fileName;
@@ -207,203 +262,329 @@ QCoro::Task<Document *> DocumentIO::importLDrawModel(QString fileName)
     co_return nullptr;
 }
 
-bool DocumentIO::parseLDrawModel(QFile *f, bool isStudio, BrickLink::IO::ParseResult &pr)
+namespace {
+
+// the key the part references are consolidated on: either a known item/color or the raw ids
+struct LDrawPartKey
 {
-    QVector<QString> recursion_detection;
-    QHash<QString, QVector<Lot *>> subCache;
-    QVector<Lot *> ldrawLots;
+    const BrickLink::Item *item = nullptr;
+    const BrickLink::Color *color = nullptr;
+    QByteArray itemId;  // only if item is null
+    uint colorId = 0;   // only if color is null
 
-    {
-        stopwatch parse("parse ldraw model");
+    bool operator==(const LDrawPartKey &other) const = default;
+};
 
-        if (!parseLDrawModelInternal(f, isStudio, QString(), ldrawLots, subCache, recursion_detection))
-            return false;
-    }
+size_t qHash(const LDrawPartKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.item, key.color, key.itemId, key.colorId);
+}
+
+// the parts of a (sub-)model, consolidated in the order of their first appearance
+struct LDrawPartList
+{
+    std::vector<std::pair<LDrawPartKey, qint64>> parts;
+    QHash<LDrawPartKey, qsizetype> index;
+
+    void add(const LDrawPartKey &key, qint64 count)
     {
-        stopwatch consolidate("removing duplicates");
-        // remove duplicate lot pointers that get added due to sub-module caching
-        for (int i = 0; i < ldrawLots.count(); ++i) {
-            if (auto *lot = ldrawLots[i]) {
-                for (int j = i + 1; j < ldrawLots.count(); ++j) {
-                    if (auto *&otherLot = ldrawLots[j]) {
-                        if (lot == otherLot) {
-                            lot->setQuantity(lot->quantity() + 1);
-                            otherLot = nullptr;
-                        }
-                    }
-                }
-            }
+        auto it = index.constFind(key);
+        if (it == index.cend()) {
+            index.insert(key, qsizetype(parts.size()));
+            parts.emplace_back(key, count);
+        } else {
+            parts[*it].second += count;
         }
     }
-    {
-        stopwatch consolidate("consolidate ldraw model");
-        // consolidate everything
-        for (int i = 0; i < ldrawLots.count(); ++i) {
-            if (auto *lot = ldrawLots[i]) {
-                if (lot->isIncomplete())
-                    pr.incInvalidLotCount();
-
-                for (int j = i + 1; j < ldrawLots.count(); ++j) {
-                    if (auto *&otherLot = ldrawLots[j]) {
-                        bool mergeable = false;
-
-                        if (!lot->isIncomplete() && !otherLot->isIncomplete()) {
-                            // item AND color are non-null and match
-                            mergeable = (lot->item() == otherLot->item())
-                                        && (lot->color() == otherLot->color());
-
-                        } else if (lot->isIncomplete() && otherLot->isIncomplete()) {
-                            // either item AND color are null on both, or one is non-null and matches
-                            if ((lot->item() == otherLot->item()) && (lot->color() == otherLot->color()))
-                                mergeable = (*lot->isIncomplete() == *otherLot->isIncomplete());
-                        }
+};
 
-                        if (mergeable) {
-                            lot->setQuantity(lot->quantity() + otherLot->quantity());
-                            delete otherLot;
-                            otherLot = nullptr;
-                        }
-                    }
-                }
-                pr.addLot(std::move(lot));
-            }
-        }
-    }
-    return true;
-}
+struct LDrawReference
+{
+    LDrawPartKey part;  // the fallback, if this is not a resolvable sub-model
+    QString subModel;   // set, if this could be a reference to a sub-model
+    qint64 count = 0;
+};
 
-bool DocumentIO::parseLDrawModelInternal(QFile *f, bool isStudio, const QString &modelName,
-                                         QVector<Lot *> &lots,
-                                         QHash<QString, QVector<Lot *>> &subCache,
-                                         QVector<QString> &recursionDetection)
+struct LDrawModel
 {
-    auto it = subCache.constFind(modelName);
-    if (it != subCache.cend()) {
-        lots = it.value();
-        return true;
-    }
+    QByteArrayView data;
+    QString dir;        // for resolving external sub-model files
+    std::vector<LDrawReference> references;
+};
 
-    if (recursionDetection.contains(modelName))
-        return false;
-    recursionDetection.append(modelName);
+class LDrawTokenizer
+{
+public:
+    explicit LDrawTokenizer(QByteArrayView line)
+        : m_pos(line.data())
+        , m_end(line.data() + line.size())
+    { }
 
-    QStringList searchpath;
-    bool is_mpd = false;
-    int current_mpd_index = -1;
-    QString current_mpd_model;
-    bool is_mpd_model_found = false;
+    QByteArrayView next()
+    {
+        skipSpace();
+        const char *start = m_pos;
+        while ((m_pos < m_end) && !isSpace(*m_pos))
+            ++m_pos;
+        return { start, m_pos - start };
+    }
 
-    searchpath.append(QFileInfo(*f).dir().absolutePath());
+    // everything that is left, without the surrounding white-space
+    QByteArrayView rest()
+    {
+        skipSpace();
+        const char *end = m_end;
+        while ((end > m_pos) && isSpace(end[-1]))
+            --end;
+        return { m_pos, end - m_pos };
+    }
 
-    if (f->isOpen()) {
-        QTextStream in(f);
-        QString line;
+    static bool equals(QByteArrayView token, std::string_view str)
+    {
+        return std::string_view(token.data(), size_t(token.size())) == str;
+    }
 
-        while (!(line = in.readLine()).isNull()) {
-            if (line.isEmpty())
-                continue;
+private:
+    static bool isSpace(char c)  { return (c == ' ') || (c == '\t') || (c == '\r'); }
 
-            if (line.at(0) == u'0') {
-                const auto split = QStringView{line}.split(u' ', Qt::SkipEmptyParts);
-                auto strPosition = [line](QStringView sv) { return sv.constData() - line.constData(); };
+    void skipSpace()
+    {
+        while ((m_pos < m_end) && isSpace(*m_pos))
+            ++m_pos;
+    }
 
-                if ((split.count() >= 2) && (split.at(1) == u"FILE")) {
-                    is_mpd = true;
-                    current_mpd_model = line.mid(strPosition(split.at(2))).toLower();
-                    current_mpd_index++;
+    const char *m_pos;
+    const char *m_end;
+};
 
-                    if (is_mpd_model_found)
-                        break;
+template <typename F> void forEachLDrawLine(QByteArrayView data, F &&callback)
+{
+    qsizetype pos = 0;
+    while (pos < data.size()) {
+        qsizetype eol = data.indexOf('\n', pos);
+        if (eol < 0)
+            eol = data.size();
+        callback(data.sliced(pos, eol - pos), pos);
+        pos = eol + 1;
+    }
+}
 
-                    if ((current_mpd_model == modelName.toLower()) || (modelName.isEmpty() && (current_mpd_index == 0)))
-                        is_mpd_model_found = true;
+// A single pass over the file, recording the byte range of every MPD sub-model (the first one
+// is the main model). Files without any "0 FILE" lines are a single model named mainName.
+QVector<std::pair<QString, QByteArrayView>> indexLDrawFile(QByteArrayView data, const QString &mainName)
+{
+    QVector<std::pair<QString, QByteArrayView>> models;
+    QString currentName;
+    qsizetype currentStart = -1;
+
+    auto endModel = [&](qsizetype end) {
+        if (currentStart >= 0)
+            models.emplace_back(currentName, data.sliced(currentStart, end - currentStart));
+        currentStart = -1;
+    };
 
-                    if (f->isSequential())
-                        return false; // we need to seek!
-                }
+    forEachLDrawLine(data, [&](QByteArrayView line, qsizetype lineStart) {
+        LDrawTokenizer tokens(line);
+        if (!LDrawTokenizer::equals(tokens.next(), "0"))
+            return;
+        const auto cmd = tokens.next();
+        if (LDrawTokenizer::equals(cmd, "FILE")) {
+            endModel(lineStart);
+            currentName = QString::fromUtf8(tokens.rest()).toLower();
+            currentStart = lineStart;
+        } else if (LDrawTokenizer::equals(cmd, "NOFILE")) {
+            endModel(lineStart);
+        }
+    });
+    endModel(data.size());
 
-            } else if (line.at(0) == u'1') {
-                if (is_mpd && !is_mpd_model_found)
-                    continue;
-                const auto split = QStringView{line}.split(u' ', Qt::SkipEmptyParts);
-                auto strPosition = [line](QStringView sv) { return sv.constData() - line.constData(); };
+    if (models.isEmpty())
+        models.emplace_back(mainName, data);
+    return models;
+}
 
-                if (split.count() >= 15) {
-                    uint colid = split.at(1).toUInt();
-                    QString partname = line.mid(strPosition(split.at(14))).toLower();
+uint toUInt(QByteArrayView token)
+{
+    uint i = 0;
+    auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), i);
+    return ((ec == std::errc { }) && (ptr == (token.data() + token.size()))) ? i : 0;
+}
 
-                    QString partid = partname;
-                    partid.truncate(partid.lastIndexOf(u'.'));
+// This only needs read access to the BrickLink database, so the models can be parsed in parallel
+void parseLDrawModel(LDrawModel &model, bool isStudio)
+{
+    QHash<std::pair<QByteArray, uint>, qsizetype> index;
 
-                    const BrickLink::Item *itemp = BrickLink::core()->item('P', partid.toLatin1());
+    forEachLDrawLine(model.data, [&](QByteArrayView line, qsizetype) {
+        LDrawTokenizer tokens(line);
+        if (!LDrawTokenizer::equals(tokens.next(), "1"))
+            return;
 
-                    if (!itemp && !partname.endsWith(u".dat")) {
-                        bool got_subfile = false;
-                        QVector<Lot *> subLots;
+        const uint colid = toUInt(tokens.next());
+        for (int i = 0; i < 12; ++i) { // the position and the transformation matrix
+            if (tokens.next().isEmpty())
+                return;
+        }
+        const auto fileName = tokens.rest(); // may contain spaces
+        if (fileName.isEmpty())
+            return;
+
+        std::pair<QByteArray, uint> rawKey { fileName.toByteArray(), colid };
+        if (auto it = index.constFind(rawKey); it != index.cend()) {
+            ++model.references[size_t(*it)].count;
+            return;
+        }
 
-                        if (is_mpd) {
-                            qint64 oldpos = f->pos();
-                            f->seek(0);
+        const QString partname = QString::fromUtf8(fileName).toLower();
+        QString partid = partname;
+        partid.truncate(partid.lastIndexOf(u'.'));
+
+        const BrickLink::Item *itemp = BrickLink::core()->item('P', partid.toLatin1());
+        const BrickLink::Color *colp = isStudio ? BrickLink::core()->color(colid)
+                                                : BrickLink::core()->colorFromLDrawId(int(colid));
+        if (colp && (colp->id() == BrickLink::Color::InvalidId)) // LDraw-only color
+            colp = nullptr;
+
+        LDrawReference ref;
+        ref.part = { itemp, colp, itemp ? QByteArray { } : partid.toLatin1(), colp ? 0 : colid };
+        if (!itemp && !partname.endsWith(u".dat"))
+            ref.subModel = partname;
+        ref.count = 1;
+
+        index.insert(rawKey, qsizetype(model.references.size()));
+        model.references.push_back(std::move(ref));
+    });
+}
 
-                            got_subfile = parseLDrawModelInternal(f, isStudio, partname, subLots, subCache, recursionDetection);
+} // namespace
 
-                            f->seek(oldpos);
-                        }
+bool DocumentIO::parseLDrawModel(QFile *f, bool isStudio, BrickLink::IO::ParseResult &pr)
+{
+    if (!f->isOpen())
+        return false;
 
-                        if (!got_subfile) {
-                            for (const auto &path : std::as_const(searchpath)) {
-                                QFile subf(path + u'/' + partname);
+    std::vector<QByteArray> fileData; // the LDrawModels reference this data
+    std::vector<std::pair<QString, LDrawModel>> pending;
+    QHash<QString, LDrawModel> models;
+    QSet<QString> knownNames;
+    QString rootName;
+
+    auto addModels = [&](const QVector<std::pair<QString, QByteArrayView>> &index, const QString &dir) {
+        for (const auto &[name, data] : index) {
+            if (!knownNames.contains(name)) {
+                knownNames.insert(name);
+                pending.emplace_back(name, LDrawModel { data, dir, { } });
+            }
+        }
+    };
 
-                                if (subf.open(QIODevice::ReadOnly)) {
+    {
+        stopwatch index("index ldraw model");
 
-                                    (void) parseLDrawModelInternal(&subf, isStudio, partname, subLots, subCache, recursionDetection);
+        fileData.push_back(f->readAll());
+        const auto mainIndex = indexLDrawFile(fileData.back(), { });
+        rootName = mainIndex.constFirst().first;
+        addModels(mainIndex, QFileInfo(*f).dir().absolutePath());
+    }
+    {
+        stopwatch parse("parse ldraw model");
 
-                                    got_subfile = true;
-                                    break;
-                                }
-                            }
-                        }
-                        if (got_subfile) {
-                            subCache.insert(partname, subLots);
-                            lots.append(subLots);
-                            continue;
-                        }
+        // every round parses all the known models in parallel, then looks for references to
+        // sub-models in external files: these are loaded and parsed in the next round
+        while (!pending.empty()) {
+            QtConcurrent::blockingMap(pending, [isStudio](std::pair<QString, LDrawModel> &nameAndModel) {
+                parseLDrawModel(nameAndModel.second, isStudio);
+            });
+
+            std::vector<std::pair<QString, LDrawModel>> parsed;
+            std::swap(parsed, pending);
+
+            for (auto &[name, model] : parsed) {
+                for (const auto &ref : model.references) {
+                    if (ref.subModel.isEmpty() || knownNames.contains(ref.subModel))
+                        continue;
+
+                    QFile subf(model.dir + u'/' + ref.subModel);
+                    if (!subf.open(QIODevice::ReadOnly)) {
+                        knownNames.insert(ref.subModel); // don't try again
+                        continue;
                     }
+                    fileData.push_back(subf.readAll());
+                    auto subIndex = indexLDrawFile(fileData.back(), ref.subModel);
+                    // an external MPD file is referenced by its file name, not its first model
+                    if (std::none_of(subIndex.cbegin(), subIndex.cend(), [&](const auto &nameAndData) {
+                                         return nameAndData.first == ref.subModel; })) {
+                        subIndex.prepend({ ref.subModel, subIndex.constFirst().second });
+                    }
+                    addModels(subIndex, QFileInfo(subf).dir().absolutePath());
+                }
+                models.insert(name, std::move(model));
+            }
+        }
+    }
 
-                    const BrickLink::Color *colp = isStudio ? BrickLink::core()->color(colid)
-                                                            : BrickLink::core()->colorFromLDrawId(int(colid));
+    const LDrawPartList *root = nullptr;
+    std::unordered_map<QString, LDrawPartList> subCache; // node based: the pointers are stable
+    {
+        stopwatch consolidate("consolidate ldraw model");
 
-                    if (colp && (colp->id() == BrickLink::Color::InvalidId)) // LDraw-only color
-                        colp = nullptr;
+        QSet<QString> recursionDetection;
+
+        // the flattened part list of every sub-model is only calculated once, and then simply
+        // multiplied by the number of references
+        std::function<const LDrawPartList *(const QString &)> flatten;
+        flatten = [&](const QString &name) -> const LDrawPartList * {
+            if (auto it = subCache.find(name); it != subCache.end())
+                return &it->second;
+
+            auto mit = models.constFind(name);
+            if ((mit == models.cend()) || recursionDetection.contains(name))
+                return nullptr;
+            recursionDetection.insert(name);
+
+            LDrawPartList list;
+            for (const auto &ref : mit->references) {
+                const LDrawPartList *sub = ref.subModel.isEmpty() ? nullptr : flatten(ref.subModel);
+                if (sub) {
+                    for (const auto &[key, count] : sub->parts)
+                        list.add(key, count * ref.count);
+                } else {
+                    list.add(ref.part, ref.count);
+                }
+            }
+            recursionDetection.remove(name);
+            return &subCache.emplace(name, std::move(list)).first->second;
+        };
 
-                    auto *lot = new Lot(itemp, colp);
-                    lot->setQuantity(1);
+        root = flatten(rootName);
+    }
+    if (!root)
+        return false;
 
-                    if (!colp || !itemp) {
-                        auto *inc = new BrickLink::Incomplete;
+    for (const auto &[key, count] : root->parts) {
+        auto *lot = new Lot(key.item, key.color);
+        lot->setQuantity(int(std::min<qint64>(count, std::numeric_limits<int>::max())));
 
-                        if (!itemp) {
-                            inc->m_item_id = partid.toLatin1();
-                            inc->m_itemtype_id = 'P';
-                            inc->m_itemtype_name = u"Part"_qs;
-                        }
-                        if (!colp) {
-                            if (isStudio)
-                                inc->m_color_id = colid;
-                            else
-                                inc->m_color_name = u"LDraw #"_qs + QString::number(colid);
-                        }
-                        lot->setIncomplete(inc);
-                    }
-                    lots.append(lot);
-                }
+        if (!key.item || !key.color) {
+            auto *inc = new BrickLink::Incomplete;
+
+            if (!key.item) {
+                inc->m_item_id = key.itemId;
+                inc->m_itemtype_id = 'P';
+                inc->m_itemtype_name = u"Part"_qs;
+            }
+            if (!key.color) {
+                if (isStudio)
+                    inc->m_color_id = key.colorId;
+                else
+                    inc->m_color_name = u"LDraw #"_qs + QString::number(key.colorId);
             }
+            lot->setIncomplete(inc);
+            pr.incInvalidLotCount();
         }
+        pr.addLot(std::move(lot));
     }
-
-    recursionDetection.removeLast();
-
-    return is_mpd ? is_mpd_model_found : true;
+    return true;
 }
 
 
@@ -416,7 +597,7 @@ bool DocumentIO::parseLDrawModelInternal(QFile *f, bool isStudio, const QString
 
 Document *DocumentIO::parseBsxInventory(QFile *in)
 {
-    //stopwatch loadBsxWatch("Load BSX");
+    tracezone zone("DocumentIO::parseBsxInventory");
 
     Q_ASSERT(in);
     QXmlStreamReader xml(in);
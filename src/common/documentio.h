@@ -7,6 +7,7 @@
 #include "bricklink/global.h"
 #include "bricklink/io.h"
 #include "bricklink/lot.h"
+#include "bricklink/wantedmatch.h"
 
 #include <QCoro/QCoroTask>
 
@@ -45,6 +46,13 @@ public:
     static Document *importBrickLinkCart(BrickLink::Cart *cart);
     static Document *importBrickLinkWantedList(BrickLink::WantedList *wantedList);
 
+    // the lots are copied before the matching runs in a background thread: the prices of the
+    // inventory copies are multiplied by inventoryCrossRate to get them into the wanted list's currency
+    static QCoro::Task<BrickLink::WantedListMatch> matchWantedList(LotList wanted, LotList inventory,
+                                                                   double inventoryCrossRate = 1.);
+    static Document *importWantedListMatch(const BrickLink::WantedListMatch &match,
+                                           const QString &title, const QString &currencyCode = { });
+
     static QCoro::Task<Document *> importBrickLinkXML(QString fileName = { });
     static QCoro::Task<Document *> importLDrawModel(QString fileName = { });
 
@@ -56,10 +64,6 @@ public:
 
 private:
     static bool parseLDrawModel(QFile *f, bool isStudio, BrickLink::IO::ParseResult &pr);
-    static bool parseLDrawModelInternal(QFile *f, bool isStudio, const QString &modelName,
-                                        QVector<Lot *> &lots,
-                                        QHash<QString, QVector<Lot *> > &subCache,
-                                        QVector<QString> &recursionDetection);
 
 
 };
@@ -9,6 +9,7 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QtConcurrentFilter>
 #include <QtAlgorithms>
 #include <QStringListModel>
@@ -24,6 +25,8 @@
 #include "common/currency.h"
 #include "common/undo.h"
 #include "utility/qparallelsort.h"
+#include "utility/appstatistics.h"
+#include "utility/tracing.h"
 #include "bricklink/core.h"
 #include "bricklink/model.h"
 #include "bricklink/picture.h"
@@ -1606,6 +1609,33 @@ void DocumentModel::rebuildFilteredLotIndex()
         m_filteredLotIndex[m_filteredLots.at(i)] = i;
 }
 
+quint64 DocumentModel::memoryFootprint() const
+{
+    auto lotSize = [](const Lot &lot) {
+        quint64 size = sizeof(Lot)
+                + quint64(lot.comments().capacity() + lot.remarks().capacity()
+                          + lot.reserved().capacity() + lot.markerText().capacity()) * sizeof(QChar);
+        if (const auto *inc = lot.isIncomplete())
+            size += sizeof(*inc) + quint64(inc->m_item_id.capacity())
+                    + quint64(inc->m_item_name.capacity() + inc->m_itemtype_name.capacity()
+                              + inc->m_category_name.capacity() + inc->m_color_name.capacity())
+                    * sizeof(QChar);
+        return size;
+    };
+
+    quint64 size = sizeof(DocumentModel);
+    for (const auto *lot : m_lots)
+        size += lotSize(*lot);
+    for (const auto &lot : m_differenceBase)
+        size += lotSize(lot) + 3 * sizeof(void *); // a rough guess for the hash node overhead
+
+    size += quint64(m_lots.capacity() + m_sortedLots.capacity() + m_filteredLots.capacity())
+            * sizeof(Lot *);
+    size += quint64(m_lotIndex.size() + m_filteredLotIndex.size() + m_lotFlags.size())
+            * 4 * sizeof(void *);
+    return size;
+}
+
 bool DocumentModel::isModified() const
 {
     bool modified = !m_undo->isClean();
@@ -1879,6 +1909,32 @@ QVariant DocumentModel::dataForEditRole(const Lot *lot, Field f) const
     return (data && lot) ? data(lot) : QVariant { };
 }
 
+QVariantList DocumentModel::columnDataForEditRole(const LotList &lots, Field f) const
+{
+    // look up the column only once: m_columns.value() would copy all the std::functions per lot
+    const auto it = m_columns.constFind(f);
+    if ((it == m_columns.cend()) || !it->dataFn)
+        return QVariantList(lots.size());
+
+    QVariantList result;
+    result.reserve(lots.size());
+    for (const Lot *lot : lots)
+        result.append(it->dataFn(lot));
+    return result;
+}
+
+int DocumentModel::setColumnDataForEditRole(const LotList &lots, Field f, const QVariantList &values)
+{
+    const auto it = m_columns.constFind(f);
+    if ((it == m_columns.cend()) || !it->editable || !it->setDataFn)
+        return 0;
+
+    const auto count = std::min(lots.size(), values.size());
+    for (qsizetype i = 0; i < count; ++i)
+        it->setDataFn(lots.at(i), values.at(i));
+    return int(count);
+}
+
 QVariant DocumentModel::dataForFilterRole(const Lot *lot, Field f) const
 {
     const auto &c = m_columns.value(f);
@@ -2435,6 +2491,11 @@ void DocumentModel::setFilter(const QVector<Filter> &filter)
 void DocumentModel::sortDirect(const QVector<QPair<int, Qt::SortOrder>> &columns, bool &sorted,
                                LotList &unsortedLots)
 {
+    tracezone zone("DocumentModel::sortDirect");
+    static const int statId = AppStatistics::inst()->addHistogram(u"Document sort duration"_qs);
+    QElapsedTimer timer;
+    timer.start();
+
     bool emitSortColumnsChanged = (columns != m_sortColumns);
     bool wasSorted = isSorted();
 
@@ -2526,11 +2587,18 @@ void DocumentModel::sortDirect(const QVector<QPair<int, Qt::SortOrder>> &columns
 
     if (isSorted() != wasSorted)
         emit isSortedChanged(isSorted());
+
+    AppStatistics::inst()->record(statId, timer.nsecsElapsed() / 1000);
 }
 
 void DocumentModel::filterDirect(const QVector<Filter> &filter, bool &filtered,
                             LotList &unfilteredLots)
 {
+    tracezone zone("DocumentModel::filterDirect");
+    static const int statId = AppStatistics::inst()->addHistogram(u"Document filter duration"_qs);
+    QElapsedTimer timer;
+    timer.start();
+
     bool emitFilterChanged = (filter != m_filter);
     bool wasFiltered = isFiltered();
     qsizetype filteredSizeBefore = m_filteredLots.size();
@@ -2576,6 +2644,8 @@ void DocumentModel::filterDirect(const QVector<Filter> &filter, bool &filtered,
     qsizetype filteredSizeNow = m_filteredLots.size();
     if (filteredSizeBefore != filteredSizeNow)
         emit filteredLotCountChanged(int(filteredSizeNow));
+
+    AppStatistics::inst()->record(statId, timer.nsecsElapsed() / 1000);
 }
 
 QByteArray DocumentModel::saveSortFilterState() const
@@ -203,6 +203,8 @@ public:
     bool setData(const QModelIndex&, const QVariant&, int) override;
     QString dataForDisplayRole(const Lot *lot, Field f, bool asToolTip) const;
     QVariant dataForEditRole(const Lot *lot, Field f) const;
+    QVariantList columnDataForEditRole(const LotList &lots, Field f) const;
+    int setColumnDataForEditRole(const LotList &lots, Field f, const QVariantList &values); // no undo
     QVariant dataForFilterRole(const Lot *lot, Field f) const;
     QHash<int, QByteArray> roleNames() const override;
 
@@ -241,6 +243,8 @@ public:
     int fixedLotCount() const    { return m_fixedLotCount; }
     int invalidLotCount() const  { return m_invalidLotCount; }
 
+    quint64 memoryFootprint() const; // an estimate in bytes, not including the undo stack
+
     bool isModified() const;
     bool canBeSaved() const;
     void unsetModified(); // only for DocumentIO::fileSaveTo
@@ -31,6 +31,14 @@
 #  include <sys/sysinfo.h>
 #endif
 
+#include "bricklink/core.h"
+#include "bricklink/database.h"
+#include "bricklink/picture.h"
+#include "bricklink/priceguide.h"
+#include "common/documentlist.h"
+#include "common/documentmodel.h"
+#include "ldraw/library.h"
+#include "ldraw/meshcache.h"
 #include "qtdiag/qtdiag.h"
 #include "version.h"
 #include "systeminfo.h"
@@ -217,6 +225,36 @@ quint64 SystemInfo::physicalMemory() const
     return m_map[u"hw.memory"_qs].toULongLong();
 }
 
+// The current (estimated) heap usage per subsystem in bytes. The caches also report their budget
+// in an additional ".budget" key.
+QVariantMap SystemInfo::memoryUsage() const
+{
+    QVariantMap map;
+
+    auto addCache = [&map](const QString &key, const QPair<quint64, quint64> &stats) {
+        map[key] = stats.first;
+        map[key + u".budget"] = stats.second;
+    };
+
+    if (auto *core = BrickLink::core()) {
+        map[u"memory.database"_qs] = core->database()->memoryUsage();
+        addCache(u"memory.pictures"_qs, core->pictureCache()->cacheStats());
+        addCache(u"memory.priceguides"_qs, core->priceGuideCache()->cacheStats());
+    }
+    if (auto *library = LDraw::library()) {
+        addCache(u"memory.ldraw.parts"_qs, library->partCacheStats());
+        addCache(u"memory.ldraw.meshes"_qs, library->meshCache()->cacheStats());
+    }
+
+    quint64 documents = 0;
+    const auto docs = DocumentList::inst()->documents();
+    for (const auto *doc : docs)
+        documents += doc->model()->memoryFootprint();
+    map[u"memory.documents"_qs] = documents;
+
+    return map;
+}
+
 QString SystemInfo::qtDiag() const
 {
     return QT_PREPEND_NAMESPACE(qtDiag)(0xff);
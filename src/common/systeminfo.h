@@ -17,6 +17,7 @@ public:
     Q_INVOKABLE QVariantMap asMap() const;
     Q_INVOKABLE QVariant value(const QString &key) const;
     quint64 physicalMemory() const;
+    Q_INVOKABLE QVariantMap memoryUsage() const;
     Q_INVOKABLE QString qtDiag() const;
 
 private:
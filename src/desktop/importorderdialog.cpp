@@ -131,6 +131,35 @@ ImportOrderDialog::ImportOrderDialog(QWidget *parent)
     });
     m_contextMenu->addAction(m_showOnBrickLink);
 
+    m_summarizeLots = new QAction(this);
+    m_summarizeLots->setIcon(QIcon::fromTheme(u"view-statistics"_qs));
+    connect(m_summarizeLots, &QAction::triggered, this, [this]() -> QCoro::Task<> {
+        const auto selection = w_orders->selectionModel()->selectedRows();
+        auto type = BrickLink::OrderType::Received;
+        if (!selection.isEmpty()) {
+            if (auto order = selection.constFirst().data(BrickLink::Orders::OrderPointerRole)
+                    .value<BrickLink::Order *>()) {
+                type = order->type();
+            }
+        }
+        QDate today = QDate::currentDate();
+        QDate fromDate = today.addDays(-w_daysBack->value());
+        QString ccode = Config::inst()->defaultCurrencyCode();
+
+        const auto lots = co_await BrickLink::core()->orders()->lotsSummary(type, fromDate, today, ccode);
+        BrickLink::IO::ParseResult pr;
+        for (auto *lot : lots)
+            pr.addLot(std::move(lot));
+        pr.setCurrencyCode(ccode);
+
+        auto doc = new Document(new DocumentModel(std::move(pr))); // Document owns the items now
+        doc->setTitle((type == BrickLink::OrderType::Placed)
+                      ? tr("Summary of placed orders since %1").arg(QLocale().toString(fromDate, QLocale::ShortFormat))
+                      : tr("Summary of received orders since %1").arg(QLocale().toString(fromDate, QLocale::ShortFormat)));
+        doc->setThumbnail(u"view-financial-list"_qs);
+    });
+    m_contextMenu->addAction(m_summarizeLots);
+
     connect(w_orders, &QWidget::customContextMenuRequested,
             this, [this](const QPoint &pos) {
         m_contextMenu->popup(w_orders->viewport()->mapToGlobal(pos));
@@ -218,6 +247,7 @@ void ImportOrderDialog::languageChange()
                                                      QKeySequence::Find, w_filter->instructionToolTip()));
     m_orderInformation->setText(tr("Show order information"));
     m_showOnBrickLink->setText(tr("Show on BrickLink"));
+    m_summarizeLots->setText(tr("Summarize all items in the listed time period"));
     updateStatusLabel();
 }
 
@@ -260,6 +290,16 @@ void ImportOrderDialog::importOrders(const QModelIndexList &rows, bool combined)
     BrickLink::IO::ParseResult combinedPr;
     int orderCount = 0;
 
+    // decode all the orders in one go: this is done in parallel
+    QVector<LotList> allOrderLots;
+    if (combined) {
+        QVector<const BrickLink::Order *> orders;
+        orders.reserve(rows.size());
+        for (auto idx : rows)
+            orders << idx.data(BrickLink::Orders::OrderPointerRole).value<BrickLink::Order *>();
+        allOrderLots = BrickLink::core()->orders()->loadOrderLots(orders); // we own the Lots now
+    }
+
     for (auto idx : rows) {
         auto order = idx.data(BrickLink::Orders::OrderPointerRole).value<BrickLink::Order *>();
 
@@ -269,7 +309,7 @@ void ImportOrderDialog::importOrders(const QModelIndexList &rows, bool combined)
             if (combineCCode && (order->currencyCode() != defaultCCode))
                 crate = Currency::inst()->crossRate(order->currencyCode(), defaultCCode);
 
-            LotList orderLots = order->loadLots(); // we own the Lots now
+            LotList orderLots = allOrderLots.value(orderCount);
             if (!orderLots.isEmpty()) {
                 QColor col = QColor::fromHsl(360 * orderCount / rows.size(), 128, 128);
                 for (auto orderLot : orderLots) {
@@ -40,6 +40,7 @@ private:
     QMenu *m_contextMenu;
     QAction *m_showOnBrickLink;
     QAction *m_orderInformation;
+    QAction *m_summarizeLots;
     QSet<QString> m_selectedCurrencyCodes;
     QString m_updateMessage;
 };
@@ -353,6 +353,12 @@ void InventoryWidget::updateModel(const QVector<BrickLink::InventoryModel::Simpl
         return;
     d->m_lots = lots;
 
+    if (d->m_model && (d->m_model->mode() == d->m_mode) && (d->m_mode == Mode::CanBuild)) {
+        // the can-build engine only needs to re-evaluate the sets affected by the changes
+        d->m_model->setSimpleLots(d->m_lots);
+        return;
+    }
+
     auto *oldModel = d->m_model;
     d->m_model = new BrickLink::InventoryModel(d->m_mode, d->m_lots, this);
     d->m_view->setModel(d->m_model);
@@ -5,6 +5,7 @@
 #include <QClipboard>
 #include <QGuiApplication>
 #include <QMouseEvent>
+#include <QLocale>
 
 #include "common/application.h"
 #include "common/eventfilter.h"
@@ -49,6 +50,16 @@ SystemInfoDialog::SystemInfoDialog(QWidget *parent)
     sysInfo.remove(u"brickstore.version"_qs);
     sysInfo[u"brickstore.ldraw"_qs] = LDraw::library()->lastUpdated().toString(Qt::RFC2822Date);
 
+    const auto memory = SystemInfo::inst()->memoryUsage();
+    for (auto it = memory.cbegin(); it != memory.cend(); ++it) {
+        if (it.key().endsWith(u".budget"))
+            continue;
+        QString usage = QLocale().formattedDataSize(it.value().toLongLong());
+        if (auto budget = memory.value(it.key() + u".budget").toLongLong())
+            usage = usage + u" / " + QLocale().formattedDataSize(budget);
+        sysInfo[it.key()] = usage;
+    }
+
     for (auto it = sysInfo.cbegin(); it != sysInfo.cend(); ++it) {
         text = text + u" * **" + it.key() + u"**: " + it.value().toString() + u"\n";
     }
@@ -1,7 +1,9 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
 #include <array>
+#include <limits>
 
 #include <QFile>
 #include <QTextStream>
@@ -25,6 +27,7 @@
 #include "utility/transfer.h"
 #include "minizip/minizip.h"
 #include "ldraw/library.h"
+#include "ldraw/meshcache.h"
 #include "ldraw/part.h"
 
 
@@ -65,8 +68,7 @@ void PartLoaderJob::finish(Part *part)
 {
     if (!m_started)
         start();
-    if (part)
-        part->addRef();
+    // the part comes already ref'ed from findPart()
     m_promise.addResult(part);
     m_promise.finish();
     delete this;
@@ -80,8 +82,9 @@ Library::Library(const QString &updateUrl, QObject *parent)
     : QObject(parent)
     , m_updateUrl(updateUrl)
     , m_transfer(new Transfer(this))
+    , m_meshCache(new MeshCache)
 {
-    m_cache.setMaxCost(50 * 1024 * 1024); // 50MB
+    setMemoryBudgets({ });
 
     connect(m_transfer, &Transfer::progress,
             this, [this](TransferJob *j, int done, int total) {
@@ -203,21 +206,19 @@ QFuture<Part *> Library::partFromFile(const QString &file)
 
 void Library::partLoaderThread()
 {
-    while (!m_partLoaderShutdown) {
+    forever {
         m_partLoaderMutex.lock();
-        m_partLoaderCondition.wait(&m_partLoaderMutex);
+        while (!m_partLoaderShutdown && m_partLoaderJobs.isEmpty())
+            m_partLoaderCondition.wait(&m_partLoaderMutex);
 
         if (m_partLoaderShutdown) {
             m_partLoaderMutex.unlock();
-            continue;
+            break;
         }
 
-        PartLoaderJob *plj = m_partLoaderJobs.isEmpty() ? nullptr : m_partLoaderJobs.takeFirst();
+        PartLoaderJob *plj = m_partLoaderJobs.takeFirst();
         m_partLoaderMutex.unlock();
 
-        if (!plj)
-            continue;
-
         plj->start();
         auto *part = m_partLoaderShutdown ? nullptr : findPart(plj->file(), plj->path());
         plj->finish(part);
@@ -226,24 +227,28 @@ void Library::partLoaderThread()
 
 void Library::startPartLoaderThread()
 {
-    if (!m_partLoaderThread)
-        m_partLoaderThread.reset(QThread::create(&Library::partLoaderThread, this));
-    m_partLoaderThread->start();
+    // independent parts can be loaded in parallel, but the sub-parts are shared a lot, so
+    // more threads would mostly wait on each other
+    const int threadCount = std::clamp(QThread::idealThreadCount(), 1, MaxPartLoaderThreads);
+
+    while (m_partLoaderThreads.size() < size_t(threadCount)) {
+        m_partLoaderThreads.emplace_back(QThread::create(&Library::partLoaderThread, this));
+        m_partLoaderThreads.back()->start();
+    }
 }
 
 void Library::shutdownPartLoaderThread()
 {
-    if (m_partLoaderThread) {
-        if (m_partLoaderThread->isRunning()) {
-            m_partLoaderMutex.lock();
-            m_partLoaderShutdown = 1;
-            m_partLoaderCondition.wakeOne();
-            m_partLoaderMutex.unlock();
+    if (!m_partLoaderThreads.empty()) {
+        m_partLoaderMutex.lock();
+        m_partLoaderShutdown = 1;
+        m_partLoaderCondition.wakeAll();
+        m_partLoaderMutex.unlock();
 
-            m_partLoaderThread->wait();
-            m_partLoaderShutdown = 0;
-        }
-        m_partLoaderThread.reset();
+        for (const auto &thread : m_partLoaderThreads)
+            thread->wait();
+        m_partLoaderThreads.clear();
+        m_partLoaderShutdown = 0;
     }
     for (auto *plj : std::as_const(m_partLoaderJobs))
         plj->finish(nullptr);
@@ -285,6 +290,7 @@ QCoro::Task<bool> Library::setPath(const QString &path, bool forceReload)
 
     m_zip.reset();
     m_searchpath.clear();
+    m_fileIndex.clear();
     m_partIdMapping.clear();
 
     if (valid && m_isZip) {
@@ -351,6 +357,11 @@ QCoro::Task<bool> Library::setPath(const QString &path, bool forceReload)
             }
         }
 
+        // resolving a model references thousands of sub-files: look them up in memory
+        m_fileIndex = co_await QtConcurrent::run([searchpath = m_searchpath, zip = m_zip.get()]() {
+            return buildFileIndex(searchpath, zip);
+        });
+
         m_etag.clear();
         if (m_zip) {
             QFile f(m_path + u".etag");
@@ -370,6 +381,11 @@ QCoro::Task<bool> Library::setPath(const QString &path, bool forceReload)
         qInfo().noquote() << "LDraw installation at" << m_path << "is not usable";
     }
 
+    // only ZIP libraries have a version we can key the on-disk mesh cache with
+    m_meshCache->setLibraryVersion((valid && m_zip) ? (m_path + u'|' + m_etag + u'|'
+                                                       + m_lastUpdated.toString(Qt::ISODateWithMs))
+                                                    : QString { });
+
     emit libraryReset();
     if (m_valid != valid) {
         m_valid = valid;
@@ -464,16 +480,61 @@ void Library::emitUpdateStartedIfNecessary()
     }
 }
 
-Part *Library::findPart(const QString &_filename, const QString &_parentdir)
+QHash<QString, QString> Library::buildFileIndex(const QStringList &searchPath, const MiniZip *zip)
+{
+    QHash<QString, QString> index;
+
+    if (zip) {
+        const auto entries = zip->fileList();
+        index.reserve(entries.size());
+        for (const QString &entry : entries) {
+            QString file = u"!ZIP!" + entry;
+            index.insert(file.toLower(), file);
+        }
+    } else {
+        // the sub-directories overlap (e.g. p and p/48), but the first hit is the same file anyway
+        for (const QString &dir : searchPath) {
+            QDirIterator it(dir, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                QString file = it.next();
+                QString key = file.toLower();
+                if (!index.contains(key))
+                    index.insert(key, file);
+            }
+        }
+    }
+    return index;
+}
+
+QString Library::lookupFile(const QString &dir, const QString &filename) const
+{
+    auto it = m_fileIndex.constFind(QString(dir + u'/' + filename).toLower());
+    if (it != m_fileIndex.cend())
+        return *it;
+
+    // everything within the search path is indexed: no need to ask the file system
+    if (dir.startsWith(u"!ZIP!"))
+        return { };
+    for (const QString &sp : m_searchpath) {
+        if ((dir == sp) || dir.startsWith(QString(sp + u'/')))
+            return { };
+    }
+
+    // the parent directory of a file outside of the library, e.g. a model opened by the user
+    QString testname = QDir(dir).canonicalPath() + u'/' + filename;
+#if defined(Q_OS_UNIX) && !defined(Q_OS_MACOS) && !defined(Q_OS_IOS)
+    if (!QFile::exists(testname))
+        testname = testname.toLower();
+#endif
+    if (QFile::exists(testname))
+        return QFileInfo(testname).canonicalFilePath();
+    return { };
+}
+
+Part *Library::findPart(const QString &_filename, const QString &parentdir)
 {
     QString filename = _filename;
     filename.replace(u'\\', u'/');
-    QString parentdir = _parentdir;
-    if (!parentdir.isEmpty() && !parentdir.startsWith(u"!ZIP!"))
-        parentdir = QDir(parentdir).canonicalPath();
-
-    bool inZip = false;
-    bool found = false;
 
     // add the logo on studs     //TODO: make this configurable
     if (filename == u"stud.dat")
@@ -481,92 +542,85 @@ Part *Library::findPart(const QString &_filename, const QString &_parentdir)
     else if (filename == u"stud2.dat")
         filename = u"stud2-logo4.dat"_qs;
 
+    QString file; // either "!ZIP!" + the entry name, or an absolute, canonical file path
+
     if (QFileInfo(filename).isRelative()) {
         // search order is parentdir => p => parts => models
 
-        QStringList searchpath = m_searchpath;
-        if (!parentdir.isEmpty() && !searchpath.contains(parentdir))
-            searchpath.prepend(parentdir);
-
-        for (const QString &sp : std::as_const(searchpath)) {
-
-            if (sp.startsWith(u"!ZIP!")) {
-                filename = filename.toLower();
-                QString testname = sp.mid(5) + u'/' + filename;
-                if (m_zip->contains(testname)) {
-                    QFileInfo fi(filename);
-                    parentdir = sp;
-                    if (fi.path() != u".")
-                        parentdir = parentdir + u'/' + fi.path();
-                    filename = testname;
-                    inZip = true;
-                    found = true;
-                    break;
-                }
-            } else {
-                QString testname = sp + u'/' + filename;
-#if defined(Q_OS_UNIX) && !defined(Q_OS_MACOS) && !defined(Q_OS_IOS)
-                if (!QFile::exists(testname))
-                    testname = testname.toLower();
-#endif
-                if (QFile::exists(testname)) {
-                    filename = testname;
-                    parentdir = QFileInfo(testname).path();
-                    found = true;
-                    break;
-                }
-            }
+        if (!parentdir.isEmpty())
+            file = lookupFile(parentdir, filename);
+
+        for (const QString &sp : std::as_const(m_searchpath)) {
+            if (!file.isEmpty())
+                break;
+            if (sp != parentdir)
+                file = lookupFile(sp, filename);
         }
     } else {
 #if defined(Q_OS_UNIX) && !defined(Q_OS_MACOS) && !defined(Q_OS_IOS)
         if (!QFile::exists(filename))
             filename = filename.toLower();
 #endif
-        if (QFile::exists(filename)) {
-            parentdir = QFileInfo(filename).path();
-            found = true;
-        }
+        if (QFile::exists(filename))
+            file = QFileInfo(filename).canonicalFilePath();
     }
 
-    if (!found)
+    if (file.isEmpty())
         return nullptr;
-    if (!inZip)
-        filename = QFileInfo(filename).canonicalFilePath();
 
-    Part *p = m_cache[filename];
-    if (!p) {
-        QByteArray data;
+    const bool inZip = file.startsWith(u"!ZIP!");
+    if (inZip)
+        file = file.mid(5);
 
-        if (inZip) {
-            try {
-                data = m_zip->readFile(filename);
-            } catch (const Exception &e) {
-                qCWarning(LogLDraw) << "Failed to read from LDraw ZIP:" << e.errorString();
-            }
-        } else {
-            QFile f(filename);
+    // the cache is shared between all loader threads: a part is ref'ed before the lock is
+    // released, so that it cannot be trimmed by a concurrent insert()
+    {
+        QMutexLocker locker(&m_cacheMutex);
+        if (Part *p = m_cache[file]) {
+            p->addRef();
+            return p;
+        }
+    }
 
-            if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
-                qCWarning(LogLDraw) << "Failed to open file" << filename << ":" << f.errorString();
-            } else {
-                data = f.readAll();
-                if (f.error() != QFile::NoError)
-                    qCWarning(LogLDraw) << "Failed to read file" << filename << ":" << f.errorString();
-                f.close();
-            }
+    QByteArray data;
+
+    if (inZip) {
+        try {
+            QMutexLocker locker(&m_zipMutex); // MiniZip is not thread-safe
+            data = m_zip->readFile(file);
+        } catch (const Exception &e) {
+            qCWarning(LogLDraw) << "Failed to read from LDraw ZIP:" << e.errorString();
         }
-        if (!data.isEmpty()) {
-            p = Part::parse(data, parentdir);
-            if (p) {
-                if (!m_cache.insert(filename, p, p->cost())) {
-                    qCWarning(LogLDraw) << "Unable to cache file" << filename;
-                    p = nullptr;
-                }
+    } else {
+        QFile f(file);
 
-                //qCInfo(LogLDraw) << "Cache at" << m_cache.totalCost() << "/" <<  m_cache.maxCost() << "with" << m_cache.size() << "parts";
-            }
+        if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qCWarning(LogLDraw) << "Failed to open file" << file << ":" << f.errorString();
+        } else {
+            data = f.readAll();
+            if (f.error() != QFile::NoError)
+                qCWarning(LogLDraw) << "Failed to read file" << file << ":" << f.errorString();
+            f.close();
         }
     }
+    if (data.isEmpty())
+        return nullptr;
+
+    const QString dir = inZip ? QString(u"!ZIP!" + QFileInfo(file).path()) : QFileInfo(file).path();
+    Part *p = Part::parse(data, dir);
+    if (!p)
+        return nullptr;
+
+    QMutexLocker locker(&m_cacheMutex);
+    if (Part *existing = m_cache[file]) {
+        // another thread was faster
+        delete p;
+        p = existing;
+    } else if (!m_cache.insert(file, p, p->cost())) {
+        qCWarning(LogLDraw) << "Unable to cache file" << file;
+        return nullptr;
+    }
+    p->addRef();
     return p;
 }
 
@@ -606,9 +660,23 @@ bool Library::checkLDrawDir(const QString &ldir)
     return ok;
 }
 
-QPair<int, int> Library::partCacheStats() const
+void Library::setMemoryBudgets(const QMap<QByteArray, int> &budgets)
+{
+    quint64 partBudget = quint64(std::max(0, budgets.value("LDrawPart"))) * 1'000'000ULL;
+    if (!partBudget)
+        partBudget = 50 * 1024 * 1024; // 50MB
+
+    {
+        QMutexLocker locker(&m_cacheMutex);
+        m_cache.setMaxCost(int(std::min<quint64>(partBudget, std::numeric_limits<int>::max())));
+    }
+    m_meshCache->setMemoryBudget(quint64(std::max(0, budgets.value("LDrawMesh"))) * 1'000'000ULL);
+}
+
+QPair<quint64, quint64> Library::partCacheStats() const
 {
-    return qMakePair(m_cache.totalCost(), m_cache.maxCost());
+    QMutexLocker locker(&m_cacheMutex);
+    return qMakePair(quint64(m_cache.totalCost()), quint64(m_cache.maxCost()));
 }
 
 QStringList Library::potentialLDrawDirs()
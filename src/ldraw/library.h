@@ -3,8 +3,12 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include <QObject>
 #include <QHash>
+#include <QMap>
 #include <QDateTime>
 #include <QString>
 #include <QByteArray>
@@ -31,6 +35,7 @@ class MiniZip;
 
 namespace LDraw {
 
+class MeshCache;
 class Part;
 class PartElement;
 class PartLoaderJob;
@@ -65,7 +70,9 @@ public:
     static QStringList potentialLDrawDirs();
     static bool checkLDrawDir(const QString &dir);
 
-    QPair<int, int> partCacheStats() const;
+    void setMemoryBudgets(const QMap<QByteArray, int> &budgets); // in MB, 0 means automatic
+    QPair<quint64, quint64> partCacheStats() const; // memory used and budget in bytes
+    MeshCache *meshCache() const       { return m_meshCache.get(); }
 
 signals:
     void updateStarted();
@@ -87,7 +94,10 @@ private:
     friend Library *create(const QString &);
 
     void partLoaderThread();
-    Part *findPart(const QString &_filename, const QString &_parentdir);
+    static QHash<QString, QString> buildFileIndex(const QStringList &searchPath, const MiniZip *zip);
+    QString lookupFile(const QString &dir, const QString &filename) const;
+    // the returned part is already ref'ed
+    Part *findPart(const QString &_filename, const QString &parentdir);
     QByteArray readLDrawFile(const QString &filename);
     void setUpdateStatus(UpdateStatus updateStatus);
     void emitUpdateStartedIfNecessary();
@@ -108,14 +118,19 @@ private:
     bool m_isZip = false;
     bool m_locked = false; // during updates/loading
     std::unique_ptr<MiniZip> m_zip;
+    QMutex m_zipMutex;
     QStringList m_searchpath;
+    QHash<QString, QString> m_fileIndex;  // lower-case path -> path (ZIP entries start with !ZIP!)
     QHash<QString, QString> m_partIdMapping;
+    mutable QMutex m_cacheMutex;
     Q3Cache<QString, Part> m_cache;  // path -> part
+    std::unique_ptr<MeshCache> m_meshCache;
 
     QVector<PartLoaderJob *> m_partLoaderJobs;
     QMutex m_partLoaderMutex;
     QWaitCondition m_partLoaderCondition;
-    std::unique_ptr<QThread> m_partLoaderThread;
+    static constexpr int MaxPartLoaderThreads = 4;
+    std::vector<std::unique_ptr<QThread>> m_partLoaderThreads;
     QAtomicInt m_partLoaderShutdown = 0;
     QAtomicInt m_partLoaderClear = 0;
 
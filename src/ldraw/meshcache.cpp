@@ -0,0 +1,581 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QThreadPool>
+#include <QtGui/QGenericMatrix>
+#include <QtGui/QMatrix4x4>
+#include <QtQuick3D/QQuick3DInstancing>
+
+#include "bricklink/core.h"
+#include "utility/chunkreader.h"
+#include "utility/chunkwriter.h"
+#include "ldraw/library.h"
+#include "ldraw/meshcache.h"
+#include "ldraw/part.h"
+#include "ldraw/rendergeometry.h"
+
+
+namespace {
+
+using LineEntry = QQuick3DInstancing::InstanceTableEntry;
+
+struct Vertex
+{
+    QVector3D p;
+    QVector3D n;
+};
+
+// the geometry of a part in its own coordinate system
+struct LocalMesh
+{
+    std::map<const BrickLink::Color *, std::vector<Vertex>> surfaces; // 3 vertices per triangle
+    std::vector<LineEntry> lines;
+};
+
+// Sub-parts like studs and primitives are referenced hundreds of times with the same color
+// and winding. Instead of walking their elements again for every reference, each of these
+// combinations is only flattened once and then stamped out with the reference's matrix.
+class Flattener
+{
+public:
+    explicit Flattener(const BrickLink::Color *modelColor)
+        : m_modelColor(modelColor)
+    { }
+
+    const LocalMesh &flatten(LDraw::Part *part, const BrickLink::Color *baseColor, bool inverted);
+
+private:
+    const BrickLink::Color *mapColor(int colorId, const BrickLink::Color *baseColor) const;
+    QVector4D mapEdgeColor(int colorId, const BrickLink::Color *baseColor) const;
+    static void append(LocalMesh &to, const LocalMesh &from, const QMatrix4x4 &matrix);
+
+    const BrickLink::Color *m_modelColor;
+    std::map<std::tuple<LDraw::Part *, const BrickLink::Color *, bool>, std::unique_ptr<LocalMesh>> m_meshes;
+};
+
+const BrickLink::Color *Flattener::mapColor(int colorId, const BrickLink::Color *baseColor) const
+{
+    auto c = (colorId == 16) ? (baseColor ? baseColor : m_modelColor)
+                             : BrickLink::core()->colorFromLDrawId(colorId);
+    if (!c && colorId >= 256) {
+        int newColorId = ((colorId - 256) & 0x0f);
+        qCWarning(LogLDraw) << "Dithered colors are not supported, using only one:"
+                            << colorId << "->" << newColorId;
+        c = BrickLink::core()->colorFromLDrawId(newColorId);
+    }
+    if (!c) {
+        qCWarning(LogLDraw) << "Could not map LDraw color" << colorId;
+        c = BrickLink::core()->color(9 /*light gray*/);
+    }
+    return c;
+}
+
+QVector4D Flattener::mapEdgeColor(int colorId, const BrickLink::Color *baseColor) const
+{
+    QColor c = Qt::black;
+
+    if (colorId == 24) {
+        if (baseColor)
+            c = baseColor->ldrawEdgeColor();
+        else if (m_modelColor)
+            c = m_modelColor->ldrawEdgeColor();
+    } else if (auto *color = BrickLink::core()->colorFromLDrawId(colorId)) {
+        c = color->ldrawColor();
+    }
+    return { float(c.redF()), float(c.greenF()), float(c.blueF()), float(c.alphaF()) };
+}
+
+const LocalMesh &Flattener::flatten(LDraw::Part *part, const BrickLink::Color *baseColor,
+                                    bool inverted)
+{
+    using namespace LDraw;
+
+    const auto key = std::make_tuple(part, baseColor, inverted);
+    if (auto it = m_meshes.find(key); it != m_meshes.end())
+        return *it->second;
+
+    auto mesh = std::make_unique<LocalMesh>();
+    bool invertNext = false;
+    bool ccw = true;
+
+    auto addTriangle = [&mesh](const BrickLink::Color *color, const QVector3D &p0,
+                               const QVector3D &p1, const QVector3D &p2) {
+        const auto n = QVector3D::normal(p0, p1, p2);
+        auto &vertices = mesh->surfaces[color];
+        vertices.push_back({ p0, n });
+        vertices.push_back({ p1, n });
+        vertices.push_back({ p2, n });
+    };
+
+    const auto &elements = part->elements();
+    for (const Element *e : elements) {
+        bool isBFCCommand = false;
+        bool isBFCInvertNext = false;
+
+        switch (e->type()) {
+        case Element::Type::BfcCommand: {
+            const auto *be = static_cast<const BfcCommandElement *>(e);
+
+            if (be->invertNext()) {
+                invertNext = true;
+                isBFCInvertNext = true;
+            }
+            if (be->cw())
+                ccw = inverted ? false : true;
+            if (be->ccw())
+                ccw = inverted ? true : false;
+
+            isBFCCommand = true;
+            break;
+        }
+        case Element::Type::Triangle: {
+            const auto te = static_cast<const TriangleElement *>(e);
+            const auto p = te->points();
+            addTriangle(mapColor(te->color(), baseColor), p[0], ccw ? p[2] : p[1], ccw ? p[1] : p[2]);
+            break;
+        }
+        case Element::Type::Quad: {
+            const auto qe = static_cast<const QuadElement *>(e);
+            const auto color = mapColor(qe->color(), baseColor);
+            const auto p = qe->points();
+            const auto &p0 = p[0];
+            const auto &p1 = p[ccw ? 3 : 1];
+            const auto &p2 = p[2];
+            const auto &p3 = p[ccw ? 1 : 3];
+            const auto n = QVector3D::normal(p0, p1, p2);
+
+            auto &vertices = mesh->surfaces[color];
+            for (const auto *v : { &p0, &p1, &p2, &p2, &p3, &p0 })
+                vertices.push_back({ *v, n });
+            break;
+        }
+        case Element::Type::Line: {
+            const auto le = static_cast<const LineElement *>(e);
+            const auto p = le->points();
+            mesh->lines.push_back(QmlRenderLineInstancing::lineEntry(
+                mapEdgeColor(le->color(), baseColor), p[0], p[1]));
+            break;
+        }
+        case Element::Type::CondLine: {
+            const auto cle = static_cast<const CondLineElement *>(e);
+            const auto p = cle->points();
+            mesh->lines.push_back(QmlRenderLineInstancing::conditionalLineEntry(
+                mapEdgeColor(cle->color(), baseColor), p[0], p[1], p[2], p[3]));
+            break;
+        }
+        case Element::Type::Part: {
+            const auto pe = static_cast<const PartElement *>(e);
+            if (!pe->part())
+                break;
+            const bool matrixReversed = (pe->matrix().determinant() < 0);
+
+            const LocalMesh &sub = flatten(pe->part(), mapColor(pe->color(), baseColor),
+                                           inverted ^ invertNext ^ matrixReversed);
+            append(*mesh, sub, pe->matrix());
+            break;
+        }
+        default:
+            break;
+        }
+
+        if (!isBFCCommand || !isBFCInvertNext)
+            invertNext = false;
+    }
+
+    return *m_meshes.emplace(key, std::move(mesh)).first->second;
+}
+
+void Flattener::append(LocalMesh &to, const LocalMesh &from, const QMatrix4x4 &matrix)
+{
+    // the normals of the transformed triangles are the transformed normals, but their
+    // direction flips when the matrix mirrors the geometry
+    const QMatrix3x3 nm = matrix.normalMatrix();
+    const float nsign = (matrix.determinant() < 0) ? -1.f : 1.f;
+
+    auto mapNormal = [&nm, nsign](const QVector3D &n) {
+        return QVector3D(nm(0, 0) * n.x() + nm(0, 1) * n.y() + nm(0, 2) * n.z(),
+                         nm(1, 0) * n.x() + nm(1, 1) * n.y() + nm(1, 2) * n.z(),
+                         nm(2, 0) * n.x() + nm(2, 1) * n.y() + nm(2, 2) * n.z()).normalized() * nsign;
+    };
+
+    for (const auto &[color, vertices] : from.surfaces) {
+        auto &toVertices = to.surfaces[color];
+        toVertices.reserve(toVertices.size() + vertices.size());
+        for (const auto &v : vertices)
+            toVertices.push_back({ matrix.map(v.p), mapNormal(v.n) });
+    }
+
+    auto mapRow = [&matrix](const QVector4D &row) {
+        return QVector4D(matrix.map(row.toVector3D()), row.w());
+    };
+
+    to.lines.reserve(to.lines.size() + from.lines.size());
+    for (const auto &line : from.lines) {
+        LineEntry mapped = line;
+        mapped.row0 = mapRow(line.row0);
+        mapped.row1 = mapRow(line.row1);
+        if (line.instanceData.w() == 1) { // conditional: the control points are in row2 and the data
+            mapped.row2 = mapRow(line.row2);
+            mapped.instanceData = mapRow(line.instanceData);
+        }
+        to.lines.push_back(mapped);
+    }
+}
+
+std::vector<std::pair<float, float>> uvMapToNearestPlane(const QVector3D &normal,
+                                                         std::initializer_list<const QVector3D> vectors)
+{
+    const float ax = std::abs(normal.x());
+    const float ay = std::abs(normal.y());
+    const float az = std::abs(normal.z());
+
+    int uc = 0, vc = 0;
+
+    if ((ax >= ay) && (ax >= az)) {
+        uc = 1; vc = 2;
+        if (normal.x() < 0)
+            std::swap(uc, vc);
+    } else if ((ay > ax) && (ay >= az)) {
+        uc = 0; vc = 2;
+        if (normal.y() < 0)
+            std::swap(uc, vc);
+    } else if ((az > ax) && (az > ay)) {
+        uc = 0; vc = 1;
+        if (normal.z() < 0)
+            std::swap(uc, vc);
+    }
+
+    std::vector<std::pair<float, float>> uv;
+    for (auto &&vec : std::as_const(vectors))
+        uv.emplace_back(vec[uc] / 24, vec[vc] / 24);
+
+    return uv;
+}
+
+// welding needs exact matches, but -0 and +0 have to compare equal
+using VertexKey = std::array<float, 8>;
+
+struct VertexKeyHash
+{
+    size_t operator()(const VertexKey &key) const noexcept
+    {
+        return qHashBits(key.data(), sizeof(key));
+    }
+};
+
+LDraw::Mesh::Surface createSurface(const BrickLink::Color *color, const std::vector<Vertex> &vertices)
+{
+    LDraw::Mesh::Surface surface;
+    surface.colorId = color->id();
+    surface.isTextured = color->hasParticles() || (color->id() == 0);
+
+    const int floatsPerVertex = surface.isTextured ? 8 : 6;
+
+    std::vector<float> vertexData;
+    std::vector<quint32> indexData;
+    indexData.reserve(vertices.size());
+    std::unordered_map<VertexKey, quint32, VertexKeyHash> welded;
+    welded.reserve(vertices.size() / 2);
+
+    static constexpr auto fmin = std::numeric_limits<float>::lowest();
+    static constexpr auto fmax = std::numeric_limits<float>::max();
+
+    QVector3D vmin = QVector3D(fmax, fmax, fmax);
+    QVector3D vmax = QVector3D(fmin, fmin, fmin);
+
+    for (const auto &v : vertices) {
+        VertexKey key { v.p.x() + 0.f, v.p.y() + 0.f, v.p.z() + 0.f,
+                        v.n.x() + 0.f, v.n.y() + 0.f, v.n.z() + 0.f, 0.f, 0.f };
+        if (surface.isTextured) {
+            const auto uv = uvMapToNearestPlane(v.n, { v.p });
+            key[6] = uv[0].first + 0.f;
+            key[7] = uv[0].second + 0.f;
+        }
+
+        auto [it, inserted] = welded.try_emplace(key, quint32(welded.size()));
+        if (inserted) {
+            vertexData.insert(vertexData.end(), key.cbegin(), key.cbegin() + floatsPerVertex);
+
+            vmin = QVector3D(std::min(vmin.x(), v.p.x()), std::min(vmin.y(), v.p.y()), std::min(vmin.z(), v.p.z()));
+            vmax = QVector3D(std::max(vmax.x(), v.p.x()), std::max(vmax.y(), v.p.y()), std::max(vmax.z(), v.p.z()));
+        }
+        indexData.push_back(it->second);
+    }
+
+    // calculate bounding sphere
+    const QVector3D center = (vmin + vmax) / 2;
+    float radius = 0;
+
+    for (size_t i = 0; i < vertexData.size(); i += size_t(floatsPerVertex)) {
+        const auto v = vertexData.data() + i;
+        radius = std::max(radius, (center - QVector3D { v[0], v[1], v[2] }).lengthSquared());
+    }
+
+    surface.vertexData = QByteArray(reinterpret_cast<const char *>(vertexData.data()),
+                                    qsizetype(vertexData.size() * sizeof(float)));
+    surface.indexData = QByteArray(reinterpret_cast<const char *>(indexData.data()),
+                                   qsizetype(indexData.size() * sizeof(quint32)));
+    surface.vmin = vmin;
+    surface.vmax = vmax;
+    surface.center = center;
+    surface.radius = std::sqrt(radius);
+    return surface;
+}
+
+} // namespace
+
+
+namespace LDraw {
+
+int Mesh::cost() const
+{
+    qsizetype c = lineData.size();
+    for (const auto &surface : surfaces)
+        c += surface.vertexData.size() + surface.indexData.size();
+    return int(std::min<qsizetype>(c, std::numeric_limits<int>::max()));
+}
+
+
+MeshCache::MeshCache()
+    : m_cache(64 * 1024 * 1024) // bytes
+{ }
+
+MeshCache::~MeshCache()
+{ }
+
+void MeshCache::setMemoryBudget(quint64 budget)
+{
+    if (!budget)
+        budget = 64 * 1024 * 1024;
+
+    QMutexLocker locker(&m_mutex);
+    m_cache.setMaxCost(qsizetype(std::min<quint64>(budget, std::numeric_limits<qsizetype>::max())));
+}
+
+QPair<quint64, quint64> MeshCache::cacheStats() const
+{
+    QMutexLocker locker(&m_mutex);
+    return qMakePair(quint64(m_cache.totalCost()), quint64(m_cache.maxCost()));
+}
+
+std::shared_ptr<const Mesh> MeshCache::mesh(Part *part, const BrickLink::Item *item,
+                                            const BrickLink::Color *color)
+{
+    if (!part || !item || !color)
+        return { };
+
+    const QString key = QLatin1Char(item->itemTypeId()) + QString::fromLatin1(item->id())
+                        + u'@' + QString::number(color->id());
+    QString fileName;
+    uint generation = 0;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        if (auto *cached = m_cache.object(key))
+            return *cached;
+
+        generation = m_generation;
+        if (!m_diskCacheDir.isEmpty()) {
+            fileName = m_diskCacheDir + u'/'
+                       + QString::fromLatin1(QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex())
+                       + u".mesh";
+        }
+    }
+
+    std::shared_ptr<const Mesh> mesh;
+    if (!fileName.isEmpty())
+        mesh = loadFromDisk(fileName);
+    if (!mesh) {
+        auto newMesh = flatten(part, color);
+        if (!fileName.isEmpty())
+            saveToDisk(fileName, *newMesh);
+        mesh = newMesh;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (generation == m_generation) // the library has not been reset in the meantime
+        m_cache.insert(key, new std::shared_ptr<const Mesh>(mesh), mesh->cost());
+    return mesh;
+}
+
+void MeshCache::setLibraryVersion(const QString &version)
+{
+    static const QString baseDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                                   + u"/ldraw-meshes";
+    QString versionDir;
+    if (!version.isEmpty()) {
+        const auto hash = QCryptographicHash::hash(
+            (version + u'|' + QString::number(FormatVersion)).toUtf8(), QCryptographicHash::Sha1);
+        versionDir = QString::fromLatin1(hash.toHex().left(16));
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_cache.clear();
+        ++m_generation;
+        m_diskCacheDir = versionDir.isEmpty() ? QString { } : (baseDir + u'/' + versionDir);
+    }
+
+    // get rid of the meshes of all other library versions, without blocking the caller
+    QThreadPool::globalInstance()->start([versionDir]() {
+        QDir dir(baseDir);
+        const auto subDirs = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        for (const auto &subDir : subDirs) {
+            if (subDir != versionDir)
+                QDir(dir.filePath(subDir)).removeRecursively();
+        }
+    });
+}
+
+void MeshCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cache.clear();
+    ++m_generation;
+}
+
+std::shared_ptr<Mesh> MeshCache::flatten(Part *part, const BrickLink::Color *color)
+{
+    auto mesh = std::make_shared<Mesh>();
+
+    Flattener flattener(color);
+    const LocalMesh &local = flattener.flatten(part, color, false);
+
+    for (const auto &[surfaceColor, vertices] : local.surfaces) {
+        if (!vertices.empty())
+            mesh->surfaces.append(createSurface(surfaceColor, vertices));
+    }
+
+    // no more than 100MB to prevent bad_allocs in Quick3D
+    const auto lineCount = std::min(local.lines.size(), size_t(100000000 / sizeof(LineEntry)));
+    mesh->lineData = QByteArray(reinterpret_cast<const char *>(local.lines.data()),
+                                qsizetype(lineCount * sizeof(LineEntry)));
+
+    float &radius = mesh->radius;
+    QVector3D &center = mesh->center;
+
+    for (const auto &surface : std::as_const(mesh->surfaces)) {
+        // Merge all the bounding spheres. This is not perfect, but very, very close in most cases
+        const auto geoCenter = surface.center;
+        const auto geoRadius = surface.radius;
+
+        if (qFuzzyIsNull(radius)) { // first one
+            center = geoCenter;
+            radius = geoRadius;
+        } else {
+            QVector3D d = geoCenter - center;
+            float l = d.length();
+
+            if ((l + radius) < geoRadius) { // the old one is inside the new one
+                center = geoCenter;
+                radius = geoRadius;
+            } else if ((l + geoRadius) > radius) { // the new one is NOT inside the old one -> we need to merge
+                float nr = (radius + l + geoRadius) / 2;
+                center = center + (geoCenter - center).normalized() * (nr - radius);
+                radius = nr;
+            }
+        }
+    }
+    return mesh;
+}
+
+std::shared_ptr<Mesh> MeshCache::loadFromDisk(const QString &fileName)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly))
+        return { };
+
+    auto mesh = std::make_shared<Mesh>();
+
+    ChunkReader cr(&f, QDataStream::LittleEndian);
+    QDataStream &ds = cr.dataStream();
+
+    bool ok = cr.startChunk() && (cr.chunkId() == ChunkId('L','D','M','C'))
+            && (cr.chunkVersion() == FormatVersion);
+
+    while (ok && cr.startChunk()) {
+        switch (cr.chunkId() | ChunkVersion(cr.chunkVersion())) {
+        case ChunkId('S','U','R','F') | ChunkVersion(1): {
+            Mesh::Surface surface;
+            ds >> surface.colorId >> surface.isTextured >> surface.vertexData >> surface.indexData
+                >> surface.vmin >> surface.vmax >> surface.center >> surface.radius;
+            mesh->surfaces.append(surface);
+            break;
+        }
+        case ChunkId('L','I','N','E') | ChunkVersion(1):
+            ds >> mesh->lineData;
+            break;
+        case ChunkId('B','N','D','S') | ChunkVersion(1):
+            ds >> mesh->center >> mesh->radius;
+            break;
+        default:
+            cr.skipChunk();
+            break;
+        }
+        ok = (ds.status() == QDataStream::Ok) && cr.endChunk();
+    }
+
+    if (ok) {
+        // the colors are stored by id, so they could be gone after a database update
+        for (const auto &surface : std::as_const(mesh->surfaces)) {
+            if (!BrickLink::core()->color(surface.colorId)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (!ok) {
+        qCWarning(LogLDraw) << "Discarding the invalid mesh cache file" << fileName;
+        f.remove();
+        return { };
+    }
+    return mesh;
+}
+
+void MeshCache::saveToDisk(const QString &fileName, const Mesh &mesh)
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly))
+        return;
+
+    ChunkWriter cw(&f, QDataStream::LittleEndian);
+    QDataStream &ds = cw.dataStream();
+
+    bool ok = cw.startChunk(ChunkId('L','D','M','C'), FormatVersion);
+
+    for (const auto &surface : mesh.surfaces) {
+        ok = ok && cw.startChunk(ChunkId('S','U','R','F'), 1);
+        ds << surface.colorId << surface.isTextured << surface.vertexData << surface.indexData
+           << surface.vmin << surface.vmax << surface.center << surface.radius;
+        ok = ok && cw.endChunk();
+    }
+
+    ok = ok && cw.startChunk(ChunkId('L','I','N','E'), 1);
+    ds << mesh.lineData;
+    ok = ok && cw.endChunk();
+
+    ok = ok && cw.startChunk(ChunkId('B','N','D','S'), 1);
+    ds << mesh.center << mesh.radius;
+    ok = ok && cw.endChunk();
+
+    ok = ok && cw.endChunk(); // LDMC root chunk
+
+    if (!ok || (ds.status() != QDataStream::Ok) || !f.commit())
+        qCWarning(LogLDraw) << "Failed to write the mesh cache file" << fileName << ":" << f.errorString();
+}
+
+} // namespace LDraw
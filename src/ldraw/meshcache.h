@@ -0,0 +1,89 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <memory>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCache>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtGui/QVector3D>
+
+namespace BrickLink {
+class Color;
+class Item;
+}
+
+
+namespace LDraw {
+
+class Part;
+
+// A part flattened for one specific color: all sub-parts are resolved and transformed and the
+// vertices of each surface are welded, so they can be referenced via an index buffer.
+class Mesh
+{
+public:
+    struct Surface
+    {
+        uint colorId = 0;          // BrickLink color id
+        bool isTextured = false;   // the vertices have UV coordinates
+        QByteArray vertexData;     // floats: position (3), normal (3) [, uv (2)]
+        QByteArray indexData;      // quint32: 3 per triangle
+        QVector3D vmin;
+        QVector3D vmax;
+        QVector3D center;
+        float radius = 0;
+
+        int stride() const  { return int((isTextured ? 8 : 6) * sizeof(float)); }
+    };
+
+    QVector<Surface> surfaces;
+    QByteArray lineData;           // QQuick3DInstancing::InstanceTableEntry, one per line
+    QVector3D center;
+    float radius = 0;
+
+    int cost() const;
+};
+
+
+// Flattening a part is expensive, so the results are cached per BrickLink item and color:
+// in memory and - for versioned (ZIP) libraries - on disk as well. The on-disk cache lives in
+// a sub-directory per library version, so an update implicitly invalidates it.
+// All functions are thread-safe.
+
+class MeshCache
+{
+public:
+    MeshCache();
+    ~MeshCache();
+
+    std::shared_ptr<const Mesh> mesh(Part *part, const BrickLink::Item *item,
+                                     const BrickLink::Color *color);
+
+    // an empty version disables the disk cache
+    void setLibraryVersion(const QString &version);
+    void clear();
+
+    void setMemoryBudget(quint64 budget); // in bytes, 0 means automatic
+    QPair<quint64, quint64> cacheStats() const; // memory used and budget in bytes
+
+    static std::shared_ptr<Mesh> flatten(Part *part, const BrickLink::Color *color);
+
+private:
+    static std::shared_ptr<Mesh> loadFromDisk(const QString &fileName);
+    static void saveToDisk(const QString &fileName, const Mesh &mesh);
+
+    static constexpr int FormatVersion = 1;
+
+    mutable QMutex m_mutex;
+    QString m_diskCacheDir;
+    uint m_generation = 0;
+    QCache<QString, std::shared_ptr<const Mesh>> m_cache;
+};
+
+} // namespace LDraw
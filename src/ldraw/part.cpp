@@ -1,7 +1,10 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
-#include <QTextStream>
+#include <algorithm>
+#include <charconv>
+#include <memory>
+
 #include <QDebug>
 
 #include "library.h"
@@ -10,18 +13,107 @@
 
 namespace LDraw {
 
-Element *Element::fromString(const QString &line, const QString &dir)
+namespace {
+
+// Splits a single LDraw line into tokens separated by spaces or tabs, without any allocations
+class Tokenizer
+{
+public:
+    explicit Tokenizer(QByteArrayView line)
+        : m_pos(line.data())
+        , m_end(line.data() + line.size())
+    { }
+
+    QByteArrayView next()
+    {
+        skipSpace();
+        const char *start = m_pos;
+        while ((m_pos < m_end) && !isSpace(*m_pos))
+            ++m_pos;
+        return { start, m_pos - start };
+    }
+
+    // everything that is left, without the surrounding white-space
+    QByteArrayView rest()
+    {
+        skipSpace();
+        const char *end = m_end;
+        while ((end > m_pos) && isSpace(end[-1]))
+            --end;
+        return { m_pos, end - m_pos };
+    }
+
+    int count() const
+    {
+        Tokenizer t = *this;
+        int n = 0;
+        while (!t.next().isEmpty())
+            ++n;
+        return n;
+    }
+
+private:
+    static bool isSpace(char c)  { return (c == ' ') || (c == '\t'); }
+
+    void skipSpace()
+    {
+        while ((m_pos < m_end) && isSpace(*m_pos))
+            ++m_pos;
+    }
+
+    const char *m_pos;
+    const char *m_end;
+};
+
+// just like QString::toInt() and toFloat(), these return 0 for invalid numbers
+int toInt(QByteArrayView token)
+{
+    int i = 0;
+    const char *first = token.data();
+    const char *last = first + token.size();
+    if ((first < last) && (*first == '+'))
+        ++first;
+    auto [ptr, ec] = std::from_chars(first, last, i);
+    return ((ec == std::errc { }) && (ptr == last)) ? i : 0;
+}
+
+float toFloat(QByteArrayView token)
+{
+#if defined(__cpp_lib_to_chars)
+    float f = 0;
+    const char *first = token.data();
+    const char *last = first + token.size();
+    if ((first < last) && (*first == '+'))
+        ++first;
+    auto [ptr, ec] = std::from_chars(first, last, f);
+    return ((ec == std::errc { }) && (ptr == last)) ? f : 0;
+#else
+    // no floating point support in std::from_chars (e.g. older libc++)
+    return QByteArray::fromRawData(token.data(), token.size()).toFloat();
+#endif
+}
+
+} // namespace
+
+
+Element *Element::fromByteArray(QByteArrayView line, const QString &dir, MemoryResource *pool)
 {
-    Element *e = nullptr;
+    Tokenizer tokens(line);
 
-    static auto parseVectors = []<typename T, const int N>(const QStringList &list) {
+    static auto parseVectors = []<typename T, const int N>(Tokenizer &tokens, MemoryResource *pool) {
+        const int color = toInt(tokens.next());
         QVector3D v[N];
 
-        for (int i = 0; i < N; ++i)
-            v[i] = QVector3D(list[3*i + 1].toFloat(), list[3*i + 2].toFloat(), list[3*i + 3].toFloat());
-        return T::create(list[0].toInt(), v);
+        for (int i = 0; i < N; ++i) {
+            const float x = toFloat(tokens.next());
+            const float y = toFloat(tokens.next());
+            const float z = toFloat(tokens.next());
+            v[i] = QVector3D(x, y, z);
+        }
+        return T::create(color, v, pool);
     };
 
+    // the number of tokens after the line type
     static const int element_count_lut[] = {
          0,
         14,
@@ -31,51 +123,50 @@ Element *Element::fromString(const QString &line, const QString &dir)
         13,
     };
 
-    auto list = line.simplified().split(u' ');
-
-    if (!list.isEmpty()) {
-        int t = list.at(0).toInt();
-        list.removeFirst();
-
-        if (t >= 0 && t <= 5) {
-            int count = element_count_lut[t];
-            if ((count == 0) || (list.size() == count)) {
-                switch (t) {
-                case 0: {
-                    const QString cmd = line.mid(1).trimmed();
-                    if (cmd.startsWith(u"PE_TEX_")) // Stud.io textures do not have fallbacks
-                        break;
-                    e = CommentElement::create(cmd);
-                    break;
-                }
-                case 1: {
-                    QMatrix4x4 m {
-                        list[4].toFloat(), list[5].toFloat(), list[6].toFloat(), list[1].toFloat(),
-                        list[7].toFloat(), list[8].toFloat(), list[9].toFloat(), list[2].toFloat(),
-                        list[10].toFloat(), list[11].toFloat(), list[12].toFloat(), list[3].toFloat(),
-                        0, 0, 0, 1
-                    };
-                    m.optimize();
-                    e = PartElement::create(list[0].toInt(), m, list[13], dir);
-                    break;
-                }
-                case 2:
-                    e = parseVectors.template operator()<LineElement, 2>(list);
-                    break;
-                case 3:
-                    e = parseVectors.template operator()<TriangleElement, 3>(list);
-                    break;
-                case 4:
-                    e = parseVectors.template operator()<QuadElement, 4>(list);
-                    break;
-                case 5:
-                    e = parseVectors.template operator()<CondLineElement, 4>(list);
-                    break;
-                }
-            }
-        }
+    const auto typeToken = tokens.next();
+    if (typeToken.isEmpty())
+        return nullptr;
+    int t = toInt(typeToken);
+    if ((t < 0) || (t > 5))
+        return nullptr;
+
+    // the filename of a sub-part reference may contain spaces
+    const int count = element_count_lut[t];
+    if (count && ((t == 1) ? (tokens.count() < count) : (tokens.count() != count)))
+        return nullptr;
+
+    switch (t) {
+    case 0: {
+        const QString cmd = QString::fromUtf8(tokens.rest());
+        if (cmd.startsWith(u"PE_TEX_")) // Stud.io textures do not have fallbacks
+            return nullptr;
+        return CommentElement::create(cmd, pool);
     }
-    return e;
+    case 1: {
+        const int color = toInt(tokens.next());
+        float f[12];
+        for (float &v : f)
+            v = toFloat(tokens.next());
+
+        QMatrix4x4 m {
+            f[3], f[4],  f[5],  f[0],
+            f[6], f[7],  f[8],  f[1],
+            f[9], f[10], f[11], f[2],
+            0,    0,     0,     1
+        };
+        m.optimize();
+        return PartElement::create(color, m, QString::fromUtf8(tokens.rest()), dir, pool);
+    }
+    case 2:
+        return parseVectors.template operator()<LineElement, 2>(tokens, pool);
+    case 3:
+        return parseVectors.template operator()<TriangleElement, 3>(tokens, pool);
+    case 4:
+        return parseVectors.template operator()<QuadElement, 4>(tokens, pool);
+    case 5:
+        return parseVectors.template operator()<CondLineElement, 4>(tokens, pool);
+    }
+    return nullptr;
 }
 
 
@@ -89,12 +180,12 @@ CommentElement::CommentElement(Element::Type t, const QString &text)
     , m_comment(text)
 { }
 
-CommentElement *CommentElement::create(const QString &text)
+CommentElement *CommentElement::create(const QString &text, MemoryResource *pool)
 {
     if (text.startsWith(u"BFC "))
-        return new BfcCommandElement(text);
+        return BfcCommandElement::create(text, pool);
     else
-        return new CommentElement(text);
+        return new (pool->allocate(sizeof(CommentElement), alignof(CommentElement))) CommentElement(text);
 }
 
 
@@ -116,9 +207,9 @@ BfcCommandElement::BfcCommandElement(const QString &text)
     }
 }
 
-BfcCommandElement *BfcCommandElement::create(const QString &text)
+BfcCommandElement *BfcCommandElement::create(const QString &text, MemoryResource *pool)
 {
-    return new BfcCommandElement(text);
+    return new (pool->allocate(sizeof(BfcCommandElement), alignof(BfcCommandElement))) BfcCommandElement(text);
 }
 
 
@@ -128,9 +219,9 @@ LineElement::LineElement(int color, const QVector3D *v)
     memcpy(m_points, v, sizeof(m_points));
 }
 
-LineElement *LineElement::create(int color, const QVector3D *v)
+LineElement *LineElement::create(int color, const QVector3D *v, MemoryResource *pool)
 {
-    return new LineElement(color, v);
+    return new (pool->allocate(sizeof(LineElement), alignof(LineElement))) LineElement(color, v);
 }
 
 
@@ -140,9 +231,9 @@ CondLineElement::CondLineElement(int color, const QVector3D *v)
     memcpy(m_points, v, sizeof(m_points));
 }
 
-CondLineElement *CondLineElement::create(int color, const QVector3D *v)
+CondLineElement *CondLineElement::create(int color, const QVector3D *v, MemoryResource *pool)
 {
-    return new CondLineElement(color, v);
+    return new (pool->allocate(sizeof(CondLineElement), alignof(CondLineElement))) CondLineElement(color, v);
 }
 
 
@@ -153,9 +244,9 @@ TriangleElement::TriangleElement(int color, const QVector3D *v)
     memcpy(m_points, v, sizeof(m_points));
 }
 
-TriangleElement *TriangleElement::create(int color, const QVector3D *v)
+TriangleElement *TriangleElement::create(int color, const QVector3D *v, MemoryResource *pool)
 {
-    return new TriangleElement(color, v);
+    return new (pool->allocate(sizeof(TriangleElement), alignof(TriangleElement))) TriangleElement(color, v);
 }
 
 
@@ -166,9 +257,9 @@ QuadElement::QuadElement(int color, const QVector3D *v)
     memcpy(m_points, v, sizeof(m_points));
 }
 
-QuadElement *QuadElement::create(int color, const QVector3D *v)
+QuadElement *QuadElement::create(int color, const QVector3D *v, MemoryResource *pool)
 {
-    return new QuadElement(color, v);
+    return new (pool->allocate(sizeof(QuadElement), alignof(QuadElement))) QuadElement(color, v);
 }
 
 
@@ -176,8 +267,7 @@ QuadElement *QuadElement::create(int color, const QVector3D *v)
 PartElement::PartElement(int color, const QMatrix4x4 &matrix, Part *p)
     : Element(Type::Part), m_matrix(matrix), m_part(p), m_color(color)
 {
-    if (m_part)
-        m_part->addRef();
+    // the part comes already ref'ed from Library::findPart()
 }
 
 PartElement::~PartElement()
@@ -187,47 +277,65 @@ PartElement::~PartElement()
 }
 
 PartElement *PartElement::create(int color, const QMatrix4x4 &matrix,
-                                 const QString &filename, const QString &parentdir)
+                                 const QString &filename, const QString &parentdir,
+                                 MemoryResource *pool)
 {
     PartElement *e = nullptr;
     if (Part *p = library()->findPart(filename, parentdir))
-        e = new PartElement(color, matrix, p);
+        e = new (pool->allocate(sizeof(PartElement), alignof(PartElement))) PartElement(color, matrix, p);
     return e;
 }
 
 
+Part::Part(size_t initialPoolSize)
+    : m_pool(initialPoolSize, &m_poolUpstream)
+{ }
+
 Part::~Part()
 {
-    qDeleteAll(m_elements);
+    for (Element *e : std::as_const(m_elements))
+        e->~Element();
 }
 
 Part *Part::parse(const QByteArray &data, const QString &dir)
 {
-    Part *p = new Part();
-    QTextStream ts(data);
+    // the binary elements take up roughly half the space of their text representation
+    auto p = std::unique_ptr<Part>(new Part(std::max<size_t>(size_t(data.size()) / 2, 1024)));
 
-    QString line;
+    const char *pos = data.constData();
+    const char *end = pos + data.size();
+    if ((data.size() >= 3) && data.startsWith("\xef\xbb\xbf")) // UTF-8 BOM
+        pos += 3;
+
+    int commentSize = 0;
     int lineno = 0;
-    while (!ts.atEnd()) {
-        line = ts.readLine();
+    while (pos < end) {
+        const char *eol = std::find(pos, end, '\n');
+        QByteArrayView line(pos, eol - pos);
+        pos = (eol < end) ? eol + 1 : end;
         lineno++;
-        if (line.isEmpty())
+
+        if (line.endsWith('\r'))
+            line.chop(1);
+        if (Tokenizer(line).rest().isEmpty())
             continue;
-        if (Element *e = Element::fromString(line, dir)) {
+        if (Element *e = Element::fromByteArray(line, dir, &p->m_pool)) {
             p->m_elements.append(e);
-            p->m_cost += int(e->size());
+            if ((e->type() == Element::Type::Comment) || (e->type() == Element::Type::BfcCommand))
+                commentSize += int(static_cast<CommentElement *>(e)->comment().size() * 2);
         } else {
-            qCWarning(LogLDraw) << "Could not parse line" << lineno << ":" << line;
-            delete p;
+            qCWarning(LogLDraw) << "Could not parse line" << lineno << ":" << QString::fromUtf8(line);
             return nullptr;
         }
     }
 
-    if (p->m_elements.isEmpty()) {
-        delete p;
-        p = nullptr;
-    }
-    return p;
+    if (p->m_elements.isEmpty())
+        return nullptr;
+
+    p->m_elements.squeeze();
+    p->m_cost = int(sizeof(Part) + p->m_poolUpstream.allocatedSize()
+                    + size_t(p->m_elements.capacity()) * sizeof(Element *)) + commentSize;
+    return p.release();
 }
 
 int Part::cost() const
@@ -9,8 +9,11 @@
 #include <QVector3D>
 #include <QMatrix4x4>
 
+#include "utility/memoryresource.h"
 #include "utility/ref.h"
 
+class BrickStoreBench;
+
 
 namespace LDraw {
 
@@ -27,14 +30,18 @@ public:
     int cost() const;
 
 protected:
-    Part() = default;
+    explicit Part(size_t initialPoolSize);
 
     static Part *parse(const QByteArray &data, const QString &dir);
     friend class PartElement;
     friend class Library;
+    friend class ::BrickStoreBench;
 
     static void calculateBoundingBox(const Part *part, const QMatrix4x4 &matrix, QVector3D &vmin, QVector3D &vmax);
 
+    // all elements are allocated from m_pool: they are destructed in ~Part, but never deleted
+    CountingMemoryResource m_poolUpstream;
+    MonotonicMemoryResource m_pool;
     QVector<Element *> m_elements;
     int m_cost = 0;
 };
@@ -53,7 +60,8 @@ public:
         CondLine
     };
 
-    static Element *fromString(const QString &line, const QString &dir);
+    // line points to a single line without the line ending
+    static Element *fromByteArray(QByteArrayView line, const QString &dir, MemoryResource *pool);
     inline Type type() const  { return m_type; }
     virtual ~Element() = default;
     virtual uint size() const = 0;
@@ -74,7 +82,7 @@ public:
     QString comment() const  { return m_comment; }
     uint size() const override { return int(sizeof(*this)) + uint(m_comment.size() * 2); }
 
-    static CommentElement *create(const QString &text);
+    static CommentElement *create(const QString &text, MemoryResource *pool);
 
 protected:
     CommentElement(Type t, const QString &text);
@@ -97,7 +105,7 @@ public:
     bool cw() const { return m_cw; }
     bool invertNext() const { return m_invertNext; }
 
-    static BfcCommandElement *create(const QString &text);
+    static BfcCommandElement *create(const QString &text, MemoryResource *pool);
 
 protected:
     BfcCommandElement(const QString &);
@@ -122,7 +130,7 @@ public:
     const QVector3D *points() const { return m_points;}
     uint size() const override      { return sizeof(*this); }
 
-    static LineElement *create(int color, const QVector3D *points);
+    static LineElement *create(int color, const QVector3D *points, MemoryResource *pool);
 
 protected:
     LineElement(int color, const QVector3D *points);
@@ -141,7 +149,7 @@ public:
     const QVector3D *points() const { return m_points;}
     uint size() const override      { return sizeof(*this); }
 
-    static CondLineElement *create(int color, const QVector3D *points);
+    static CondLineElement *create(int color, const QVector3D *points, MemoryResource *pool);
 
 protected:
     CondLineElement(int color, const QVector3D *points);
@@ -160,7 +168,7 @@ public:
     const QVector3D *points() const { return m_points;}
     uint size() const override      { return sizeof(*this); }
 
-    static TriangleElement *create(int color, const QVector3D *points);
+    static TriangleElement *create(int color, const QVector3D *points, MemoryResource *pool);
 
 protected:
     TriangleElement(int color, const QVector3D *points);
@@ -179,7 +187,7 @@ public:
     const QVector3D *points() const { return m_points;}
     uint size() const override      { return sizeof(*this); }
 
-    static QuadElement *create(int color, const QVector3D *points);
+    static QuadElement *create(int color, const QVector3D *points, MemoryResource *pool);
 
 protected:
     QuadElement(int color, const QVector3D *points);
@@ -200,7 +208,7 @@ public:
     uint size() const override       { return sizeof(*this); }
 
     static PartElement *create(int color, const QMatrix4x4 &m, const QString &filename,
-                               const QString &parentdir);
+                               const QString &parentdir, MemoryResource *pool);
 
     ~PartElement() override;
 
@@ -16,6 +16,7 @@
 
 #include "bricklink/core.h"
 #include "library.h"
+#include "meshcache.h"
 #include "part.h"
 #include "rendercontroller.h"
 
@@ -198,96 +199,47 @@ QCoro::Task<void> RenderController::updateGeometries()
 
     // in
     Part *part = m_part;
+    const BrickLink::Item *item = m_item;
     const BrickLink::Color *color = m_color;
 
     // out
-    float radius = 0;
-    QVector3D center;
+    std::shared_ptr<const Mesh> mesh;
     QList<QmlRenderGeometry *> geos;
-    QByteArray lineBuffer;
 
     QPointer<RenderController> guard(this);
 
-    co_await QtConcurrent::run([part, color, &lineBuffer, &geos, &radius, &center]() {
-        QHash<const BrickLink::Color *, QByteArray> surfaceBuffers;
-        RenderController::fillVertexBuffers(part, color, color, QMatrix4x4(), false, surfaceBuffers, lineBuffer);
+    co_await QtConcurrent::run([part, item, color, &mesh, &geos]() {
+        mesh = library()->meshCache()->mesh(part, item, color);
+        if (!mesh)
+            return;
 
-        for (auto it = surfaceBuffers.cbegin(); it != surfaceBuffers.cend(); ++it) {
-            const QByteArray &data = it.value();
-            if (data.isEmpty())
+        for (const auto &surface : mesh->surfaces) {
+            const BrickLink::Color *surfaceColor = BrickLink::core()->color(surface.colorId);
+            if (!surfaceColor)
                 continue;
 
-            const BrickLink::Color *surfaceColor = it.key();
-            const bool isTextured = surfaceColor->hasParticles() || (surfaceColor->id() == 0);
-
-            const int stride = (3 + 3 + (isTextured ? 2 : 0)) * sizeof(float);
-
             auto geo = new QmlRenderGeometry(surfaceColor);
 
-            // calculate bounding box
-            static constexpr auto fmin = std::numeric_limits<float>::min();
-            static constexpr auto fmax = std::numeric_limits<float>::max();
-
-            QVector3D vmin = QVector3D(fmax, fmax, fmax);
-            QVector3D vmax = QVector3D(fmin, fmin, fmin);
-
-            for (int i = 0; i < data.size(); i += stride) {
-                auto v = reinterpret_cast<const float *>(it->constData() + i);
-                vmin = QVector3D(std::min(vmin.x(), v[0]), std::min(vmin.y(), v[1]), std::min(vmin.z(), v[2]));
-                vmax = QVector3D(std::max(vmax.x(), v[0]), std::max(vmax.y(), v[1]), std::max(vmax.z(), v[2]));
-            }
-
-            // calculate bounding sphere
-            QVector3D surfaceCenter = (vmin + vmax) / 2;
-            float surfaceRadius = 0;
-
-            for (int i = 0; i < data.size(); i += stride) {
-                auto v = reinterpret_cast<const float *>(it->constData() + i);
-                surfaceRadius = std::max(surfaceRadius, (surfaceCenter - QVector3D { v[0], v[1], v[2] }).lengthSquared());
-            }
-            surfaceRadius = std::sqrt(surfaceRadius);
-
             geo->setPrimitiveType(QQuick3DGeometry::PrimitiveType::Triangles);
-            geo->setStride(stride);
+            geo->setStride(surface.stride());
             geo->addAttribute(QQuick3DGeometry::Attribute::PositionSemantic, 0, QQuick3DGeometry::Attribute::F32Type);
             geo->addAttribute(QQuick3DGeometry::Attribute::NormalSemantic, 3 * sizeof(float), QQuick3DGeometry::Attribute::F32Type);
-            if (isTextured) {
+            if (surface.isTextured) {
                 geo->addAttribute(QQuick3DGeometry::Attribute::TexCoord0Semantic, 6 * sizeof(float), QQuick3DGeometry::Attribute::F32Type);
 
                 QQuick3DTextureData *texData = generateMaterialTextureData(surfaceColor);
                 texData->setParentItem(geo);
                 geo->setTextureData(texData);
             }
-            geo->setBounds(vmin, vmax);
-            geo->setCenter(surfaceCenter);
-            geo->setRadius(surfaceRadius);
-            geo->setVertexData(data);
+            geo->addAttribute(QQuick3DGeometry::Attribute::IndexSemantic, 0, QQuick3DGeometry::Attribute::U32Type);
+            geo->setBounds(surface.vmin, surface.vmax);
+            geo->setCenter(surface.center);
+            geo->setRadius(surface.radius);
+            geo->setVertexData(surface.vertexData);
+            geo->setIndexData(surface.indexData);
 
             geos.append(geo);
         }
-
-        for (auto *geo : std::as_const(geos)) {
-            // Merge all the bounding spheres. This is not perfect, but very, very close in most cases
-            const auto geoCenter = geo->center();
-            const auto geoRadius = geo->radius();
-
-            if (qFuzzyIsNull(radius)) { // first one
-                center = geoCenter;
-                radius = geoRadius;
-            } else {
-                QVector3D d = geoCenter - center;
-                float l = d.length();
-
-                if ((l + radius) < geoRadius) { // the old one is inside the new one
-                    center = geoCenter;
-                    radius = geoRadius;
-                } else if ((l + geoRadius) > radius) { // the new one is NOT inside the old one -> we need to merge
-                    float nr = (radius + l + geoRadius) / 2;
-                    center = center + (geoCenter - center).normalized() * (nr - radius);
-                    radius = nr;
-                }
-            }
-        }
     });
 
     if (!guard) // Sentry report: we've been deleted while the co-routine was running
@@ -300,7 +252,10 @@ QCoro::Task<void> RenderController::updateGeometries()
     m_geos = geos;
     emit surfacesChanged();
 
-    m_lines->setBuffer(lineBuffer);
+    const QVector3D center = mesh ? mesh->center : QVector3D { };
+    const float radius = mesh ? mesh->radius : 0;
+
+    m_lines->setBuffer(mesh ? mesh->lineData : QByteArray { });
     m_lines->update();
 
 
@@ -316,196 +271,6 @@ QCoro::Task<void> RenderController::updateGeometries()
     emit canRenderChanged(canRender());
 }
 
-std::vector<std::pair<float, float>> RenderController::uvMapToNearestPlane(const QVector3D &normal,
-                                                                           std::initializer_list<const QVector3D> vectors)
-{
-    const float ax = std::abs(normal.x());
-    const float ay = std::abs(normal.y());
-    const float az = std::abs(normal.z());
-
-    int uc = 0, vc = 0;
-
-    if ((ax >= ay) && (ax >= az)) {
-        uc = 1; vc = 2;
-        if (normal.x() < 0)
-            std::swap(uc, vc);
-    } else if ((ay > ax) && (ay >= az)) {
-        uc = 0; vc = 2;
-        if (normal.y() < 0)
-            std::swap(uc, vc);
-    } else if ((az > ax) && (az > ay)) {
-        uc = 0; vc = 1;
-        if (normal.z() < 0)
-            std::swap(uc, vc);
-    }
-
-    std::vector<std::pair<float, float>> uv;
-    for (auto &&vec : std::as_const(vectors))
-        uv.emplace_back(vec[uc] / 24, vec[vc] / 24);
-
-    return uv;
-}
-
-void RenderController::fillVertexBuffers(Part *part, const BrickLink::Color *modelColor,
-                                         const BrickLink::Color *baseColor,const QMatrix4x4 &matrix,
-                                         bool inverted, QHash<const BrickLink::Color *, QByteArray> &surfaceBuffers,
-                                         QByteArray &lineBuffer)
-{
-    if (!part)
-        return;
-
-    bool invertNext = false;
-    bool ccw = true;
-
-    static auto addFloatsToByteArray = [](QByteArray &buffer, std::initializer_list<float> fs) {
-        qsizetype oldSize = buffer.size();
-        size_t size = fs.size() * sizeof(float);
-        buffer.resize(oldSize + qsizetype(size));
-        auto *ptr = reinterpret_cast<float *>(buffer.data() + oldSize);
-        memcpy(ptr, fs.begin(), size);
-    };
-
-    auto mapColor = [&baseColor, &modelColor](int colorId) -> const BrickLink::Color * {
-        auto c = (colorId == 16) ? (baseColor ? baseColor : modelColor)
-                                 : BrickLink::core()->colorFromLDrawId(colorId);
-        if (!c && colorId >= 256) {
-            int newColorId = ((colorId - 256) & 0x0f);
-            qCWarning(LogLDraw) << "Dithered colors are not supported, using only one:"
-                                << colorId << "->" << newColorId;
-            c = BrickLink::core()->colorFromLDrawId(newColorId);
-        }
-        if (!c) {
-            qCWarning(LogLDraw) << "Could not map LDraw color" << colorId;
-            c = BrickLink::core()->color(9 /*light gray*/);
-        }
-        return c;
-    };
-
-    auto mapEdgeQColor = [&baseColor, &modelColor](int colorId) -> QColor {
-        if (colorId == 24) {
-            if (baseColor)
-                return baseColor->ldrawEdgeColor();
-            else if (modelColor)
-                return modelColor->ldrawEdgeColor();
-        } else if (auto *c = BrickLink::core()->colorFromLDrawId(colorId)) {
-            return c->ldrawColor();
-        }
-        return Qt::black;
-    };
-
-    const auto &elements = part->elements();
-    for (const Element *e : elements) {
-        bool isBFCCommand = false;
-        bool isBFCInvertNext = false;
-
-        switch (e->type()) {
-        case Element::Type::BfcCommand: {
-            const auto *be = static_cast<const BfcCommandElement *>(e);
-
-            if (be->invertNext()) {
-                invertNext = true;
-                isBFCInvertNext = true;
-            }
-            if (be->cw())
-                ccw = inverted ? false : true;
-            if (be->ccw())
-                ccw = inverted ? true : false;
-
-            isBFCCommand = true;
-            break;
-        }
-        case Element::Type::Triangle: {
-            const auto te = static_cast<const TriangleElement *>(e);
-            const auto color = mapColor(te->color());
-            const auto p = te->points();
-            const auto p0m = matrix.map(p[0]);
-            const auto p1m = matrix.map(ccw ? p[2] : p[1]);
-            const auto p2m = matrix.map(ccw ? p[1] : p[2]);
-            const auto n = QVector3D::normal(p0m, p1m, p2m);
-
-            if (color->hasParticles() || (color->id() == 0)) {
-                const auto uv = uvMapToNearestPlane(n, { p0m, p1m, p2m });
-
-                addFloatsToByteArray(surfaceBuffers[color], {
-                    p0m.x(), p0m.y(), p0m.z(), n.x(), n.y(), n.z(), uv[0].first, uv[0].second,
-                    p1m.x(), p1m.y(), p1m.z(), n.x(), n.y(), n.z(), uv[1].first, uv[1].second,
-                    p2m.x(), p2m.y(), p2m.z(), n.x(), n.y(), n.z(), uv[2].first, uv[2].second });
-            } else {
-                addFloatsToByteArray(surfaceBuffers[color], {
-                    p0m.x(), p0m.y(), p0m.z(), n.x(), n.y(), n.z(),
-                    p1m.x(), p1m.y(), p1m.z(), n.x(), n.y(), n.z(),
-                    p2m.x(), p2m.y(), p2m.z(), n.x(), n.y(), n.z() });
-            }
-            break;
-        }
-        case Element::Type::Quad: {
-            const auto qe = static_cast<const QuadElement *>(e);
-            const auto color = mapColor(qe->color());
-            const auto p = qe->points();
-            const auto p0m = matrix.map(p[0]);
-            const auto p1m = matrix.map(p[ccw ? 3 : 1]);
-            const auto p2m = matrix.map(p[2]);
-            const auto p3m = matrix.map(p[ccw ? 1 : 3]);
-            const auto n = QVector3D::normal(p0m, p1m, p2m);
-
-            if (color->hasParticles() || (color->id() == 0)) {
-                const auto uv = uvMapToNearestPlane(n, { p0m, p1m, p2m, p3m });
-
-                addFloatsToByteArray(surfaceBuffers[color], {
-                    p0m.x(), p0m.y(), p0m.z(), n.x(), n.y(), n.z(), uv[0].first, uv[0].second,
-                    p1m.x(), p1m.y(), p1m.z(), n.x(), n.y(), n.z(), uv[1].first, uv[1].second,
-                    p2m.x(), p2m.y(), p2m.z(), n.x(), n.y(), n.z(), uv[2].first, uv[2].second,
-                    p2m.x(), p2m.y(), p2m.z(), n.x(), n.y(), n.z(), uv[2].first, uv[2].second,
-                    p3m.x(), p3m.y(), p3m.z(), n.x(), n.y(), n.z(), uv[3].first, uv[3].second,
-                    p0m.x(), p0m.y(), p0m.z(), n.x(), n.y(), n.z(), uv[0].first, uv[0].second });
-            } else {
-                addFloatsToByteArray(surfaceBuffers[color], {
-                    p0m.x(), p0m.y(), p0m.z(), n.x(), n.y(), n.z(),
-                    p1m.x(), p1m.y(), p1m.z(), n.x(), n.y(), n.z(),
-                    p2m.x(), p2m.y(), p2m.z(), n.x(), n.y(), n.z(),
-                    p2m.x(), p2m.y(), p2m.z(), n.x(), n.y(), n.z(),
-                    p3m.x(), p3m.y(), p3m.z(), n.x(), n.y(), n.z(),
-                    p0m.x(), p0m.y(), p0m.z(), n.x(), n.y(), n.z() });
-            }
-            break;
-        }
-        case Element::Type::Line: {
-            const auto le = static_cast<const LineElement *>(e);
-            const auto c = mapEdgeQColor(le->color());
-            const auto p = le->points();
-            auto p0m = matrix.map(p[0]);
-            auto p1m = matrix.map(p[1]);
-            QmlRenderLineInstancing::addLineToBuffer(lineBuffer, c, p0m, p1m);
-            break;
-        }
-        case Element::Type::CondLine: {
-            const auto cle = static_cast<const CondLineElement *>(e);
-            const auto c = mapEdgeQColor(cle->color());
-            const auto p = cle->points();
-            auto p0m = matrix.map(p[0]);
-            auto p1m = matrix.map(p[1]);
-            auto p2m = matrix.map(p[2]);
-            auto p3m = matrix.map(p[3]);
-            QmlRenderLineInstancing::addConditionalLineToBuffer(lineBuffer, c, p0m, p1m, p2m, p3m);
-            break;
-        }
-        case Element::Type::Part: {
-            const auto pe = static_cast<const PartElement *>(e);
-            bool matrixReversed = (pe->matrix().determinant() < 0);
-
-            fillVertexBuffers(pe->part(), modelColor, mapColor(pe->color()), matrix * pe->matrix(),
-                              inverted ^ invertNext ^ matrixReversed, surfaceBuffers, lineBuffer);
-            break;
-        }
-        default:
-            break;
-        }
-
-        if (!isBFCCommand || !isBFCInvertNext)
-            invertNext = false;
-    }
-}
-
 QQuick3DTextureData *RenderController::generateMaterialTextureData(const BrickLink::Color *color)
 {
     static constexpr int GeneratorVersion = 1;
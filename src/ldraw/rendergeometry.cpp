@@ -47,35 +47,28 @@ void QmlRenderLineInstancing::setBuffer(const QByteArray &ba)
 //}
 
 
-void QmlRenderLineInstancing::addLineToBuffer(QByteArray &buffer, const QColor &c,
-                                              const QVector3D &p0, const QVector3D &p1)
+QQuick3DInstancing::InstanceTableEntry QmlRenderLineInstancing::lineEntry(const QVector4D &color,
+                                                                        const QVector3D &p0,
+                                                                        const QVector3D &p1)
 {
-    // no more than 100MB to prevent bad_allocs in Quick3D
-    if (buffer.size() > 100000000)
-        return;
-
-    QQuick3DInstancing::InstanceTableEntry entry { { p0, 0 },
-                                                   { p1, 0 },
-                                                   { },
-                                                   QVector4D { c.redF(), c.greenF(), c.blueF(), c.alphaF() },
-                                                   { } };
-    buffer.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    return { { p0, 0 },
+             { p1, 0 },
+             { },
+             color,
+             { } };
 }
 
-void QmlRenderLineInstancing::addConditionalLineToBuffer(QByteArray &buffer, const QColor &c,
-                                                         const QVector3D &p0, const QVector3D &p1,
-                                                         const QVector3D &p2, const QVector3D &p3)
+QQuick3DInstancing::InstanceTableEntry QmlRenderLineInstancing::conditionalLineEntry(const QVector4D &color,
+                                                                                   const QVector3D &p0,
+                                                                                   const QVector3D &p1,
+                                                                                   const QVector3D &p2,
+                                                                                   const QVector3D &p3)
 {
-    // no more than 100MB to prevent bad_allocs in Quick3D
-    if (buffer.size() > 100000000)
-        return;
-
-    QQuick3DInstancing::InstanceTableEntry entry { { p0, 0 },
-                                                   { p1, 0 },
-                                                   { p2, 0 },
-                                                   QVector4D { c.redF(), c.greenF(), c.blueF(), c.alphaF() },
-                                                   { p3, 1 /* is conditional */ } };
-    buffer.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    return { { p0, 0 },
+             { p1, 0 },
+             { p2, 0 },
+             color,
+             { p3, 1 /* is conditional */ } };
 }
 
 } // namespace LDraw
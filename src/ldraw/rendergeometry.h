@@ -65,10 +65,11 @@ public:
     void clear();
     void setBuffer(const QByteArray &ba);
 
-    static void addLineToBuffer(QByteArray &buffer, const QColor &c, const QVector3D &p0,
-                                const QVector3D &p1);
-    static void addConditionalLineToBuffer(QByteArray &buffer, const QColor &c, const QVector3D &p0,
-                                           const QVector3D &p1, const QVector3D &p2, const QVector3D &p3);
+    static InstanceTableEntry lineEntry(const QVector4D &color, const QVector3D &p0,
+                                        const QVector3D &p1);
+    static InstanceTableEntry conditionalLineEntry(const QVector4D &color, const QVector3D &p0,
+                                                   const QVector3D &p1, const QVector3D &p2,
+                                                   const QVector3D &p3);
 
 private:
     QByteArray m_buffer;
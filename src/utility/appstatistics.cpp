@@ -1,8 +1,14 @@
 // Copyright (C) 2004-2024 Robert Griebl
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <bit>
+#include <cmath>
+
 #include <QCoreApplication>
 #include <QThread>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
 
 #include "appstatistics.h"
 
@@ -35,8 +41,61 @@ int AppStatistics::addSource(const QString &name, const QString &unit)
     return sid;
 }
 
+int AppStatistics::addCounter(const QString &name, const QString &unit)
+{
+    return addMetric(Kind::Counter, name, unit);
+}
+
+int AppStatistics::addGauge(const QString &name, const QString &unit)
+{
+    return addMetric(Kind::Gauge, name, unit);
+}
+
+int AppStatistics::addHitRate(const QString &name)
+{
+    return addMetric(Kind::HitRate, name, u"%"_qs);
+}
+
+int AppStatistics::addHistogram(const QString &name, const QString &unit)
+{
+    return addMetric(Kind::Histogram, name, unit);
+}
+
+int AppStatistics::addMetric(Kind kind, const QString &name, const QString &unit)
+{
+    auto m = std::make_unique<Metric>();
+    m->kind = kind;
+    if (kind == Kind::Histogram) {
+        m->buckets.reset(new std::atomic<quint64>[HistogramBuckets]);
+        for (int i = 0; i < HistogramBuckets; ++i)
+            m->buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    int sid = addSource(name, unit);
+    m_sources.last().kind = kind;
+
+    if (sid < MaxMetrics) {
+        m_metrics[sid].store(m.get(), std::memory_order_release);
+        m_ownedMetrics.push_back(std::move(m));
+    } else {
+        qWarning() << "AppStatistics: too many metrics, ignoring updates for" << name;
+    }
+    return sid;
+}
+
+AppStatistics::Metric *AppStatistics::metric(int sourceId) const
+{
+    if ((sourceId <= 0) || (sourceId >= MaxMetrics))
+        return nullptr;
+    return m_metrics[sourceId].load(std::memory_order_acquire);
+}
+
 void AppStatistics::removeSource(int sourceId)
 {
+    // the Metric object itself stays alive: another thread might still be updating it
+    if (metric(sourceId))
+        m_metrics[sourceId].store(nullptr, std::memory_order_release);
+
     for (auto i = 0; i < m_sources.size(); ++i) {
         if (m_sources.at(i).id == sourceId) {
             emit sourceAboutToBeRemoved(sourceId);
@@ -85,6 +144,15 @@ QVariant AppStatistics::sourceValue(int sourceId, const QVariant &defaultValue)
     return defaultValue;
 }
 
+AppStatistics::Kind AppStatistics::sourceKind(int sourceId) const
+{
+    for (const auto &src : m_sources) {
+        if (src.id == sourceId)
+            return src.kind;
+    }
+    return Kind::Value;
+}
+
 int AppStatistics::updateInterval() const
 {
     return m_updateInterval;
@@ -106,6 +174,9 @@ AppStatistics::AppStatistics(QObject *parent)
 
     connect(&m_timer, &QTimer::timeout,
             this, [this]() {
+        updateMetrics();
+        writeSnapshot();
+
         if (m_updateNeeded.testAndSetOrdered(true, false)) {
             // only take an expensive lock if we really have to
             m_mutex.lock();
@@ -135,6 +206,9 @@ AppStatistics::AppStatistics(QObject *parent)
             }
         }
     });
+
+    if (qEnvironmentVariableIsSet("BS_STATISTICS_FILE"))
+        setSnapshotFileName(qEnvironmentVariable("BS_STATISTICS_FILE"));
 }
 
 void AppStatistics::update(int sourceId, const QVariant &value)
@@ -144,6 +218,209 @@ void AppStatistics::update(int sourceId, const QVariant &value)
     m_updateNeeded.testAndSetOrdered(false, true);
 }
 
+void AppStatistics::increment(int sourceId, qint64 delta)
+{
+    if (auto *m = metric(sourceId))
+        m->value.fetch_add(delta, std::memory_order_relaxed);
+}
+
+void AppStatistics::setGauge(int sourceId, qint64 value)
+{
+    if (auto *m = metric(sourceId))
+        m->value.store(value, std::memory_order_relaxed);
+}
+
+void AppStatistics::hit(int sourceId, bool isHit)
+{
+    if (auto *m = metric(sourceId)) {
+        if (isHit)
+            m->value.fetch_add(1, std::memory_order_relaxed);
+        m->total.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void AppStatistics::record(int sourceId, qint64 sample)
+{
+    auto *m = metric(sourceId);
+    if (!m || !m->buckets)
+        return;
+
+    m->buckets[histogramBucket(sample)].fetch_add(1, std::memory_order_relaxed);
+    m->value.fetch_add(1, std::memory_order_relaxed);
+    m->total.fetch_add(sample, std::memory_order_relaxed);
+
+    qint64 max = m->max.load(std::memory_order_relaxed);
+    while ((sample > max) && !m->max.compare_exchange_weak(max, sample, std::memory_order_relaxed))
+        ;
+}
+
+int AppStatistics::histogramBucket(qint64 sample)
+{
+    if (sample < 16)
+        return int(std::max(sample, qint64(0)));
+    const int log2 = int(std::bit_width(quint64(sample))) - 1; // >= 4
+    const int sub = int(sample >> (log2 - 3)) & 7;
+    return 16 + (log2 - 4) * 8 + sub;
+}
+
+qint64 AppStatistics::histogramBucketValue(int bucket)
+{
+    if (bucket < 16)
+        return bucket;
+    const int log2 = (bucket - 16) / 8 + 4;
+    const int sub = (bucket - 16) % 8;
+    const qint64 width = qint64(1) << (log2 - 3);
+    return (8 + sub) * width + width / 2; // the middle of the bucket
+}
+
+qint64 AppStatistics::percentile(int sourceId, double p) const
+{
+    auto *m = metric(sourceId);
+    if (!m || !m->buckets)
+        return 0;
+
+    // the counts are read while other threads might still be recording: this is only an estimate
+    const auto count = m->value.load(std::memory_order_relaxed);
+    if (count <= 0)
+        return 0;
+    const auto target = std::max(qint64(1), qint64(std::ceil(std::clamp(p, 0., 1.) * double(count))));
+    qint64 sum = 0;
+    for (int i = 0; i < HistogramBuckets; ++i) {
+        sum += qint64(m->buckets[i].load(std::memory_order_relaxed));
+        if (sum >= target)
+            return std::min(histogramBucketValue(i), m->max.load(std::memory_order_relaxed));
+    }
+    return m->max.load(std::memory_order_relaxed);
+}
+
+QVariant AppStatistics::metricValue(const Source &src) const
+{
+    auto *m = metric(src.id);
+    if (!m)
+        return src.value;
+
+    switch (m->kind) {
+    case Kind::Counter:
+    case Kind::Gauge:
+        return m->value.load(std::memory_order_relaxed);
+    case Kind::HitRate: {
+        const auto lookups = m->total.load(std::memory_order_relaxed);
+        const auto hits = m->value.load(std::memory_order_relaxed);
+        if (!lookups)
+            return u"-"_qs;
+        return u"%1 (%2 / %3)"_qs.arg(100. * double(hits) / double(lookups), 0, 'f', 1)
+                .arg(hits).arg(lookups);
+    }
+    case Kind::Histogram: {
+        const auto count = m->value.load(std::memory_order_relaxed);
+        if (!count)
+            return u"-"_qs;
+        return u"p50 %1, p90 %2, p99 %3, max %4 (n=%5)"_qs
+                .arg(percentile(src.id, .5)).arg(percentile(src.id, .9))
+                .arg(percentile(src.id, .99)).arg(m->max.load(std::memory_order_relaxed))
+                .arg(count);
+    }
+    default:
+        return src.value;
+    }
+}
+
+void AppStatistics::updateMetrics()
+{
+    QVector<std::pair<int, QVariant>> newData;
+    int firstRow = std::numeric_limits<int>::max();
+    int lastRow = std::numeric_limits<int>::min();
+
+    for (int i = 0; i < int(m_sources.size()); ++i) {
+        auto &src = m_sources[i];
+        if (src.kind == Kind::Value)
+            continue;
+        auto value = metricValue(src);
+        if (value != src.value) {
+            src.value = value;
+            newData.append({ src.id, value });
+            firstRow = std::min(firstRow, i);
+            lastRow = std::max(lastRow, i);
+        }
+    }
+    if (!newData.isEmpty()) {
+        emit valuesChanged(newData);
+        emit dataChanged(index(firstRow, 1), index(lastRow, 1), { Qt::DisplayRole });
+    }
+}
+
+QJsonValue AppStatistics::metricSnapshot(const Source &src) const
+{
+    auto *m = metric(src.id);
+    if (!m)
+        return QJsonValue::fromVariant(src.value);
+
+    switch (m->kind) {
+    case Kind::HitRate:
+        return QJsonObject {
+            { u"hits"_qs, m->value.load(std::memory_order_relaxed) },
+            { u"lookups"_qs, m->total.load(std::memory_order_relaxed) },
+        };
+    case Kind::Histogram: {
+        QJsonArray buckets; // [value, count] pairs of the non-empty buckets
+        for (int i = 0; i < HistogramBuckets; ++i) {
+            if (auto n = m->buckets[i].load(std::memory_order_relaxed))
+                buckets.append(QJsonArray { histogramBucketValue(i), qint64(n) });
+        }
+        return QJsonObject {
+            { u"count"_qs, m->value.load(std::memory_order_relaxed) },
+            { u"sum"_qs, m->total.load(std::memory_order_relaxed) },
+            { u"max"_qs, m->max.load(std::memory_order_relaxed) },
+            { u"p50"_qs, percentile(src.id, .5) },
+            { u"p90"_qs, percentile(src.id, .9) },
+            { u"p99"_qs, percentile(src.id, .99) },
+            { u"buckets"_qs, buckets },
+        };
+    }
+    default:
+        return m->value.load(std::memory_order_relaxed);
+    }
+}
+
+QJsonObject AppStatistics::snapshot() const
+{
+    QJsonObject metrics;
+    for (const auto &src : m_sources) {
+        QString name = src.name;
+        if (!src.unit.isEmpty())
+            name = name + u" [" + src.unit + u']';
+        metrics.insert(name, metricSnapshot(src));
+    }
+    return QJsonObject {
+        { u"timestamp"_qs, QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs) },
+        { u"metrics"_qs, metrics },
+    };
+}
+
+QString AppStatistics::snapshotFileName() const
+{
+    return m_snapshotFile.fileName();
+}
+
+void AppStatistics::setSnapshotFileName(const QString &fileName)
+{
+    if (fileName == m_snapshotFile.fileName())
+        return;
+
+    m_snapshotFile.close();
+    m_snapshotFile.setFileName(fileName);
+    if (!fileName.isEmpty() && !m_snapshotFile.open(QIODevice::WriteOnly | QIODevice::Append))
+        qWarning() << "AppStatistics: could not open snapshot file" << fileName << ":" << m_snapshotFile.errorString();
+}
+
+void AppStatistics::writeSnapshot()
+{
+    if (m_snapshotFile.isOpen()) {
+        m_snapshotFile.write(QJsonDocument(snapshot()).toJson(QJsonDocument::Compact) + '\n');
+        m_snapshotFile.flush();
+    }
+}
+
 int AppStatistics::columnCount(const QModelIndex &parent) const
 {
     return parent.isValid() ? 0 : 2;
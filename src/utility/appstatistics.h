@@ -3,6 +3,10 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <memory>
+
 #include <QAbstractTableModel>
 #include <QHash>
 #include <QVector>
@@ -12,6 +16,8 @@
 #include <QMutex>
 #include <QTimer>
 #include <QAtomicInteger>
+#include <QFile>
+#include <QJsonObject>
 
 
 class AppStatistics : public QAbstractTableModel
@@ -22,13 +28,27 @@ class AppStatistics : public QAbstractTableModel
 public:
     static AppStatistics *inst();
 
+    enum class Kind {
+        Value,      // any QVariant, set via update()
+        Counter,    // monotonic, see increment()
+        Gauge,      // the current level of something, see setGauge()
+        HitRate,    // hits vs. lookups, see hit()
+        Histogram,  // the distribution of samples (e.g. latencies), see record()
+    };
+    Q_ENUM(Kind)
+
     int addSource(const QString &name, const QString &unit = { });
+    int addCounter(const QString &name, const QString &unit = { });
+    int addGauge(const QString &name, const QString &unit = { });
+    int addHitRate(const QString &name);
+    int addHistogram(const QString &name, const QString &unit = u"us"_qs);
     void removeSource(int sourceId);
 
     QVector<int> sourceIds() const;
     QString sourceName(int sourceId) const;
     QString sourceUnit(int sourceId) const;
     QVariant sourceValue(int sourceId, const QVariant &defaultValue = { }) const;
+    Kind sourceKind(int sourceId) const;
 
     int updateInterval() const;
     void setUpdateInterval(int newUpdateInterval);
@@ -36,6 +56,19 @@ public:
     // update() can be called from any thread
     void update(int sourceId, const QVariant &value);
 
+    // the typed metrics can be updated lock-free from any thread
+    void increment(int sourceId, qint64 delta = 1);
+    void setGauge(int sourceId, qint64 value);
+    void hit(int sourceId, bool isHit);
+    void record(int sourceId, qint64 sample);
+    qint64 percentile(int sourceId, double p) const;
+
+    // all the current values, for exporting
+    QJsonObject snapshot() const;
+    // if set, a snapshot is appended to this file every updateInterval (as JSON lines)
+    QString snapshotFileName() const;
+    void setSnapshotFileName(const QString &fileName);
+
     int columnCount(const QModelIndex &parent = { }) const override;
     int rowCount(const QModelIndex &parent = { }) const override;
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
@@ -56,10 +89,38 @@ private:
         QString name;
         QString unit;
         QVariant value;
+        Kind kind = Kind::Value;
     };
     QVector<Source> m_sources;
     int m_nextSourceId = 0;
 
+    // Log-linear buckets with a relative error of 12.5%: exact up to 16, then 8 sub-buckets
+    // for every power of 2.
+    static constexpr int HistogramBuckets = 16 + (63 - 4) * 8;
+    static int histogramBucket(qint64 sample);
+    static qint64 histogramBucketValue(int bucket);
+
+    struct Metric {
+        Kind kind;
+        std::atomic<qint64> value { 0 };  // counter, gauge, hits, histogram sample count
+        std::atomic<qint64> total { 0 };  // lookups, histogram sample sum
+        std::atomic<qint64> max { 0 };    // histogram maximum
+        std::unique_ptr<std::atomic<quint64>[]> buckets;
+    };
+    // the metrics are indexed by source id, so they can be found without locking
+    static constexpr int MaxMetrics = 256;
+    std::array<std::atomic<Metric *>, MaxMetrics> m_metrics { };
+    std::vector<std::unique_ptr<Metric>> m_ownedMetrics;
+
+    int addMetric(Kind kind, const QString &name, const QString &unit);
+    Metric *metric(int sourceId) const;
+    QVariant metricValue(const Source &src) const;
+    QJsonValue metricSnapshot(const Source &src) const;
+    void updateMetrics();
+    void writeSnapshot();
+
+    QFile m_snapshotFile;
+
     int m_updateInterval = 1000; // every second
     QTimer m_timer;
 
@@ -0,0 +1,223 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+#include <limits>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QDataStream>
+#include <QtCore/QHash>
+
+#include "utility/binarydelta.h"
+#include "utility/exception.h"
+
+
+// Delta format (little endian):
+//   quint64 target size
+//   followed by any number of operations:
+//     'C' quint64 base offset, quint64 length    -> copy from base
+//     'I' quint64 length, <length> bytes         -> insert literal data
+//   terminated by a single 'E'
+
+namespace {
+
+enum Operation : quint8 {
+    OpCopy = 'C',
+    OpInsert = 'I',
+    OpEnd = 'E',
+};
+
+// the weak checksum from rsync: cheap to roll forward by a single byte
+class RollingChecksum
+{
+public:
+    void init(const char *data, qsizetype size)
+    {
+        m_a = m_b = 0;
+        m_size = quint32(size);
+        for (qsizetype i = 0; i < size; ++i) {
+            m_a += uchar(data[i]);
+            m_b += quint32(size - i) * uchar(data[i]);
+        }
+    }
+
+    void roll(uchar out, uchar in)
+    {
+        m_a = m_a - out + in;
+        m_b = m_b - m_size * out + m_a;
+    }
+
+    quint32 value() const  { return (m_a & 0xffff) | (m_b << 16); }
+
+private:
+    quint32 m_a = 0;
+    quint32 m_b = 0;
+    quint32 m_size = 0;
+};
+
+} // namespace
+
+
+namespace BinaryDelta {
+
+QByteArray create(QByteArrayView base, QByteArrayView target)
+{
+    QByteArray delta;
+    QBuffer buffer(&delta);
+    buffer.open(QIODevice::WriteOnly);
+    QDataStream ds(&buffer);
+    ds.setByteOrder(QDataStream::LittleEndian);
+
+    ds << quint64(target.size());
+
+    // only the first occurrence of each checksum is indexed: the database files are full of
+    // repeated data, but the match is extended as far as possible anyway
+    QHash<quint32, qsizetype> index;
+    index.reserve(base.size() / BlockSize);
+    RollingChecksum rc;
+    for (qsizetype offset = 0; (offset + BlockSize) <= base.size(); offset += BlockSize) {
+        rc.init(base.data() + offset, BlockSize);
+        if (!index.contains(rc.value()))
+            index.insert(rc.value(), offset);
+    }
+
+    // copies are kept pending, so that adjacent ones can be merged
+    qsizetype copyOffset = 0;
+    qsizetype copyLength = 0;
+
+    auto flushCopy = [&]() {
+        if (copyLength) {
+            ds << quint8(OpCopy) << quint64(copyOffset) << quint64(copyLength);
+            copyLength = 0;
+        }
+    };
+    auto addCopy = [&](qsizetype offset, qsizetype length) {
+        if (copyLength && ((copyOffset + copyLength) == offset)) {
+            copyLength += length;
+        } else {
+            flushCopy();
+            copyOffset = offset;
+            copyLength = length;
+        }
+    };
+    auto addLiteral = [&](qsizetype from, qsizetype to) {
+        if (to > from) {
+            flushCopy();
+            ds << quint8(OpInsert) << quint64(to - from);
+            ds.writeRawData(target.data() + from, int(to - from));
+        }
+    };
+
+    qsizetype pos = 0;
+    qsizetype literalStart = 0;
+
+    if (!index.isEmpty() && (target.size() >= BlockSize))
+        rc.init(target.data(), BlockSize);
+
+    while (!index.isEmpty() && ((pos + BlockSize) <= target.size())) {
+        auto it = index.constFind(rc.value());
+
+        if ((it != index.cend()) && !std::memcmp(base.data() + *it, target.data() + pos, BlockSize)) {
+            qsizetype baseOffset = *it;
+            qsizetype targetOffset = pos;
+            qsizetype length = BlockSize;
+
+            // grow the match: backwards only into the literal data that has not been emitted yet
+            while ((targetOffset > literalStart) && (baseOffset > 0)
+                   && (base[baseOffset - 1] == target[targetOffset - 1])) {
+                --baseOffset;
+                --targetOffset;
+                ++length;
+            }
+            while (((targetOffset + length) < target.size()) && ((baseOffset + length) < base.size())
+                   && (base[baseOffset + length] == target[targetOffset + length])) {
+                ++length;
+            }
+
+            addLiteral(literalStart, targetOffset);
+            addCopy(baseOffset, length);
+
+            pos = literalStart = targetOffset + length;
+            if ((pos + BlockSize) <= target.size())
+                rc.init(target.data() + pos, BlockSize);
+        } else {
+            if ((pos + BlockSize) < target.size())
+                rc.roll(uchar(target[pos]), uchar(target[pos + BlockSize]));
+            ++pos;
+        }
+    }
+    addLiteral(literalStart, target.size());
+    flushCopy();
+    ds << quint8(OpEnd);
+
+    return delta;
+}
+
+QByteArray apply(QByteArrayView base, QByteArrayView delta)
+{
+    QByteArray ba = QByteArray::fromRawData(delta.data(), delta.size());
+    QBuffer buffer(&ba);
+    buffer.open(QIODevice::ReadOnly);
+    QDataStream ds(&buffer);
+    ds.setByteOrder(QDataStream::LittleEndian);
+
+    auto check = [&ds, &buffer]() {
+        if (ds.status() != QDataStream::Ok)
+            throw Exception("truncated delta at position %1").arg(buffer.pos());
+    };
+
+    quint64 targetSize = 0;
+    ds >> targetSize;
+    check();
+    if (targetSize > quint64(std::numeric_limits<int>::max()))
+        throw Exception("delta target size %1 is too large").arg(targetSize);
+
+    QByteArray target;
+    target.reserve(qsizetype(targetSize));
+
+    forever {
+        quint8 op = 0;
+        ds >> op;
+        check();
+
+        if (op == OpEnd)
+            break;
+
+        switch (op) {
+        case OpCopy: {
+            quint64 offset = 0, length = 0;
+            ds >> offset >> length;
+            check();
+            if ((offset > quint64(base.size())) || (length > (quint64(base.size()) - offset))) {
+                throw Exception("delta copy operation out of range (%1 + %2 > %3)")
+                    .arg(offset).arg(length).arg(base.size());
+            }
+            target.append(base.sliced(qsizetype(offset), qsizetype(length)));
+            break;
+        }
+        case OpInsert: {
+            quint64 length = 0;
+            ds >> length;
+            check();
+            if (length > quint64(delta.size() - buffer.pos()))
+                throw Exception("truncated delta at position %1").arg(buffer.pos());
+            target.append(delta.sliced(buffer.pos(), qsizetype(length)));
+            ds.skipRawData(int(length));
+            break;
+        }
+        default:
+            throw Exception("invalid delta operation %1 at position %2").arg(op).arg(buffer.pos() - 1);
+        }
+
+        if (quint64(target.size()) > targetSize)
+            throw Exception("delta produces more than the expected %1 bytes").arg(targetSize);
+    }
+
+    if (quint64(target.size()) != targetSize) {
+        throw Exception("delta produced %1 bytes, but %2 were expected")
+            .arg(target.size()).arg(targetSize);
+    }
+    return target;
+}
+
+} // namespace BinaryDelta
@@ -0,0 +1,26 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QByteArrayView>
+
+
+// A simple rsync-style binary diff: the target is described as a sequence of "copy a range
+// of the base" and "insert these literal bytes" operations. Matches are found by indexing
+// the base in BlockSize blocks via a rolling checksum, so insertions and deletions in the
+// middle of the file do not invalidate everything after them.
+// The result is not compressed: it is meant to be shipped through the same LZMA pipeline
+// as the full files.
+
+namespace BinaryDelta {
+
+constexpr qsizetype BlockSize = 64;
+
+QByteArray create(QByteArrayView base, QByteArrayView target);
+
+// throws an Exception if the delta is corrupt or does not fit the base
+QByteArray apply(QByteArrayView base, QByteArrayView delta);
+
+} // namespace BinaryDelta
@@ -63,7 +63,7 @@ void MonotonicMemoryResource::release_buffers() noexcept
 bool DatabaseMonotonicMemoryResource::debug = false;
 
 DatabaseMonotonicMemoryResource::DatabaseMonotonicMemoryResource(size_t initialSize)
-    : MonotonicMemoryResource(initialSize)
+    : MonotonicMemoryResource(initialSize, &m_countingUpstream)
     , stepSize(initialSize)
 { }
 
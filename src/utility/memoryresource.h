@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include <QDebug>
 
 #if __has_include(<memory_resource>)
@@ -298,12 +300,57 @@ private:
 ///////////////////////////////////////////////////////////////////////
 
 
-class DatabaseMonotonicMemoryResource : public MonotonicMemoryResource
+// Forwards everything to the upstream resource, but keeps track of the number of bytes
+// currently allocated. Put this underneath a MonotonicMemoryResource to get its real size.
+class CountingMemoryResource : public MemoryResource
+{
+public:
+    explicit CountingMemoryResource(MemoryResource *upstream = defaultMemoryResource()) noexcept
+        : m_upstream(upstream)
+    { }
+
+    size_t allocatedSize() const noexcept
+    { return m_allocated.load(std::memory_order_relaxed); }
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        void *p = m_upstream->allocate(bytes, alignment);
+        m_allocated.fetch_add(bytes, std::memory_order_relaxed);
+        return p;
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override
+    {
+        m_allocated.fetch_sub(bytes, std::memory_order_relaxed);
+        m_upstream->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const MemoryResource &other) const noexcept override
+    { return this == &other; }
+
+private:
+    MemoryResource *m_upstream;
+    std::atomic<size_t> m_allocated = 0;
+};
+
+
+// The upstream counter has to be constructed before the MonotonicMemoryResource base class
+// and destructed after it, so it lives in a base class of its own.
+struct CountingUpstreamHolder
+{
+    CountingMemoryResource m_countingUpstream;
+};
+
+class DatabaseMonotonicMemoryResource : private CountingUpstreamHolder, public MonotonicMemoryResource
 {
 public:
     explicit DatabaseMonotonicMemoryResource(size_t initialSize);
     ~DatabaseMonotonicMemoryResource() noexcept override;
 
+    // the memory requested from upstream, i.e. including the unused rest of the current buffer
+    size_t allocatedSize() const noexcept  { return m_countingUpstream.allocatedSize(); }
+
     static bool debug;
 
 protected:
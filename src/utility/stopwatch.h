@@ -6,6 +6,8 @@
 #include <QtDebug>
 #include <QElapsedTimer>
 
+#include "utility/tracing.h"
+
 
 class stopwatch
 {
@@ -21,7 +23,14 @@ public:
     }
     void restart(const QByteArray &desc = { })
     {
-        qint64 micros = m_timer.nsecsElapsed() / 1000;
+        qint64 nsecs = m_timer.nsecsElapsed();
+        qint64 micros = nsecs / 1000;
+
+        // also visible as a zone in the trace
+        if (Tracer::isEnabled()) {
+            qint64 end = Tracer::now();
+            Tracer::zone(Tracer::intern(m_label), end - nsecs, end);
+        }
 
         int sec = 0;
         if (micros > 1000 * 1000) {
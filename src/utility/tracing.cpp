@@ -0,0 +1,287 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QHash>
+#include <QtCore/QIODevice>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
+
+#include "utility/exception.h"
+#include "utility/tracing.h"
+
+
+namespace {
+
+struct Event
+{
+    const char *name;
+    qint64 timestamp;    // nsec
+    qint64 value;        // the duration in nsec for zones
+    bool isCounter;
+};
+
+// Only the owning thread writes to its buffer, so the mutex is uncontended unless a trace is
+// written or cleared at the same time.
+struct ThreadBuffer
+{
+    static constexpr quint64 Capacity = 16384;
+
+    QMutex mutex;
+    int tid = 0;
+    QByteArray threadName;
+    std::vector<Event> events;
+    quint64 written = 0;
+    bool active = false;
+
+    void append(const Event &e)
+    {
+        QMutexLocker locker(&mutex);
+        if (events.empty())
+            events.resize(Capacity);
+        events[written++ % Capacity] = e;
+    }
+};
+
+// The thread pools constantly expire and create threads: when a thread exits, its events are
+// moved into a global ring buffer of limited size and its buffer is reused for the next new
+// thread. This way, the memory used is bounded by the number of threads running concurrently.
+struct Registry
+{
+    static constexpr quint64 RetiredCapacity = 65536;
+
+    struct RetiredEvent
+    {
+        Event event;
+        int tid;
+    };
+
+    QMutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::vector<ThreadBuffer *> freeBuffers;
+    std::vector<RetiredEvent> retired;
+    quint64 retiredWritten = 0;
+    QHash<int, QByteArray> retiredThreadNames;
+    int nextTid = 1;
+    QSet<QByteArray> internedNames;
+
+    void retire(ThreadBuffer *buffer);
+};
+
+Registry *registry()
+{
+    static Registry r;
+    return &r;
+}
+
+void Registry::retire(ThreadBuffer *buffer)
+{
+    QMutexLocker locker(&mutex);
+    QMutexLocker bufferLocker(&buffer->mutex);
+
+    const quint64 count = std::min(buffer->written, ThreadBuffer::Capacity);
+    if (count) {
+        if (retired.empty())
+            retired.resize(RetiredCapacity);
+        for (quint64 i = buffer->written - count; i < buffer->written; ++i)
+            retired[retiredWritten++ % RetiredCapacity] = { buffer->events.at(i % ThreadBuffer::Capacity), buffer->tid };
+        retiredThreadNames.insert(buffer->tid, buffer->threadName);
+
+        // forget the names of the threads whose events have all been overwritten by now
+        if (retiredThreadNames.size() > 1024) {
+            QSet<int> tids;
+            for (quint64 i = 0; i < std::min(retiredWritten, RetiredCapacity); ++i)
+                tids.insert(retired.at(i).tid);
+            retiredThreadNames.removeIf([&tids](const auto &it) { return !tids.contains(it.key()); });
+        }
+    }
+    buffer->written = 0;
+    buffer->active = false;
+    freeBuffers.push_back(buffer);
+}
+
+const auto processStart = std::chrono::steady_clock::now();
+
+// hands the buffer back to the registry when the thread exits
+struct ThreadBufferHandle
+{
+    ThreadBuffer *buffer = nullptr;
+
+    ~ThreadBufferHandle()
+    {
+        if (buffer)
+            registry()->retire(buffer);
+    }
+};
+
+thread_local ThreadBufferHandle threadBuffer;
+
+ThreadBuffer *currentThreadBuffer()
+{
+    if (!threadBuffer.buffer) {
+        auto *r = registry();
+
+        QMutexLocker locker(&r->mutex);
+        ThreadBuffer *buffer;
+        if (!r->freeBuffers.empty()) {
+            buffer = r->freeBuffers.back();
+            r->freeBuffers.pop_back();
+        } else {
+            r->buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffer = r->buffers.back().get();
+        }
+
+        QMutexLocker bufferLocker(&buffer->mutex);
+        buffer->tid = r->nextTid++;
+        buffer->threadName.clear();
+        if (auto *thread = QThread::currentThread()) {
+            buffer->threadName = thread->objectName().toUtf8();
+            if (buffer->threadName.isEmpty() && qApp && (thread == qApp->thread()))
+                buffer->threadName = "Main";
+        }
+        if (buffer->threadName.isEmpty())
+            buffer->threadName = "Thread " + QByteArray::number(buffer->tid);
+        buffer->active = true;
+        threadBuffer.buffer = buffer;
+    }
+    return threadBuffer.buffer;
+}
+
+QByteArray jsonString(const char *str)
+{
+    QByteArray result = "\"";
+    for (const char *c = str; *c; ++c) {
+        if ((*c == '"') || (*c == '\\'))
+            result.append('\\').append(*c);
+        else if (uchar(*c) < 0x20)
+            result.append("\\u00").append(QByteArray::number(uchar(*c), 16).rightJustified(2, '0'));
+        else
+            result.append(*c);
+    }
+    return result.append('"');
+}
+
+QByteArray toMicroSeconds(qint64 nsec)
+{
+    return QByteArray::number(double(nsec) / 1000., 'f', 3);
+}
+
+} // namespace
+
+
+std::atomic<bool> Tracer::s_enabled = (qEnvironmentVariableIntValue("BS_TRACE") == 1);
+
+void Tracer::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::clear()
+{
+    auto *r = registry();
+    QMutexLocker locker(&r->mutex);
+    for (const auto &buffer : r->buffers) {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        buffer->written = 0;
+    }
+    r->retiredWritten = 0;
+    r->retiredThreadNames.clear();
+}
+
+qint64 Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()
+                                                                - processStart).count();
+}
+
+const char *Tracer::intern(const QByteArray &name)
+{
+    auto *r = registry();
+    QMutexLocker locker(&r->mutex);
+    auto it = r->internedNames.constFind(name);
+    if (it == r->internedNames.cend()) {
+        // a deep copy, in case name was created via fromRawData()
+        it = r->internedNames.insert(QByteArray(name.constData(), name.size()));
+    }
+    return it->constData();
+}
+
+void Tracer::zone(const char *name, qint64 start, qint64 end)
+{
+    currentThreadBuffer()->append({ name, start, end - start, false });
+}
+
+void Tracer::counter(const char *name, qint64 value)
+{
+    if (isEnabled())
+        currentThreadBuffer()->append({ name, now(), value, true });
+}
+
+void Tracer::writeChromeTrace(QIODevice *device)
+{
+    auto write = [device](const QByteArray &data) {
+        if (device->write(data) != data.size())
+            throw Exception("could not write the trace: %1").arg(device->errorString());
+    };
+
+    write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    auto *r = registry();
+    QMutexLocker locker(&r->mutex);
+    bool first = true;
+
+    auto threadNameEvent = [&first](const QByteArray &tid, const QByteArray &threadName) {
+        QByteArray out = first ? "" : ",\n";
+        first = false;
+        return out + "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid
+                + ",\"args\":{\"name\":" + jsonString(threadName.constData()) + "}}";
+    };
+    auto traceEvent = [](const QByteArray &tid, const Event &e) {
+        QByteArray out = ",\n{\"name\":" + jsonString(e.name) + ",\"pid\":1,\"tid\":" + tid
+                + ",\"ts\":" + toMicroSeconds(e.timestamp);
+        if (e.isCounter)
+            out += ",\"ph\":\"C\",\"args\":{\"value\":" + QByteArray::number(e.value) + "}}";
+        else
+            out += ",\"ph\":\"X\",\"dur\":" + toMicroSeconds(e.value) + '}';
+        return out;
+    };
+
+    for (const auto &buffer : r->buffers) {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        if (!buffer->active)
+            continue;
+        const QByteArray tid = QByteArray::number(buffer->tid);
+        QByteArray out = threadNameEvent(tid, buffer->threadName);
+
+        const quint64 count = std::min(buffer->written, ThreadBuffer::Capacity);
+        for (quint64 i = buffer->written - count; i < buffer->written; ++i) {
+            out += traceEvent(tid, buffer->events.at(i % ThreadBuffer::Capacity));
+            if (out.size() > 65536)
+                write(std::exchange(out, { }));
+        }
+        write(out);
+    }
+
+    // the events of the threads that have already finished: all of them have a name entry, so
+    // there always is a thread_name event in front of the first event
+    QByteArray out;
+    for (auto it = r->retiredThreadNames.cbegin(); it != r->retiredThreadNames.cend(); ++it)
+        out += threadNameEvent(QByteArray::number(it.key()), it.value());
+
+    const quint64 count = std::min(r->retiredWritten, Registry::RetiredCapacity);
+    for (quint64 i = r->retiredWritten - count; i < r->retiredWritten; ++i) {
+        const auto &retired = r->retired.at(i % Registry::RetiredCapacity);
+        out += traceEvent(QByteArray::number(retired.tid), retired.event);
+        if (out.size() > 65536)
+            write(std::exchange(out, { }));
+    }
+    write(out);
+    write("\n]}\n");
+}
@@ -0,0 +1,61 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <atomic>
+
+#include <QtCore/QByteArray>
+
+QT_FORWARD_DECLARE_CLASS(QIODevice)
+
+
+// A low overhead, always compiled-in tracer: scoped zones and counters are recorded into a ring
+// buffer per thread and can be dumped at any time in the Chrome trace JSON format, which can be
+// loaded into chrome://tracing or https://ui.perfetto.dev.
+// The events of exited threads are kept in a global ring buffer, so the memory usage stays
+// bounded in long sessions, even with thread pools constantly recreating their threads.
+// Tracing is disabled by default (a zone then costs a single atomic load) and can be enabled by
+// setting the BS_TRACE environment variable to 1 or at runtime via setEnabled().
+// The names have to stay valid for the lifetime of the process: use string literals or intern().
+
+class Tracer
+{
+public:
+    static bool isEnabled()  { return s_enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enabled);
+    static void clear();
+
+    static qint64 now(); // in nsec
+    static const char *intern(const QByteArray &name);
+
+    static void zone(const char *name, qint64 start, qint64 end);
+    static void counter(const char *name, qint64 value);
+
+    // throws an Exception on write errors
+    static void writeChromeTrace(QIODevice *device);
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+
+class tracezone
+{
+public:
+    explicit tracezone(const char *name)
+        : m_name(Tracer::isEnabled() ? name : nullptr)
+        , m_start(m_name ? Tracer::now() : 0)
+    { }
+    ~tracezone()
+    {
+        if (m_name)
+            Tracer::zone(m_name, m_start, Tracer::now());
+    }
+
+private:
+    Q_DISABLE_COPY(tracezone)
+
+    const char *m_name;
+    qint64 m_start;
+};
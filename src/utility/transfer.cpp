@@ -11,7 +11,9 @@
 #include <QCoreApplication>
 #include <QUrlQuery>
 
+#include "appstatistics.h"
 #include "transfer.h"
+#include "tracing.h"
 
 Q_LOGGING_CATEGORY(LogTransfer, "bs.transfer", QtWarningMsg)
 
@@ -158,6 +160,7 @@ Transfer::Transfer(QNetworkCookieJar *&&cookieJar, QObject *parent)
     connect(m_retriever, &TransferRetriever::finished,
             this, [this](TransferJob *job) {
         if (!job->isActive()) {
+            recordLatency(job);
             emit finished(job);
 
             if (job->m_reset_for_reuse) {
@@ -222,6 +225,20 @@ void Transfer::abortAllJobs()
     QMetaObject::invokeMethod(m_retriever, &TransferRetriever::abortAllJobs, Qt::BlockingQueuedConnection);
 }
 
+void Transfer::recordLatency(const TransferJob *job)
+{
+    if (!job->isCompleted() && !job->isFailed())
+        return;
+
+    // one histogram per host, created on demand (this runs on the main thread)
+    static QHash<QString, int> statIds;
+    const QString host = job->effectiveUrl().host();
+    auto it = statIds.constFind(host);
+    if (it == statIds.cend())
+        it = statIds.insert(host, AppStatistics::inst()->addHistogram(u"HTTP latency " + host, u"ms"_qs));
+    AppStatistics::inst()->record(*it, job->m_timer.elapsed());
+}
+
 QString Transfer::userAgent() const
 {
     return m_user_agent;
@@ -322,6 +339,8 @@ void TransferRetriever::abortAllJobs()
 
 void TransferRetriever::schedule()
 {
+    tracezone zone("TransferRetriever::schedule");
+
     if (!m_nam) {
         m_nam = new QNetworkAccessManager(this);
         if (m_cookieJar)
@@ -356,6 +375,7 @@ void TransferRetriever::schedule()
         req.setSslConfiguration(ssl);
 #endif
         j->setStatus(TransferJob::Active);
+        j->m_timer.start();
         if (isget) {
             if (!j->m_only_if_different.isEmpty())
                 req.setHeader(QNetworkRequest::IfNoneMatchHeader, j->m_only_if_different);
@@ -391,6 +411,8 @@ void TransferRetriever::schedule()
         m_currentJobs.append(j);
         emit started(j);
     }
+    Tracer::counter("Transfer active jobs", m_currentJobs.size());
+    Tracer::counter("Transfer queued jobs", m_jobs.size());
 }
 
 void TransferRetriever::downloadFinished(QNetworkReply *reply)
@@ -468,12 +490,13 @@ void TransferRetriever::downloadFinished(QNetworkReply *reply)
     j->m_reply->deleteLater();
     j->m_reply = nullptr;
 
+    emit finished(j); // the thread adapter lambda in Transfer will delete the job
+
+    // only report the progress after finished(): an idle Transfer has delivered all its jobs
     emit overallProgress(++m_progressDone, m_progressTotal);
     if (m_progressDone == m_progressTotal)
         m_progressDone = m_progressTotal = 0;
 
-    emit finished(j); // the thread adapter lambda in Transfer will delete the job
-
     m_currentJobs.removeAll(j);
 
     QMetaObject::invokeMethod(this, &TransferRetriever::schedule, Qt::QueuedConnection);
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QUrl>
 #include <QUrlQuery>
 #include <QThread>
@@ -99,6 +100,7 @@ private:
 
     QByteArray   m_userTag;
     QVariant     m_userData;
+    QElapsedTimer m_timer;
 
     uint         m_respcode         : 16 = 0;
     Status       m_status           : 4 = Inactive;
@@ -187,6 +189,7 @@ public slots:
 
 private:
     void internalFinished(TransferJob *job);
+    static void recordLatency(const TransferJob *job);
 
     QThread *m_retrieverThread;
     TransferRetriever *m_retriever;
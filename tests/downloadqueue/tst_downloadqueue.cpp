@@ -0,0 +1,210 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <memory>
+
+#include <QtCore/QHash>
+#include <QtCore/QTimer>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtTest/QTest>
+#include <QCoro/QCoroSignal>
+#include <QCoro/QCoroTask>
+
+#include "bricklink/downloadqueue_p.h"
+#include "utility/exception.h"
+
+
+// A minimal HTTP/1.0 stand-in for the BrickLink server: every path answers with a 503 for the
+// first failuresPerPath requests (or failuresFor[path], if set), then with a 200 and the path as
+// the body. The paths starting with /broken/ always fail. The answers are delayed, so that concurrent requests overlap, and
+// the maximum number of requests in flight is recorded.
+
+class StandInServer : public QTcpServer
+{
+public:
+    int failuresPerPath = 0;
+    QHash<QByteArray, int> failuresFor;
+    int delay = 50; // msec
+    int inFlight = 0;
+    int maxInFlight = 0;
+    int requestCount = 0;
+
+    QUrl url(const QString &path) const
+    {
+        return QUrl(u"http://127.0.0.1:%1/%2"_qs.arg(serverPort()).arg(path));
+    }
+
+protected:
+    void incomingConnection(qintptr handle) override
+    {
+        auto socket = new QTcpSocket(this);
+        socket->setSocketDescriptor(handle);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            if (socket->property("bsHandled").toBool() || !socket->canReadLine())
+                return;
+            socket->setProperty("bsHandled", true);
+
+            // "GET /path HTTP/1.1": the headers are irrelevant
+            const QByteArray path = socket->readLine().split(' ').value(1);
+            ++requestCount;
+            maxInFlight = std::max(maxInFlight, ++inFlight);
+
+            const bool fail = path.startsWith("/broken/")
+                    || (m_requests[path]++ < failuresFor.value(path, failuresPerPath));
+
+            QTimer::singleShot(delay, socket, [this, socket, path, fail]() {
+                --inFlight;
+                const QByteArray body = fail ? QByteArray("unavailable") : path;
+                socket->write((fail ? "HTTP/1.0 503 Service Unavailable\r\n" : "HTTP/1.0 200 OK\r\n")
+                              + "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                              + "Connection: close\r\n\r\n" + body);
+                socket->disconnectFromHost();
+            });
+        });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+
+private:
+    QHash<QByteArray, int> m_requests;
+};
+
+
+class tst_DownloadQueue : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void concurrencyBound_data();
+    void concurrencyBound();
+    void retryTransientFailures();
+    void giveUpAfterMaxRetries();
+    void inOrderDelivery();
+
+private:
+    BrickLink::DownloadQueue::FetchFunction fetch();
+
+    std::unique_ptr<StandInServer> m_server;
+    std::unique_ptr<QNetworkAccessManager> m_nam;
+};
+
+
+void tst_DownloadQueue::init()
+{
+    m_server = std::make_unique<StandInServer>();
+    QVERIFY(m_server->listen(QHostAddress::LocalHost));
+    m_nam = std::make_unique<QNetworkAccessManager>();
+}
+
+void tst_DownloadQueue::cleanup()
+{
+    m_nam.reset();
+    m_server.reset();
+}
+
+BrickLink::DownloadQueue::FetchFunction tst_DownloadQueue::fetch()
+{
+    return [nam = m_nam.get()](const QUrl &url, const QString &) -> QCoro::Task<QByteArray> {
+        std::unique_ptr<QNetworkReply> reply(nam->get(QNetworkRequest(url)));
+        co_await qCoro(reply.get(), &QNetworkReply::finished);
+        if (reply->error() != QNetworkReply::NoError)
+            throw Exception(u"%1: %2"_qs.arg(url.path(), reply->errorString()));
+        co_return reply->readAll();
+    };
+}
+
+void tst_DownloadQueue::concurrencyBound_data()
+{
+    QTest::addColumn<int>("maxConcurrent");
+
+    // QNetworkAccessManager itself uses up to 6 connections per host
+    QTest::newRow("1") << 1;
+    QTest::newRow("3") << 3;
+    QTest::newRow("5") << 5;
+}
+
+void tst_DownloadQueue::concurrencyBound()
+{
+    QFETCH(int, maxConcurrent);
+
+    BrickLink::DownloadQueue queue(fetch(), { }, u"test"_qs,
+                                   BrickLink::DownloadQueue::Delivery::AsCompleted, maxConcurrent);
+    int delivered = 0;
+    for (int i = 0; i < 20; ++i) {
+        queue.enqueue(m_server->url(u"file-%1"_qs.arg(i)), { },
+                      [&delivered](const QByteArray &) { ++delivered; });
+    }
+
+    QCOMPARE(QCoro::waitFor(queue.run()), 0);
+    QCOMPARE(delivered, 20);
+    QCOMPARE(m_server->requestCount, 20);
+    QCOMPARE(m_server->maxInFlight, maxConcurrent);
+}
+
+void tst_DownloadQueue::retryTransientFailures()
+{
+    m_server->failuresPerPath = 2;
+
+    BrickLink::DownloadQueue queue(fetch(), { }, u"test"_qs,
+                                   BrickLink::DownloadQueue::Delivery::AsCompleted, 4);
+    queue.setInitialRetryDelay(10);
+    QStringList bodies;
+    for (int i = 0; i < 4; ++i) {
+        queue.enqueue(m_server->url(u"file-%1"_qs.arg(i)), { },
+                      [&bodies](const QByteArray &data) { bodies << QString::fromLatin1(data); });
+    }
+
+    QCOMPARE(QCoro::waitFor(queue.run()), 0);
+    QCOMPARE(queue.retryCount(), 4 * 2);
+    QCOMPARE(m_server->requestCount, 4 * 3);
+    bodies.sort();
+    QCOMPARE(bodies, (QStringList { u"/file-0"_qs, u"/file-1"_qs, u"/file-2"_qs, u"/file-3"_qs }));
+}
+
+void tst_DownloadQueue::giveUpAfterMaxRetries()
+{
+    BrickLink::DownloadQueue queue(fetch(), { }, u"test"_qs,
+                                   BrickLink::DownloadQueue::Delivery::AsCompleted, 2, 3);
+    queue.setInitialRetryDelay(10);
+    int delivered = 0;
+    auto callback = [&delivered](const QByteArray &) { ++delivered; };
+    queue.enqueue(m_server->url(u"broken/a"_qs), { }, callback);
+    queue.enqueue(m_server->url(u"ok"_qs), { }, callback);
+
+    QCOMPARE(QCoro::waitFor(queue.run()), 1);
+    QCOMPARE(delivered, 1);
+    QCOMPARE(queue.retryCount(), 3);
+    QCOMPARE(m_server->requestCount, 1 + 3 + 1);
+    QCOMPARE(queue.errors().size(), 1);
+    QVERIFY(queue.errors().constFirst().startsWith(u"/broken/a"));
+}
+
+void tst_DownloadQueue::inOrderDelivery()
+{
+    // the first download is retried, so it finishes last, but still has to be delivered first
+    m_server->failuresFor.insert("/file-0", 1);
+
+    BrickLink::DownloadQueue queue(fetch(), { }, u"test"_qs,
+                                   BrickLink::DownloadQueue::Delivery::InOrder, 4);
+    queue.setInitialRetryDelay(100);
+    QStringList bodies;
+    for (int i = 0; i < 4; ++i) {
+        queue.enqueue(m_server->url(u"file-%1"_qs.arg(i)), { },
+                      [&bodies](const QByteArray &data) { bodies << QString::fromLatin1(data); });
+    }
+
+    QCOMPARE(QCoro::waitFor(queue.run()), 0);
+    QCOMPARE(queue.retryCount(), 1);
+    QCOMPARE(bodies, (QStringList { u"/file-0"_qs, u"/file-1"_qs, u"/file-2"_qs, u"/file-3"_qs }));
+}
+
+QTEST_GUILESS_MAIN(tst_DownloadQueue)
+
+#include "tst_downloadqueue.moc"
@@ -0,0 +1,192 @@
+// Copyright (C) 2004-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <QtTest/QTest>
+
+#include "bricklink/xmlreader_p.h"
+#include "utility/exception.h"
+
+
+// The catalog XML reader is fed with BrickLink's downloads: these tests cover the parts of XML
+// we actually see there (CDATA sections, entities, non UTF-8 encodings) and that anything else
+// is rejected instead of being silently misparsed.
+
+class tst_XmlReader : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parse_data();
+    void parse();
+    void invalid_data();
+    void invalid();
+    void missingTag();
+
+private:
+    enum { ItemId, ItemName };
+    static constexpr auto schema = BrickLink::xmlSchema("CATALOG", "ITEM", "ITEMID", "ITEMNAME");
+
+    static QStringList itemNames(const QByteArray &xml, bool doubleEscapedEntities = false);
+    static bool throws(const QByteArray &xml);
+};
+
+
+QStringList tst_XmlReader::itemNames(const QByteArray &xml, bool doubleEscapedEntities)
+{
+    QStringList names;
+    BrickLink::parseXml(xml, schema, doubleEscapedEntities, [&names](const auto &e) {
+        names << e.string(ItemName);
+    });
+    return names;
+}
+
+bool tst_XmlReader::throws(const QByteArray &xml)
+{
+    try {
+        itemNames(xml);
+    } catch (const Exception &) {
+        return true;
+    }
+    return false;
+}
+
+void tst_XmlReader::parse_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+    QTest::addColumn<bool>("doubleEscapedEntities");
+    QTest::addColumn<QStringList>("names");
+
+    QTest::newRow("CDATA")
+            << QByteArray("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                          "<CATALOG>\n"
+                          "  <ITEM>\n"
+                          "    <ITEMID>3001</ITEMID>\n"
+                          "    <ITEMNAME><![CDATA[Brick 2 x 4 <with> & without &amp; entities]]></ITEMNAME>\n"
+                          "  </ITEM>\n"
+                          "  <ITEM>\n"
+                          "    <ITEMID>3002</ITEMID>\n"
+                          "    <ITEMNAME>\n"
+                          "      <![CDATA[ Brick 2 x 3 ]]>\n"
+                          "    </ITEMNAME>\n"
+                          "  </ITEM>\n"
+                          "  <ITEM>\n"
+                          "    <ITEMID>3003</ITEMID>\n"
+                          "    <ITEMNAME>Brick 2 x 2 &amp; plain text</ITEMNAME>\n"
+                          "  </ITEM>\n"
+                          "</CATALOG>\n")
+            << false
+            << QStringList { u"Brick 2 x 4 <with> & without &amp; entities"_qs,
+                             u"Brick 2 x 3"_qs,
+                             u"Brick 2 x 2 & plain text"_qs };
+    QTest::newRow("ISO-8859-1")
+            << QByteArray("<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+                          "<CATALOG><ITEM><ITEMID>970c00</ITEMID>"
+                          "<ITEMNAME>Hips and Legs - Caf\xE9 " "\xC9" "dition \xBD</ITEMNAME>"
+                          "</ITEM></CATALOG>")
+            << false
+            << QStringList { u"Hips and Legs - Caf\u00e9 \u00c9dition \u00bd"_qs };
+    QTest::newRow("BOM")
+            << QByteArray("\xEF\xBB\xBF<CATALOG><ITEM><ITEMNAME>Caf\xC3\xA9</ITEMNAME></ITEM></CATALOG>")
+            << false
+            << QStringList { u"Caf\u00e9"_qs };
+    QTest::newRow("character references")
+            << QByteArray("<CATALOG><ITEM><ITEMNAME>&#40;x&#x29; &lt;&gt;&quot;&apos;</ITEMNAME></ITEM></CATALOG>")
+            << false
+            << QStringList { u"(x) <>\"'"_qs };
+    QTest::newRow("double escaped")
+            << QByteArray("<CATALOG><ITEM><ITEMNAME>&amp;#40;x&amp;#41; &amp; y</ITEMNAME></ITEM></CATALOG>")
+            << true
+            << QStringList { u"(x) & y"_qs };
+    QTest::newRow("not double escaped")
+            << QByteArray("<CATALOG><ITEM><ITEMNAME>&amp;#40;x&amp;#41;</ITEMNAME></ITEM></CATALOG>")
+            << false
+            << QStringList { u"&#40;x&#41;"_qs };
+    QTest::newRow("comments, attributes and unknown tags")
+            << QByteArray("<!DOCTYPE CATALOG>\n<!-- a <comment> -->\n"
+                          "<CATALOG version=\"1\"><ITEM><!-- inside -->"
+                          "<ITEMTYPE>P</ITEMTYPE><EMPTY/><ITEMNAME lang=\"en\">Plate</ITEMNAME>"
+                          "</ITEM><ITEM/></CATALOG>")
+            << false
+            << QStringList { u"Plate"_qs, QString { } };
+    QTest::newRow("empty root")
+            << QByteArray("<?xml version=\"1.0\"?><CATALOG/>")
+            << false
+            << QStringList { };
+    QTest::newRow("empty document")
+            << QByteArray("  \n")
+            << false
+            << QStringList { };
+}
+
+void tst_XmlReader::parse()
+{
+    QFETCH(QByteArray, xml);
+    QFETCH(bool, doubleEscapedEntities);
+    QFETCH(QStringList, names);
+
+    QStringList parsed;
+    try {
+        BrickLink::parseXml(xml, schema, doubleEscapedEntities, [&parsed](const auto &e) {
+            parsed << e.string(ItemName, true);
+        });
+    } catch (const Exception &e) {
+        QFAIL(qPrintable(e.errorString()));
+    }
+    QCOMPARE(parsed, names);
+}
+
+void tst_XmlReader::invalid_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+
+    QTest::newRow("wrong root") << QByteArray("<INVENTORY><ITEM/></INVENTORY>");
+    QTest::newRow("wrong element") << QByteArray("<CATALOG><COLOR/></CATALOG>");
+    QTest::newRow("mismatched end tag") << QByteArray("<CATALOG><ITEM><ITEMNAME>x</ITEMID></ITEM></CATALOG>");
+    QTest::newRow("unterminated element") << QByteArray("<CATALOG><ITEM><ITEMNAME>x");
+    QTest::newRow("unterminated CDATA") << QByteArray("<CATALOG><ITEM><ITEMNAME><![CDATA[x</ITEMNAME></ITEM></CATALOG>");
+    QTest::newRow("text and CDATA") << QByteArray("<CATALOG><ITEM><ITEMNAME>a<![CDATA[b]]></ITEMNAME></ITEM></CATALOG>");
+    QTest::newRow("multiple CDATA") << QByteArray("<CATALOG><ITEM><ITEMNAME><![CDATA[a]]><![CDATA[b]]></ITEMNAME></ITEM></CATALOG>");
+    QTest::newRow("text outside") << QByteArray("<CATALOG>text<ITEM/></CATALOG>");
+    QTest::newRow("unterminated comment") << QByteArray("<CATALOG><!-- <ITEM/></CATALOG>");
+    QTest::newRow("unknown entity") << QByteArray("<CATALOG><ITEM><ITEMNAME>&nbsp;</ITEMNAME></ITEM></CATALOG>");
+    QTest::newRow("unterminated entity") << QByteArray("<CATALOG><ITEM><ITEMNAME>a &amp b</ITEMNAME></ITEM></CATALOG>");
+    QTest::newRow("invalid character reference") << QByteArray("<CATALOG><ITEM><ITEMNAME>&#xZZ;</ITEMNAME></ITEM></CATALOG>");
+    QTest::newRow("unsupported encoding") << QByteArray("<?xml version=\"1.0\" encoding=\"X-NONSENSE\"?><CATALOG/>");
+    QTest::newRow("invalid encoding declaration") << QByteArray("<?xml version=\"1.0\" encoding=ISO-8859-1?><CATALOG/>");
+}
+
+void tst_XmlReader::invalid()
+{
+    QFETCH(QByteArray, xml);
+
+    QVERIFY(throws(xml));
+}
+
+void tst_XmlReader::missingTag()
+{
+    const QByteArray xml("<CATALOG><ITEM><ITEMID>3001</ITEMID></ITEM></CATALOG>");
+
+    int count = 0;
+    bool hasId = false;
+    bool hasName = true;
+    QByteArray id;
+    QString optionalName = u"not empty"_qs;
+
+    BrickLink::parseXml(xml, schema, false, [&](const auto &e) {
+        ++count;
+        hasId = e.contains(ItemId);
+        hasName = e.contains(ItemName);
+        id = e.raw(ItemId).toByteArray();
+        optionalName = e.string(ItemName, true);
+    });
+    QCOMPARE(count, 1);
+    QVERIFY(hasId);
+    QVERIFY(!hasName);
+    QCOMPARE(id, QByteArray("3001"));
+    QVERIFY(optionalName.isEmpty());
+    QVERIFY(throws(xml));
+}
+
+QTEST_APPLESS_MAIN(tst_XmlReader)
+
+#include "tst_xmlreader.moc"